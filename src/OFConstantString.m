@@ -22,6 +22,7 @@
 #include <string.h>
 
 #import "OFConstantString.h"
+#import "OFString+Private.h"
 #import "OFString_UTF8.h"
 
 #import "OFInitializationFailedException.h"
@@ -106,6 +107,11 @@ struct {
 {
 	OF_DEALLOC_UNSUPPORTED
 }
+
+- (bool)OF_isConstantString
+{
+	return true;
+}
 @end
 
 @implementation OFConstantString
@@ -274,6 +280,11 @@ struct {
 	return [self description];
 }
 
+- (bool)OF_isConstantString
+{
+	return true;
+}
+
 /* From OFString */
 - (const char*)UTF8String
 {
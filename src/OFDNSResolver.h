@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2008, 2009, 2010, 2011, 2012, 2013, 2014, 2015, 2016
+ *   Jonathan Schleifer <js@heap.zone>
+ *
+ * All rights reserved.
+ *
+ * This file is part of ObjFW. It may be distributed under the terms of the
+ * Q Public License 1.0, which can be found in the file LICENSE.QPL included in
+ * the packaging of this file.
+ *
+ * Alternatively, it may be distributed under the terms of the GNU General
+ * Public License, either version 2 or 3, which can be found in the file
+ * LICENSE.GPLv2 or LICENSE.GPLv3 respectively included in the packaging of this
+ * file.
+ */
+
+#import "OFObject.h"
+#import "OFUDPSocket.h"
+
+#ifndef OF_HAVE_SOCKETS
+# error No sockets available!
+#endif
+
+OF_ASSUME_NONNULL_BEGIN
+
+/*! @file */
+
+@class OFArray OF_GENERIC(ObjectType);
+@class OFDataArray;
+@class OFMutableDictionary OF_GENERIC(KeyType, ObjectType);
+@class OFException;
+
+#ifdef OF_HAVE_BLOCKS
+/*!
+ * @brief A block which is called when a host has been resolved.
+ *
+ * @param host The host that has been resolved
+ * @param addresses An OFDataArray of @ref of_udp_socket_address_t with all
+ *		    addresses of the host or `nil` on error. The port of all
+ *		    addresses is 0.
+ * @param exception An exception which occurred while resolving or `nil` on
+ *		    success
+ */
+typedef void (^of_dns_resolver_async_resolve_block_t)(OFString *host,
+    OFDataArray *_Nullable addresses, OFException *_Nullable exception);
+#endif
+
+/*!
+ * @class OFDNSResolver OFDNSResolver.h ObjFW/OFDNSResolver.h
+ *
+ * @brief A class for resolving host names without blocking.
+ *
+ * Unlike the resolver used by the blocking methods of the socket classes,
+ * OFDNSResolver neither blocks nor needs a thread: It sends its queries using
+ * an @ref OFUDPSocket and waits for the answer in the run loop of the thread
+ * which started the query.
+ *
+ * When created, the resolver reads the name servers, search domains and options
+ * from `/etc/resolv.conf` and the static hosts from `/etc/hosts`, if available.
+ * Answers are cached for as long as the TTL of the answer allows.
+ *
+ * @warning A resolver must only be used from the thread which created it!
+ */
+@interface OFDNSResolver: OFObject
+{
+	OFMutableDictionary *_staticHosts;
+	OFArray OF_GENERIC(OFString*) *_nameServers;
+	OFArray OF_GENERIC(OFString*) *_searchDomains;
+	unsigned int _minNumberOfDotsInAbsoluteName;
+	uint16_t _nameServerPort;
+	of_time_interval_t _timeout;
+	unsigned int _maxAttempts;
+	OFMutableDictionary *_cache, *_queries;
+	OFUDPSocket *_IPv4Socket;
+#ifdef OF_HAVE_IPV6
+	OFUDPSocket *_IPv6Socket;
+#endif
+	bool _IPv4SocketReceiving, _IPv6SocketReceiving;
+	unsigned char _buffer[512];
+}
+
+/*!
+ * The name servers to query, as an array of IPv4 or IPv6 addresses.
+ *
+ * The name servers are tried in order. If no name server is configured,
+ * 127.0.0.1 is used. Queries in flight are restarted with the first of the new
+ * name servers.
+ */
+@property (copy) OFArray OF_GENERIC(OFString*) *nameServers;
+
+/*!
+ * The domains which are appended to host names that are not fully qualified.
+ *
+ * A host name ending with a dot is never looked up in the search domains.
+ * Otherwise, the search domains are tried in order until one of them has
+ * addresses for the host.
+ */
+@property (copy) OFArray OF_GENERIC(OFString*) *searchDomains;
+
+/*!
+ * The minimum number of dots a host name needs to be tried as is before it is
+ * tried in the search domains. The default is 1.
+ */
+@property unsigned int minNumberOfDotsInAbsoluteName;
+
+/*!
+ * The port on which the name servers are queried. The default is 53.
+ */
+@property uint16_t nameServerPort;
+
+/*!
+ * The time after which a query to a name server is considered lost and the
+ * next name server is tried.
+ */
+@property of_time_interval_t timeout;
+
+/*!
+ * How often each name server is tried before giving up.
+ */
+@property unsigned int maxAttempts;
+
+/*!
+ * @brief Creates a new, autoreleased OFDNSResolver.
+ *
+ * @return A new, autoreleased OFDNSResolver
+ */
++ (instancetype)resolver;
+
+/*!
+ * @brief Asynchronously resolves the specified host.
+ *
+ * @param host The host to resolve
+ * @param target The target on which to call the selector once the host has been
+ *		 resolved
+ * @param selector The selector to call on the target. The signature must be
+ *		   `void (OFString *host, OFDataArray *addresses,
+ *		   OFException *exception)`. The addresses are
+ *		   @ref of_udp_socket_address_t with the port set to 0 and
+ *		   `nil` on error.
+ */
+- (void)asyncResolveHost: (OFString*)host
+		  target: (id)target
+		selector: (SEL)selector;
+
+#ifdef OF_HAVE_BLOCKS
+/*!
+ * @brief Asynchronously resolves the specified host.
+ *
+ * @param host The host to resolve
+ * @param block The block to execute once the host has been resolved
+ */
+- (void)asyncResolveHost: (OFString*)host
+		   block: (of_dns_resolver_async_resolve_block_t)block;
+#endif
+
+/*!
+ * @brief Removes all entries from the cache.
+ */
+- (void)removeAllCachedEntries;
+@end
+
+OF_ASSUME_NONNULL_END
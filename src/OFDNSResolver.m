@@ -0,0 +1,1179 @@
+/*
+ * Copyright (c) 2008, 2009, 2010, 2011, 2012, 2013, 2014, 2015, 2016
+ *   Jonathan Schleifer <js@heap.zone>
+ *
+ * All rights reserved.
+ *
+ * This file is part of ObjFW. It may be distributed under the terms of the
+ * Q Public License 1.0, which can be found in the file LICENSE.QPL included in
+ * the packaging of this file.
+ *
+ * Alternatively, it may be distributed under the terms of the GNU General
+ * Public License, either version 2 or 3, which can be found in the file
+ * LICENSE.GPLv2 or LICENSE.GPLv3 respectively included in the packaging of this
+ * file.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_ARPA_INET_H
+# include <arpa/inet.h>
+#endif
+
+#import "OFDNSResolver.h"
+#import "OFArray.h"
+#import "OFDataArray.h"
+#import "OFDate.h"
+#import "OFDictionary.h"
+#ifdef OF_HAVE_FILES
+# import "OFFile.h"
+#endif
+#import "OFNumber.h"
+#import "OFString.h"
+#import "OFTimer.h"
+
+#import "OFAddressTranslationFailedException.h"
+#import "OFInvalidArgumentException.h"
+#import "OFInvalidFormatException.h"
+#import "OFOpenItemFailedException.h"
+#import "OFOutOfRangeException.h"
+
+#import "socket.h"
+#import "of_ascii.h"
+
+/*
+ * Without EDNS, a DNS message sent over UDP is limited to 512 bytes. Longer
+ * answers are truncated, which is no problem for address records, as there
+ * are always enough of them.
+ */
+#define MAX_PACKET_SIZE 512
+#define MAX_CACHE_SIZE 256
+#define MAX_NAME_SERVERS 3
+#define MAX_NDOTS 15
+#define HEADER_SIZE 12
+
+#define TYPE_A 1
+#define TYPE_AAAA 28
+#define CLASS_IN 1
+
+#define RCODE_NO_ERROR 0
+#define RCODE_NAME_ERROR 3
+
+@interface OFDNSResolver_Query: OFObject
+{
+@public
+	OFString *_host;
+	id _target;
+	SEL _selector;
+#ifdef OF_HAVE_BLOCKS
+	of_dns_resolver_async_resolve_block_t _block;
+#endif
+	/* The names to try in order, with the search domains appended */
+	OFArray OF_GENERIC(OFString*) *_names;
+	size_t _nameIndex;
+	/* One request per record type */
+	OFDataArray *_requests[2];
+	uint16_t _IDs[2];
+	bool _done[2];
+	size_t _numRequests;
+	OFDataArray *_addresses[2];
+	uint32_t _TTL;
+	size_t _nameServerIndex;
+	unsigned int _attempt;
+	OFTimer *_timer;
+	OFException *_exception;
+}
+@end
+
+@interface OFDNSResolver_CacheEntry: OFObject
+{
+@public
+	OFDataArray *_addresses;
+	OFDate *_expirationDate;
+}
+@end
+
+@interface OFDNSResolver ()
+#ifdef OF_HAVE_FILES
+- (void)OF_parseHosts;
+- (void)OF_parseResolvConf;
+#endif
+- (void)OF_startQuery: (OFDNSResolver_Query*)query;
+- (bool)OF_queryNextName: (OFDNSResolver_Query*)query;
+- (void)OF_sendQuery: (OFDNSResolver_Query*)query;
+- (void)OF_retryQuery: (OFDNSResolver_Query*)query;
+- (void)OF_finishQuery: (OFDNSResolver_Query*)query;
+- (void)OF_deliverResultForQuery: (OFDNSResolver_Query*)query;
+- (void)OF_closeIdleSockets;
+- (OFUDPSocket*)OF_socketForAddress: (of_udp_socket_address_t*)address;
+- (void)OF_handleResponse: (const unsigned char*)buffer
+		   length: (size_t)length
+		   sender: (of_udp_socket_address_t*)sender;
+-      (bool)OF_socket: (OFUDPSocket*)sock
+  didReceiveIntoBuffer: (void*)buffer
+		length: (size_t)length
+		sender: (of_udp_socket_address_t)sender
+	     exception: (OFException*)exception;
+@end
+
+static uint16_t
+randomUInt16(void)
+{
+#if defined(HAVE_ARC4RANDOM)
+	return (uint16_t)arc4random();
+#elif defined(HAVE_RANDOM)
+	return (uint16_t)random();
+#else
+	return (uint16_t)rand();
+#endif
+}
+
+static bool
+parseIPv4Address(const char *string, struct in_addr *addr)
+{
+	unsigned char bytes[4];
+	size_t i;
+
+	for (i = 0; i < 4; i++) {
+		unsigned int byte = 0;
+		size_t digits = 0;
+
+		while (*string >= '0' && *string <= '9') {
+			byte = byte * 10 + (*string++ - '0');
+
+			if (++digits > 3 || byte > 255)
+				return false;
+		}
+
+		if (digits == 0)
+			return false;
+
+		bytes[i] = byte;
+
+		if (i < 3 && *string++ != '.')
+			return false;
+	}
+
+	if (*string != '\0')
+		return false;
+
+	memcpy(&addr->s_addr, bytes, 4);
+
+	return true;
+}
+
+/*
+ * Fills in the address if the string is a numeric IPv4 or IPv6 address. The
+ * port is left at 0.
+ */
+static bool
+parseNumericAddress(OFString *string, of_udp_socket_address_t *address)
+{
+	const char *cString = [string UTF8String];
+	struct sockaddr_in *sin = (struct sockaddr_in*)&address->address;
+#if defined(OF_HAVE_IPV6) && defined(HAVE_INET_PTON)
+	struct sockaddr_in6 *sin6 = (struct sockaddr_in6*)&address->address;
+#endif
+
+	memset(address, 0, sizeof(*address));
+
+	if (parseIPv4Address(cString, &sin->sin_addr)) {
+		sin->sin_family = AF_INET;
+		address->length = (socklen_t)sizeof(*sin);
+
+		return true;
+	}
+
+#if defined(OF_HAVE_IPV6) && defined(HAVE_INET_PTON)
+	if (strchr(cString, ':') != NULL &&
+	    inet_pton(AF_INET6, cString, &sin6->sin6_addr) == 1) {
+		sin6->sin6_family = AF_INET6;
+		address->length = (socklen_t)sizeof(*sin6);
+
+		return true;
+	}
+#endif
+
+	return false;
+}
+
+static void
+setPort(of_udp_socket_address_t *address, uint16_t port)
+{
+	switch (address->address.ss_family) {
+	case AF_INET:
+		((struct sockaddr_in*)&address->address)->sin_port =
+		    OF_BSWAP16_IF_LE(port);
+		break;
+#ifdef OF_HAVE_IPV6
+	case AF_INET6:
+		((struct sockaddr_in6*)&address->address)->sin6_port =
+		    OF_BSWAP16_IF_LE(port);
+		break;
+#endif
+	}
+}
+
+static OFString*
+normalizeHost(OFString *host)
+{
+	host = [host lowercaseString];
+
+	if ([host hasSuffix: @"."])
+		host = [host substringWithRange:
+		    of_range(0, [host length] - 1)];
+
+	return host;
+}
+
+static OFDataArray*
+createRequest(OFString *host, uint16_t ID, uint16_t type)
+{
+	OFDataArray *request = [OFDataArray dataArrayWithCapacity:
+	    MAX_PACKET_SIZE];
+	unsigned char header[HEADER_SIZE] = {
+		ID >> 8, ID & 0xFF,
+		0x01, 0x00,	/* Standard query, recursion desired */
+		0x00, 0x01,	/* One question */
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+	};
+	unsigned char question[5] = {
+		0x00,		/* Root label */
+		type >> 8, type & 0xFF,
+		CLASS_IN >> 8, CLASS_IN & 0xFF
+	};
+	const char *cString = [host UTF8String];
+	size_t length = [host UTF8StringLength];
+
+	if (length == 0 || length > 253)
+		@throw [OFInvalidArgumentException exception];
+
+	[request addItems: header
+		    count: HEADER_SIZE];
+
+	while (length > 0) {
+		const char *dot = memchr(cString, '.', length);
+		size_t labelLength = (dot != NULL
+		    ? (size_t)(dot - cString) : length);
+		unsigned char labelLengthByte = (unsigned char)labelLength;
+
+		if (labelLength == 0 || labelLength > 63)
+			@throw [OFInvalidArgumentException exception];
+
+		[request addItem: &labelLengthByte];
+		[request addItems: cString
+			    count: labelLength];
+
+		cString += labelLength;
+		length -= labelLength;
+
+		if (dot != NULL) {
+			cString++;
+			length--;
+		}
+	}
+
+	[request addItems: question
+		    count: sizeof(question)];
+
+	return request;
+}
+
+/*
+ * Returns the names to query for the host, in the order in which the resolver
+ * of libc tries them: Names with enough dots are tried as is first, all others
+ * only after the search domains.
+ */
+static OFArray OF_GENERIC(OFString*)*
+namesForHost(OFString *host, OFArray OF_GENERIC(OFString*) *searchDomains,
+    unsigned int minNumberOfDots)
+{
+	OFMutableArray OF_GENERIC(OFString*) *names;
+	OFString *name = normalizeHost(host);
+	bool tryAsIsFirst;
+
+	/* A trailing dot means the name is fully qualified */
+	if ([host hasSuffix: @"."] || [searchDomains count] == 0)
+		return [OFArray arrayWithObject: name];
+
+	names = [OFMutableArray array];
+	tryAsIsFirst = ([[name componentsSeparatedByString: @"."] count] - 1 >=
+	    minNumberOfDots);
+
+	if (tryAsIsFirst)
+		[names addObject: name];
+
+	for (OFString *domain in searchDomains)
+		[names addObject: [OFString stringWithFormat: @"%@.%@",
+		    name, normalizeHost(domain)]];
+
+	if (!tryAsIsFirst)
+		[names addObject: name];
+
+	[names makeImmutable];
+
+	return names;
+}
+
+/* Skips a possibly compressed name, returning false if it is invalid. */
+static bool
+skipName(const unsigned char *buffer, size_t length, size_t *i)
+{
+	while (*i < length) {
+		unsigned char labelLength = buffer[*i];
+
+		if ((labelLength & 0xC0) == 0xC0) {
+			/* A pointer ends the name */
+			if (*i + 2 > length)
+				return false;
+
+			*i += 2;
+			return true;
+		}
+
+		if (labelLength & 0xC0)
+			return false;
+
+		*i += 1 + labelLength;
+
+		if (labelLength == 0)
+			return true;
+	}
+
+	return false;
+}
+
+@implementation OFDNSResolver_Query
+- (void)dealloc
+{
+	[_host release];
+	[_target release];
+#ifdef OF_HAVE_BLOCKS
+	[_block release];
+#endif
+	[_names release];
+	[_requests[0] release];
+	[_requests[1] release];
+	[_addresses[0] release];
+	[_addresses[1] release];
+	[_timer release];
+	[_exception release];
+
+	[super dealloc];
+}
+@end
+
+@implementation OFDNSResolver_CacheEntry
+- (void)dealloc
+{
+	[_addresses release];
+	[_expirationDate release];
+
+	[super dealloc];
+}
+@end
+
+@implementation OFDNSResolver
+@synthesize nameServerPort = _nameServerPort, timeout = _timeout;
+@synthesize maxAttempts = _maxAttempts, searchDomains = _searchDomains;
+@synthesize minNumberOfDotsInAbsoluteName = _minNumberOfDotsInAbsoluteName;
+
++ (instancetype)resolver
+{
+	return [[[self alloc] init] autorelease];
+}
+
+- init
+{
+	self = [super init];
+
+	@try {
+		_staticHosts = [[OFMutableDictionary alloc] init];
+		_nameServerPort = 53;
+		_timeout = 5;
+		_maxAttempts = 2;
+		_minNumberOfDotsInAbsoluteName = 1;
+		_cache = [[OFMutableDictionary alloc] init];
+		_queries = [[OFMutableDictionary alloc] init];
+
+#ifdef OF_HAVE_FILES
+		[self OF_parseHosts];
+		[self OF_parseResolvConf];
+#endif
+
+		if (_nameServers == nil)
+			_nameServers = [[OFArray alloc]
+			    initWithObject: @"127.0.0.1"];
+
+		if (_searchDomains == nil)
+			_searchDomains = [[OFArray alloc] init];
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	[_staticHosts release];
+	[_nameServers release];
+	[_searchDomains release];
+	[_cache release];
+	[_queries release];
+	[_IPv4Socket release];
+#ifdef OF_HAVE_IPV6
+	[_IPv6Socket release];
+#endif
+
+	[super dealloc];
+}
+
+#ifdef OF_HAVE_FILES
+- (void)OF_parseHosts
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFFile *file;
+	OFString *line;
+
+	@try {
+		file = [OFFile fileWithPath: @"/etc/hosts"
+				       mode: @"r"];
+	} @catch (OFOpenItemFailedException *e) {
+		objc_autoreleasePoolPop(pool);
+		return;
+	}
+
+	while ((line = [file readLine]) != nil) {
+		void *pool2 = objc_autoreleasePoolPush();
+		OFArray OF_GENERIC(OFString*) *components;
+		of_udp_socket_address_t address;
+		size_t i, count;
+		of_range_t commentRange = [line rangeOfString: @"#"];
+
+		if (commentRange.location != OF_NOT_FOUND)
+			line = [line substringWithRange:
+			    of_range(0, commentRange.location)];
+
+		components = [[line stringByReplacingOccurrencesOfString: @"\t"
+							      withString: @" "]
+		    componentsSeparatedByString: @" "
+					options: OF_STRING_SKIP_EMPTY];
+		count = [components count];
+
+		if (count < 2 || !parseNumericAddress(
+		    [components firstObject], &address)) {
+			objc_autoreleasePoolPop(pool2);
+			continue;
+		}
+
+		for (i = 1; i < count; i++) {
+			OFString *host =
+			    normalizeHost([components objectAtIndex: i]);
+			OFDataArray *addresses =
+			    [_staticHosts objectForKey: host];
+
+			if (addresses == nil) {
+				addresses = [OFDataArray dataArrayWithItemSize:
+				    sizeof(of_udp_socket_address_t)];
+				[_staticHosts setObject: addresses
+						 forKey: host];
+			}
+
+			[addresses addItem: &address];
+		}
+
+		objc_autoreleasePoolPop(pool2);
+	}
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)OF_parseResolvConf
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFMutableArray OF_GENERIC(OFString*) *nameServers =
+	    [OFMutableArray array];
+	OFArray OF_GENERIC(OFString*) *searchDomains = nil;
+	OFFile *file;
+	OFString *line;
+
+	@try {
+		file = [OFFile fileWithPath: @"/etc/resolv.conf"
+				       mode: @"r"];
+	} @catch (OFOpenItemFailedException *e) {
+		objc_autoreleasePoolPop(pool);
+		return;
+	}
+
+	while ((line = [file readLine]) != nil) {
+		void *pool2 = objc_autoreleasePoolPush();
+		OFArray OF_GENERIC(OFString*) *components;
+		OFString *option;
+		of_udp_socket_address_t address;
+		size_t count;
+
+		if ([line hasPrefix: @"#"] || [line hasPrefix: @";"]) {
+			objc_autoreleasePoolPop(pool2);
+			continue;
+		}
+
+		components = [[line stringByReplacingOccurrencesOfString: @"\t"
+							      withString: @" "]
+		    componentsSeparatedByString: @" "
+					options: OF_STRING_SKIP_EMPTY];
+		count = [components count];
+
+		if (count < 2) {
+			objc_autoreleasePoolPop(pool2);
+			continue;
+		}
+
+		option = [components firstObject];
+
+		if ([option isEqual: @"nameserver"]) {
+			OFString *nameServer = [components objectAtIndex: 1];
+
+			if ([nameServers count] < MAX_NAME_SERVERS &&
+			    parseNumericAddress(nameServer, &address))
+				[nameServers addObject: nameServer];
+		} else if ([option isEqual: @"domain"] ||
+		    [option isEqual: @"search"]) {
+			/* Like with the resolver of libc, the last one wins */
+			searchDomains = [components objectsInRange:
+			    of_range(1, count - 1)];
+		} else if ([option isEqual: @"options"]) {
+			for (OFString *flag in components) {
+				@try {
+					if ([flag hasPrefix: @"timeout:"])
+						_timeout = [[flag
+						    substringWithRange:
+						    of_range(8, [flag length] -
+						    8)] decimalValue];
+					else if ([flag hasPrefix: @"attempts:"])
+						_maxAttempts = (unsigned int)
+						    [[flag substringWithRange:
+						    of_range(9, [flag length] -
+						    9)] decimalValue];
+					else if ([flag hasPrefix: @"ndots:"])
+						_minNumberOfDotsInAbsoluteName =
+						    (unsigned int)[[flag
+						    substringWithRange:
+						    of_range(6, [flag length] -
+						    6)] decimalValue];
+				} @catch (OFInvalidFormatException *e) {
+				} @catch (OFOutOfRangeException *e) {
+				}
+			}
+		}
+
+		objc_autoreleasePoolPop(pool2);
+	}
+
+	if (_timeout < 1)
+		_timeout = 1;
+	if (_maxAttempts < 1)
+		_maxAttempts = 1;
+	if (_minNumberOfDotsInAbsoluteName > MAX_NDOTS)
+		_minNumberOfDotsInAbsoluteName = MAX_NDOTS;
+
+	if ([nameServers count] > 0) {
+		[nameServers makeImmutable];
+		_nameServers = [nameServers copy];
+	}
+
+	_searchDomains = [searchDomains copy];
+
+	objc_autoreleasePoolPop(pool);
+}
+#endif
+
+- (OFArray OF_GENERIC(OFString*)*)nameServers
+{
+	return [[_nameServers retain] autorelease];
+}
+
+- (void)setNameServers: (OFArray OF_GENERIC(OFString*)*)nameServers
+{
+	of_udp_socket_address_t address;
+
+	for (OFString *nameServer in nameServers)
+		if (!parseNumericAddress(nameServer, &address))
+			@throw [OFInvalidArgumentException exception];
+
+	if ([nameServers count] == 0)
+		@throw [OFInvalidArgumentException exception];
+
+	OFArray *old = _nameServers;
+	_nameServers = [nameServers copy];
+	[old release];
+
+	/*
+	 * The name server index of queries in flight might be past the end of
+	 * the new name servers, so restart them with the first one.
+	 */
+	for (OFNumber *ID in [_queries allKeys]) {
+		OFDNSResolver_Query *query = [_queries objectForKey: ID];
+
+		/* Queries are in the dictionary once per request */
+		if (query->_IDs[0] != [ID uInt16Value])
+			continue;
+
+		query->_nameServerIndex = 0;
+		query->_attempt = 0;
+		[self OF_sendQuery: query];
+	}
+}
+
+- (void)removeAllCachedEntries
+{
+	[_cache removeAllObjects];
+}
+
+- (void)asyncResolveHost: (OFString*)host
+		  target: (id)target
+		selector: (SEL)selector
+{
+	OFDNSResolver_Query *query =
+	    [[[OFDNSResolver_Query alloc] init] autorelease];
+
+	query->_host = [host copy];
+	query->_target = [target retain];
+	query->_selector = selector;
+
+	[self OF_startQuery: query];
+}
+
+#ifdef OF_HAVE_BLOCKS
+- (void)asyncResolveHost: (OFString*)host
+		   block: (of_dns_resolver_async_resolve_block_t)block
+{
+	OFDNSResolver_Query *query =
+	    [[[OFDNSResolver_Query alloc] init] autorelease];
+
+	query->_host = [host copy];
+	query->_block = [block copy];
+
+	[self OF_startQuery: query];
+}
+#endif
+
+- (void)OF_startQuery: (OFDNSResolver_Query*)query
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFString *host = normalizeHost(query->_host);
+	of_udp_socket_address_t address;
+	OFDataArray *addresses;
+	OFDNSResolver_CacheEntry *entry;
+
+	/* Numeric addresses and static hosts need no query */
+	if (parseNumericAddress(host, &address)) {
+		addresses = [OFDataArray dataArrayWithItemSize:
+		    sizeof(of_udp_socket_address_t)];
+		[addresses addItem: &address];
+	} else
+		addresses = [_staticHosts objectForKey: host];
+
+	if (addresses == nil && (entry = [_cache objectForKey: host]) != nil) {
+		if ([entry->_expirationDate timeIntervalSinceNow] > 0)
+			addresses = entry->_addresses;
+		else
+			[_cache removeObjectForKey: host];
+	}
+
+	if (addresses != nil) {
+		query->_addresses[0] = [addresses copy];
+
+		/* Always deliver asynchronously, like a real query */
+		[OFTimer scheduledTimerWithTimeInterval: 0
+						 target: self
+					       selector: @selector(
+							     OF_deliverResultForQuery:)
+						 object: query
+						repeats: false];
+
+		objc_autoreleasePoolPop(pool);
+		return;
+	}
+
+	query->_names = [namesForHost(query->_host, _searchDomains,
+	    _minNumberOfDotsInAbsoluteName) retain];
+
+	if (![self OF_queryNextName: query]) {
+		/* None of the names is valid, so it can't be resolved */
+		query->_exception = [[OFAddressTranslationFailedException
+		    alloc] initWithHost: query->_host];
+
+		[OFTimer scheduledTimerWithTimeInterval: 0
+						 target: self
+					       selector: @selector(
+							     OF_deliverResultForQuery:)
+						 object: query
+						repeats: false];
+	}
+
+	objc_autoreleasePoolPop(pool);
+}
+
+/*
+ * Sends the requests for the name at the name index, skipping names which are
+ * not valid. Returns false if there is no name left to query.
+ */
+- (bool)OF_queryNextName: (OFDNSResolver_Query*)query
+{
+	void *pool = objc_autoreleasePoolPush();
+	uint16_t types[2] = { TYPE_A, TYPE_AAAA };
+	size_t i, count = [query->_names count];
+
+	for (i = 0; i < 2; i++) {
+		[query->_requests[i] release];
+		query->_requests[i] = nil;
+		[query->_addresses[i] release];
+		query->_addresses[i] = nil;
+		query->_done[i] = false;
+	}
+
+#ifdef OF_HAVE_IPV6
+	query->_numRequests = 2;
+#else
+	query->_numRequests = 1;
+#endif
+
+	for (; query->_nameIndex < count; query->_nameIndex++) {
+		OFString *name = [query->_names objectAtIndex:
+		    query->_nameIndex];
+
+		@try {
+			for (i = 0; i < query->_numRequests; i++) {
+				/* Use a random ID that is not in use yet */
+				do {
+					query->_IDs[i] = randomUInt16();
+				} while ((i > 0 &&
+				    query->_IDs[i] == query->_IDs[0]) ||
+				    [_queries objectForKey: [OFNumber
+				    numberWithUInt16: query->_IDs[i]]] != nil);
+
+				query->_requests[i] = [createRequest(name,
+				    query->_IDs[i], types[i]) retain];
+			}
+		} @catch (OFInvalidArgumentException *e) {
+			/* Not a valid host name, so try the next one */
+			for (i = 0; i < query->_numRequests; i++) {
+				[query->_requests[i] release];
+				query->_requests[i] = nil;
+			}
+
+			continue;
+		}
+
+		break;
+	}
+
+	if (query->_nameIndex >= count) {
+		query->_numRequests = 0;
+
+		objc_autoreleasePoolPop(pool);
+		return false;
+	}
+
+	for (i = 0; i < query->_numRequests; i++) {
+		query->_addresses[i] = [[OFDataArray alloc]
+		    initWithItemSize: sizeof(of_udp_socket_address_t)];
+
+		[_queries setObject: query
+			     forKey: [OFNumber numberWithUInt16:
+					 query->_IDs[i]]];
+	}
+
+	query->_TTL = UINT32_MAX;
+	query->_nameServerIndex = 0;
+	query->_attempt = 0;
+
+	[self OF_sendQuery: query];
+
+	objc_autoreleasePoolPop(pool);
+	return true;
+}
+
+- (OFUDPSocket*)OF_socketForAddress: (of_udp_socket_address_t*)address
+{
+	OFUDPSocket **sock;
+	bool *receiving;
+	OFString *bindHost;
+
+	switch (address->address.ss_family) {
+	case AF_INET:
+		sock = &_IPv4Socket;
+		receiving = &_IPv4SocketReceiving;
+		bindHost = @"0.0.0.0";
+		break;
+#ifdef OF_HAVE_IPV6
+	case AF_INET6:
+		sock = &_IPv6Socket;
+		receiving = &_IPv6SocketReceiving;
+		bindHost = @"::";
+		break;
+#endif
+	default:
+		@throw [OFInvalidArgumentException exception];
+	}
+
+	if (*sock == nil) {
+		OFUDPSocket *newSocket = [OFUDPSocket socket];
+
+		[newSocket bindToHost: bindHost
+				 port: 0];
+
+		*sock = [newSocket retain];
+	}
+
+	if (!*receiving) {
+		[*sock asyncReceiveIntoBuffer: _buffer
+				       length: MAX_PACKET_SIZE
+				       target: self
+				     selector: @selector(OF_socket:
+						   didReceiveIntoBuffer:length:
+						   sender:exception:)];
+		*receiving = true;
+	}
+
+	return *sock;
+}
+
+- (void)OF_sendQuery: (OFDNSResolver_Query*)query
+{
+	of_udp_socket_address_t address;
+	size_t i;
+
+	[query->_timer invalidate];
+	[query->_timer release];
+	query->_timer = nil;
+
+	parseNumericAddress([_nameServers objectAtIndex:
+	    query->_nameServerIndex], &address);
+	setPort(&address, _nameServerPort);
+
+	@try {
+		OFUDPSocket *sock = [self OF_socketForAddress: &address];
+
+		for (i = 0; i < query->_numRequests; i++) {
+			if (query->_done[i])
+				continue;
+
+			[sock sendBuffer: [query->_requests[i] items]
+				  length: [query->_requests[i] count]
+				receiver: &address];
+		}
+	} @catch (OFException *e) {
+		/*
+		 * The name server is unreachable. Try the next one, but from
+		 * the run loop, as we might be called from somebody else's
+		 * handler.
+		 */
+		query->_timer = [[OFTimer
+		    scheduledTimerWithTimeInterval: 0
+					    target: self
+					  selector: @selector(OF_retryQuery:)
+					    object: query
+					   repeats: false] retain];
+		return;
+	}
+
+	query->_timer = [[OFTimer
+	    scheduledTimerWithTimeInterval: _timeout
+				    target: self
+				  selector: @selector(OF_retryQuery:)
+				    object: query
+				   repeats: false] retain];
+}
+
+- (void)OF_retryQuery: (OFDNSResolver_Query*)query
+{
+	if (++query->_nameServerIndex >= [_nameServers count]) {
+		query->_nameServerIndex = 0;
+
+		if (++query->_attempt >= _maxAttempts) {
+			query->_exception = [[OFAddressTranslationFailedException
+			    alloc] initWithHost: query->_host];
+			[self OF_finishQuery: query];
+			return;
+		}
+	}
+
+	[self OF_sendQuery: query];
+}
+
+- (void)OF_finishQuery: (OFDNSResolver_Query*)query
+{
+	void *pool = objc_autoreleasePoolPush();
+	size_t i;
+
+	[query->_timer invalidate];
+	[query->_timer release];
+	query->_timer = nil;
+
+	[[query retain] autorelease];
+
+	for (i = 0; i < query->_numRequests; i++)
+		[_queries removeObjectForKey:
+		    [OFNumber numberWithUInt16: query->_IDs[i]]];
+
+	/* Without any address for this name, try the next one */
+	if (query->_exception == nil) {
+		size_t numAddresses = 0;
+
+		for (i = 0; i < query->_numRequests; i++)
+			numAddresses += [query->_addresses[i] count];
+
+		if (numAddresses == 0 &&
+		    query->_nameIndex + 1 < [query->_names count]) {
+			query->_nameIndex++;
+
+			if ([self OF_queryNextName: query]) {
+				objc_autoreleasePoolPop(pool);
+				return;
+			}
+		}
+	}
+
+	if (query->_exception == nil) {
+		if (query->_numRequests > 1) {
+			[query->_addresses[0]
+			    addItems: [query->_addresses[1] items]
+			       count: [query->_addresses[1] count]];
+			[query->_addresses[1] release];
+			query->_addresses[1] = nil;
+		}
+
+		if ([query->_addresses[0] count] == 0)
+			query->_exception = [[OFAddressTranslationFailedException
+			    alloc] initWithHost: query->_host];
+		else if (query->_TTL > 0) {
+			OFDNSResolver_CacheEntry *entry;
+
+			if ([_cache count] >= MAX_CACHE_SIZE)
+				[_cache removeAllObjects];
+
+			entry = [[[OFDNSResolver_CacheEntry alloc] init]
+			    autorelease];
+			entry->_addresses = [query->_addresses[0] copy];
+			entry->_expirationDate = [[OFDate alloc]
+			    initWithTimeIntervalSinceNow: query->_TTL];
+
+			[_cache setObject: entry
+				   forKey: normalizeHost(query->_host)];
+		}
+	}
+
+	[self OF_deliverResultForQuery: query];
+
+	if ([_queries count] == 0)
+		[OFTimer scheduledTimerWithTimeInterval: 0
+						 target: self
+					       selector: @selector(
+							     OF_closeIdleSockets)
+						repeats: false];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)OF_deliverResultForQuery: (OFDNSResolver_Query*)query
+{
+	OFDataArray *addresses =
+	    (query->_exception == nil ? query->_addresses[0] : nil);
+
+#ifdef OF_HAVE_BLOCKS
+	if (query->_block != NULL)
+		query->_block(query->_host, addresses, query->_exception);
+	else {
+#endif
+		void (*func)(id, SEL, OFString*, OFDataArray*, OFException*) =
+		    (void(*)(id, SEL, OFString*, OFDataArray*, OFException*))
+		    [query->_target methodForSelector: query->_selector];
+
+		func(query->_target, query->_selector, query->_host,
+		    addresses, query->_exception);
+#ifdef OF_HAVE_BLOCKS
+	}
+#endif
+}
+
+- (void)OF_closeIdleSockets
+{
+	if ([_queries count] > 0)
+		return;
+
+	if (_IPv4SocketReceiving)
+		[_IPv4Socket cancelAsyncRequests];
+	[_IPv4Socket release];
+	_IPv4Socket = nil;
+	_IPv4SocketReceiving = false;
+
+#ifdef OF_HAVE_IPV6
+	if (_IPv6SocketReceiving)
+		[_IPv6Socket cancelAsyncRequests];
+	[_IPv6Socket release];
+	_IPv6Socket = nil;
+	_IPv6SocketReceiving = false;
+#endif
+}
+
+-      (bool)OF_socket: (OFUDPSocket*)sock
+  didReceiveIntoBuffer: (void*)buffer
+		length: (size_t)length
+		sender: (of_udp_socket_address_t)sender
+	     exception: (OFException*)exception
+{
+	if (exception == nil)
+		[self OF_handleResponse: buffer
+				 length: length
+				 sender: &sender];
+
+	if ([_queries count] > 0)
+		return true;
+
+	/* OF_closeIdleSockets will take care of the socket */
+	if (sock == _IPv4Socket)
+		_IPv4SocketReceiving = false;
+#ifdef OF_HAVE_IPV6
+	else if (sock == _IPv6Socket)
+		_IPv6SocketReceiving = false;
+#endif
+
+	return false;
+}
+
+- (void)OF_handleResponse: (const unsigned char*)buffer
+		   length: (size_t)length
+		   sender: (of_udp_socket_address_t*)sender
+{
+	OFDNSResolver_Query *query;
+	of_udp_socket_address_t nameServer;
+	const unsigned char *request;
+	size_t i, j, requestIndex, questionLength;
+	uint16_t ID, numAnswers, type;
+	unsigned char rcode;
+
+	if (length < HEADER_SIZE)
+		return;
+
+	ID = (buffer[0] << 8) | buffer[1];
+	query = [_queries objectForKey: [OFNumber numberWithUInt16: ID]];
+
+	if (query == nil)
+		return;
+
+	for (requestIndex = 0; requestIndex < query->_numRequests;
+	    requestIndex++)
+		if (query->_IDs[requestIndex] == ID)
+			break;
+
+	if (requestIndex == query->_numRequests || query->_done[requestIndex])
+		return;
+
+	/* Only accept answers from the name server that was asked */
+	parseNumericAddress([_nameServers objectAtIndex:
+	    query->_nameServerIndex], &nameServer);
+	setPort(&nameServer, _nameServerPort);
+
+	if (!of_udp_socket_address_equal(sender, &nameServer))
+		return;
+
+	/* Must be a response with exactly our question */
+	if (!(buffer[2] & 0x80) || buffer[4] != 0 || buffer[5] != 1)
+		return;
+
+	request = [query->_requests[requestIndex] items];
+	questionLength = [query->_requests[requestIndex] count] - HEADER_SIZE;
+
+	if (length < HEADER_SIZE + questionLength)
+		return;
+
+	/* Servers are free to change the case of the name */
+	if (of_ascii_casematch((const char*)buffer + HEADER_SIZE,
+	    (const char*)request + HEADER_SIZE, questionLength) !=
+	    questionLength)
+		return;
+
+	i = HEADER_SIZE + questionLength;
+
+	rcode = buffer[3] & 0x0F;
+
+	if (rcode != RCODE_NO_ERROR && rcode != RCODE_NAME_ERROR) {
+		/* Server failure or refused - ask the next name server */
+		[self OF_retryQuery: query];
+		return;
+	}
+
+	type = (requestIndex == 0 ? TYPE_A : TYPE_AAAA);
+	numAnswers = (buffer[6] << 8) | buffer[7];
+
+	for (j = 0; j < numAnswers; j++) {
+		of_udp_socket_address_t address;
+		uint16_t answerType, answerClass, dataLength;
+		uint32_t TTL;
+
+		if (!skipName(buffer, length, &i) || i + 10 > length)
+			break;
+
+		answerType = (buffer[i] << 8) | buffer[i + 1];
+		answerClass = (buffer[i + 2] << 8) | buffer[i + 3];
+		TTL = ((uint32_t)buffer[i + 4] << 24) |
+		    ((uint32_t)buffer[i + 5] << 16) |
+		    ((uint32_t)buffer[i + 6] << 8) | buffer[i + 7];
+		dataLength = (buffer[i + 8] << 8) | buffer[i + 9];
+		i += 10;
+
+		if (i + dataLength > length)
+			break;
+
+		/* CNAMEs are skipped, the server includes their target. */
+		if (answerType != type || answerClass != CLASS_IN) {
+			i += dataLength;
+			continue;
+		}
+
+		memset(&address, 0, sizeof(address));
+
+		if (type == TYPE_A && dataLength == 4) {
+			struct sockaddr_in *sin =
+			    (struct sockaddr_in*)&address.address;
+
+			sin->sin_family = AF_INET;
+			memcpy(&sin->sin_addr.s_addr, buffer + i, 4);
+			address.length = (socklen_t)sizeof(*sin);
+#ifdef OF_HAVE_IPV6
+		} else if (type == TYPE_AAAA && dataLength == 16) {
+			struct sockaddr_in6 *sin6 =
+			    (struct sockaddr_in6*)&address.address;
+
+			sin6->sin6_family = AF_INET6;
+			memcpy(sin6->sin6_addr.s6_addr, buffer + i, 16);
+			address.length = (socklen_t)sizeof(*sin6);
+#endif
+		} else {
+			i += dataLength;
+			continue;
+		}
+
+		[query->_addresses[requestIndex] addItem: &address];
+
+		if (TTL < query->_TTL)
+			query->_TTL = TTL;
+
+		i += dataLength;
+	}
+
+	query->_done[requestIndex] = true;
+
+	for (j = 0; j < query->_numRequests; j++)
+		if (!query->_done[j])
+			return;
+
+	[self OF_finishQuery: query];
+}
+@end
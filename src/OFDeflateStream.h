@@ -23,8 +23,14 @@ OF_ASSUME_NONNULL_BEGIN
 /*!
  * @class OFDeflateStream OFDeflateStream.h ObjFW/OFDeflateStream.h
  *
- * @brief A class that handles Deflate decompression transparently for an
- *	  underlying stream.
+ * @brief A class that handles Deflate compression and decompression
+ *	  transparently for an underlying stream.
+ *
+ * Data written to the stream is compressed using the fixed Huffman codes and
+ * written to the underlying stream. Each write ends a block, so that all data
+ * written so far can be decompressed by the other end without waiting for
+ * more. Calling @ref close writes the end of the compressed data, but does not
+ * close the underlying stream.
  */
 @interface OFDeflateStream: OFStream
 {
@@ -67,8 +73,18 @@ OF_ASSUME_NONNULL_BEGIN
 		} context;
 		bool inLastBlock, atEndOfStream;
 	} *_decompression;
+	struct of_deflate_stream_compression_ivars *_compression;
+	int _compressionLevel;
 }
 
+/*!
+ * The level at which written data is compressed, from 0 (no compression) to 9
+ * (best compression).
+ *
+ * The default is 6. It needs to be set before anything is written.
+ */
+@property int compressionLevel;
+
 /*!
  * @brief Creates a new OFDeflateStream with the specified underlying stream.
  *
@@ -32,7 +32,10 @@
 #import "OFDataArray.h"
 
 #import "OFInitializationFailedException.h"
+#import "OFInvalidArgumentException.h"
 #import "OFInvalidFormatException.h"
+#import "OFNotImplementedException.h"
+#import "OFNotOpenException.h"
 #import "OFOutOfMemoryException.h"
 #import "OFReadFailedException.h"
 
@@ -64,6 +67,9 @@ struct huffman_tree {
 
 @interface OFDeflateStream ()
 - (void)OF_initDecompression;
+#ifndef DEFLATE64
+- (void)OF_initCompression;
+#endif
 @end
 
 #ifndef DEFLATE64
@@ -259,6 +265,347 @@ releaseTree(struct huffman_tree *tree)
 	free(tree);
 }
 
+#ifndef DEFLATE64
+#define WINDOW_SIZE	32768
+#define WINDOW_MASK	(WINDOW_SIZE - 1)
+#define HASH_BITS	15
+#define HASH_SIZE	(1 << HASH_BITS)
+#define HASH_MASK	(HASH_SIZE - 1)
+#define MIN_MATCH	3
+#define MAX_MATCH	258
+#define OUTPUT_SIZE	4096
+#define MAX_STORED	65535
+
+struct of_deflate_stream_compression_ivars {
+	uint8_t window[2 * WINDOW_SIZE];
+	/* Positions are stored + 1, so that 0 means there is none */
+	uint32_t head[HASH_SIZE], prev[WINDOW_SIZE];
+	uint8_t output[OUTPUT_SIZE];
+	size_t windowLength, outputLength;
+	uint32_t bits;
+	uint8_t bitsLength;
+	uint16_t maxChain, niceLength;
+	bool store, lazyInsert, finished;
+};
+
+/* The fixed Huffman codes, bit reversed so they can be written LSB first */
+static uint16_t fixedLitLenCodes[288];
+static uint8_t fixedLitLenCodeLengths[288];
+static uint8_t fixedDistCodes[30];
+
+static uint16_t
+reverseBits(uint16_t value, uint8_t length)
+{
+	uint16_t ret = 0;
+
+	for (uint8_t i = 0; i < length; i++) {
+		ret = (ret << 1) | (value & 1);
+		value >>= 1;
+	}
+
+	return ret;
+}
+
+static void
+initFixedCodes(void)
+{
+	for (uint16_t i = 0; i < 288; i++) {
+		uint16_t code;
+		uint8_t length;
+
+		if (i < 144) {
+			code = 0x30 + i;
+			length = 8;
+		} else if (i < 256) {
+			code = 0x190 + (i - 144);
+			length = 9;
+		} else if (i < 280) {
+			code = i - 256;
+			length = 7;
+		} else {
+			code = 0xC0 + (i - 280);
+			length = 8;
+		}
+
+		fixedLitLenCodes[i] = reverseBits(code, length);
+		fixedLitLenCodeLengths[i] = length;
+	}
+
+	for (uint8_t i = 0; i < 30; i++)
+		fixedDistCodes[i] = (uint8_t)reverseBits(i, 5);
+}
+
+static void
+flushOutput(OFDeflateStream *stream,
+    struct of_deflate_stream_compression_ivars *ivars)
+{
+	[stream->_stream writeBuffer: ivars->output
+			      length: ivars->outputLength];
+	ivars->outputLength = 0;
+}
+
+static OF_INLINE void
+writeBits(OFDeflateStream *stream,
+    struct of_deflate_stream_compression_ivars *ivars, uint32_t bits,
+    uint8_t count)
+{
+	ivars->bits |= bits << ivars->bitsLength;
+	ivars->bitsLength += count;
+
+	while (ivars->bitsLength >= 8) {
+		if OF_UNLIKELY (ivars->outputLength == OUTPUT_SIZE)
+			flushOutput(stream, ivars);
+
+		ivars->output[ivars->outputLength++] = ivars->bits & 0xFF;
+		ivars->bits >>= 8;
+		ivars->bitsLength -= 8;
+	}
+}
+
+static void
+alignToByte(OFDeflateStream *stream,
+    struct of_deflate_stream_compression_ivars *ivars)
+{
+	if (ivars->bitsLength > 0)
+		writeBits(stream, ivars, 0, 8 - ivars->bitsLength);
+}
+
+static OF_INLINE void
+writeLiteral(OFDeflateStream *stream,
+    struct of_deflate_stream_compression_ivars *ivars, uint16_t value)
+{
+	writeBits(stream, ivars, fixedLitLenCodes[value],
+	    fixedLitLenCodeLengths[value]);
+}
+
+static void
+writePair(OFDeflateStream *stream,
+    struct of_deflate_stream_compression_ivars *ivars, uint16_t length,
+    uint16_t distance)
+{
+	uint8_t code = 28, low = 0, high = 29;
+
+	/* Length 258 has its own code, even though code 27 could encode it */
+	if (length < MAX_MATCH) {
+		code = 0;
+		while (code < 27 && lengthCodes[code + 1] <= length - 3)
+			code++;
+	}
+
+	writeLiteral(stream, ivars, 257 + code);
+	writeBits(stream, ivars, (length - 3) - lengthCodes[code],
+	    lengthExtraBits[code]);
+
+	/* Binary search for the last distance code <= distance */
+	while (low < high) {
+		uint8_t middle = (low + high + 1) / 2;
+
+		if (distanceCodes[middle] <= distance)
+			low = middle;
+		else
+			high = middle - 1;
+	}
+
+	writeBits(stream, ivars, fixedDistCodes[low], 5);
+	writeBits(stream, ivars, distance - distanceCodes[low],
+	    distanceExtraBits[low]);
+}
+
+static OF_INLINE uint32_t
+hashBytes(const uint8_t *bytes)
+{
+	return ((bytes[0] << 10) ^ (bytes[1] << 5) ^ bytes[2]) & HASH_MASK;
+}
+
+static OF_INLINE void
+insertPosition(struct of_deflate_stream_compression_ivars *ivars,
+    size_t position)
+{
+	uint32_t h = hashBytes(ivars->window + position);
+
+	ivars->prev[position & WINDOW_MASK] = ivars->head[h];
+	ivars->head[h] = (uint32_t)position + 1;
+}
+
+static void
+slideWindow(struct of_deflate_stream_compression_ivars *ivars)
+{
+	memmove(ivars->window, ivars->window + WINDOW_SIZE,
+	    ivars->windowLength - WINDOW_SIZE);
+	ivars->windowLength -= WINDOW_SIZE;
+
+	for (size_t i = 0; i < HASH_SIZE; i++)
+		ivars->head[i] = (ivars->head[i] > WINDOW_SIZE
+		    ? ivars->head[i] - WINDOW_SIZE : 0);
+
+	for (size_t i = 0; i < WINDOW_SIZE; i++)
+		ivars->prev[i] = (ivars->prev[i] > WINDOW_SIZE
+		    ? ivars->prev[i] - WINDOW_SIZE : 0);
+}
+
+static uint16_t
+longestMatch(struct of_deflate_stream_compression_ivars *ivars,
+    size_t position, size_t end, uint16_t *distance)
+{
+	const uint8_t *current = ivars->window + position;
+	size_t available = end - position;
+	uint32_t candidate = ivars->head[hashBytes(current)];
+	uint16_t chain = ivars->maxChain, bestLength = 0;
+
+	if (available > MAX_MATCH)
+		available = MAX_MATCH;
+
+	while (candidate > 0 && chain-- > 0) {
+		size_t start = candidate - 1;
+		const uint8_t *match = ivars->window + start;
+		uint16_t length = 0;
+
+		/*
+		 * The chain might continue with an entry that has been
+		 * overwritten by a newer position.
+		 */
+		if (start >= position || position - start > WINDOW_SIZE)
+			break;
+
+		if (match[bestLength] == current[bestLength])
+			while (length < available &&
+			    match[length] == current[length])
+				length++;
+
+		if (length > bestLength) {
+			bestLength = length;
+			*distance = (uint16_t)(position - start);
+
+			if (length >= ivars->niceLength || length == available)
+				break;
+		}
+
+		candidate = ivars->prev[start & WINDOW_MASK];
+		if (candidate - 1 >= start)
+			break;
+	}
+
+	return (bestLength >= MIN_MATCH ? bestLength : 0);
+}
+
+static void
+initCompression(struct of_deflate_stream_compression_ivars *ivars, int level)
+{
+	static const uint16_t maxChains[10] = {
+		0, 4, 8, 16, 32, 64, 128, 256, 1024, 4096
+	};
+	static const uint16_t niceLengths[10] = {
+		0, 8, 16, 32, 64, 128, 128, 258, 258, 258
+	};
+
+	ivars->store = (level == 0);
+	ivars->maxChain = maxChains[level];
+	ivars->niceLength = niceLengths[level];
+	ivars->lazyInsert = (level <= 3);
+}
+
+/* Compresses the buffer as a block that is not the last one. */
+static void
+compressBuffer(OFDeflateStream *stream,
+    struct of_deflate_stream_compression_ivars *ivars, const uint8_t *buffer,
+    size_t length)
+{
+	if (ivars->store) {
+		while (length > 0) {
+			size_t blockLength =
+			    (length > MAX_STORED ? MAX_STORED : length);
+
+			writeBits(stream, ivars, 0, 3);
+			alignToByte(stream, ivars);
+			writeBits(stream, ivars, (uint32_t)blockLength, 16);
+			writeBits(stream, ivars, (uint32_t)~blockLength & 0xFFFF,
+			    16);
+
+			flushOutput(stream, ivars);
+			[stream->_stream writeBuffer: buffer
+					      length: blockLength];
+
+			buffer += blockLength;
+			length -= blockLength;
+		}
+
+		return;
+	}
+
+	/* Not the last block, fixed Huffman codes */
+	writeBits(stream, ivars, 2, 3);
+
+	while (length > 0) {
+		size_t position = ivars->windowLength, end;
+		size_t toCopy = 2 * WINDOW_SIZE - ivars->windowLength;
+
+		if (toCopy == 0) {
+			slideWindow(ivars);
+			continue;
+		}
+
+		if (toCopy > length)
+			toCopy = length;
+
+		memcpy(ivars->window + position, buffer, toCopy);
+		ivars->windowLength += toCopy;
+		buffer += toCopy;
+		length -= toCopy;
+
+		/*
+		 * Matches can not extend into data that has not been written
+		 * yet, but they can start in data written before.
+		 */
+		end = ivars->windowLength;
+
+		while (position < end) {
+			uint16_t matchLength = 0, distance = 0;
+
+			if (end - position >= MIN_MATCH) {
+				matchLength = longestMatch(ivars, position, end,
+				    &distance);
+				insertPosition(ivars, position);
+			}
+
+			if (matchLength == 0) {
+				writeLiteral(stream, ivars,
+				    ivars->window[position++]);
+				continue;
+			}
+
+			writePair(stream, ivars, matchLength, distance);
+
+			if (ivars->lazyInsert)
+				position += matchLength;
+			else {
+				size_t matchEnd = position + matchLength;
+
+				for (position++; position < matchEnd;
+				    position++)
+					if (end - position >= MIN_MATCH)
+						insertPosition(ivars, position);
+			}
+		}
+	}
+
+	writeLiteral(stream, ivars, 256);
+	flushOutput(stream, ivars);
+}
+
+static void
+finishCompression(OFDeflateStream *stream,
+    struct of_deflate_stream_compression_ivars *ivars)
+{
+	/* Last block, fixed Huffman codes, only the end of block */
+	writeBits(stream, ivars, 3, 3);
+	writeLiteral(stream, ivars, 256);
+	alignToByte(stream, ivars);
+	flushOutput(stream, ivars);
+
+	ivars->finished = true;
+}
+#endif
+
 @implementation OFDeflateStream
 + (void)initialize
 {
@@ -282,6 +629,10 @@ releaseTree(struct huffman_tree *tree)
 		lengths[i] = 5;
 
 	fixedDistTree = constructTree(lengths, 32);
+
+#ifndef DEFLATE64
+	initFixedCodes();
+#endif
 }
 
 #ifndef DEFLATE64
@@ -300,6 +651,7 @@ releaseTree(struct huffman_tree *tree)
 	self = [super init];
 
 	_stream = [stream retain];
+	_compressionLevel = 6;
 
 	return self;
 }
@@ -836,7 +1188,81 @@ start:
 
 - (bool)hasDataInReadBuffer
 {
-	return ([super hasDataInReadBuffer] || [_stream hasDataInReadBuffer]);
+	struct of_deflate_stream_decompression_ivars *ivars = _decompression;
+
+	if ([super hasDataInReadBuffer])
+		return true;
+
+	/*
+	 * Reading stops once the buffer is full, which can leave compressed
+	 * data or the rest of a pair that has not been written yet, so that
+	 * more can be read without the underlying stream becoming readable.
+	 */
+	if (ivars != NULL && !ivars->atEndOfStream &&
+	    (ivars->bufferIndex < ivars->bufferLength ||
+	    (ivars->state == HUFFMAN_BLOCK &&
+	    (ivars->context.huffman.state == WRITE_VALUE ||
+	    ivars->context.huffman.state == PROCESS_PAIR))))
+		return true;
+
+	return [_stream hasDataInReadBuffer];
+}
+
+- (void)setCompressionLevel: (int)level
+{
+	if (level < 0 || level > 9)
+		@throw [OFInvalidArgumentException exception];
+
+	_compressionLevel = level;
+}
+
+- (int)compressionLevel
+{
+	return _compressionLevel;
+}
+
+- (void)OF_initCompression
+{
+	_compression = [self allocMemoryWithSize: sizeof(*_compression)];
+	memset(_compression, 0, sizeof(*_compression));
+
+	initCompression(_compression, _compressionLevel);
+}
+
+- (void)lowlevelWriteBuffer: (const void*)buffer
+		     length: (size_t)length
+{
+	if (_compression == NULL)
+		[self OF_initCompression];
+
+	if (_compression->finished)
+		@throw [OFNotOpenException exceptionWithObject: self];
+
+	/* An empty block would be a waste of bits. */
+	if (length == 0)
+		return;
+
+	compressBuffer(self, _compression, buffer, length);
+}
+
+- (int)fileDescriptorForWriting
+{
+	return [_stream fileDescriptorForWriting];
+}
+
+- (void)close
+{
+	if (_compression != NULL && !_compression->finished)
+		finishCompression(self, _compression);
+
+	[super close];
+}
+#else
+- (void)lowlevelWriteBuffer: (const void*)buffer
+		     length: (size_t)length
+{
+	@throw [OFNotImplementedException exceptionWithSelector: _cmd
+							 object: self];
 }
 #endif
 @end
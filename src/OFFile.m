@@ -35,6 +35,7 @@
 #endif
 
 #import "OFFile.h"
+#import "OFStream+Private.h"
 #import "OFString.h"
 #import "OFSystemInfo.h"
 
@@ -234,6 +235,8 @@ parseMode(const char *mode)
 - (void)lowlevelWriteBuffer: (const void*)buffer
 		     length: (size_t)length
 {
+	size_t bytesWritten = 0;
+
 	if (_fd == -1 || _atEndOfStream)
 		@throw [OFWriteFailedException exceptionWithObject: self
 						   requestedLength: length];
@@ -241,22 +244,47 @@ parseMode(const char *mode)
 #ifndef OF_WINDOWS
 	if (length > SSIZE_MAX)
 		@throw [OFOutOfRangeException exception];
-
-	if (write(_fd, buffer, length) != (ssize_t)length)
-		@throw [OFWriteFailedException exceptionWithObject: self
-						   requestedLength: length
-							     errNo: errno];
 #else
 	if (length > INT_MAX)
 		@throw [OFOutOfRangeException exception];
+#endif
 
-	if (write(_fd, buffer, (int)length) != (int)length)
-		@throw [OFWriteFailedException exceptionWithObject: self
-						   requestedLength: length
-							     errNo: errno];
+	while (bytesWritten < length) {
+#ifndef OF_WINDOWS
+		ssize_t ret = write(_fd, (const char*)buffer + bytesWritten,
+		    length - bytesWritten);
+#else
+		int ret = write(_fd, (const char*)buffer + bytesWritten,
+		    (int)(length - bytesWritten));
 #endif
+
+		if (ret < 0)
+			@throw [OFWriteFailedException
+			    exceptionWithObject: self
+				requestedLength: length
+				   bytesWritten: bytesWritten
+					  errNo: errno];
+
+		bytesWritten += ret;
+	}
 }
 
+#if defined(HAVE_WRITEV) && defined(HAVE_SYS_UIO_H)
+- (void)lowlevelWriteBuffers: (const of_stream_buffer_t*)buffers
+		       count: (size_t)count
+{
+	if (_fd == -1 || _atEndOfStream) {
+		[super lowlevelWriteBuffers: buffers
+				      count: count];
+		return;
+	}
+
+	[self OF_writeBuffers: buffers
+			count: count
+	       fileDescriptor: _fd];
+}
+#endif
+
 - (of_offset_t)lowlevelSeekToOffset: (of_offset_t)offset
 			     whence: (int)whence
 {
@@ -289,6 +317,16 @@ parseMode(const char *mode)
 	return _fd;
 }
 
+- (int)OF_rawFileDescriptorForReading
+{
+	return (_atEndOfStream ? -1 : _fd);
+}
+
+- (int)OF_rawFileDescriptorForWriting
+{
+	return (_atEndOfStream ? -1 : _fd);
+}
+
 - (void)close
 {
 	if (_fd != -1)
@@ -52,7 +52,6 @@
 #import "OFMoveItemFailedException.h"
 #import "OFNotImplementedException.h"
 #import "OFOpenItemFailedException.h"
-#import "OFOutOfMemoryException.h"
 #import "OFReadFailedException.h"
 #import "OFRemoveItemFailedException.h"
 #import "OFStatItemFailedException.h"
@@ -700,14 +699,8 @@ of_lstat(OFString *path, of_stat_t *buffer)
 			objc_autoreleasePoolPop(pool2);
 		}
 	} else if (S_ISREG(s.st_mode)) {
-		size_t pageSize = [OFSystemInfo pageSize];
 		OFFile *sourceFile = nil;
 		OFFile *destinationFile = nil;
-		char *buffer;
-
-		if ((buffer = malloc(pageSize)) == NULL)
-			@throw [OFOutOfMemoryException
-			    exceptionWithRequestedSize: pageSize];
 
 		@try {
 			sourceFile = [OFFile fileWithPath: source
@@ -715,14 +708,7 @@ of_lstat(OFString *path, of_stat_t *buffer)
 			destinationFile = [OFFile fileWithPath: destination
 							  mode: @"wb"];
 
-			while (![sourceFile isAtEndOfStream]) {
-				size_t length;
-
-				length = [sourceFile readIntoBuffer: buffer
-							     length: pageSize];
-				[destinationFile writeBuffer: buffer
-						      length: length];
-			}
+			[sourceFile transferToStream: destinationFile];
 
 #ifdef OF_HAVE_CHMOD
 			[self changePermissionsOfItemAtPath: destination
@@ -745,7 +731,6 @@ of_lstat(OFString *path, of_stat_t *buffer)
 		} @finally {
 			[sourceFile close];
 			[destinationFile close];
-			free(buffer);
 		}
 #ifdef OF_HAVE_SYMLINK
 	} else if (S_ISLNK(s.st_mode)) {
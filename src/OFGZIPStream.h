@@ -24,7 +24,8 @@ OF_ASSUME_NONNULL_BEGIN
 @interface OFGZIPStream: OFStream
 {
 	OFStream *_stream;
-	OFDeflateStream *_inflateStream;
+	OFDeflateStream *_inflateStream, *_deflateStream;
+	int _compressionLevel;
 	enum {
 		OF_GZIP_STREAM_ID1,
 		OF_GZIP_STREAM_ID2,
@@ -74,6 +75,16 @@ OF_ASSUME_NONNULL_BEGIN
 	uint32_t _CRC32, _uncompressedSize;
 }
 
+/*!
+ * The level at which written data is compressed, from 0 (no compression) to 9
+ * (best compression).
+ *
+ * The default is 6. It needs to be set before anything is written. Calling
+ * @ref close writes the end of the compressed data, but does not close the
+ * underlying stream.
+ */
+@property int compressionLevel;
+
 + (instancetype)streamWithStream: (OFStream*)stream;
 - initWithStream: (OFStream*)stream;
 @end
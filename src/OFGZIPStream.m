@@ -23,6 +23,7 @@
 #import "crc32.h"
 
 #import "OFChecksumFailedException.h"
+#import "OFInvalidArgumentException.h"
 #import "OFInvalidFormatException.h"
 
 @implementation OFGZIPStream
@@ -38,6 +39,7 @@
 	@try {
 		_stream = [stream retain];
 		_CRC32 = ~0;
+		_compressionLevel = 6;
 	} @catch (id e) {
 		[self release];
 		@throw e;
@@ -50,6 +52,7 @@
 {
 	[_stream release];
 	[_inflateStream release];
+	[_deflateStream release];
 	[_modificationDate release];
 
 	[super dealloc];
@@ -255,6 +258,76 @@
 	}
 }
 
+- (void)setCompressionLevel: (int)level
+{
+	if (level < 0 || level > 9)
+		@throw [OFInvalidArgumentException exception];
+
+	_compressionLevel = level;
+}
+
+- (int)compressionLevel
+{
+	return _compressionLevel;
+}
+
+- (void)lowlevelWriteBuffer: (const void*)buffer
+		     length: (size_t)length
+{
+	if (_deflateStream == nil) {
+		/* No flags, no modification time, no extra flags */
+		static const uint8_t header[10] = {
+			0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0,
+			OF_GZIP_STREAM_OS_UNKNOWN
+		};
+
+		[_stream writeBuffer: header
+			      length: sizeof(header)];
+
+		_deflateStream = [[OFDeflateStream alloc]
+		    initWithStream: _stream];
+		[_deflateStream setCompressionLevel: _compressionLevel];
+	}
+
+	[_deflateStream writeBuffer: buffer
+			     length: length];
+
+	_CRC32 = of_crc32(_CRC32, buffer, length);
+	_uncompressedSize += (uint32_t)length;
+}
+
+- (int)fileDescriptorForWriting
+{
+	return [_stream fileDescriptorForWriting];
+}
+
+- (void)close
+{
+	if (_deflateStream != nil) {
+		uint32_t CRC32 = ~_CRC32;
+		uint8_t trailer[8] = {
+			CRC32 & 0xFF, (CRC32 >> 8) & 0xFF,
+			(CRC32 >> 16) & 0xFF, CRC32 >> 24,
+			_uncompressedSize & 0xFF,
+			(_uncompressedSize >> 8) & 0xFF,
+			(_uncompressedSize >> 16) & 0xFF,
+			_uncompressedSize >> 24
+		};
+
+		[_deflateStream close];
+		[_deflateStream release];
+		_deflateStream = nil;
+
+		[_stream writeBuffer: trailer
+			      length: sizeof(trailer)];
+
+		_CRC32 = ~0;
+		_uncompressedSize = 0;
+	}
+
+	[super close];
+}
+
 - (bool)lowlevelIsAtEndOfStream
 {
 	return [_stream isAtEndOfStream];
@@ -28,7 +28,51 @@ OF_ASSUME_NONNULL_BEGIN
 @class OFURL;
 @class OFTCPSocket;
 @class OFDictionary OF_GENERIC(KeyType, ObjectType);
+@class OFMutableDictionary OF_GENERIC(KeyType, ObjectType);
+@class OFMutableArray OF_GENERIC(ObjectType);
 @class OFDataArray;
+@class OFException;
+#ifdef OF_HAVE_THREADS
+@class OFCondition;
+#endif
+
+/*!
+ * @struct of_http_client_statistics_t OFHTTPClient.h ObjFW/OFHTTPClient.h
+ *
+ * @brief Statistics about the connections of an OFHTTPClient.
+ */
+typedef struct {
+	/*! The number of connections that have been established */
+	uintmax_t connectionsCreated;
+	/*! The number of requests that reused an idle connection */
+	uintmax_t connectionsReused;
+	/*!
+	 * The number of idle connections that have been closed because they
+	 * timed out, failed the health check or did not fit into the pool
+	 */
+	uintmax_t connectionsEvicted;
+	/*! The number of connections currently used by a request or response */
+	size_t activeConnections;
+	/*! The number of connections currently idle in the pool */
+	size_t idleConnections;
+} of_http_client_statistics_t;
+
+#ifdef OF_HAVE_BLOCKS
+/*!
+ * @brief A block which is called when an asynchronous request of an
+ *	  OFHTTPClient finished.
+ *
+ * @param client The OFHTTPClient which performed the request
+ * @param request The request which has been performed
+ * @param response The response for the request or `nil` if an exception
+ *		   occurred
+ * @param exception An exception which occurred while performing the request
+ *		    or `nil` on success
+ */
+typedef void (^of_http_client_async_request_block_t)(OFHTTPClient *client,
+    OFHTTPRequest *request, OFHTTPResponse *_Nullable response,
+    OFException *_Nullable exception);
+#endif
 
 /*!
  * @protocol OFHTTPClientDelegate OFHTTPClient.h ObjFW/OFHTTPClient.h
@@ -92,21 +136,69 @@ OF_ASSUME_NONNULL_BEGIN
 	    statusCode: (int)statusCode
 	       request: (OFHTTPRequest*)request
 	      response: (OFHTTPResponse*)response;
+
+/*!
+ * @brief A callback which is called when an asynchronous request of an
+ *	  OFHTTPClient received a response.
+ *
+ * The body can then be read from the response, preferably asynchronously as
+ * well.
+ *
+ * @param client The OFHTTPClient which performed the request
+ * @param request The request which has been performed
+ * @param response The response for the request
+ */
+-      (void)client: (OFHTTPClient*)client
+  didPerformRequest: (OFHTTPRequest*)request
+	   response: (OFHTTPResponse*)response;
+
+/*!
+ * @brief A callback which is called when an asynchronous request of an
+ *	  OFHTTPClient failed.
+ *
+ * If the server responded with a status code other than 2xx, the exception is
+ * an OFHTTPRequestFailedException which contains the response.
+ *
+ * @param client The OFHTTPClient which performed the request
+ * @param exception The exception which occurred
+ * @param request The request which failed
+ */
+-	  (void)client: (OFHTTPClient*)client
+  didFailWithException: (OFException*)exception
+	       request: (OFHTTPRequest*)request;
 @end
 
 /*!
  * @class OFHTTPClient OFHTTPClient.h ObjFW/OFHTTPClient.h
  *
  * @brief A class for performing HTTP requests.
+ *
+ * Connections are kept in a pool per scheme, host and port and reused for
+ * further requests to the same server if it supports persistent connections.
+ * A connection is returned to the pool once the body of its response has been
+ * read completely. Responses which are closed or deallocated before that
+ * close their connection instead.
+ *
+ * Requests can also be performed asynchronously, in which case connecting,
+ * sending the request and receiving the head of the response happen in the
+ * run loop of the thread that started the request. The response is then passed
+ * to the delegate or a block.
+ *
+ * An OFHTTPClient can be used by multiple threads at the same time, but the
+ * delegate is then called from all of them.
  */
 @interface OFHTTPClient: OFObject
 {
 	id <OFHTTPClientDelegate> _delegate;
-	bool _insecureRedirectsAllowed;
-	OFTCPSocket *_socket;
-	OFURL *_lastURL;
-	bool _lastWasHEAD;
-	OFHTTPResponse *_lastResponse;
+	bool _insecureRedirectsAllowed, _decompressesResponses;
+	OFMutableDictionary *_pools;
+	size_t _maxIdleConnectionsPerHost, _maxConnectionsPerHost;
+	of_time_interval_t _idleTimeout, _timeout;
+	of_http_client_statistics_t _statistics;
+	OFMutableArray *_asyncRequests, *_waitingRequests;
+#ifdef OF_HAVE_THREADS
+	OFCondition *_condition;
+#endif
 }
 
 /*!
@@ -119,6 +211,65 @@ OF_ASSUME_NONNULL_BEGIN
  */
 @property bool insecureRedirectsAllowed;
 
+/*!
+ * Whether response bodies compressed with gzip or Deflate are decompressed
+ * transparently.
+ *
+ * If enabled, requests without an `Accept-Encoding` header ask for gzip or
+ * Deflate and the body of a response with a `Content-Encoding` of `gzip`,
+ * `x-gzip` or `deflate` is decompressed while it is read. The headers of the
+ * response are passed on unchanged, so the `Content-Length` is the one of the
+ * compressed body.
+ *
+ * The default is false.
+ */
+@property bool decompressesResponses;
+
+/*!
+ * The maximum number of idle connections kept per scheme, host and port.
+ *
+ * The default is 4. Setting it to 0 disables reusing connections.
+ */
+@property size_t maxIdleConnectionsPerHost;
+
+/*!
+ * The maximum number of connections per scheme, host and port, including the
+ * idle ones.
+ *
+ * If the limit is reached, @ref performRequest: waits until another thread
+ * finishes reading a response. Without threads, it throws an
+ * OFOutOfRangeException instead. Asynchronous requests are queued until a
+ * connection becomes available.
+ *
+ * The default is `SIZE_MAX`, which means there is no limit.
+ */
+@property size_t maxConnectionsPerHost;
+
+/*!
+ * The time in seconds after which an idle connection is closed.
+ *
+ * Idle connections are also checked before they are reused and closed if the
+ * server closed them or sent unexpected data in the meantime.
+ *
+ * The default is 10 seconds.
+ */
+@property of_time_interval_t idleTimeout;
+
+/*!
+ * The time in seconds after which an asynchronous request fails with an
+ * OFConnectionFailedException with `ETIMEDOUT` if no response has been
+ * received yet.
+ *
+ * The time is measured separately for every request and every redirect. The
+ * default is 0, which means there is no timeout.
+ */
+@property of_time_interval_t timeout;
+
+/*!
+ * Statistics about the connections of the client.
+ */
+@property (readonly) of_http_client_statistics_t statistics;
+
 /*!
  * @brief Creates a new OFHTTPClient.
  *
@@ -146,7 +297,74 @@ OF_ASSUME_NONNULL_BEGIN
 			redirects: (size_t)redirects;
 
 /*!
- * @brief Closes connections that are still open due to keep-alive.
+ * @brief Asynchronously performs the specified HTTP request.
+ *
+ * The delegate is informed about the response or the exception that occurred
+ * using @ref OFHTTPClientDelegate::client:didPerformRequest:response: or
+ * @ref OFHTTPClientDelegate::client:didFailWithException:request:.
+ *
+ * If the maximum number of connections per host is reached, the request is
+ * started once another connection has been released.
+ *
+ * @note HTTPS connections are established blocking, as the TLS socket classes
+ *	 only implement a blocking handshake.
+ *
+ * @param request The request to perform
+ */
+- (void)asyncPerformRequest: (OFHTTPRequest*)request;
+
+/*!
+ * @brief Asynchronously performs the specified HTTP request.
+ *
+ * @param request The request to perform
+ * @param redirects The maximum number of redirects after which no further
+ *		    attempt is done to follow the redirect, but instead the
+ *		    redirect is passed to the delegate
+ */
+- (void)asyncPerformRequest: (OFHTTPRequest*)request
+		  redirects: (size_t)redirects;
+
+#ifdef OF_HAVE_BLOCKS
+/*!
+ * @brief Asynchronously performs the specified HTTP request.
+ *
+ * @param request The request to perform
+ * @param block The block to call with the response or the exception that
+ *		occurred
+ */
+- (void)asyncPerformRequest: (OFHTTPRequest*)request
+		      block: (of_http_client_async_request_block_t)block;
+
+/*!
+ * @brief Asynchronously performs the specified HTTP request.
+ *
+ * @param request The request to perform
+ * @param redirects The maximum number of redirects after which no further
+ *		    attempt is done to follow the redirect, but instead the
+ *		    redirect is passed to the block
+ * @param block The block to call with the response or the exception that
+ *		occurred
+ */
+- (void)asyncPerformRequest: (OFHTTPRequest*)request
+		  redirects: (size_t)redirects
+		      block: (of_http_client_async_request_block_t)block;
+#endif
+
+/*!
+ * @brief Cancels an asynchronous request.
+ *
+ * Neither the delegate nor the block is called for a cancelled request. This
+ * needs to be called from the thread that started the request.
+ *
+ * @param request The request passed to @ref asyncPerformRequest: that should be
+ *		  cancelled
+ */
+- (void)cancelAsyncRequest: (OFHTTPRequest*)request;
+
+/*!
+ * @brief Closes all idle connections.
+ *
+ * Connections which are still used by a response are not affected.
  */
 - (void)close;
 @end
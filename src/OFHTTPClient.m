@@ -16,25 +16,42 @@
 
 #include "config.h"
 
-#include <ctype.h>
 #include <errno.h>
 #include <string.h>
 
+#ifdef HAVE_POLL_H
+# include <poll.h>
+#else
+# include <sys/time.h>
+#endif
+
 #import "OFHTTPClient.h"
 #import "OFHTTPRequest.h"
 #import "OFHTTPResponse.h"
+#import "OFStream+Private.h"
 #import "OFString.h"
 #import "OFURL.h"
 #import "OFTCPSocket.h"
+#import "OFArray.h"
+#import "OFDate.h"
 #import "OFDictionary.h"
 #import "OFDataArray.h"
-
+#import "OFDeflateStream.h"
+#import "OFGZIPStream.h"
+#import "OFRunLoop.h"
+#import "OFRunLoop+Private.h"
+#import "OFTimer.h"
+#ifdef OF_HAVE_THREADS
+# import "OFCondition.h"
+#endif
+
+#import "OFChecksumFailedException.h"
+#import "OFConnectionFailedException.h"
 #import "OFHTTPRequestFailedException.h"
 #import "OFInvalidEncodingException.h"
 #import "OFInvalidFormatException.h"
 #import "OFInvalidServerReplyException.h"
 #import "OFNotImplementedException.h"
-#import "OFOutOfMemoryException.h"
 #import "OFOutOfRangeException.h"
 #import "OFReadFailedException.h"
 #import "OFTruncatedDataException.h"
@@ -42,43 +59,281 @@
 #import "OFUnsupportedVersionException.h"
 #import "OFWriteFailedException.h"
 
-static OF_INLINE void
-normalizeKey(char *str_)
+#import "of_adler32.h"
+#import "of_http_parser.h"
+#import "socket_helpers.h"
+
+#ifdef OF_WII
+# define pollfd pollsd
+#endif
+
+/*
+ * Reads the head of the response into the socket's read buffer and parses it
+ * there. Returns false if the connection was closed before anything was
+ * received.
+ */
+static bool
+readResponseHead(OFTCPSocket *socket, of_http_parser_t *parser)
 {
-	unsigned char *str = (unsigned char*)str_;
-	bool firstLetter = true;
+	of_http_parser_init(parser, true);
 
-	while (*str != '\0') {
-		if (!isalnum(*str)) {
-			firstLetter = true;
-			str++;
-			continue;
+	for (;;) {
+		switch (of_http_parser_parse(parser, [socket OF_readBuffer],
+		    [socket OF_readBufferLength])) {
+		case OF_HTTP_PARSER_DONE:
+			return true;
+		case OF_HTTP_PARSER_INCOMPLETE:
+			break;
+		default:
+			@throw [OFInvalidServerReplyException exception];
 		}
 
-		*str = (firstLetter ? toupper(*str) : tolower(*str));
+		if ([socket OF_fillReadBuffer] == 0 &&
+		    [socket lowlevelIsAtEndOfStream]) {
+			if ([socket OF_readBufferLength] == 0)
+				return false;
 
-		firstLetter = false;
-		str++;
+			@throw [OFInvalidServerReplyException exception];
+		}
 	}
 }
 
+/*
+ * An idle connection must not have become readable, as that means that the
+ * server either closed it or sent something that was not requested.
+ */
+static bool
+isConnectionHealthy(OFTCPSocket *socket)
+{
+	int fd = [socket fileDescriptorForReading];
+#if defined(HAVE_POLL_H) || defined(OF_WII)
+	struct pollfd pfd;
+#else
+	fd_set readFDs;
+	struct timeval timeout;
+#endif
+
+	if (fd < 0 || [socket hasDataInReadBuffer])
+		return false;
+
+#if defined(HAVE_POLL_H) || defined(OF_WII)
+	memset(&pfd, 0, sizeof(pfd));
+# ifdef OF_WII
+	pfd.socket = fd;
+# else
+	pfd.fd = fd;
+# endif
+	pfd.events = POLLIN;
+
+	return (poll(&pfd, 1, 0) == 0);
+#else
+# ifndef OF_WINDOWS
+	if (fd >= (int)FD_SETSIZE)
+		return false;
+# endif
+
+	FD_ZERO(&readFDs);
+	FD_SET((of_socket_t)fd, &readFDs);
+	timeout.tv_sec = 0;
+	timeout.tv_usec = 0;
+
+	return (select(fd + 1, &readFDs, NULL, NULL, &timeout) == 0);
+#endif
+}
+
+static OFString*
+poolKeyForURL(OFURL *URL)
+{
+	OFString *scheme = [URL scheme];
+
+	if (![scheme isEqual: @"http"] && ![scheme isEqual: @"https"])
+		@throw [OFUnsupportedProtocolException exceptionWithURL: URL];
+
+	return [OFString stringWithFormat: @"%@://%@:%u",
+					   scheme, [URL host],
+					   (unsigned int)[URL port]];
+}
+
+@interface OFHTTPClient_Pool: OFObject
+{
+@public
+	/* Sorted by the time they became idle, oldest first */
+	OFMutableArray OF_GENERIC(OFTCPSocket*) *_idleSockets;
+	OFDataArray *_idleSince;
+	size_t _activeConnections;
+}
+@end
+
+@interface OFHTTPClient_AsyncRequest: OFObject
+{
+	OFHTTPClient *_client;
+	OFHTTPRequest *_originalRequest, *_request;
+	OFMutableDictionary OF_GENERIC(OFString*, OFString*) *_headers;
+	size_t _redirects;
+#ifdef OF_HAVE_BLOCKS
+	of_http_client_async_request_block_t _block;
+#endif
+	OFRunLoop *_runLoop;
+	OFString *_poolKey;
+	OFDataArray *_requestData;
+	OFTCPSocket *_socket;
+	OFHTTPResponse *_response;
+	OFTimer *_timer;
+	bool _reused, _connecting, _finished;
+	of_http_parser_t _parser;
+}
+
+- initWithClient: (OFHTTPClient*)client
+	 request: (OFHTTPRequest*)request
+       redirects: (size_t)redirects;
+#ifdef OF_HAVE_BLOCKS
+- initWithClient: (OFHTTPClient*)client
+	 request: (OFHTTPRequest*)request
+       redirects: (size_t)redirects
+	   block: (of_http_client_async_request_block_t)block;
+#endif
+- (OFHTTPRequest*)originalRequest;
+- (void)startRequest: (OFHTTPRequest*)request;
+- (void)acquireSocket;
+- (void)retryAcquiringSocket;
+- (void)socketDidConnect: (OFTCPSocket*)socket
+	       exception: (OFException*)exception;
+- (void)sendRequest;
+- (size_t)socket: (OFTCPSocket*)socket
+  didWriteRequest: (const void**)request
+     bytesWritten: (size_t)bytesWritten
+	exception: (OFException*)exception;
+- (bool)parseResponseFromSocket: (OFTCPSocket*)socket
+		      exception: (OFException*)exception;
+- (void)retryWithNewConnection;
+- (void)deliverResponse;
+- (void)timedOut;
+- (void)failWithException: (OFException*)exception;
+- (void)finishWithResponse: (OFHTTPResponse*)response
+		 exception: (OFException*)exception;
+- (void)closeConnection;
+- (void)cancel;
+@end
+
+@class OFHTTPClientResponseBody;
+
 @interface OFHTTPClientResponse: OFHTTPResponse
 {
 	OFTCPSocket *_socket;
+	OFHTTPClient *_client;
+	OFString *_poolKey;
 	bool _hasContentLength, _chunked, _keepAlive, _atEndOfStream;
 	size_t _toRead;
+	int _fileDescriptor;
+	enum {
+		CONTENT_ENCODING_GZIP,
+		CONTENT_ENCODING_DEFLATE
+	} _contentEncoding;
+	OFHTTPClientResponseBody *_body;
+	OFStream *_decompressionStream;
+	uint8_t _zlibHeader[2], _zlibHeaderLength;
+	uint8_t _zlibTrailer[4], _zlibTrailerLength;
+	bool _zlib;
+	uint32_t _adler32;
 }
 
-- initWithSocket: (OFTCPSocket*)socket;
+- initWithSocket: (OFTCPSocket*)socket
+	  client: (OFHTTPClient*)client
+	 poolKey: (OFString*)poolKey;
 - (void)OF_setKeepAlive: (bool)keepAlive;
+- (bool)OF_isKeepAlive;
+- (void)OF_setHasBody: (bool)hasBody;
+- (void)OF_decompressBody;
+- (void)OF_releaseSocket;
+- (size_t)OF_readBodyIntoBuffer: (void*)buffer
+			 length: (size_t)length;
+- (bool)OF_bodyIsAtEndOfStream;
+- (bool)OF_bodyHasDataInReadBuffer;
+- (bool)OF_skipZlibHeader;
+@end
+
+/*
+ * The body of a response as it is sent by the server, which the
+ * decompression stream reads from.
+ */
+@interface OFHTTPClientResponseBody: OFStream
+{
+	OFHTTPClientResponse *_response;
+}
+
+- initWithResponse: (OFHTTPClientResponse*)response;
+@end
+
+@interface OFHTTPClient ()
+- (OFMutableDictionary OF_GENERIC(OFString*, OFString*)*)OF_headersForRequest:
+    (OFHTTPRequest*)request;
+- (OFString*)OF_requestStringForRequest: (OFHTTPRequest*)request
+				headers: (OFDictionary OF_GENERIC(OFString*,
+					     OFString*)*)headers;
+- (bool)OF_tryAcquireSocket: (OFTCPSocket**)socket
+		    poolKey: (OFString*)poolKey;
+- (OFTCPSocket*)OF_socketForRequest: (OFHTTPRequest*)request
+			    poolKey: (OFString*)poolKey
+			     reused: (bool*)reused;
+- (bool)OF_acquireSocket: (OFTCPSocket**)socket
+		 poolKey: (OFString*)poolKey
+	    asyncRequest: (OFHTTPClient_AsyncRequest*)asyncRequest;
+- (OFTCPSocket*)OF_createSocketForRequest: (OFHTTPRequest*)request;
+- (void)OF_countCreatedConnection;
+- (void)OF_releaseSocket: (OFTCPSocket*)socket
+		 poolKey: (OFString*)poolKey
+		reusable: (bool)reusable;
+- (void)OF_evictIdleConnectionsInPool: (OFHTTPClient_Pool*)pool;
+- (OFHTTPClientResponse*)OF_responseForRequest: (OFHTTPRequest*)request
+					socket: (OFTCPSocket*)socket
+				       poolKey: (OFString*)poolKey
+					parser: (of_http_parser_t*)parser;
+- (OFHTTPRequest*)OF_redirectForRequest: (OFHTTPRequest*)request
+				headers: (OFDictionary OF_GENERIC(OFString*,
+					     OFString*)*)headers
+			       response: (OFHTTPResponse*)response
+			      redirects: (size_t)redirects;
+- (void)OF_asyncPerformRequest: (OFHTTPClient_AsyncRequest*)asyncRequest;
+- (void)OF_removeAsyncRequest: (OFHTTPClient_AsyncRequest*)asyncRequest;
+@end
+
+@implementation OFHTTPClient_Pool
+- init
+{
+	self = [super init];
+
+	@try {
+		_idleSockets = [[OFMutableArray alloc] init];
+		_idleSince = [[OFDataArray alloc]
+		    initWithItemSize: sizeof(of_time_interval_t)];
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	[_idleSockets release];
+	[_idleSince release];
+
+	[super dealloc];
+}
 @end
 
 @implementation OFHTTPClientResponse
 - initWithSocket: (OFTCPSocket*)socket
+	  client: (OFHTTPClient*)client
+	 poolKey: (OFString*)poolKey
 {
 	self = [super init];
 
 	_socket = [socket retain];
+	_client = [client retain];
+	_poolKey = [poolKey copy];
+	_fileDescriptor = -1;
 
 	return self;
 }
@@ -88,9 +343,77 @@ normalizeKey(char *str_)
 	_keepAlive = keepAlive;
 }
 
+- (bool)OF_isKeepAlive
+{
+	return _keepAlive;
+}
+
+- (void)OF_setHasBody: (bool)hasBody
+{
+	if (!hasBody || (_hasContentLength && _toRead == 0)) {
+		_atEndOfStream = true;
+		[self OF_releaseSocket];
+	}
+}
+
+- (void)OF_decompressBody
+{
+	OFString *contentEncoding =
+	    [[self headers] objectForKey: @"Content-Encoding"];
+
+	if (_atEndOfStream || contentEncoding == nil)
+		return;
+
+	if ([contentEncoding caseInsensitiveCompare: @"gzip"] ==
+	    OF_ORDERED_SAME ||
+	    [contentEncoding caseInsensitiveCompare: @"x-gzip"] ==
+	    OF_ORDERED_SAME)
+		_contentEncoding = CONTENT_ENCODING_GZIP;
+	else if ([contentEncoding caseInsensitiveCompare: @"deflate"] ==
+	    OF_ORDERED_SAME)
+		_contentEncoding = CONTENT_ENCODING_DEFLATE;
+	else
+		return;
+
+	/* The stream is created lazily, as creating it can read */
+	_body = [[OFHTTPClientResponseBody alloc] initWithResponse: self];
+}
+
+/*
+ * Hands the socket back to the client, which keeps it for the next request if
+ * the whole body has been read and the server allows it.
+ */
+- (void)OF_releaseSocket
+{
+	OFTCPSocket *socket = _socket;
+
+	if (socket == nil)
+		return;
+
+	/*
+	 * This might happen while the response is observed by a run loop,
+	 * which then still needs the file descriptor to stop observing it.
+	 */
+	_fileDescriptor = [socket fileDescriptorForReading];
+	_socket = nil;
+
+	@try {
+		[_client OF_releaseSocket: socket
+				  poolKey: _poolKey
+				 reusable: _keepAlive && _atEndOfStream];
+	} @finally {
+		[socket release];
+	}
+}
+
 - (void)dealloc
 {
-	[_socket release];
+	[self OF_releaseSocket];
+
+	[_client release];
+	[_poolKey release];
+	[_decompressionStream release];
+	[_body release];
 
 	[super dealloc];
 }
@@ -126,41 +449,48 @@ normalizeKey(char *str_)
 	}
 }
 
-- (size_t)lowlevelReadIntoBuffer: (void*)buffer
-			  length: (size_t)length
+- (size_t)OF_readBodyIntoBuffer: (void*)buffer
+			 length: (size_t)length
 {
 	if (_atEndOfStream)
+		return 0;
+
+	if (_socket == nil)
 		@throw [OFReadFailedException exceptionWithObject: self
 						  requestedLength: length
 							    errNo: ENOTCONN];
 
-	if (!_hasContentLength && !_chunked)
-		return [_socket readIntoBuffer: buffer
-					length: length];
+	if (!_hasContentLength && !_chunked) {
+		length = [_socket readIntoBuffer: buffer
+					  length: length];
+
+		if (length == 0 && [_socket isAtEndOfStream]) {
+			_atEndOfStream = true;
+			[self OF_releaseSocket];
+		}
+
+		return length;
+	}
 
 	/* Content-Length */
 	if (!_chunked) {
-		size_t ret;
-
-		if (_toRead == 0) {
-			_atEndOfStream = true;
+		if (length > _toRead)
+			length = _toRead;
 
-			if (!_keepAlive)
-				[_socket close];
+		length = [_socket readIntoBuffer: buffer
+					  length: length];
 
-			return 0;
-		}
+		if (length == 0 && [_socket isAtEndOfStream])
+			@throw [OFTruncatedDataException exception];
 
-		if (_toRead < length)
-			ret = [_socket readIntoBuffer: buffer
-					       length: _toRead];
-		else
-			ret = [_socket readIntoBuffer: buffer
-					       length: length];
+		_toRead -= length;
 
-		_toRead -= ret;
+		if (_toRead == 0) {
+			_atEndOfStream = true;
+			[self OF_releaseSocket];
+		}
 
-		return ret;
+		return length;
 	}
 
 	/* Chunked */
@@ -171,6 +501,9 @@ normalizeKey(char *str_)
 		length = [_socket readIntoBuffer: buffer
 					  length: length];
 
+		if (length == 0 && [_socket isAtEndOfStream])
+			@throw [OFTruncatedDataException exception];
+
 		_toRead -= length;
 
 		if (_toRead == 0)
@@ -190,6 +523,9 @@ normalizeKey(char *str_)
 			@throw [OFInvalidServerReplyException exception];
 		}
 
+		if (line == nil)
+			@throw [OFTruncatedDataException exception];
+
 		range = [line rangeOfString: @";"];
 		if (range.location != OF_NOT_FOUND)
 			line = [line substringWithRange:
@@ -207,9 +543,8 @@ normalizeKey(char *str_)
 		}
 
 		if (_toRead == 0) {
-			_atEndOfStream = true;
-
-			if (_keepAlive) {
+			/* Skip the trailer, which ends with an empty line */
+			do {
 				@try {
 					line = [_socket readLine];
 				} @catch (OFInvalidEncodingException *e) {
@@ -217,11 +552,13 @@ normalizeKey(char *str_)
 					    exception];
 				}
 
-				if ([line length] > 0)
-					@throw [OFInvalidServerReplyException
+				if (line == nil)
+					@throw [OFTruncatedDataException
 					    exception];
-			} else
-				[_socket close];
+			} while ([line length] > 0);
+
+			_atEndOfStream = true;
+			[self OF_releaseSocket];
 		}
 
 		objc_autoreleasePoolPop(pool);
@@ -230,162 +567,1042 @@ normalizeKey(char *str_)
 	}
 }
 
-- (bool)lowlevelIsAtEndOfStream
+- (bool)OF_bodyIsAtEndOfStream
 {
-	if (!_hasContentLength && !_chunked)
+	if (!_hasContentLength && !_chunked && _socket != nil)
 		return [_socket isAtEndOfStream];
 
 	return _atEndOfStream;
 }
 
+- (bool)OF_bodyHasDataInReadBuffer
+{
+	return [_socket hasDataInReadBuffer];
+}
+
+/*
+ * Deflate in HTTP is supposed to use the zlib format, but some servers send
+ * raw Deflate data instead, so the header is only skipped if there is one.
+ * Returns false if more data is needed.
+ */
+- (bool)OF_skipZlibHeader
+{
+	while (_zlibHeaderLength < 2) {
+		size_t length = [_body readIntoBuffer: _zlibHeader +
+						       _zlibHeaderLength
+					       length: 2 - _zlibHeaderLength];
+
+		if (length == 0) {
+			if (![_body isAtEndOfStream])
+				return false;
+
+			break;
+		}
+
+		_zlibHeaderLength += length;
+	}
+
+	if (_zlibHeaderLength < 2 || (_zlibHeader[0] & 0x0F) != 8 ||
+	    (_zlibHeader[0] >> 4) > 7 ||
+	    ((_zlibHeader[0] << 8) | _zlibHeader[1]) % 31 != 0)
+		[_body unreadFromBuffer: _zlibHeader
+				 length: _zlibHeaderLength];
+	else {
+		_zlib = true;
+		_adler32 = 1;
+	}
+
+	return true;
+}
+
+- (size_t)lowlevelReadIntoBuffer: (void*)buffer
+			  length: (size_t)length
+{
+	if (_body == nil)
+		return [self OF_readBodyIntoBuffer: buffer
+					    length: length];
+
+	if (_decompressionStream == nil) {
+		if (_contentEncoding == CONTENT_ENCODING_GZIP)
+			_decompressionStream = [[OFGZIPStream alloc]
+			    initWithStream: _body];
+		else {
+			if (![self OF_skipZlibHeader])
+				return 0;
+
+			_decompressionStream = [[OFDeflateStream alloc]
+			    initWithStream: _body];
+		}
+	}
+
+	if (![_decompressionStream isAtEndOfStream]) {
+		length = [_decompressionStream readIntoBuffer: buffer
+						       length: length];
+
+		if (_zlib)
+			_adler32 = of_adler32(_adler32, buffer, length);
+
+		return length;
+	}
+
+	/*
+	 * The zlib format ends with the Adler-32 of the uncompressed data, like
+	 * gzip ends with the CRC-32, which OFGZIPStream checks. This only reads
+	 * once per call, like any other read, so that it does not block when
+	 * the response is read from a run loop.
+	 */
+	if (_zlib && _zlibTrailerLength < 4) {
+		size_t trailerLength = [_body
+		    readIntoBuffer: _zlibTrailer + _zlibTrailerLength
+			    length: 4 - _zlibTrailerLength];
+
+		if (trailerLength == 0 && [_body isAtEndOfStream])
+			@throw [OFTruncatedDataException exception];
+
+		_zlibTrailerLength += trailerLength;
+
+		if (_zlibTrailerLength < 4)
+			return 0;
+
+		if (((uint32_t)_zlibTrailer[0] << 24 |
+		    (uint32_t)_zlibTrailer[1] << 16 |
+		    (uint32_t)_zlibTrailer[2] << 8 | _zlibTrailer[3]) !=
+		    _adler32)
+			@throw [OFChecksumFailedException exception];
+	}
+
+	/*
+	 * Whatever follows the compressed data still needs to be read for the
+	 * connection to be reusable.
+	 */
+	if (![_body isAtEndOfStream]) {
+		char discard[64];
+
+		[_body readIntoBuffer: discard
+			       length: sizeof(discard)];
+
+		if (![_body isAtEndOfStream])
+			return 0;
+	}
+
+	[_decompressionStream release];
+	_decompressionStream = nil;
+	[_body release];
+	_body = nil;
+
+	return 0;
+}
+
+- (bool)lowlevelIsAtEndOfStream
+{
+	if (_body != nil)
+		return false;
+
+	return [self OF_bodyIsAtEndOfStream];
+}
+
 - (int)fileDescriptorForReading
 {
 	if (_socket == nil)
-		return -1;
+		return _fileDescriptor;
 
 	return [_socket fileDescriptorForReading];
 }
 
 - (bool)hasDataInReadBuffer
 {
-	return ([super hasDataInReadBuffer] || [_socket hasDataInReadBuffer]);
+	if ([super hasDataInReadBuffer])
+		return true;
+
+	if (_body != nil) {
+		/* Reading can not block anymore once the body has been read */
+		if ([self OF_bodyIsAtEndOfStream])
+			return true;
+
+		if (_decompressionStream != nil &&
+		    ![_decompressionStream isAtEndOfStream])
+			return [_decompressionStream hasDataInReadBuffer];
+
+		return [_body hasDataInReadBuffer];
+	}
+
+	return [_socket hasDataInReadBuffer];
 }
 
 - (void)close
 {
-	[_socket release];
-	_socket = nil;
+	[self OF_releaseSocket];
 
 	[super close];
 }
 @end
 
-@implementation OFHTTPClient
-@synthesize delegate = _delegate;
-@synthesize insecureRedirectsAllowed = _insecureRedirectsAllowed;
+@implementation OFHTTPClientResponseBody
+- initWithResponse: (OFHTTPClientResponse*)response
+{
+	self = [super init];
 
-+ (instancetype)client
+	/* Not retained, as the response retains the body */
+	_response = response;
+
+	return self;
+}
+
+- (size_t)lowlevelReadIntoBuffer: (void*)buffer
+			  length: (size_t)length
 {
-	return [[[self alloc] init] autorelease];
+	return [_response OF_readBodyIntoBuffer: buffer
+					 length: length];
 }
 
-- (void)dealloc
+- (bool)lowlevelIsAtEndOfStream
 {
-	[self close];
+	return [_response OF_bodyIsAtEndOfStream];
+}
 
-	[super dealloc];
+- (int)fileDescriptorForReading
+{
+	return [_response fileDescriptorForReading];
 }
 
-- (OFHTTPResponse*)performRequest: (OFHTTPRequest*)request
+- (bool)hasDataInReadBuffer
 {
-	return [self performRequest: request
-			  redirects: 10];
+	return ([super hasDataInReadBuffer] ||
+	    [_response OF_bodyHasDataInReadBuffer]);
 }
+@end
 
-- (OFTCPSocket*)OF_closeAndCreateSocketForRequest: (OFHTTPRequest*)request
+@implementation OFHTTPClient_AsyncRequest
+- initWithClient: (OFHTTPClient*)client
+	 request: (OFHTTPRequest*)request
+       redirects: (size_t)redirects
 {
-	OFURL *URL = [request URL];
-	OFTCPSocket *socket;
+	self = [super init];
 
-	[self close];
+	_client = [client retain];
+	_originalRequest = [request retain];
+	_redirects = redirects;
+	_runLoop = [[OFRunLoop currentRunLoop] retain];
 
-	if ([[URL scheme] isEqual: @"https"]) {
-		if (of_tls_socket_class == Nil)
-			@throw [OFUnsupportedProtocolException
-			    exceptionWithURL: URL];
+	return self;
+}
 
-		socket = [[[of_tls_socket_class alloc] init]
-		    autorelease];
-	} else
-		socket = [OFTCPSocket socket];
+#ifdef OF_HAVE_BLOCKS
+- initWithClient: (OFHTTPClient*)client
+	 request: (OFHTTPRequest*)request
+       redirects: (size_t)redirects
+	   block: (of_http_client_async_request_block_t)block
+{
+	self = [self initWithClient: client
+			    request: request
+			  redirects: redirects];
 
-	if ([_delegate respondsToSelector:
-	    @selector(client:didCreateSocket:request:)])
-		[_delegate client: self
-		  didCreateSocket: socket
-			  request: request];
+	_block = [block copy];
+
+	return self;
+}
+#endif
 
-	[socket connectToHost: [URL host]
-			 port: [URL port]];
+- (void)dealloc
+{
+	[_client release];
+	[_originalRequest release];
+	[_request release];
+	[_headers release];
+#ifdef OF_HAVE_BLOCKS
+	[_block release];
+#endif
+	[_runLoop release];
+	[_poolKey release];
+	[_requestData release];
+	[_socket release];
+	[_response release];
+	[_timer release];
 
-	return socket;
+	[super dealloc];
 }
 
-- (OFHTTPResponse*)performRequest: (OFHTTPRequest*)request
-			redirects: (size_t)redirects
+- (OFHTTPRequest*)originalRequest
+{
+	return _originalRequest;
+}
+
+- (void)startRequest: (OFHTTPRequest*)request
 {
 	void *pool = objc_autoreleasePoolPush();
-	OFURL *URL = [request URL];
-	OFString *scheme = [URL scheme];
-	of_http_request_method_t method = [request method];
-	OFMutableString *requestString;
-	OFString *user, *password;
-	OFMutableDictionary OF_GENERIC(OFString*, OFString*) *headers;
-	OFDataArray *body = [request body];
-	OFTCPSocket *socket;
-	OFHTTPClientResponse *response;
-	OFString *line, *version, *redirect, *connectionHeader;
-	bool keepAlive;
-	OFMutableDictionary OF_GENERIC(OFString*, OFString*) *serverHeaders;
-	OFEnumerator *keyEnumerator, *objectEnumerator;
-	OFString *key, *object;
-	int status;
+	OFString *poolKey, *requestString;
+	OFMutableDictionary *headers;
+	OFDataArray *requestData, *body;
+	of_time_interval_t timeout;
 
-	if (![scheme isEqual: @"http"] && ![scheme isEqual: @"https"])
-		@throw [OFUnsupportedProtocolException exceptionWithURL: URL];
+	@try {
+		poolKey = poolKeyForURL([request URL]);
+		headers = [_client OF_headersForRequest: request];
+		requestString = [_client OF_requestStringForRequest: request
+							    headers: headers];
+
+		/* The request is sent with a single write */
+		requestData = [OFDataArray dataArray];
+		[requestData addItems: [requestString UTF8String]
+				count: [requestString UTF8StringLength]];
+
+		if ((body = [request body]) != nil)
+			[requestData addItems: [body items]
+					count: [body count] * [body itemSize]];
+	} @catch (id e) {
+		[self performSelector: @selector(failWithException:)
+			   withObject: e
+			   afterDelay: 0];
+
+		objc_autoreleasePoolPop(pool);
+		return;
+	}
+
+	[_request release];
+	_request = [request retain];
+	[_poolKey release];
+	_poolKey = [poolKey copy];
+	[_headers release];
+	_headers = [headers retain];
+	[_requestData release];
+	_requestData = [requestData retain];
+
+	if ((timeout = [_client timeout]) > 0)
+		_timer = [[OFTimer
+		    scheduledTimerWithTimeInterval: timeout
+					    target: self
+					  selector: @selector(timedOut)
+					   repeats: false] retain];
+
+	/*
+	 * Acquiring a socket is deferred, as an idle socket might still be
+	 * observed by the run loop through the response that released it.
+	 */
+	[self performSelector: @selector(acquireSocket)
+		   afterDelay: 0];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)acquireSocket
+{
+	OFURL *URL = [_request URL];
+	OFTCPSocket *socket;
+
+	if (_finished)
+		return;
+
+	@try {
+		if (![_client OF_acquireSocket: &socket
+				       poolKey: _poolKey
+				  asyncRequest: self])
+			return;
+	} @catch (id e) {
+		[self finishWithResponse: nil
+			       exception: e];
+		return;
+	}
+
+	if (socket != nil) {
+		_socket = [socket retain];
+		_reused = true;
+
+		[self sendRequest];
+		return;
+	}
+
+	_reused = false;
+	_connecting = true;
+
+	@try {
+		_socket = [[_client OF_createSocketForRequest: _request] retain];
+	} @catch (id e) {
+		[self socketDidConnect: nil
+			     exception: e];
+		return;
+	}
+
+#ifdef OF_HAVE_THREADS
+	if (![[URL scheme] isEqual: @"https"]) {
+		[_socket asyncConnectToHost: [URL host]
+				       port: [URL port]
+				     target: self
+				   selector: @selector(socketDidConnect:
+						 exception:)];
+		return;
+	}
+#endif
+
+	@try {
+		[_socket connectToHost: [URL host]
+				  port: [URL port]];
+	} @catch (id e) {
+		[self socketDidConnect: _socket
+			     exception: e];
+		return;
+	}
+
+	[self socketDidConnect: _socket
+		     exception: nil];
+}
+
+- (void)retryAcquiringSocket
+{
+	OFTimer *timer = [OFTimer timerWithTimeInterval: 0
+						 target: self
+					       selector: @selector(
+							     acquireSocket)
+						repeats: false];
+
+	/* This is called by whichever thread released a connection */
+	[_runLoop addTimer: timer];
+}
+
+- (void)socketDidConnect: (OFTCPSocket*)socket
+	       exception: (OFException*)exception
+{
+	_connecting = false;
+
+	if (exception != nil || _finished) {
+		[_client OF_releaseSocket: nil
+				  poolKey: _poolKey
+				 reusable: false];
+		[_socket release];
+		_socket = nil;
+
+		if (exception != nil)
+			[self performSelector: @selector(failWithException:)
+				   withObject: exception
+				   afterDelay: 0];
+
+		return;
+	}
+
+	[_client OF_countCreatedConnection];
+
+	/*
+	 * When connecting asynchronously, this is called while the run loop
+	 * still handles the connection attempt, which used the same file
+	 * descriptor. Like acquiring a socket, sending is therefore deferred.
+	 */
+	[self performSelector: @selector(sendRequest)
+		   afterDelay: 0];
+}
+
+- (void)sendRequest
+{
+	if (_finished)
+		return;
+
+	[_socket asyncWriteBuffer: [_requestData items]
+			   length: [_requestData count]
+			   target: self
+			 selector: @selector(socket:didWriteRequest:
+				       bytesWritten:exception:)];
+}
+
+- (size_t)socket: (OFTCPSocket*)socket
+  didWriteRequest: (const void**)request
+     bytesWritten: (size_t)bytesWritten
+	exception: (OFException*)exception
+{
+	if (_finished)
+		return 0;
+
+	/*
+	 * Everything that closes the socket is deferred until the run loop
+	 * is done with it.
+	 */
+	if (exception != nil) {
+		if (_reused &&
+		    [exception isKindOfClass: [OFWriteFailedException class]] &&
+		    ([(OFWriteFailedException*)exception errNo] ==
+		    ECONNRESET ||
+		    [(OFWriteFailedException*)exception errNo] == EPIPE))
+			[self performSelector: @selector(retryWithNewConnection)
+				   afterDelay: 0];
+		else
+			[self performSelector: @selector(failWithException:)
+				   withObject: exception
+				   afterDelay: 0];
+
+		return 0;
+	}
+
+	of_http_parser_init(&_parser, true);
+
+	[OFRunLoop OF_addAsyncFillReadBufferForStream: socket
+						target: self
+					      selector: @selector(
+							    parseResponseFromSocket:
+							    exception:)];
+
+	return 0;
+}
+
+- (bool)parseResponseFromSocket: (OFTCPSocket*)socket
+		      exception: (OFException*)exception
+{
+	OFHTTPClientResponse *response;
+
+	if (_finished)
+		return false;
+
+	if (exception != nil) {
+		[self performSelector: @selector(failWithException:)
+			   withObject: exception
+			   afterDelay: 0];
+		return false;
+	}
+
+	switch (of_http_parser_parse(&_parser, [socket OF_readBuffer],
+	    [socket OF_readBufferLength])) {
+	case OF_HTTP_PARSER_INCOMPLETE:
+		if (![socket lowlevelIsAtEndOfStream]) {
+			[socket OF_setWaitingForDelimiter: true];
+			return true;
+		}
 
-	/* Can we reuse the socket? */
-	if (_socket != nil && [[_lastURL scheme] isEqual: scheme] &&
-	    [[_lastURL host] isEqual: [URL host]] &&
-	    [_lastURL port] == [URL port]) {
 		/*
-		 * Set _socket to nil, so that in case of an error it won't be
-		 * reused. If everything is successfull, we set _socket again
-		 * at the end.
+		 * The server closed the idle connection after it passed the
+		 * health check, so try again with another one.
 		 */
-		socket = [_socket autorelease];
+		if (_reused && [socket OF_readBufferLength] == 0)
+			[self performSelector: @selector(retryWithNewConnection)
+				   afterDelay: 0];
+		else
+			[self performSelector: @selector(failWithException:)
+				   withObject: [OFInvalidServerReplyException
+						   exception]
+				   afterDelay: 0];
+
+		return false;
+	case OF_HTTP_PARSER_DONE:
+		break;
+	default:
+		[self performSelector: @selector(failWithException:)
+			   withObject: [OFInvalidServerReplyException exception]
+			   afterDelay: 0];
+		return false;
+	}
+
+	[socket OF_setWaitingForDelimiter: false];
+
+	@try {
+		response = [_client OF_responseForRequest: _request
+						   socket: socket
+						  poolKey: _poolKey
+						   parser: &_parser];
+	} @catch (id e) {
+		/* The socket has been released to the client already */
+		[_socket autorelease];
 		_socket = nil;
 
-		[_lastURL release];
-		_lastURL = nil;
+		[self performSelector: @selector(failWithException:)
+			   withObject: e
+			   afterDelay: 0];
+		return false;
+	}
+
+	/* From here on, the response takes care of the socket. */
+	_response = [response retain];
+	[_socket release];
+	_socket = nil;
+
+	/*
+	 * Reading the body asynchronously must not start before the run loop
+	 * stopped observing the socket, which only happens once this returns,
+	 * as both share the same file descriptor.
+	 */
+	[self performSelector: @selector(deliverResponse)
+		   afterDelay: 0];
+
+	return false;
+}
+
+- (void)retryWithNewConnection
+{
+	if (_finished)
+		return;
+
+	[self closeConnection];
+	[self acquireSocket];
+}
+
+- (void)deliverResponse
+{
+	OFHTTPResponse *response;
+	OFHTTPRequest *redirect;
+
+	if (_finished)
+		return;
+
+	response = [_response autorelease];
+	_response = nil;
+
+	[_timer invalidate];
+	[_timer release];
+	_timer = nil;
+
+	@try {
+		redirect = [_client OF_redirectForRequest: _request
+						  headers: _headers
+						 response: response
+						redirects: _redirects];
+	} @catch (id e) {
+		[response close];
+		[self finishWithResponse: nil
+			       exception: e];
+		return;
+	}
+
+	if (redirect != nil) {
+		/*
+		 * Unlike with synchronous requests, the rest of the body is not
+		 * read, so the connection is only reused if there is none.
+		 */
+		[response close];
+
+		_redirects--;
+		[self startRequest: redirect];
+		return;
+	}
+
+	if ([response statusCode] / 100 != 2) {
+		[self finishWithResponse: nil
+			       exception: [OFHTTPRequestFailedException
+					      exceptionWithRequest: _request
+							  response: response]];
+		return;
+	}
+
+	[self finishWithResponse: response
+		       exception: nil];
+}
+
+- (void)timedOut
+{
+	OFURL *URL = [_request URL];
+
+	if (_finished)
+		return;
+
+	[self finishWithResponse: nil
+		       exception: [OFConnectionFailedException
+				      exceptionWithHost: [URL host]
+						   port: [URL port]
+						 socket: _socket
+						  errNo: ETIMEDOUT]];
+}
+
+- (void)failWithException: (OFException*)exception
+{
+	if (_finished)
+		return;
+
+	[self finishWithResponse: nil
+		       exception: exception];
+}
+
+- (void)finishWithResponse: (OFHTTPResponse*)response
+		 exception: (OFException*)exception
+{
+	id <OFHTTPClientDelegate> delegate;
+
+	[[self retain] autorelease];
+
+	_finished = true;
+
+	[_timer invalidate];
+	[self closeConnection];
+	[_client OF_removeAsyncRequest: self];
+
+#ifdef OF_HAVE_BLOCKS
+	if (_block != NULL) {
+		_block(_client, _originalRequest, response, exception);
+		return;
+	}
+#endif
+
+	delegate = [_client delegate];
+
+	if (exception == nil) {
+		if ([delegate respondsToSelector:
+		    @selector(client:didPerformRequest:response:)])
+			[delegate     client: _client
+			   didPerformRequest: _originalRequest
+				    response: response];
+	} else {
+		if ([delegate respondsToSelector:
+		    @selector(client:didFailWithException:request:)])
+			[delegate	 client: _client
+			   didFailWithException: exception
+					request: _originalRequest];
+	}
+}
+
+/*
+ * Gives up the connection without reusing it. While connecting, this is left
+ * to socketDidConnect:exception:.
+ */
+- (void)closeConnection
+{
+	if (_socket != nil && !_connecting) {
+		OFTCPSocket *socket = _socket;
+
+		_socket = nil;
 
 		@try {
-			if (!_lastWasHEAD) {
-				/*
-				 * Throw away content that has not been read
-				 * yet.
-				 */
-				while (![_lastResponse isAtEndOfStream]) {
-					char buffer[512];
-
-					[_lastResponse readIntoBuffer: buffer
-							       length: 512];
-				}
-			}
+			[socket cancelAsyncRequests];
+			[socket close];
+			[_client OF_releaseSocket: socket
+					  poolKey: _poolKey
+					 reusable: false];
 		} @finally {
-			[_lastResponse release];
-			_lastResponse = nil;
+			[socket release];
 		}
-	} else
-		socket = [self OF_closeAndCreateSocketForRequest: request];
+	}
+
+	if (_response != nil) {
+		[_response close];
+		[_response release];
+		_response = nil;
+	}
+}
+
+- (void)cancel
+{
+	if (_finished)
+		return;
+
+	[[self retain] autorelease];
+
+	_finished = true;
+
+	[_timer invalidate];
+	[self closeConnection];
+	[_client OF_removeAsyncRequest: self];
+}
+@end
+
+@implementation OFHTTPClient
+@synthesize delegate = _delegate;
+@synthesize insecureRedirectsAllowed = _insecureRedirectsAllowed;
+@synthesize maxIdleConnectionsPerHost = _maxIdleConnectionsPerHost;
+@synthesize maxConnectionsPerHost = _maxConnectionsPerHost;
+@synthesize idleTimeout = _idleTimeout, timeout = _timeout;
+@synthesize decompressesResponses = _decompressesResponses;
+
++ (instancetype)client
+{
+	return [[[self alloc] init] autorelease];
+}
+
+- init
+{
+	self = [super init];
+
+	@try {
+		_pools = [[OFMutableDictionary alloc] init];
+		_asyncRequests = [[OFMutableArray alloc] init];
+		_waitingRequests = [[OFMutableArray alloc] init];
+#ifdef OF_HAVE_THREADS
+		_condition = [[OFCondition alloc] init];
+#endif
+		_maxIdleConnectionsPerHost = 4;
+		_maxConnectionsPerHost = SIZE_MAX;
+		_idleTimeout = 10;
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	if (_pools != nil)
+		[self close];
+
+	[_pools release];
+	[_asyncRequests release];
+	[_waitingRequests release];
+#ifdef OF_HAVE_THREADS
+	[_condition release];
+#endif
+
+	[super dealloc];
+}
+
+- (of_http_client_statistics_t)statistics
+{
+	of_http_client_statistics_t statistics;
+
+#ifdef OF_HAVE_THREADS
+	[_condition lock];
+	@try {
+#endif
+		statistics = _statistics;
+		statistics.activeConnections = 0;
+		statistics.idleConnections = 0;
+
+		for (OFHTTPClient_Pool *pool in [_pools allObjects]) {
+			statistics.activeConnections +=
+			    pool->_activeConnections;
+			statistics.idleConnections +=
+			    [pool->_idleSockets count];
+		}
+#ifdef OF_HAVE_THREADS
+	} @finally {
+		[_condition unlock];
+	}
+#endif
+
+	return statistics;
+}
+
+- (OFHTTPResponse*)performRequest: (OFHTTPRequest*)request
+{
+	return [self performRequest: request
+			  redirects: 10];
+}
+
+- (void)OF_evictIdleConnectionsInPool: (OFHTTPClient_Pool*)pool
+{
+	of_time_interval_t now = [[OFDate date] timeIntervalSince1970];
+	const of_time_interval_t *idleSince = [pool->_idleSince items];
+	size_t count = [pool->_idleSince count], expired = 0;
+
+	while (expired < count && now - idleSince[expired] >= _idleTimeout)
+		[[pool->_idleSockets objectAtIndex: expired++] close];
+
+	[pool->_idleSockets removeObjectsInRange: of_range(0, expired)];
+	[pool->_idleSince removeItemsInRange: of_range(0, expired)];
+
+	_statistics.connectionsEvicted += expired;
+}
+
+
+/* Must be called with the lock held. */
+- (bool)OF_tryAcquireSocket: (OFTCPSocket**)socket
+		    poolKey: (OFString*)poolKey
+{
+	OFHTTPClient_Pool *pool = [_pools objectForKey: poolKey];
+	OFTCPSocket *idleSocket;
+
+	if (pool == nil) {
+		pool = [[[OFHTTPClient_Pool alloc] init] autorelease];
+		[_pools setObject: pool
+			   forKey: poolKey];
+	}
+
+	[self OF_evictIdleConnectionsInPool: pool];
 
 	/*
-	 * As a work around for a bug with split packets in lighttpd when using
-	 * HTTPS, we construct the complete request in a buffer string and then
-	 * send it all at once.
+	 * The connection that was idle for the shortest time is the least
+	 * likely to have been closed by the server.
 	 */
+	while ((idleSocket = [pool->_idleSockets lastObject]) != nil) {
+		[[idleSocket retain] autorelease];
+		[pool->_idleSockets removeLastObject];
+		[pool->_idleSince removeLastItem];
 
-	if ([URL query] != nil)
-		requestString = [OFMutableString stringWithFormat:
-		    @"%s %@?%@ HTTP/%@\r\n",
-		    of_http_request_method_to_string(method), [URL path],
-		    [[URL query] stringByURLEncoding],
-		    [request protocolVersionString]];
-	else
-		requestString = [OFMutableString stringWithFormat:
-		    @"%s %@ HTTP/%@\r\n",
-		    of_http_request_method_to_string(method), [URL path],
-		    [request protocolVersionString]];
+		if (isConnectionHealthy(idleSocket))
+			break;
+
+		[idleSocket close];
+		_statistics.connectionsEvicted++;
+	}
+
+	if (idleSocket == nil &&
+	    pool->_activeConnections >= _maxConnectionsPerHost)
+		return false;
+
+	pool->_activeConnections++;
+
+	if (idleSocket != nil)
+		_statistics.connectionsReused++;
+
+	*socket = idleSocket;
+	return true;
+}
+
+- (OFTCPSocket*)OF_socketForRequest: (OFHTTPRequest*)request
+			    poolKey: (OFString*)poolKey
+			     reused: (bool*)reused
+{
+	OFURL *URL = [request URL];
+	OFTCPSocket *socket = nil;
+
+#ifdef OF_HAVE_THREADS
+	[_condition lock];
+	@try {
+#endif
+		while (![self OF_tryAcquireSocket: &socket
+					  poolKey: poolKey]) {
+#ifdef OF_HAVE_THREADS
+			[_condition wait];
+#else
+			@throw [OFOutOfRangeException exception];
+#endif
+		}
+#ifdef OF_HAVE_THREADS
+	} @finally {
+		[_condition unlock];
+	}
+#endif
+
+	*reused = (socket != nil);
+	if (socket != nil)
+		return socket;
+
+	@try {
+		socket = [self OF_createSocketForRequest: request];
+		[socket connectToHost: [URL host]
+				 port: [URL port]];
+	} @catch (id e) {
+		[self OF_releaseSocket: nil
+			       poolKey: poolKey
+			      reusable: false];
+		@throw e;
+	}
+
+	[self OF_countCreatedConnection];
+
+	return socket;
+}
+
+/*
+ * Like OF_socketForRequest:poolKey:reused:, but never blocks and never
+ * connects. If the limit of connections is reached, the asynchronous request
+ * is told to try again once a connection has been released. Otherwise, the
+ * socket is set to an idle socket or nil if a new one needs to be created.
+ */
+- (bool)OF_acquireSocket: (OFTCPSocket**)socket
+		 poolKey: (OFString*)poolKey
+	    asyncRequest: (OFHTTPClient_AsyncRequest*)asyncRequest
+{
+	bool acquired;
+
+#ifdef OF_HAVE_THREADS
+	[_condition lock];
+	@try {
+#endif
+		acquired = [self OF_tryAcquireSocket: socket
+					     poolKey: poolKey];
+
+		if (!acquired)
+			[_waitingRequests addObject: asyncRequest];
+#ifdef OF_HAVE_THREADS
+	} @finally {
+		[_condition unlock];
+	}
+#endif
+
+	return acquired;
+}
+
+- (void)OF_countCreatedConnection
+{
+#ifdef OF_HAVE_THREADS
+	[_condition lock];
+#endif
+	_statistics.connectionsCreated++;
+#ifdef OF_HAVE_THREADS
+	[_condition unlock];
+#endif
+}
+
+- (void)OF_releaseSocket: (OFTCPSocket*)socket
+		 poolKey: (OFString*)poolKey
+		reusable: (bool)reusable
+{
+	OFArray OF_GENERIC(OFHTTPClient_AsyncRequest*) *waitingRequests = nil;
+
+#ifdef OF_HAVE_THREADS
+	[_condition lock];
+	@try {
+#endif
+		OFHTTPClient_Pool *pool = [_pools objectForKey: poolKey];
+
+		OF_ENSURE(pool != nil && pool->_activeConnections > 0);
+
+		pool->_activeConnections--;
+
+		if (socket != nil && reusable &&
+		    _maxIdleConnectionsPerHost > 0) {
+			of_time_interval_t now =
+			    [[OFDate date] timeIntervalSince1970];
+
+			[self OF_evictIdleConnectionsInPool: pool];
+
+			if ([pool->_idleSockets count] >=
+			    _maxIdleConnectionsPerHost) {
+				[[pool->_idleSockets firstObject] close];
+				[pool->_idleSockets removeObjectAtIndex: 0];
+				[pool->_idleSince removeItemAtIndex: 0];
+				_statistics.connectionsEvicted++;
+			}
+
+			[pool->_idleSockets addObject: socket];
+			[pool->_idleSince addItem: &now];
+		}
+
+		if (pool->_activeConnections == 0 &&
+		    [pool->_idleSockets count] == 0)
+			[_pools removeObjectForKey: poolKey];
+
+		if ([_waitingRequests count] > 0) {
+			waitingRequests = [[_waitingRequests copy] autorelease];
+			[_waitingRequests removeAllObjects];
+		}
+
+#ifdef OF_HAVE_THREADS
+		/* Waiting threads might wait for different hosts */
+		[_condition broadcast];
+	} @finally {
+		[_condition unlock];
+	}
+#endif
+
+	/* Waiting requests might wait for different hosts as well */
+	for (OFHTTPClient_AsyncRequest *asyncRequest in waitingRequests)
+		[asyncRequest retryAcquiringSocket];
+}
+
+- (OFTCPSocket*)OF_createSocketForRequest: (OFHTTPRequest*)request
+{
+	OFURL *URL = [request URL];
+	OFTCPSocket *socket;
+
+	if ([[URL scheme] isEqual: @"https"]) {
+		if (of_tls_socket_class == Nil)
+			@throw [OFUnsupportedProtocolException
+			    exceptionWithURL: URL];
+
+		socket = [[[of_tls_socket_class alloc] init]
+		    autorelease];
+	} else
+		socket = [OFTCPSocket socket];
+
+	if ([_delegate respondsToSelector:
+	    @selector(client:didCreateSocket:request:)])
+		[_delegate client: self
+		  didCreateSocket: socket
+			  request: request];
+
+	return socket;
+}
+
+- (OFMutableDictionary OF_GENERIC(OFString*, OFString*)*)OF_headersForRequest:
+    (OFHTTPRequest*)request
+{
+	OFURL *URL = [request URL];
+	OFString *scheme = [URL scheme];
+	OFMutableDictionary OF_GENERIC(OFString*, OFString*) *headers;
+	OFDataArray *body = [request body];
+	OFString *user, *password;
 
 	headers = [[[request headers] mutableCopy] autorelease];
 	if (headers == nil)
@@ -430,6 +1647,11 @@ normalizeKey(char *str_)
 				    @"<https://heap.zone/objfw>"
 			    forKey: @"User-Agent"];
 
+	if (_decompressesResponses &&
+	    [headers objectForKey: @"Accept-Encoding"] == nil)
+		[headers setObject: @"gzip, deflate"
+			    forKey: @"Accept-Encoding"];
+
 	if (body != nil) {
 		if ([headers objectForKey: @"Content-Length"] == nil) {
 			OFString *contentLength = [OFString stringWithFormat:
@@ -451,6 +1673,37 @@ normalizeKey(char *str_)
 		[headers setObject: @"keep-alive"
 			    forKey: @"Connection"];
 
+	return headers;
+}
+
+- (OFString*)OF_requestStringForRequest: (OFHTTPRequest*)request
+				headers: (OFDictionary OF_GENERIC(OFString*,
+					     OFString*)*)headers
+{
+	OFURL *URL = [request URL];
+	of_http_request_method_t method = [request method];
+	OFMutableString *requestString;
+	OFEnumerator *keyEnumerator, *objectEnumerator;
+	OFString *key, *object;
+
+	/*
+	 * As a work around for a bug with split packets in lighttpd when using
+	 * HTTPS, we construct the complete request in a buffer string and then
+	 * send it all at once.
+	 */
+
+	if ([URL query] != nil)
+		requestString = [OFMutableString stringWithFormat:
+		    @"%s %@?%@ HTTP/%@\r\n",
+		    of_http_request_method_to_string(method), [URL path],
+		    [[URL query] stringByURLEncoding],
+		    [request protocolVersionString]];
+	else
+		requestString = [OFMutableString stringWithFormat:
+		    @"%s %@ HTTP/%@\r\n",
+		    of_http_request_method_to_string(method), [URL path],
+		    [request protocolVersionString]];
+
 	keyEnumerator = [headers keyEnumerator];
 	objectEnumerator = [headers objectEnumerator];
 
@@ -460,241 +1713,270 @@ normalizeKey(char *str_)
 
 	[requestString appendString: @"\r\n"];
 
-	@try {
-		[socket writeString: requestString];
-	} @catch (OFWriteFailedException *e) {
-		if ([e errNo] != ECONNRESET && [e errNo] != EPIPE)
-			@throw e;
-
-		/* Reconnect in case a keep-alive connection timed out */
-		socket = [self OF_closeAndCreateSocketForRequest: request];
-		[socket writeString: requestString];
-	}
+	return requestString;
+}
 
-	if (body != nil)
-		[socket writeBuffer: [body items]
-			     length: [body count] * [body itemSize]];
+/*
+ * Creates the response from the head parsed from the socket's read buffer. If
+ * this throws, the socket has been released already.
+ */
+- (OFHTTPClientResponse*)OF_responseForRequest: (OFHTTPRequest*)request
+					socket: (OFTCPSocket*)socket
+				       poolKey: (OFString*)poolKey
+					parser: (of_http_parser_t*)parser
+{
+	of_http_request_method_t method = [request method];
+	const char *head = [socket OF_readBuffer];
+	OFDictionary OF_GENERIC(OFString*, OFString*) *serverHeaders;
+	OFHTTPClientResponse *response;
+	bool keepAlive;
+	int status;
 
 	@try {
-		line = [socket readLine];
-	} @catch (OFInvalidEncodingException *e) {
-		@throw [OFInvalidServerReplyException exception];
+		if (parser->major != 1 || parser->minor > 1)
+			@throw [OFUnsupportedVersionException
+			    exceptionWithVersion: [OFString stringWithFormat:
+						      @"%u.%u", parser->major,
+						      parser->minor]];
+
+		status = parser->statusCode;
+		serverHeaders = of_http_parser_headers(parser, head);
+
+		if (parser->minor > 0)
+			keepAlive = !of_http_parser_has_token(parser, head,
+			    OF_HTTP_HEADER_CONNECTION, "close");
+		else
+			keepAlive = of_http_parser_has_token(parser, head,
+			    OF_HTTP_HEADER_CONNECTION, "keep-alive");
+
+		[socket OF_consumeReadBuffer: parser->length];
+
+		response = [[[OFHTTPClientResponse alloc]
+		    initWithSocket: socket
+			    client: self
+			   poolKey: poolKey] autorelease];
+	} @catch (id e) {
+		[self OF_releaseSocket: socket
+			       poolKey: poolKey
+			      reusable: false];
+		@throw e;
 	}
 
-	/*
-	 * It's possible that the write succeeds on a connection that is
-	 * keep-alive, but the connection has already been closed by the remote
-	 * end due to a timeout. In this case, we need to reconnect.
-	 */
-	if (line == nil) {
-		socket = [self OF_closeAndCreateSocketForRequest: request];
-		[socket writeString: requestString];
-
-		if (body != nil)
-			[socket writeBuffer: [body items]
-				     length: [body count] *
-					     [body itemSize]];
+	/* From here on, the response takes care of the socket. */
+	[response OF_setKeepAlive: keepAlive];
+	[response setProtocolVersion:
+	    (of_http_request_protocol_version_t){ 1, parser->minor }];
+	[response setStatusCode: status];
+	[response setHeaders: serverHeaders];
+	[response OF_setHasBody: (method != OF_HTTP_REQUEST_METHOD_HEAD &&
+	    status / 100 != 1 && status != 204 && status != 304)];
 
-		@try {
-			line = [socket readLine];
-		} @catch (OFInvalidEncodingException *e) {
-			@throw [OFInvalidServerReplyException exception];
-		}
-	}
+	if (_decompressesResponses)
+		[response OF_decompressBody];
 
-	if (![line hasPrefix: @"HTTP/"] || [line length] < 9 ||
-	    [line characterAtIndex: 8] != ' ')
-		@throw [OFInvalidServerReplyException exception];
+	if ([_delegate respondsToSelector:
+	    @selector(client:didReceiveHeaders:statusCode:request:)])
+		[_delegate     client: self
+		    didReceiveHeaders: serverHeaders
+			   statusCode: status
+			      request: request];
 
-	version = [line substringWithRange: of_range(5, 3)];
-	if (![version isEqual: @"1.0"] && ![version isEqual: @"1.1"])
-		@throw [OFUnsupportedVersionException
-		    exceptionWithVersion: version];
+	return response;
+}
 
-	status = (int)[[line substringWithRange: of_range(9, 3)] decimalValue];
+/*
+ * Returns the request to perform next if the response is a redirect that
+ * should be followed and nil otherwise.
+ */
+- (OFHTTPRequest*)OF_redirectForRequest: (OFHTTPRequest*)request
+				headers: (OFDictionary OF_GENERIC(OFString*,
+					     OFString*)*)headers
+			       response: (OFHTTPResponse*)response
+			      redirects: (size_t)redirects
+{
+	OFURL *URL = [request URL];
+	of_http_request_method_t method = [request method];
+	int status = [response statusCode];
+	OFString *redirect;
+	OFURL *newURL;
+	OFHTTPRequest *newRequest;
+	OFMutableDictionary *newHeaders;
+	bool follow;
 
-	serverHeaders = [OFMutableDictionary dictionary];
+	/* FIXME: Case-insensitive check of redirect's scheme */
+	if (redirects == 0 || (status != 301 && status != 302 &&
+	    status != 303 && status != 307) ||
+	    (redirect = [[response headers] objectForKey: @"Location"]) ==
+	    nil || (!_insecureRedirectsAllowed &&
+	    ![[URL scheme] isEqual: @"http"] &&
+	    ![redirect hasPrefix: @"https://"]))
+		return nil;
+
+	newURL = [OFURL URLWithString: redirect
+			relativeToURL: URL];
+
+	if ([_delegate respondsToSelector: @selector(client:
+	    shouldFollowRedirect:statusCode:request:response:)])
+		follow = [_delegate client: self
+		      shouldFollowRedirect: newURL
+				statusCode: status
+				   request: request
+				  response: response];
+	else {
+		/*
+		 * 301, 302 and 307 should only redirect with user
+		 * confirmation if the request method is not GET or HEAD.
+		 * Asking the delegate and getting true returned is considered
+		 * user confirmation.
+		 */
+		if (method == OF_HTTP_REQUEST_METHOD_GET ||
+		    method == OF_HTTP_REQUEST_METHOD_HEAD)
+			follow = true;
+		/*
+		 * 303 should always be redirected and converted to a GET
+		 * request.
+		 */
+		else if (status == 303)
+			follow = true;
+		else
+			follow = false;
+	}
 
-	for (;;) {
-		OFString *key, *value, *old;
-		const char *lineC, *tmp;
-		char *keyC;
+	if (!follow)
+		return nil;
 
-		@try {
-			line = [socket readLine];
-		} @catch (OFInvalidEncodingException *e) {
-			@throw [OFInvalidServerReplyException exception];
-		}
+	newRequest = [[request copy] autorelease];
+	newHeaders = [[headers mutableCopy] autorelease];
 
-		if (line == nil)
-			@throw [OFInvalidServerReplyException exception];
+	if (![[newURL host] isEqual: [URL host]])
+		[newHeaders removeObjectForKey: @"Host"];
 
-		if ([line length] == 0)
-			break;
+	/*
+	 * 303 means the request should be converted to a GET request before
+	 * redirection. This also means stripping the entity of the request.
+	 */
+	if (status == 303) {
+		OFEnumerator *keyEnumerator, *objectEnumerator;
+		id key, object;
+
+		keyEnumerator = [headers keyEnumerator];
+		objectEnumerator = [headers objectEnumerator];
+		while ((key = [keyEnumerator nextObject]) != nil &&
+		    (object = [objectEnumerator nextObject]) != nil)
+			if ([key hasPrefix: @"Content-"])
+				[newHeaders removeObjectForKey: key];
+
+		[newRequest setMethod: OF_HTTP_REQUEST_METHOD_GET];
+		[newRequest setBody: nil];
+	}
 
-		lineC = [line UTF8String];
+	[newRequest setURL: newURL];
+	[newRequest setHeaders: newHeaders];
 
-		if ((tmp = strchr(lineC, ':')) == NULL)
-			@throw [OFInvalidServerReplyException exception];
+	return newRequest;
+}
 
-		if ((keyC = malloc(tmp - lineC + 1)) == NULL)
-			@throw [OFOutOfMemoryException
-			    exceptionWithRequestedSize: tmp - lineC + 1];
+- (OFHTTPResponse*)performRequest: (OFHTTPRequest*)request
+			redirects: (size_t)redirects
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFDataArray *body = [request body];
+	OFMutableDictionary OF_GENERIC(OFString*, OFString*) *headers;
+	OFString *poolKey, *requestString;
+	OFTCPSocket *socket;
+	OFHTTPClientResponse *response;
+	OFHTTPRequest *redirect;
+	of_http_parser_t parser;
 
-		memcpy(keyC, lineC, tmp - lineC);
-		keyC[tmp - lineC] = '\0';
-		normalizeKey(keyC);
+	poolKey = poolKeyForURL([request URL]);
+	headers = [self OF_headersForRequest: request];
+	requestString = [self OF_requestStringForRequest: request
+						 headers: headers];
 
-		@try {
-			key = [OFString stringWithUTF8StringNoCopy: keyC
-						      freeWhenDone: true];
-		} @catch (id e) {
-			free(keyC);
-			@throw e;
-		}
+	for (;;) {
+		bool reused;
 
-		do {
-			tmp++;
-		} while (*tmp == ' ');
+		socket = [self OF_socketForRequest: request
+					   poolKey: poolKey
+					    reused: &reused];
 
-		value = [OFString stringWithUTF8String: tmp];
+		@try {
+			[socket writeString: requestString];
 
-		old = [serverHeaders objectForKey: key];
-		if (old != nil)
-			value = [old stringByAppendingFormat: @",%@", value];
+			if (body != nil)
+				[socket writeBuffer: [body items]
+					     length: [body count] *
+						     [body itemSize]];
 
-		[serverHeaders setObject: value
-				  forKey: key];
-	}
+			if (readResponseHead(socket, &parser))
+				break;
 
-	[serverHeaders makeImmutable];
+			if (!reused)
+				@throw [OFInvalidServerReplyException
+				    exception];
+		} @catch (OFWriteFailedException *e) {
+			[self OF_releaseSocket: socket
+				       poolKey: poolKey
+				      reusable: false];
 
-	if ([_delegate respondsToSelector:
-	    @selector(client:didReceiveHeaders:statusCode:request:)])
-		[_delegate     client: self
-		    didReceiveHeaders: serverHeaders
-			   statusCode: status
-			      request: request];
+			if (!reused ||
+			    ([e errNo] != ECONNRESET && [e errNo] != EPIPE))
+				@throw e;
 
-	response = [[[OFHTTPClientResponse alloc] initWithSocket: socket]
-	    autorelease];
-	[response setProtocolVersionFromString: version];
-	[response setStatusCode: status];
-	[response setHeaders: serverHeaders];
+			continue;
+		} @catch (id e) {
+			[self OF_releaseSocket: socket
+				       poolKey: poolKey
+				      reusable: false];
+			@throw e;
+		}
 
-	connectionHeader = [serverHeaders objectForKey: @"Connection"];
-	if ([version isEqual: @"1.1"]) {
-		if (connectionHeader != nil)
-			keepAlive = ([connectionHeader caseInsensitiveCompare:
-			    @"close"] != OF_ORDERED_SAME);
-		else
-			keepAlive = true;
-	} else {
-		if (connectionHeader != nil)
-			keepAlive = ([connectionHeader caseInsensitiveCompare:
-			    @"keep-alive"] == OF_ORDERED_SAME);
-		else
-			keepAlive = false;
+		/*
+		 * The server closed the idle connection after it passed the
+		 * health check, so try again with another one.
+		 */
+		[self OF_releaseSocket: socket
+			       poolKey: poolKey
+			      reusable: false];
 	}
 
-	if (keepAlive) {
-		[response OF_setKeepAlive: true];
+	response = [self OF_responseForRequest: request
+					socket: socket
+				       poolKey: poolKey
+					parser: &parser];
 
-		_socket = [socket retain];
-		_lastURL = [URL copy];
-		_lastWasHEAD = (method == OF_HTTP_REQUEST_METHOD_HEAD);
-		_lastResponse = [response retain];
-	}
+	redirect = [self OF_redirectForRequest: request
+				       headers: headers
+				      response: response
+				     redirects: redirects];
 
-	/* FIXME: Case-insensitive check of redirect's scheme */
-	if (redirects > 0 && (status == 301 || status == 302 ||
-	    status == 303 || status == 307) &&
-	    (redirect = [serverHeaders objectForKey: @"Location"]) != nil &&
-	    (_insecureRedirectsAllowed || [scheme isEqual: @"http"] ||
-	    [redirect hasPrefix: @"https://"])) {
-		OFURL *newURL;
-		bool follow;
-
-		newURL = [OFURL URLWithString: redirect
-				relativeToURL: URL];
-
-		if ([_delegate respondsToSelector: @selector(client:
-		    shouldFollowRedirect:statusCode:request:response:)])
-			follow = [_delegate client: self
-			      shouldFollowRedirect: newURL
-					statusCode: status
-					   request: request
-					  response: response];
-		else {
-			/*
-			 * 301, 302 and 307 should only redirect with user
-			 * confirmation if the request method is not GET or
-			 * HEAD. Asking the delegate and getting true returned
-			 * is considered user confirmation.
-			 */
-			if (method == OF_HTTP_REQUEST_METHOD_GET ||
-			    method == OF_HTTP_REQUEST_METHOD_HEAD)
-				follow = true;
-			/*
-			 * 303 should always be redirected and converted to a
-			 * GET request.
-			 */
-			else if (status == 303)
-				follow = true;
-			else
-				follow = false;
-		}
+	if (redirect != nil) {
+		/*
+		 * Read what is left of the body, so that the connection can be
+		 * reused.
+		 */
+		if ([response OF_isKeepAlive]) {
+			while (![response isAtEndOfStream]) {
+				char buffer[512];
 
-		if (follow) {
-			OFHTTPRequest *newRequest =
-			    [[request copy] autorelease];
-			OFMutableDictionary *newHeaders =
-			    [[headers mutableCopy] autorelease];
-
-			if (![[newURL host] isEqual: [URL host]])
-				[newHeaders removeObjectForKey: @"Host"];
-
-			/*
-			 * 303 means the request should be converted to a GET
-			 * request before redirection. This also means stripping
-			 * the entity of the request.
-			 */
-			if (status == 303) {
-				OFEnumerator *keyEnumerator, *objectEnumerator;
-				id key, object;
-
-				keyEnumerator = [headers keyEnumerator];
-				objectEnumerator = [headers objectEnumerator];
-				while ((key = [keyEnumerator nextObject]) !=
-				    nil &&
-				    (object = [objectEnumerator nextObject]) !=
-				    nil)
-					if ([key hasPrefix: @"Content-"])
-						[newHeaders
-						    removeObjectForKey: key];
-
-				[newRequest setMethod:
-				    OF_HTTP_REQUEST_METHOD_GET];
-				[newRequest setBody: nil];
+				[response readIntoBuffer: buffer
+						  length: 512];
 			}
+		}
 
-			[newRequest setURL: newURL];
-			[newRequest setHeaders: newHeaders];
-
-			[newRequest retain];
-			objc_autoreleasePoolPop(pool);
-			[newRequest autorelease];
+		[redirect retain];
+		objc_autoreleasePoolPop(pool);
+		[redirect autorelease];
 
-			return [self performRequest: newRequest
-					  redirects: redirects - 1];
-		}
+		return [self performRequest: redirect
+				  redirects: redirects - 1];
 	}
 
 	[response retain];
 	objc_autoreleasePoolPop(pool);
 	[response autorelease];
 
-	if (status / 100 != 2)
+	if ([response statusCode] / 100 != 2)
 		@throw [OFHTTPRequestFailedException
 		    exceptionWithRequest: request
 				response: response];
@@ -702,16 +1984,128 @@ normalizeKey(char *str_)
 	return response;
 }
 
+- (void)asyncPerformRequest: (OFHTTPRequest*)request
+{
+	[self asyncPerformRequest: request
+			redirects: 10];
+}
+
+- (void)asyncPerformRequest: (OFHTTPRequest*)request
+		  redirects: (size_t)redirects
+{
+	OFHTTPClient_AsyncRequest *asyncRequest;
+
+	asyncRequest = [[[OFHTTPClient_AsyncRequest alloc]
+	    initWithClient: self
+		   request: request
+		 redirects: redirects] autorelease];
+
+	[self OF_asyncPerformRequest: asyncRequest];
+}
+
+#ifdef OF_HAVE_BLOCKS
+- (void)asyncPerformRequest: (OFHTTPRequest*)request
+		      block: (of_http_client_async_request_block_t)block
+{
+	[self asyncPerformRequest: request
+			redirects: 10
+			    block: block];
+}
+
+- (void)asyncPerformRequest: (OFHTTPRequest*)request
+		  redirects: (size_t)redirects
+		      block: (of_http_client_async_request_block_t)block
+{
+	OFHTTPClient_AsyncRequest *asyncRequest;
+
+	asyncRequest = [[[OFHTTPClient_AsyncRequest alloc]
+	    initWithClient: self
+		   request: request
+		 redirects: redirects
+		     block: block] autorelease];
+
+	[self OF_asyncPerformRequest: asyncRequest];
+}
+#endif
+
+- (void)OF_asyncPerformRequest: (OFHTTPClient_AsyncRequest*)asyncRequest
+{
+	/* Keeps the request alive until it finished or has been cancelled */
+#ifdef OF_HAVE_THREADS
+	[_condition lock];
+	@try {
+#endif
+		[_asyncRequests addObject: asyncRequest];
+#ifdef OF_HAVE_THREADS
+	} @finally {
+		[_condition unlock];
+	}
+#endif
+
+	[asyncRequest startRequest: [asyncRequest originalRequest]];
+}
+
+- (void)OF_removeAsyncRequest: (OFHTTPClient_AsyncRequest*)asyncRequest
+{
+#ifdef OF_HAVE_THREADS
+	[_condition lock];
+	@try {
+#endif
+		[_waitingRequests removeObjectIdenticalTo: asyncRequest];
+		[_asyncRequests removeObjectIdenticalTo: asyncRequest];
+#ifdef OF_HAVE_THREADS
+	} @finally {
+		[_condition unlock];
+	}
+#endif
+}
+
+- (void)cancelAsyncRequest: (OFHTTPRequest*)request
+{
+	OFHTTPClient_AsyncRequest *asyncRequest = nil;
+
+#ifdef OF_HAVE_THREADS
+	[_condition lock];
+	@try {
+#endif
+		for (OFHTTPClient_AsyncRequest *iter in _asyncRequests) {
+			if ([iter originalRequest] == request) {
+				asyncRequest = [[iter retain] autorelease];
+				break;
+			}
+		}
+#ifdef OF_HAVE_THREADS
+	} @finally {
+		[_condition unlock];
+	}
+#endif
+
+	[asyncRequest cancel];
+}
+
 - (void)close
 {
-	[_socket close];
-	[_socket release];
-	_socket = nil;
+#ifdef OF_HAVE_THREADS
+	[_condition lock];
+	@try {
+#endif
+		for (OFString *poolKey in [_pools allKeys]) {
+			OFHTTPClient_Pool *pool =
+			    [_pools objectForKey: poolKey];
 
-	[_lastURL release];
-	_lastURL = nil;
+			for (OFTCPSocket *socket in pool->_idleSockets)
+				[socket close];
 
-	[_lastResponse release];
-	_lastResponse = nil;
+			[pool->_idleSockets removeAllObjects];
+			[pool->_idleSince removeAllItems];
+
+			if (pool->_activeConnections == 0)
+				[_pools removeObjectForKey: poolKey];
+		}
+#ifdef OF_HAVE_THREADS
+	} @finally {
+		[_condition unlock];
+	}
+#endif
 }
 @end
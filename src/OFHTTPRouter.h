@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2008, 2009, 2010, 2011, 2012, 2013, 2014, 2015, 2016
+ *   Jonathan Schleifer <js@heap.zone>
+ *
+ * All rights reserved.
+ *
+ * This file is part of ObjFW. It may be distributed under the terms of the
+ * Q Public License 1.0, which can be found in the file LICENSE.QPL included in
+ * the packaging of this file.
+ *
+ * Alternatively, it may be distributed under the terms of the GNU General
+ * Public License, either version 2 or 3, which can be found in the file
+ * LICENSE.GPLv2 or LICENSE.GPLv3 respectively included in the packaging of this
+ * file.
+ */
+
+
+#import "OFObject.h"
+
+#ifndef OF_HAVE_SOCKETS
+# error No sockets available!
+#endif
+
+OF_ASSUME_NONNULL_BEGIN
+
+/*! @file */
+
+@class OFHTTPServer;
+@class OFHTTPRequest;
+@class OFHTTPResponse;
+@class OFStream;
+@class OFString;
+@class OFArray OF_GENERIC(ObjectType);
+
+@protocol OFHTTPRouteHandler;
+
+/*!
+ * @brief The maximum number of parameters a route can have.
+ */
+#define OF_HTTP_ROUTER_MAX_PARAMETERS 16
+
+/*!
+ * @struct of_http_router_match_t OFHTTPRouter.h ObjFW/OFHTTPRouter.h
+ *
+ * @brief The route a path matched and the parameters captured from it.
+ *
+ * The parameters are ranges of the path, so that matching does not need to
+ * allocate anything.
+ */
+typedef struct {
+	/*! The handler of the route the path matched */
+	id <OFHTTPRouteHandler> handler;
+	/*! The names of the parameters of the route, in the order they appear */
+	OFArray OF_GENERIC(OFString*) *parameterNames;
+	/*! The path that was matched, which the parameter ranges refer to */
+	const char *path;
+	/*! The number of parameters captured */
+	size_t parametersCount;
+	/*! The ranges of the captured parameters in the path */
+	of_range_t parameters[OF_HTTP_ROUTER_MAX_PARAMETERS];
+} of_http_router_match_t;
+
+/*!
+ * @protocol OFHTTPRouteHandler OFHTTPRouter.h ObjFW/OFHTTPRouter.h
+ *
+ * @brief A handler for the requests matching a route of an OFHTTPRouter.
+ */
+@protocol OFHTTPRouteHandler <OFObject>
+/*!
+ * @brief This method is called when the HTTP server received the head of a
+ *	  request whose path matched the route of the handler.
+ *
+ * The body is passed as a stream, the same way as it is to
+ * @ref OFHTTPServerDelegate::server:didReceiveRequest:requestBody:response:.
+ *
+ * @param server The HTTP server which received the request
+ * @param request The request the HTTP server received
+ * @param requestBody A stream to read the body of the request from or `nil`
+ *		      if the request has no body
+ * @param match The match of the path of the request, which is only valid
+ *		until this method returns
+ * @param response The response the server will send to the client
+ */
+-      (void)server: (OFHTTPServer*)server
+  didReceiveRequest: (OFHTTPRequest*)request
+	requestBody: (nullable OFStream*)requestBody
+	      match: (const of_http_router_match_t*)match
+	   response: (OFHTTPResponse*)response;
+@end
+
+/*!
+ * @class OFHTTPRouter OFHTTPRouter.h ObjFW/OFHTTPRouter.h
+ *
+ * @brief A class for dispatching the requests of an OFHTTPServer to handlers
+ *	  based on their path.
+ *
+ * Routes are patterns made of segments separated by slashes. A segment
+ * starting with `:` is a parameter that matches any non-empty segment, and a
+ * last segment starting with `*` is a wildcard that matches the rest of the
+ * path, including slashes. Everything else is matched literally. If a path
+ * matches several routes, literal segments take precedence over parameters,
+ * which take precedence over wildcards.
+ *
+ * Routes are compiled into a radix tree when they are added, which is matched
+ * against the bytes of the path without allocating anything. As matching is
+ * not synchronized, all routes need to be added before the server is started.
+ */
+@interface OFHTTPRouter: OFObject
+{
+	struct of_http_router_node *_root;
+}
+
+/*!
+ * @brief Creates a new HTTP router.
+ *
+ * @return A new, autoreleased HTTP router
+ */
++ (instancetype)router;
+
+/*!
+ * @brief Adds a route with the specified pattern.
+ *
+ * The leading slash of the pattern is optional, as the paths of the URLs of
+ * requests received by OFHTTPServer do not have one.
+ *
+ * @param pattern The pattern of the route, for example `/users/:user/\*file`
+ * @param handler The handler for requests matching the route
+ */
+- (void)addRoute: (OFString*)pattern
+	 handler: (id <OFHTTPRouteHandler>)handler;
+
+/*!
+ * @brief Matches the specified path against the routes.
+ *
+ * @param path The path to match, without a leading slash and without the
+ *	       query
+ * @param length The length of the path in bytes
+ * @param match A pointer to a match to fill in
+ * @return Whether the path matched a route
+ */
+- (bool)matchPath: (const char*)path
+	   length: (size_t)length
+	    match: (of_http_router_match_t*)match;
+@end
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*!
+ * @brief Returns the URL decoded value of the parameter with the specified
+ *	  name.
+ *
+ * @param match The match to return the parameter of
+ * @param name The name of the parameter
+ * @return The URL decoded value of the parameter or `nil` if the route has no
+ *	   parameter with the specified name
+ */
+extern OFString *_Nullable of_http_router_match_parameter(
+    const of_http_router_match_t *match, OFString *name);
+#ifdef __cplusplus
+}
+#endif
+
+OF_ASSUME_NONNULL_END
@@ -0,0 +1,408 @@
+/*
+ * Copyright (c) 2008, 2009, 2010, 2011, 2012, 2013, 2014, 2015, 2016
+ *   Jonathan Schleifer <js@heap.zone>
+ *
+ * All rights reserved.
+ *
+ * This file is part of ObjFW. It may be distributed under the terms of the
+ * Q Public License 1.0, which can be found in the file LICENSE.QPL included in
+ * the packaging of this file.
+ *
+ * Alternatively, it may be distributed under the terms of the GNU General
+ * Public License, either version 2 or 3, which can be found in the file
+ * LICENSE.GPLv2 or LICENSE.GPLv3 respectively included in the packaging of this
+ * file.
+ */
+
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#import "OFHTTPRouter.h"
+#import "OFArray.h"
+#import "OFString.h"
+
+#import "OFInvalidArgumentException.h"
+#import "OFOutOfMemoryException.h"
+#import "OFOutOfRangeException.h"
+
+struct of_http_router_route {
+	id <OFHTTPRouteHandler> handler;
+	OFArray OF_GENERIC(OFString*) *parameterNames;
+};
+
+struct of_http_router_node {
+	/* The bytes leading to this node, empty for parameters and wildcards */
+	char *label;
+	size_t labelLength;
+	/* Sorted by the first byte of their label */
+	struct of_http_router_node **children;
+	size_t childrenCount;
+	struct of_http_router_node *parameter, *wildcard;
+	struct of_http_router_route *route;
+};
+
+static struct of_http_router_node*
+newNode(const char *label, size_t labelLength)
+{
+	struct of_http_router_node *node;
+
+	if ((node = calloc(1, sizeof(*node))) == NULL)
+		@throw [OFOutOfMemoryException
+		    exceptionWithRequestedSize: sizeof(*node)];
+
+	if (labelLength > 0) {
+		if ((node->label = malloc(labelLength)) == NULL) {
+			free(node);
+			@throw [OFOutOfMemoryException
+			    exceptionWithRequestedSize: labelLength];
+		}
+
+		memcpy(node->label, label, labelLength);
+		node->labelLength = labelLength;
+	}
+
+	return node;
+}
+
+static void
+releaseNode(struct of_http_router_node *node)
+{
+	if (node == NULL)
+		return;
+
+	for (size_t i = 0; i < node->childrenCount; i++)
+		releaseNode(node->children[i]);
+
+	releaseNode(node->parameter);
+	releaseNode(node->wildcard);
+
+	if (node->route != NULL) {
+		[node->route->handler release];
+		[node->route->parameterNames release];
+		free(node->route);
+	}
+
+	free(node->children);
+	free(node->label);
+	free(node);
+}
+
+/*
+ * Returns the index of the child whose label starts with the specified byte or
+ * the index at which such a child would need to be inserted.
+ */
+static size_t
+childIndex(const struct of_http_router_node *node, char byte, bool *found)
+{
+	size_t low = 0, high = node->childrenCount;
+
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		unsigned char first = node->children[middle]->label[0];
+
+		if (first == (unsigned char)byte) {
+			*found = true;
+			return middle;
+		}
+
+		if (first < (unsigned char)byte)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	*found = false;
+	return low;
+}
+
+static void
+insertChild(struct of_http_router_node *node, size_t index,
+    struct of_http_router_node *child)
+{
+	struct of_http_router_node **children;
+
+	if (node->childrenCount > SIZE_MAX / sizeof(*children) - 1)
+		@throw [OFOutOfRangeException exception];
+
+	if ((children = realloc(node->children,
+	    (node->childrenCount + 1) * sizeof(*children))) == NULL)
+		@throw [OFOutOfMemoryException exceptionWithRequestedSize:
+		    (node->childrenCount + 1) * sizeof(*children)];
+
+	memmove(children + index + 1, children + index,
+	    (node->childrenCount - index) * sizeof(*children));
+	children[index] = child;
+
+	node->children = children;
+	node->childrenCount++;
+}
+
+/* Returns the node at which the literal ends, splitting labels as needed. */
+static struct of_http_router_node*
+insertLiteral(struct of_http_router_node *node, const char *literal,
+    size_t length)
+{
+	while (length > 0) {
+		struct of_http_router_node *child, *split;
+		size_t index, common = 0;
+		bool found;
+
+		index = childIndex(node, literal[0], &found);
+
+		if (!found) {
+			child = newNode(literal, length);
+
+			@try {
+				insertChild(node, index, child);
+			} @catch (id e) {
+				free(child->label);
+				free(child);
+				@throw e;
+			}
+
+			return child;
+		}
+
+		child = node->children[index];
+
+		while (common < length && common < child->labelLength &&
+		    literal[common] == child->label[common])
+			common++;
+
+		if (common < child->labelLength) {
+			char *label;
+
+			split = newNode(literal, common);
+
+			if ((split->children = malloc(
+			    sizeof(*split->children))) == NULL ||
+			    (label = malloc(child->labelLength - common)) ==
+			    NULL) {
+				free(split->children);
+				free(split->label);
+				free(split);
+				@throw [OFOutOfMemoryException
+				    exceptionWithRequestedSize:
+				    child->labelLength - common];
+			}
+
+			memcpy(label, child->label + common,
+			    child->labelLength - common);
+			free(child->label);
+			child->label = label;
+			child->labelLength -= common;
+
+			split->children[0] = child;
+			split->childrenCount = 1;
+			node->children[index] = split;
+
+			child = split;
+		}
+
+		node = child;
+		literal += common;
+		length -= common;
+	}
+
+	return node;
+}
+
+static bool
+isSegmentStart(const char *pattern, size_t start, size_t i)
+{
+	return (i == start || pattern[i - 1] == '/');
+}
+
+static struct of_http_router_route*
+matchNode(const struct of_http_router_node *node, const char *path,
+    size_t position, size_t length, of_http_router_match_t *match)
+{
+	struct of_http_router_route *route;
+
+	if (position == length && node->route != NULL)
+		return node->route;
+
+	if (position < length) {
+		bool found;
+		size_t index = childIndex(node, path[position], &found);
+
+		if (found) {
+			const struct of_http_router_node *child =
+			    node->children[index];
+
+			if (length - position >= child->labelLength &&
+			    memcmp(path + position, child->label,
+			    child->labelLength) == 0 &&
+			    (route = matchNode(child, path,
+			    position + child->labelLength, length,
+			    match)) != NULL)
+				return route;
+		}
+	}
+
+	if (node->parameter != NULL && position < length &&
+	    path[position] != '/') {
+		size_t end = position, count = match->parametersCount;
+
+		while (end < length && path[end] != '/')
+			end++;
+
+		match->parameters[count] = of_range(position, end - position);
+		match->parametersCount = count + 1;
+
+		if ((route = matchNode(node->parameter, path, end, length,
+		    match)) != NULL)
+			return route;
+
+		match->parametersCount = count;
+	}
+
+	if (node->wildcard != NULL && node->wildcard->route != NULL) {
+		match->parameters[match->parametersCount++] =
+		    of_range(position, length - position);
+
+		return node->wildcard->route;
+	}
+
+	return NULL;
+}
+
+OFString*
+of_http_router_match_parameter(const of_http_router_match_t *match,
+    OFString *name)
+{
+	size_t index = [match->parameterNames indexOfObject: name];
+	of_range_t range;
+
+	if (index == OF_NOT_FOUND)
+		return nil;
+
+	range = match->parameters[index];
+
+	return [[OFString stringWithUTF8String: match->path + range.location
+					length: range.length]
+	    stringByURLDecoding];
+}
+
+@implementation OFHTTPRouter
++ (instancetype)router
+{
+	return [[[self alloc] init] autorelease];
+}
+
+- init
+{
+	self = [super init];
+
+	@try {
+		_root = newNode(NULL, 0);
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	releaseNode(_root);
+
+	[super dealloc];
+}
+
+- (void)addRoute: (OFString*)pattern
+	 handler: (id <OFHTTPRouteHandler>)handler
+{
+	void *pool = objc_autoreleasePoolPush();
+	const char *UTF8String = [pattern UTF8String];
+	size_t length = [pattern UTF8StringLength], start = 0, i;
+	OFMutableArray OF_GENERIC(OFString*) *parameterNames =
+	    [OFMutableArray array];
+	struct of_http_router_node *node = _root;
+	struct of_http_router_route *route;
+
+	if (handler == nil)
+		@throw [OFInvalidArgumentException exception];
+
+	/* The paths of requests received by OFHTTPServer have no leading / */
+	if (length > 0 && UTF8String[0] == '/')
+		start = 1;
+
+	i = start;
+	while (i < length) {
+		size_t end = i;
+
+		if (isSegmentStart(UTF8String, start, i) &&
+		    (UTF8String[i] == ':' || UTF8String[i] == '*')) {
+			bool wildcard = (UTF8String[i] == '*');
+			struct of_http_router_node **next;
+
+			while (end < length && UTF8String[end] != '/')
+				end++;
+
+			if (end == i + 1 || (wildcard && end != length))
+				@throw [OFInvalidArgumentException exception];
+
+			if ([parameterNames count] ==
+			    OF_HTTP_ROUTER_MAX_PARAMETERS)
+				@throw [OFOutOfRangeException exception];
+
+			[parameterNames addObject:
+			    [OFString stringWithUTF8String: UTF8String + i + 1
+						    length: end - i - 1]];
+
+			next = (wildcard ? &node->wildcard : &node->parameter);
+			if (*next == NULL)
+				*next = newNode(NULL, 0);
+
+			node = *next;
+		} else {
+			while (end < length &&
+			    !(isSegmentStart(UTF8String, start, end) &&
+			    (UTF8String[end] == ':' || UTF8String[end] == '*')))
+				end++;
+
+			node = insertLiteral(node, UTF8String + i, end - i);
+		}
+
+		i = end;
+	}
+
+	if (node->route != NULL)
+		@throw [OFInvalidArgumentException exception];
+
+	if ((route = malloc(sizeof(*route))) == NULL)
+		@throw [OFOutOfMemoryException
+		    exceptionWithRequestedSize: sizeof(*route)];
+
+	[parameterNames makeImmutable];
+
+	route->handler = [handler retain];
+	route->parameterNames = [parameterNames retain];
+	node->route = route;
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (bool)matchPath: (const char*)path
+	   length: (size_t)length
+	    match: (of_http_router_match_t*)match
+{
+	struct of_http_router_route *route;
+
+	match->parametersCount = 0;
+
+	if ((route = matchNode(_root, path, 0, length, match)) == NULL)
+		return false;
+
+	match->handler = route->handler;
+	match->parameterNames = route->parameterNames;
+	match->path = path;
+
+	return true;
+}
+@end
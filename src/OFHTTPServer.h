@@ -25,8 +25,13 @@ OF_ASSUME_NONNULL_BEGIN
 @class OFHTTPServer;
 @class OFHTTPRequest;
 @class OFHTTPResponse;
+@class OFHTTPRouter;
+@class OFStream;
 @class OFTCPSocket;
 @class OFException;
+#ifdef OF_HAVE_THREADS
+@class OFMutableArray OF_GENERIC(ObjectType);
+#endif
 
 /*!
  * @protocol OFHTTPServerDelegate OFHTTPServer.h ObjFW/OFHTTPServer.h
@@ -34,10 +39,15 @@ OF_ASSUME_NONNULL_BEGIN
  * @brief A delegate for OFHTTPServer.
  */
 @protocol OFHTTPServerDelegate <OFObject>
+@optional
 /*!
  * @brief This method is called when the HTTP server received a request from a
  *	  client.
  *
+ * The body of the request has already been read completely and is available
+ * as the request's body. It is not called if the delegate implements
+ * @ref server:didReceiveRequest:requestBody:response:.
+ *
  * @param server The HTTP server which received the request
  * @param request The request the HTTP server received
  * @param response The response the server will send to the client
@@ -46,7 +56,32 @@ OF_ASSUME_NONNULL_BEGIN
   didReceiveRequest: (OFHTTPRequest*)request
 	   response: (OFHTTPResponse*)response;
 
-@optional
+/*!
+ * @brief This method is called when the HTTP server received the head of a
+ *	  request from a client.
+ *
+ * If the delegate implements this method, it is called as soon as the head
+ * has been parsed and the body is not read by the server. Instead, it is
+ * passed as a stream, which decodes chunked transfer encoding and ends where
+ * the body ends. Data is only read from the client when the delegate reads
+ * from the stream, so a client sending faster than the delegate handles the
+ * data is slowed down by TCP flow control.
+ *
+ * The connection is only kept alive if the body has been read completely by
+ * the time the response is closed. Reading beyond
+ * @ref OFHTTPServer::maxRequestBodySize throws an OFOutOfRangeException.
+ *
+ * @param server The HTTP server which received the request
+ * @param request The request the HTTP server received
+ * @param requestBody A stream to read the body of the request from or `nil`
+ *		      if the request has no body
+ * @param response The response the server will send to the client
+ */
+-      (void)server: (OFHTTPServer*)server
+  didReceiveRequest: (OFHTTPRequest*)request
+	requestBody: (nullable OFStream*)requestBody
+	   response: (OFHTTPResponse*)response;
+
 /*!
  * @brief This method is called when the HTTP server's listening socket
  *	  encountered an exception.
@@ -93,6 +128,16 @@ OF_ASSUME_NONNULL_BEGIN
 	id <OFHTTPServerDelegate> _delegate;
 	OFString *_name;
 	OFTCPSocket *_listeningSocket;
+	of_time_interval_t _keepAliveTimeout;
+	size_t _maxRequestsPerConnection;
+	size_t _maxRequestBodySize;
+	bool _compressesResponses;
+	int _compressionLevel;
+	OFHTTPRouter *_router;
+#ifdef OF_HAVE_THREADS
+	size_t _numberOfThreads;
+	OFMutableArray *_threadPool;
+#endif
 }
 
 /*!
@@ -118,6 +163,89 @@ OF_ASSUME_NONNULL_BEGIN
  */
 @property OF_NULLABLE_PROPERTY (copy) OFString *name;
 
+/*!
+ * The time in seconds an idle persistent connection is kept open while waiting
+ * for the next request.
+ *
+ * The default is 10 seconds.
+ */
+@property of_time_interval_t keepAliveTimeout;
+
+/*!
+ * The maximum number of requests that are handled on a single persistent
+ * connection before it is closed.
+ *
+ * Connections are kept alive if the client supports it and the response has
+ * either a `Content-Length` or uses chunked transfer encoding. Pipelined
+ * requests are handled one after another, so responses are always sent in the
+ * order the requests were received.
+ *
+ * The default is 100. Setting it to 1 disables persistent connections.
+ */
+@property size_t maxRequestsPerConnection;
+
+/*!
+ * The maximum size of a request body in bytes.
+ *
+ * Requests with a larger `Content-Length` are rejected with status 413 before
+ * any of the body is read. For chunked bodies, which have no length known in
+ * advance, the same happens once the limit is exceeded while reading.
+ *
+ * The default is `SIZE_MAX`, which means there is no limit.
+ */
+@property size_t maxRequestBodySize;
+
+/*!
+ * Whether responses are compressed with gzip if the client accepts it.
+ *
+ * Only responses with a textual `Content-Type`, such as `text/\*`, JSON, XML
+ * or JavaScript, are compressed, and only if they have a body, no
+ * `Content-Encoding` and no `Content-Length` below 256 bytes. Compressed
+ * responses use chunked transfer encoding and are compressed as they are
+ * written. Requests from HTTP/1.0 clients, which do not support chunked
+ * transfer encoding, are never compressed.
+ *
+ * The default is false.
+ */
+@property bool compressesResponses;
+
+/*!
+ * The level at which responses are compressed, from 0 (no compression) to 9
+ * (best compression).
+ *
+ * The default is 6.
+ */
+@property int compressionLevel;
+
+/*!
+ * The router which dispatches requests to handlers based on their path.
+ *
+ * Requests matching a route are passed to the handler of the route instead of
+ * the delegate. Requests matching no route are passed to the delegate or,
+ * if there is no delegate, answered with status 404.
+ *
+ * The router cannot be changed while the server is running.
+ */
+@property OF_NULLABLE_PROPERTY (retain) OFHTTPRouter *router;
+
+#ifdef OF_HAVE_THREADS
+/*!
+ * The number of threads the HTTP server uses to handle connections.
+ *
+ * The default is 1, which means all connections are handled in the run loop
+ * of the thread which called @ref start. If it is larger than 1, connections
+ * are still accepted in that thread, but handed to the worker thread which
+ * currently has the fewest connections. Each worker thread has its own run
+ * loop.
+ *
+ * @warning If this is larger than 1, the delegate is called from the worker
+ *	    threads and needs to be thread-safe!
+ *
+ * This cannot be changed while the server is running.
+ */
+@property size_t numberOfThreads;
+#endif
+
 /*!
  * @brief Creates a new HTTP server.
  *
@@ -136,6 +264,31 @@ OF_ASSUME_NONNULL_BEGIN
  *	  finished or timed out.
  */
 - (void)stop;
+
+#ifdef OF_HAVE_FILES
+/*!
+ * @brief Sends the file at the specified path as the body of the response.
+ *
+ * If the client accepts gzip and a file with the same path and `.gz` appended
+ * exists, that file is sent with `Content-Encoding: gzip` instead, so that
+ * static files can be compressed ahead of time. If the response has no
+ * `Content-Type` yet, it is guessed from the path extension.
+ *
+ * The status code is set to 200 and the `Content-Length` to the size of the
+ * file. The file is sent asynchronously from the run loop of the current
+ * thread, which should be the thread that received the request, and the
+ * response is closed once all of it has been sent. Unless the response is
+ * compressed on the fly, the file is copied to the socket inside the kernel
+ * where supported, see @ref OFStream::transferToStream:length:.
+ *
+ * @param path The path of the file to send
+ * @param request The request to which the file is sent in response
+ * @param response The response to send the file with
+ */
+- (void)sendFileAtPath: (OFString*)path
+	    forRequest: (OFHTTPRequest*)request
+	      response: (OFHTTPResponse*)response;
+#endif
 @end
 
 OF_ASSUME_NONNULL_END
@@ -16,19 +16,34 @@
 
 #include "config.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
+#include <time.h>
 
 #import "OFHTTPServer.h"
+#import "OFArray.h"
 #import "OFDataArray.h"
 #import "OFDate.h"
 #import "OFDictionary.h"
+#import "OFGZIPStream.h"
 #import "OFURL.h"
+#import "OFURL+Private.h"
 #import "OFHTTPRequest.h"
 #import "OFHTTPResponse.h"
+#import "OFHTTPRouter.h"
+#import "OFRunLoop.h"
+#import "OFRunLoop+Private.h"
+#import "OFStream+Private.h"
 #import "OFTCPSocket.h"
 #import "OFTimer.h"
+#ifdef OF_HAVE_FILES
+# import "OFFile.h"
+# import "OFFileManager.h"
+#endif
+#ifdef OF_HAVE_THREADS
+# import "OFThread.h"
+#endif
 
 #import "OFAlreadyConnectedException.h"
 #import "OFInvalidArgumentException.h"
@@ -36,11 +51,37 @@
 #import "OFNotOpenException.h"
 #import "OFOutOfMemoryException.h"
 #import "OFOutOfRangeException.h"
+#import "OFTruncatedDataException.h"
 #import "OFWriteFailedException.h"
 
+#import "of_http_parser.h"
 #import "socket_helpers.h"
+#if defined(OF_HAVE_THREADS) && defined(OF_HAVE_ATOMIC_OPS)
+# import "atomic.h"
+#endif
+#if !defined(OF_HAVE_COMPILER_TLS) && defined(OF_HAVE_THREADS)
+# import "threading.h"
+#
+# import "OFInitializationFailedException.h"
+#endif
 
 #define BUFFER_SIZE 1024
+#define MIN_HEADER_BUFFER_SIZE 512
+#define DATE_LENGTH 29
+#define MIN_COMPRESSED_SIZE 256
+
+enum {
+	CHUNK_SIZE,
+	CHUNK_EXTENSION,
+	CHUNK_EXTENSION_LF,
+	CHUNK_DATA,
+	CHUNK_DATA_CR,
+	CHUNK_DATA_LF,
+	CHUNK_TRAILER_START,
+	CHUNK_TRAILER,
+	CHUNK_TRAILER_LF,
+	CHUNK_DONE
+};
 
 /*
  * FIXME: Key normalization replaces headers like "DNT" with "Dnt".
@@ -51,8 +92,39 @@
 - (bool)OF_socket: (OFTCPSocket*)socket
   didAcceptSocket: (OFTCPSocket*)clientSocket
 	exception: (OFException*)exception;
+- (void)OF_handleClientSocket: (OFTCPSocket*)clientSocket;
 @end
 
+#ifdef OF_HAVE_THREADS
+@interface OFHTTPServer_Thread: OFThread
+{
+@public
+	volatile int _connections;
+}
+
+- (void)OF_stop;
+@end
+
+static void
+addConnection(OFHTTPServer_Thread *thread, int delta)
+{
+# ifdef OF_HAVE_ATOMIC_OPS
+	of_atomic_int_add(&thread->_connections, delta);
+# else
+	@synchronized (thread) {
+		thread->_connections += delta;
+	}
+# endif
+}
+
+@implementation OFHTTPServer_Thread
+- (void)OF_stop
+{
+	[[OFRunLoop currentRunLoop] stop];
+}
+@end
+#endif
+
 static const char*
 statusCodeToString(short code)
 {
@@ -125,6 +197,8 @@ statusCodeToString(short code)
 		return "Requested Range Not Satisfiable";
 	case 417:
 		return "Expectation Failed";
+	case 431:
+		return "Request Header Fields Too Large";
 	case 500:
 		return "Internal Server Error";
 	case 501:
@@ -142,32 +216,360 @@ statusCodeToString(short code)
 	}
 }
 
-static OF_INLINE OFString*
-normalizedKey(OFString *key)
+static bool
+hasConnectionToken(OFString *header, OFString *token)
+{
+	void *pool;
+	bool found = false;
+
+	if (header == nil)
+		return false;
+
+	pool = objc_autoreleasePoolPush();
+
+	for (OFString *component in
+	    [header componentsSeparatedByString: @","]) {
+		component = [component stringByDeletingEnclosingWhitespaces];
+
+		if ([component caseInsensitiveCompare: token] ==
+		    OF_ORDERED_SAME) {
+			found = true;
+			break;
+		}
+	}
+
+	objc_autoreleasePoolPop(pool);
+
+	return found;
+}
+
+static bool
+isCompressibleContentType(OFString *contentType)
+{
+	void *pool;
+	size_t pos;
+	bool ret;
+
+	if (contentType == nil)
+		return false;
+
+	pool = objc_autoreleasePoolPush();
+
+	if ((pos = [contentType rangeOfString: @";"].location) != OF_NOT_FOUND)
+		contentType = [contentType substringWithRange:
+		    of_range(0, pos)];
+
+	contentType = [[contentType stringByDeletingEnclosingWhitespaces]
+	    lowercaseString];
+
+	ret = ([contentType hasPrefix: @"text/"] ||
+	    [contentType isEqual: @"application/json"] ||
+	    [contentType isEqual: @"application/javascript"] ||
+	    [contentType isEqual: @"application/xml"] ||
+	    [contentType hasSuffix: @"+json"] ||
+	    [contentType hasSuffix: @"+xml"]);
+
+	objc_autoreleasePoolPop(pool);
+
+	return ret;
+}
+
+static bool
+acceptsGZIP(OFString *acceptEncoding)
 {
-	char *cString = of_strdup([key UTF8String]);
-	unsigned char *tmp = (unsigned char*)cString;
-	bool firstLetter = true;
+	void *pool;
+	int GZIP = -1, wildcard = -1;
 
-	if (cString == NULL)
-		@throw [OFOutOfMemoryException
-		    exceptionWithRequestedSize: strlen([key UTF8String])];
+	if (acceptEncoding == nil)
+		return false;
+
+	pool = objc_autoreleasePoolPush();
 
-	while (*tmp != '\0') {
-		if (!isalnum(*tmp)) {
-			firstLetter = true;
-			tmp++;
-			continue;
+	for (OFString *component in
+	    [acceptEncoding componentsSeparatedByString: @","]) {
+		OFArray *parameters = [component
+		    componentsSeparatedByString: @";"];
+		OFString *coding = [[parameters firstObject]
+		    stringByDeletingEnclosingWhitespaces];
+		bool accepted = true;
+
+		for (size_t i = 1; i < [parameters count]; i++) {
+			OFString *parameter = [[parameters objectAtIndex: i]
+			    stringByDeletingEnclosingWhitespaces];
+
+			if (![parameter hasPrefix: @"q="] &&
+			    ![parameter hasPrefix: @"Q="])
+				continue;
+
+			@try {
+				accepted = ([[parameter substringWithRange:
+				    of_range(2, [parameter length] - 2)]
+				    doubleValue] > 0);
+			} @catch (OFInvalidFormatException *e) {
+				accepted = false;
+			}
 		}
 
-		*tmp = (firstLetter ? toupper(*tmp) : tolower(*tmp));
+		if ([coding caseInsensitiveCompare: @"gzip"] ==
+		    OF_ORDERED_SAME ||
+		    [coding caseInsensitiveCompare: @"x-gzip"] ==
+		    OF_ORDERED_SAME)
+			GZIP = accepted;
+		else if ([coding isEqual: @"*"])
+			wildcard = accepted;
+	}
+
+	objc_autoreleasePoolPop(pool);
+
+	/* An explicit gzip takes precedence over the wildcard */
+	return (GZIP != -1 ? GZIP : wildcard == 1);
+}
+
+/*
+ * Whether a response is compressed depends on the request, which caches need
+ * to know about.
+ */
+static void
+addVaryAcceptEncoding(OFMutableDictionary *headers)
+{
+	OFString *vary = [headers objectForKey: @"Vary"];
+
+	if (vary == nil)
+		[headers setObject: @"Accept-Encoding"
+			    forKey: @"Vary"];
+	else if (!hasConnectionToken(vary, @"Accept-Encoding") &&
+	    !hasConnectionToken(vary, @"*"))
+		[headers setObject: [vary stringByAppendingString:
+					@", Accept-Encoding"]
+			    forKey: @"Vary"];
+}
+
+#ifdef OF_HAVE_FILES
+static OFString*
+contentTypeForPath(OFString *path)
+{
+	static const struct {
+		OFString *extension, *contentType;
+	} contentTypes[] = {
+		{ @"css", @"text/css; charset=UTF-8" },
+		{ @"gif", @"image/gif" },
+		{ @"htm", @"text/html; charset=UTF-8" },
+		{ @"html", @"text/html; charset=UTF-8" },
+		{ @"jpeg", @"image/jpeg" },
+		{ @"jpg", @"image/jpeg" },
+		{ @"js", @"application/javascript" },
+		{ @"json", @"application/json" },
+		{ @"png", @"image/png" },
+		{ @"svg", @"image/svg+xml" },
+		{ @"txt", @"text/plain; charset=UTF-8" },
+		{ @"xml", @"application/xml" }
+	};
+	OFString *extension = [[path pathExtension] lowercaseString];
+
+	for (size_t i = 0; i < sizeof(contentTypes) / sizeof(*contentTypes);
+	    i++)
+		if ([extension isEqual: contentTypes[i].extension])
+			return contentTypes[i].contentType;
+
+	return @"application/octet-stream";
+}
+#endif
+
+/*
+ * The Date header only changes once per second, so it is only formatted once
+ * per second and thread.
+ */
+#if defined(OF_HAVE_COMPILER_TLS)
+static thread_local time_t dateCacheTime = 0;
+static thread_local char dateCache[DATE_LENGTH + 1];
+#elif defined(OF_HAVE_THREADS)
+static of_spinlock_t dateCacheLock;
+static time_t dateCacheTime = 0;
+static char dateCache[DATE_LENGTH + 1];
+#else
+static time_t dateCacheTime = 0;
+static char dateCache[DATE_LENGTH + 1];
+#endif
+
+static void
+formatDate(char *buffer, time_t seconds)
+{
+	static const char *weekdays = "ThuFriSatSunMonTueWed";
+	static const char *months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	int64_t days = seconds / 86400, era, year;
+	unsigned int dayOfEra, yearOfEra, dayOfYear, monthIndex, day, month;
+	unsigned int secondOfDay = (unsigned int)(seconds % 86400);
+
+	/*
+	 * Converts the days since 1970-01-01 to a date. Years are treated as
+	 * starting in March, so that leap days are at the end of a year.
+	 */
+	days += 719468;
+	era = days / 146097;
+	dayOfEra = (unsigned int)(days - era * 146097);
+	yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 -
+	    dayOfEra / 146096) / 365;
+	dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 -
+	    yearOfEra / 100);
+	monthIndex = (5 * dayOfYear + 2) / 153;
+	day = dayOfYear - (153 * monthIndex + 2) / 5 + 1;
+	month = (monthIndex < 10 ? monthIndex + 3 : monthIndex - 9);
+	year = yearOfEra + era * 400 + (month <= 2);
+
+	/* Sun, 06 Nov 1994 08:49:37 GMT */
+	memcpy(buffer, weekdays + ((seconds / 86400) % 7) * 3, 3);
+	memcpy(buffer + 3, ", ", 2);
+	buffer[5] = '0' + day / 10;
+	buffer[6] = '0' + day % 10;
+	buffer[7] = ' ';
+	memcpy(buffer + 8, months + (month - 1) * 3, 3);
+	buffer[11] = ' ';
+	buffer[12] = '0' + year / 1000 % 10;
+	buffer[13] = '0' + year / 100 % 10;
+	buffer[14] = '0' + year / 10 % 10;
+	buffer[15] = '0' + year % 10;
+	buffer[16] = ' ';
+	buffer[17] = '0' + secondOfDay / 36000;
+	buffer[18] = '0' + secondOfDay / 3600 % 10;
+	buffer[19] = ':';
+	buffer[20] = '0' + secondOfDay / 600 % 6;
+	buffer[21] = '0' + secondOfDay / 60 % 10;
+	buffer[22] = ':';
+	buffer[23] = '0' + secondOfDay % 60 / 10;
+	buffer[24] = '0' + secondOfDay % 10;
+	memcpy(buffer + 25, " GMT", 5);
+}
+
+static void
+currentDate(char *buffer)
+{
+	time_t now = time(NULL);
+
+#if !defined(OF_HAVE_COMPILER_TLS) && defined(OF_HAVE_THREADS)
+	OF_ENSURE(of_spinlock_lock(&dateCacheLock));
+#endif
+
+	if (now != dateCacheTime) {
+		formatDate(dateCache, now);
+		dateCacheTime = now;
+	}
+
+	memcpy(buffer, dateCache, DATE_LENGTH + 1);
+
+#if !defined(OF_HAVE_COMPILER_TLS) && defined(OF_HAVE_THREADS)
+	OF_ENSURE(of_spinlock_unlock(&dateCacheLock));
+#endif
+}
+
+static size_t
+formatChunkSize(char *buffer, size_t size)
+{
+	char digits[sizeof(size_t) * 2];
+	size_t i = 0, length = 0;
+
+	do {
+		digits[i++] = "0123456789abcdef"[size & 0xF];
+		size >>= 4;
+	} while (size > 0);
 
-		firstLetter = false;
-		tmp++;
+	while (i > 0)
+		buffer[length++] = digits[--i];
+
+	buffer[length++] = '\r';
+	buffer[length++] = '\n';
+
+	return length;
+}
+
+@interface OFHTTPServerRequestBody: OFStream
+{
+	OFTCPSocket *_socket;
+	bool _chunked, _atEndOfStream;
+	int _state;
+	size_t _toRead, _sizeDigits, _maxLength;
+}
+
+- initWithSocket: (OFTCPSocket*)socket
+   contentLength: (size_t)contentLength
+	 chunked: (bool)chunked
+       maxLength: (size_t)maxLength;
+- (bool)OF_parseChunkFraming: (char)c;
+@end
+
+@interface OFHTTPServer_Connection: OFObject
+{
+	OFTCPSocket *_socket;
+	OFHTTPServer *_server;
+	OFRunLoop *_runLoop;
+	OFTimer *_timer;
+	of_http_parser_t _parser;
+	uint8_t _HTTPMinorVersion;
+	of_http_request_method_t _method;
+	OFString *_host, *_path;
+	uint16_t _port;
+	OFDictionary *_headers;
+	bool _keepAliveRequested, _chunked, _routed;
+	of_http_router_match_t _match;
+	size_t _contentLength;
+	OFHTTPServerRequestBody *_requestBody;
+	OFDataArray *_body;
+	char *_buffer;
+	size_t _numberOfRequests;
+#ifdef OF_HAVE_THREADS
+	OFHTTPServer_Thread *_thread;
+#endif
+@public
+	/* Reused to serialize the head of every response */
+	char *_headerBuffer;
+	size_t _headerBufferSize;
+}
+
+- initWithSocket: (OFTCPSocket*)socket
+	  server: (OFHTTPServer*)server;
+- (bool)parseRequestFromSocket: (OFTCPSocket*)socket
+		     exception: (OFException*)exception;
+- (bool)processHead: (const char*)head;
+- (bool)parseHost: (const char*)value
+	   length: (size_t)length;
+- (void)handleRequestBody;
+-  (bool)requestBody: (OFStream*)requestBody
+  didReadIntoBuffer: (char*)buffer
+	     length: (size_t)length
+	  exception: (OFException*)exception;
+- (bool)sendErrorAndClose: (short)statusCode;
+- (void)createResponse;
+- (void)responseDidFinishKeepingAlive: (bool)keepAlive;
+- (void)awaitNextRequest;
+@end
+
+static void
+appendToHeaderBuffer(OFHTTPServer_Connection *connection, size_t *length,
+    const char *string, size_t stringLength)
+{
+	if (stringLength > SIZE_MAX - *length)
+		@throw [OFOutOfRangeException exception];
+
+	if (*length + stringLength > connection->_headerBufferSize) {
+		size_t size = connection->_headerBufferSize;
+
+		if (size < MIN_HEADER_BUFFER_SIZE)
+			size = MIN_HEADER_BUFFER_SIZE;
+
+		while (size < *length + stringLength) {
+			if (size > SIZE_MAX / 2)
+				@throw [OFOutOfRangeException exception];
+
+			size *= 2;
+		}
+
+		connection->_headerBuffer = [connection
+		    resizeMemory: connection->_headerBuffer
+			    size: size];
+		connection->_headerBufferSize = size;
 	}
 
-	return [OFString stringWithUTF8StringNoCopy: cString
-				       freeWhenDone: true];
+	memcpy(connection->_headerBuffer + *length, string, stringLength);
+	*length += stringLength;
 }
 
 @interface OFHTTPServerResponse: OFHTTPResponse
@@ -175,18 +577,72 @@ normalizedKey(OFString *key)
 	OFTCPSocket *_socket;
 	OFHTTPServer *_server;
 	OFHTTPRequest *_request;
-	bool _chunked, _headersSent;
+	OFHTTPServer_Connection *_connection;
+	OFGZIPStream *_compressionStream;
+	bool _chunked, _headersSent, _keepAlive, _compressionChecked;
+#ifdef OF_HAVE_FILES
+	uint64_t _fileLength;
+#endif
 }
 
 - initWithSocket: (OFTCPSocket*)socket
 	  server: (OFHTTPServer*)server
-	 request: (OFHTTPRequest*)request;
+	 request: (OFHTTPRequest*)request
+      connection: (OFHTTPServer_Connection*)connection
+       keepAlive: (bool)keepAlive;
+- (bool)OF_hasDelimitedBody;
+- (size_t)OF_serializeHeadersWithEmptyBody: (bool)emptyBody;
+- (void)OF_setUpCompressionWithEmptyBody: (bool)emptyBody;
+- (void)OF_sendBuffer: (const void*)buffer
+	       length: (size_t)length;
+- (void)OF_sendHead;
+#ifdef OF_HAVE_FILES
+- (void)OF_sendFile: (OFFile*)file
+	     length: (uint64_t)length;
+- (void)OF_stream: (OFStream*)file
+  didTransferToStream: (OFStream*)response
+	       length: (uint64_t)length
+	    exception: (OFException*)exception;
+#endif
+@end
+
+/*
+ * The stream the compressed body is written to, which sends it as chunks of
+ * the response.
+ */
+@interface OFHTTPServerCompressedBody: OFStream
+{
+	/* Not retained, as the response owns the compression stream */
+	OFHTTPServerResponse *_response;
+}
+
+- initWithResponse: (OFHTTPServerResponse*)response;
+@end
+
+@implementation OFHTTPServerCompressedBody
+- initWithResponse: (OFHTTPServerResponse*)response
+{
+	self = [super init];
+
+	_response = response;
+
+	return self;
+}
+
+- (void)lowlevelWriteBuffer: (const void*)buffer
+		     length: (size_t)length
+{
+	[_response OF_sendBuffer: buffer
+			  length: length];
+}
 @end
 
 @implementation OFHTTPServerResponse
 - initWithSocket: (OFTCPSocket*)socket
 	  server: (OFHTTPServer*)server
 	 request: (OFHTTPRequest*)request
+      connection: (OFHTTPServer_Connection*)connection
+       keepAlive: (bool)keepAlive
 {
 	self = [super init];
 
@@ -194,6 +650,8 @@ normalizedKey(OFString *key)
 	_socket = [socket retain];
 	_server = [server retain];
 	_request = [request retain];
+	_connection = [connection retain];
+	_keepAlive = keepAlive;
 
 	return self;
 }
@@ -203,153 +661,583 @@ normalizedKey(OFString *key)
 	if (_socket != nil)
 		[self close];	/* includes [_socket release] */
 
+	[_compressionStream release];
 	[_server release];
 	[_request release];
+	[_connection release];
 
 	[super dealloc];
 }
 
-- (void)OF_sendHeaders
+- (bool)OF_hasDelimitedBody
+{
+	if ([_request method] == OF_HTTP_REQUEST_METHOD_HEAD)
+		return true;
+
+	if ((_statusCode >= 100 && _statusCode < 200) || _statusCode == 204 ||
+	    _statusCode == 304)
+		return true;
+
+	if ([_headers objectForKey: @"Content-Length"] != nil)
+		return true;
+
+	return [[_headers objectForKey: @"Transfer-Encoding"]
+	    isEqual: @"chunked"];
+}
+
+- (size_t)OF_serializeHeadersWithEmptyBody: (bool)emptyBody
 {
 	void *pool = objc_autoreleasePoolPush();
-	OFMutableDictionary OF_GENERIC(OFString*, OFString*) *headers;
-	OFEnumerator *keyEnumerator, *valueEnumerator;
-	OFString *key, *value;
+	OFString *connectionHeader = [_headers objectForKey: @"Connection"];
+	const char *reason = statusCodeToString(_statusCode);
+	OFEnumerator *keyEnumerator, *objectEnumerator;
+	OFString *key, *object, *name;
+	bool addContentLength = false;
+	char line[64];
+	size_t length = 0;
+	int lineLength;
+
+	/*
+	 * If the response is closed before anything has been written, the
+	 * body is known to be empty, which allows keeping the connection alive
+	 * even if no Content-Length was specified.
+	 */
+	if (![self OF_hasDelimitedBody]) {
+		if (emptyBody)
+			addContentLength = true;
+		else
+			_keepAlive = false;
+	}
 
-	[_socket writeFormat: @"HTTP/%@ %d %s\r\n",
-			      [self protocolVersionString], _statusCode,
-			      statusCodeToString(_statusCode)];
+	if (hasConnectionToken(connectionHeader, @"close"))
+		_keepAlive = false;
+
+	lineLength = snprintf(line, sizeof(line), "HTTP/%u.%u %d %s\r\n",
+	    _protocolVersion.major, _protocolVersion.minor, _statusCode,
+	    (reason != NULL ? reason : ""));
+	if (lineLength < 0 || (size_t)lineLength >= sizeof(line))
+		@throw [OFOutOfRangeException exception];
+
+	appendToHeaderBuffer(_connection, &length, line, lineLength);
+
+	keyEnumerator = [_headers keyEnumerator];
+	objectEnumerator = [_headers objectEnumerator];
+	while ((key = [keyEnumerator nextObject]) != nil &&
+	    (object = [objectEnumerator nextObject]) != nil) {
+		appendToHeaderBuffer(_connection, &length, [key UTF8String],
+		    [key UTF8StringLength]);
+		appendToHeaderBuffer(_connection, &length, ": ", 2);
+		appendToHeaderBuffer(_connection, &length, [object UTF8String],
+		    [object UTF8StringLength]);
+		appendToHeaderBuffer(_connection, &length, "\r\n", 2);
+	}
+
+	if (addContentLength)
+		appendToHeaderBuffer(_connection, &length,
+		    "Content-Length: 0\r\n", 19);
+
+	if (connectionHeader == nil) {
+		if (!_keepAlive)
+			appendToHeaderBuffer(_connection, &length,
+			    "Connection: close\r\n", 19);
+		else if ([_request protocolVersion].minor == 0)
+			appendToHeaderBuffer(_connection, &length,
+			    "Connection: keep-alive\r\n", 24);
+	}
+
+	if ([_headers objectForKey: @"Date"] == nil) {
+		memcpy(line, "Date: ", 6);
+		currentDate(line + 6);
+		memcpy(line + 6 + DATE_LENGTH, "\r\n", 2);
+
+		appendToHeaderBuffer(_connection, &length, line,
+		    6 + DATE_LENGTH + 2);
+	}
+
+	if ([_headers objectForKey: @"Server"] == nil &&
+	    (name = [_server name]) != nil) {
+		appendToHeaderBuffer(_connection, &length, "Server: ", 8);
+		appendToHeaderBuffer(_connection, &length, [name UTF8String],
+		    [name UTF8StringLength]);
+		appendToHeaderBuffer(_connection, &length, "\r\n", 2);
+	}
+
+	appendToHeaderBuffer(_connection, &length, "\r\n", 2);
+
+	_chunked = [[_headers objectForKey: @"Transfer-Encoding"]
+	    isEqual: @"chunked"];
+
+	objc_autoreleasePoolPop(pool);
+
+	return length;
+}
+
+- (void)OF_setUpCompressionWithEmptyBody: (bool)emptyBody
+{
+	void *pool;
+	OFMutableDictionary *headers;
+	OFString *contentLength, *transferEncoding;
+	OFHTTPServerCompressedBody *body;
+
+	_compressionChecked = true;
+
+	if (![_server compressesResponses] ||
+	    [_headers objectForKey: @"Content-Encoding"] != nil ||
+	    !isCompressibleContentType([_headers objectForKey: @"Content-Type"]))
+		return;
+
+	pool = objc_autoreleasePoolPush();
 
 	headers = [[_headers mutableCopy] autorelease];
+	addVaryAcceptEncoding(headers);
+
+	contentLength = [headers objectForKey: @"Content-Length"];
+	transferEncoding = [headers objectForKey: @"Transfer-Encoding"];
+
+	if (!emptyBody && [_request protocolVersion].minor > 0 &&
+	    [_request method] != OF_HTTP_REQUEST_METHOD_HEAD &&
+	    _statusCode >= 200 && _statusCode != 204 && _statusCode != 206 &&
+	    _statusCode != 304 &&
+	    (transferEncoding == nil || [transferEncoding isEqual: @"chunked"]) &&
+	    (contentLength == nil ||
+	    [contentLength decimalValue] >= MIN_COMPRESSED_SIZE) &&
+	    acceptsGZIP([[_request headers] objectForKey: @"Accept-Encoding"])) {
+		[headers removeObjectForKey: @"Content-Length"];
+		[headers setObject: @"gzip"
+			    forKey: @"Content-Encoding"];
+		[headers setObject: @"chunked"
+			    forKey: @"Transfer-Encoding"];
+
+		body = [[[OFHTTPServerCompressedBody alloc]
+		    initWithResponse: self] autorelease];
+		_compressionStream = [[OFGZIPStream alloc]
+		    initWithStream: body];
+		[_compressionStream setCompressionLevel:
+		    [_server compressionLevel]];
+	}
+
+	[self setHeaders: headers];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)lowlevelWriteBuffer: (const void*)buffer
+		     length: (size_t)length
+{
+	if (_socket == nil)
+		@throw [OFNotOpenException exceptionWithObject: self];
+
+	/* Whether to compress is decided once the head is about to be sent */
+	if (!_headersSent && !_compressionChecked)
+		[self OF_setUpCompressionWithEmptyBody: (length == 0)];
+
+	if (_compressionStream != nil)
+		[_compressionStream writeBuffer: buffer
+					 length: length];
+	else
+		[self OF_sendBuffer: buffer
+			     length: length];
+}
+
+- (void)OF_sendBuffer: (const void*)buffer
+	       length: (size_t)length
+{
+	of_stream_buffer_t buffers[4];
+	char chunkSize[sizeof(size_t) * 2 + 2];
+	size_t count = 0;
+
+	if (_socket == nil)
+		@throw [OFNotOpenException exceptionWithObject: self];
+
+	/* The head is sent together with the first data that is written. */
+	if (!_headersSent) {
+		buffers[count].buffer = _connection->_headerBuffer;
+		buffers[count++].length =
+		    [self OF_serializeHeadersWithEmptyBody: false];
+	}
+
+	/* An empty chunk would end the body. */
+	if (_chunked && length > 0) {
+		buffers[count].buffer = chunkSize;
+		buffers[count++].length = formatChunkSize(chunkSize, length);
+		buffers[count].buffer = buffer;
+		buffers[count++].length = length;
+		buffers[count].buffer = "\r\n";
+		buffers[count++].length = 2;
+	} else if (!_chunked) {
+		buffers[count].buffer = buffer;
+		buffers[count++].length = length;
+	}
+
+	if (count > 0)
+		[_socket writeBuffers: buffers
+				count: count];
+
+	_headersSent = true;
+}
+
+- (void)OF_sendHead
+{
+	if (!_headersSent && !_compressionChecked)
+		[self OF_setUpCompressionWithEmptyBody: false];
+
+	if (!_headersSent && _compressionStream == nil)
+		[self OF_sendBuffer: ""
+			     length: 0];
+
+	[_socket flushWriteBuffer];
+}
+
+#ifdef OF_HAVE_FILES
+- (void)OF_sendFile: (OFFile*)file
+	     length: (uint64_t)length
+{
+	[self OF_sendHead];
+
+	/*
+	 * If the file goes from the file to the socket inside the kernel, the
+	 * socket needs to be in non-blocking mode, as otherwise the run loop
+	 * would be blocked until the kernel sent all of it. A chunked or
+	 * compressed body is written to the socket with blocking writes that
+	 * cannot be resumed after a partial write.
+	 */
+	if ([self OF_rawFileDescriptorForWriting] != -1)
+		[_socket setBlocking: false];
+
+	_fileLength = length;
+
+	[file asyncTransferToStream: self
+			     length: length
+			     target: self
+			   selector: @selector(OF_stream:didTransferToStream:
+					 length:exception:)];
+}
+
+- (void)OF_stream: (OFStream*)file
+  didTransferToStream: (OFStream*)response
+	       length: (uint64_t)length
+	    exception: (OFException*)exception
+{
+	[_socket setBlocking: true];
+
+	/* The client waits for a body of the length it was promised */
+	if (length != _fileLength || exception != nil)
+		_keepAlive = false;
+
+	if (exception != nil) {
+		id <OFHTTPServerDelegate> delegate = [_server delegate];
+
+		if ([delegate respondsToSelector: @selector(server:
+		  didReceiveExceptionForResponse:request:exception:)])
+			[delegate		    server: _server
+			    didReceiveExceptionForResponse: self
+						   request: _request
+						 exception: exception];
+	}
+
+	[self close];
+}
+#endif
+
+- (int)OF_rawFileDescriptorForWriting
+{
+	/*
+	 * Only a body that is neither chunked nor compressed can be written to
+	 * the socket directly, and only once the head is out.
+	 */
+	if (_socket == nil || !_headersSent || _chunked ||
+	    _compressionStream != nil)
+		return -1;
+
+	return [_socket OF_rawFileDescriptorForWriting];
+}
+
+- (void)close
+{
+	OFHTTPServer_Connection *connection;
+	bool keepAlive = false;
+
+	if (_socket == nil)
+		@throw [OFNotOpenException exceptionWithObject: self];
+
+	@try {
+		of_stream_buffer_t buffers[2];
+		size_t count = 0;
+
+		if (!_headersSent && !_compressionChecked)
+			[self OF_setUpCompressionWithEmptyBody: true];
+
+		/* Writes the end of the compressed body as the last chunk */
+		if (_compressionStream != nil)
+			[_compressionStream close];
+
+		if (!_headersSent) {
+			buffers[count].buffer = _connection->_headerBuffer;
+			buffers[count++].length =
+			    [self OF_serializeHeadersWithEmptyBody: true];
+		}
+
+		if (_chunked) {
+			buffers[count].buffer = "0\r\n\r\n";
+			buffers[count++].length = 5;
+		}
+
+		if (count > 0)
+			[_socket writeBuffers: buffers
+					count: count];
+
+		_headersSent = true;
+		keepAlive = _keepAlive;
+	} @catch (OFWriteFailedException *e) {
+		id <OFHTTPServerDelegate> delegate = [_server delegate];
+
+		if ([delegate respondsToSelector: @selector(server:
+		  didReceiveExceptionForResponse:request:exception:)])
+			[delegate		    server: _server
+			    didReceiveExceptionForResponse: self
+						   request: _request
+						 exception: e];
+	}
+
+	[_compressionStream release];
+	_compressionStream = nil;
+
+	[_socket release];
+	_socket = nil;
+
+	connection = _connection;
+	_connection = nil;
+	@try {
+		[connection responseDidFinishKeepingAlive: keepAlive];
+	} @finally {
+		[connection release];
+	}
+
+	[super close];
+}
+
+- (int)fileDescriptorForWriting
+{
+	if (_socket == nil)
+		return -1;
+
+	return [_socket fileDescriptorForWriting];
+}
+@end
+
+@implementation OFHTTPServerRequestBody
+- initWithSocket: (OFTCPSocket*)socket
+   contentLength: (size_t)contentLength
+	 chunked: (bool)chunked
+       maxLength: (size_t)maxLength
+{
+	self = [super init];
+
+	_socket = [socket retain];
+	_chunked = chunked;
+	_toRead = contentLength;
+	_maxLength = maxLength;
+	_state = CHUNK_SIZE;
+
+	return self;
+}
+
+- (void)dealloc
+{
+	[_socket release];
+
+	[super dealloc];
+}
+
+- (bool)OF_parseChunkFraming: (char)c
+{
+	switch (_state) {
+	case CHUNK_SIZE:
+		if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') ||
+		    (c >= 'A' && c <= 'F')) {
+			size_t digit = (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+
+			if (_toRead > (SIZE_MAX - digit) / 16)
+				@throw [OFOutOfRangeException exception];
+
+			_toRead = _toRead * 16 + digit;
+			_sizeDigits++;
+			return true;
+		}
+
+		if (_sizeDigits == 0)
+			return false;
+
+		if (c == '\r')
+			_state = CHUNK_EXTENSION_LF;
+		else if (c == ';' || c == ' ' || c == '\t')
+			_state = CHUNK_EXTENSION;
+		else
+			return false;
+
+		return true;
+	case CHUNK_EXTENSION:
+		if (c == '\r')
+			_state = CHUNK_EXTENSION_LF;
+		else if ((unsigned char)c < 0x20 && c != '\t')
+			return false;
+
+		return true;
+	case CHUNK_EXTENSION_LF:
+		if (c != '\n')
+			return false;
+
+		_sizeDigits = 0;
+
+		if (_toRead == 0) {
+			_state = CHUNK_TRAILER_START;
+			return true;
+		}
+
+		/* _maxLength is what is left of the allowed size of the body */
+		if (_toRead > _maxLength)
+			@throw [OFOutOfRangeException exception];
+
+		_maxLength -= _toRead;
+		_state = CHUNK_DATA;
+
+		return true;
+	case CHUNK_DATA_CR:
+		_state = CHUNK_DATA_LF;
+		return (c == '\r');
+	case CHUNK_DATA_LF:
+		_state = CHUNK_SIZE;
+		return (c == '\n');
+	case CHUNK_TRAILER_START:
+		if (c == '\r') {
+			_state = CHUNK_TRAILER_LF;
+			return true;
+		}
+
+		_state = CHUNK_TRAILER;
+		/* Fall through */
+	case CHUNK_TRAILER:
+		if (c == '\n')
+			_state = CHUNK_TRAILER_START;
+		else if ((unsigned char)c < 0x20 && c != '\t' && c != '\r')
+			return false;
+
+		return true;
+	case CHUNK_TRAILER_LF:
+		if (c != '\n')
+			return false;
 
-	if ([headers objectForKey: @"Date"] == nil) {
-		OFString *date = [[OFDate date]
-		    dateStringWithFormat: @"%a, %d %b %Y %H:%M:%S GMT"];
+		_state = CHUNK_DONE;
+		_atEndOfStream = true;
 
-		[headers setObject: date
-			    forKey: @"Date"];
+		return true;
+	default:
+		return false;
 	}
+}
 
-	if ([headers objectForKey: @"Server"] == nil) {
-		OFString *name = [_server name];
+- (size_t)lowlevelReadIntoBuffer: (void*)buffer
+			  length: (size_t)length
+{
+	bool filled = false;
 
-		if (name != nil)
-			[headers setObject: name
-				    forKey: @"Server"];
-	}
+	if (_socket == nil)
+		@throw [OFNotOpenException exceptionWithObject: self];
 
-	keyEnumerator = [headers keyEnumerator];
-	valueEnumerator = [headers objectEnumerator];
-	while ((key = [keyEnumerator nextObject]) != nil &&
-	    (value = [valueEnumerator nextObject]) != nil)
-		[_socket writeFormat: @"%@: %@\r\n", key, value];
+	/*
+	 * Every call reads from the socket at most once, so that a read after
+	 * the run loop reported the socket as ready for reading never blocks.
+	 * This means that a call which only consumed chunk framing returns 0.
+	 */
+	while (!_atEndOfStream) {
+		const char *data;
+		size_t dataLength, i;
 
-	[_socket writeString: @"\r\n"];
+		if (!_chunked || _state == CHUNK_DATA) {
+			if (filled && ![_socket hasDataInReadBuffer])
+				return 0;
 
-	_headersSent = true;
-	_chunked = [[headers objectForKey: @"Transfer-Encoding"]
-	    isEqual: @"chunked"];
+			if (length > _toRead)
+				length = _toRead;
 
-	objc_autoreleasePoolPop(pool);
-}
+			length = [_socket readIntoBuffer: buffer
+						  length: length];
 
-- (void)lowlevelWriteBuffer: (const void*)buffer
-		     length: (size_t)length
-{
-	void *pool;
+			if (length == 0 && [_socket isAtEndOfStream])
+				@throw [OFTruncatedDataException exception];
 
-	if (_socket == nil)
-		@throw [OFNotOpenException exceptionWithObject: self];
+			_toRead -= length;
 
-	if (!_headersSent)
-		[self OF_sendHeaders];
+			if (_toRead == 0) {
+				if (_chunked)
+					_state = CHUNK_DATA_CR;
+				else
+					_atEndOfStream = true;
+			}
 
-	if (!_chunked) {
-		[_socket writeBuffer: buffer
-			      length: length];
-		return;
-	}
+			return length;
+		}
 
-	pool = objc_autoreleasePoolPush();
-	[_socket writeString: [OFString stringWithFormat: @"%zx\r\n", length]];
-	objc_autoreleasePoolPop(pool);
+		if ([_socket OF_readBufferLength] == 0) {
+			if (filled)
+				return 0;
 
-	[_socket writeBuffer: buffer
-		      length: length];
-	[_socket writeBuffer: "\r\n"
-		      length: 2];
-}
+			if ([_socket OF_fillReadBuffer] == 0) {
+				if ([_socket lowlevelIsAtEndOfStream])
+					@throw [OFTruncatedDataException
+					    exception];
 
-- (void)close
-{
-	if (_socket == nil)
-		@throw [OFNotOpenException exceptionWithObject: self];
+				return 0;
+			}
 
-	@try {
-		if (!_headersSent)
-			[self OF_sendHeaders];
+			filled = true;
+		}
 
-		if (_chunked)
-			[_socket writeBuffer: "0\r\n\r\n"
-				      length: 5];
-	} @catch (OFWriteFailedException *e) {
-		id <OFHTTPServerDelegate> delegate = [_server delegate];
+		data = [_socket OF_readBuffer];
+		dataLength = [_socket OF_readBufferLength];
 
-		if ([delegate respondsToSelector: @selector(server:
-		  didReceiveExceptionForResponse:request:exception:)])
-			[delegate		    server: _server
-			    didReceiveExceptionForResponse: self
-						   request: _request
-						 exception: e];
+		for (i = 0; i < dataLength && _state != CHUNK_DATA &&
+		    _state != CHUNK_DONE; i++) {
+			if (![self OF_parseChunkFraming: data[i]]) {
+				[_socket OF_consumeReadBuffer: i];
+				@throw [OFInvalidFormatException exception];
+			}
+		}
+
+		[_socket OF_consumeReadBuffer: i];
 	}
 
-	[_socket release];
-	_socket = nil;
+	return 0;
+}
 
-	[super close];
+- (bool)lowlevelIsAtEndOfStream
+{
+	return _atEndOfStream;
 }
 
-- (int)fileDescriptorForWriting
+- (int)fileDescriptorForReading
 {
 	if (_socket == nil)
 		return -1;
 
-	return [_socket fileDescriptorForWriting];
+	return [_socket fileDescriptorForReading];
 }
-@end
 
-@interface OFHTTPServer_Connection: OFObject
+- (bool)hasDataInReadBuffer
 {
-	OFTCPSocket *_socket;
-	OFHTTPServer *_server;
-	OFTimer *_timer;
-	enum {
-		AWAITING_PROLOG,
-		PARSING_HEADERS,
-		SEND_RESPONSE
-	} _state;
-	uint8_t _HTTPMinorVersion;
-	of_http_request_method_t _method;
-	OFString *_host, *_path;
-	uint16_t _port;
-	OFMutableDictionary *_headers;
-	size_t _contentLength;
-	OFDataArray *_body;
+	if ([super hasDataInReadBuffer] || _atEndOfStream)
+		return true;
+
+	return [_socket hasDataInReadBuffer];
 }
 
-- initWithSocket: (OFTCPSocket*)socket
-	  server: (OFHTTPServer*)server;
-- (bool)socket: (OFTCPSocket*)socket
-   didReadLine: (OFString*)line
-     exception: (OFException*)exception;
-- (bool)parseProlog: (OFString*)line;
-- (bool)parseHeaders: (OFString*)line;
--      (bool)socket: (OFTCPSocket*)socket
-  didReadIntoBuffer: (char*)buffer
-	     length: (size_t)length
-	  exception: (OFException*)exception;
-- (bool)sendErrorAndClose: (short)statusCode;
-- (void)createResponse;
+- (void)close
+{
+	[_socket release];
+	_socket = nil;
+
+	[super close];
+}
 @end
 
 @implementation OFHTTPServer_Connection
@@ -358,16 +1246,28 @@ normalizedKey(OFString *key)
 {
 	self = [super init];
 
+#ifdef OF_HAVE_THREADS
+	/*
+	 * The accepting thread already accounted for this connection when it
+	 * handed it over, so this needs to be set even if init fails.
+	 */
+	if ([[OFThread currentThread] isKindOfClass:
+	    [OFHTTPServer_Thread class]])
+		_thread = (OFHTTPServer_Thread*)
+		    [[OFThread currentThread] retain];
+#endif
+
 	@try {
 		_socket = [socket retain];
 		_server = [server retain];
+		_runLoop = [[OFRunLoop currentRunLoop] retain];
 		_timer = [[OFTimer
 		    scheduledTimerWithTimeInterval: 10
 					    target: socket
 					  selector: @selector(
 							cancelAsyncRequests)
 					   repeats: false] retain];
-		_state = AWAITING_PROLOG;
+		of_http_parser_init(&_parser, false);
 	} @catch (id e) {
 		[self release];
 		@throw e;
@@ -380,6 +1280,7 @@ normalizedKey(OFString *key)
 {
 	[_socket release];
 	[_server release];
+	[_runLoop release];
 
 	[_timer invalidate];
 	[_timer release];
@@ -387,215 +1288,272 @@ normalizedKey(OFString *key)
 	[_host release];
 	[_path release];
 	[_headers release];
+	[_requestBody release];
 	[_body release];
 
+#ifdef OF_HAVE_THREADS
+	if (_thread != nil) {
+		addConnection(_thread, -1);
+		[_thread release];
+	}
+#endif
+
 	[super dealloc];
 }
 
-- (bool)socket: (OFTCPSocket*)socket
-   didReadLine: (OFString*)line
-     exception: (OFException*)exception
+- (bool)parseRequestFromSocket: (OFTCPSocket*)socket
+		     exception: (OFException*)exception
 {
-	if (line == nil || exception != nil)
+	const char *head;
+
+	if (exception != nil)
 		return false;
 
-	@try {
-		switch (_state) {
-		case AWAITING_PROLOG:
-			return [self parseProlog: line];
-		case PARSING_HEADERS:
-			if (![self parseHeaders: line])
-				return false;
+	/*
+	 * The head is parsed where it is in the socket's read buffer. Strings
+	 * are only created for what is needed to create the request.
+	 */
+	head = [socket OF_readBuffer];
 
-			if (_state == SEND_RESPONSE) {
-				[self createResponse];
+	@try {
+		switch (of_http_parser_parse(&_parser, head,
+		    [socket OF_readBufferLength])) {
+		case OF_HTTP_PARSER_INCOMPLETE:
+			if ([socket lowlevelIsAtEndOfStream])
 				return false;
-			}
 
+			[socket OF_setWaitingForDelimiter: true];
 			return true;
+		case OF_HTTP_PARSER_DONE:
+			break;
+		case OF_HTTP_PARSER_UNKNOWN_METHOD:
+			return [self sendErrorAndClose: 405];
+		case OF_HTTP_PARSER_TOO_LARGE:
+			return [self sendErrorAndClose: 431];
 		default:
-			return false;
+			return [self sendErrorAndClose: 400];
 		}
+
+		[socket OF_setWaitingForDelimiter: false];
+
+		return [self processHead: head];
 	} @catch (OFWriteFailedException *e) {
 		return false;
 	}
-
-	OF_ENSURE(0);
 }
 
-- (bool)parseProlog: (OFString*)line
+- (bool)processHead: (const char*)head
 {
-	OFString *method;
-	OFMutableString *path;
-	size_t pos;
-
-	@try {
-		OFString *version = [line
-		    substringWithRange: of_range([line length] - 9, 9)];
-		of_unichar_t tmp;
-
-		if (![version hasPrefix: @" HTTP/1."])
-			return [self sendErrorAndClose: 505];
+	ssize_t host;
+	uintmax_t contentLength;
+	OFHTTPRouter *router;
+	OFTimer *timer;
 
-		tmp = [version characterAtIndex: 8];
-		if (tmp < '0' || tmp > '9')
-			return [self sendErrorAndClose: 400];
+	if (_parser.major != 1)
+		return [self sendErrorAndClose: 505];
 
-		_HTTPMinorVersion = (uint8_t)(tmp - '0');
-	} @catch (OFOutOfRangeException *e) {
-		return [self sendErrorAndClose: 400];
-	}
+	_method = _parser.method;
+	_HTTPMinorVersion = _parser.minor;
 
-	pos = [line rangeOfString: @" "].location;
-	if (pos == OF_NOT_FOUND)
+	if (head[_parser.targetStart] != '/')
 		return [self sendErrorAndClose: 400];
 
-	method = [line substringWithRange: of_range(0, pos)];
-	@try {
-		_method = of_http_request_method_from_string(
-		    [method UTF8String]);
-	} @catch (OFInvalidFormatException *e) {
-		return [self sendErrorAndClose: 405];
+	_path = [[OFString alloc]
+	    initWithUTF8String: head + _parser.targetStart + 1
+			length: _parser.targetLength - 1];
+
+	/*
+	 * Routing happens on the bytes of the path, which are the same as
+	 * those of _path, so that the match can refer to them later.
+	 */
+	if ((router = [_server router]) != nil) {
+		const char *path = head + _parser.targetStart + 1;
+		const char *query = memchr(path, '?', _parser.targetLength - 1);
+		size_t pathLength = (query != NULL ? (size_t)(query - path)
+		    : _parser.targetLength - 1);
+
+		_routed = [router matchPath: path
+				     length: pathLength
+				      match: &_match];
 	}
 
-	@try {
-		of_range_t range = of_range(pos + 1, [line length] - pos - 10);
+	host = of_http_parser_find_header(&_parser, OF_HTTP_HEADER_HOST, 0);
+	if (host != -1) {
+		if (of_http_parser_find_header(&_parser, OF_HTTP_HEADER_HOST,
+		    host + 1) != -1)
+			return [self sendErrorAndClose: 400];
 
-		path = [[[line substringWithRange:
-		    range] mutableCopy] autorelease];
-	} @catch (OFOutOfRangeException *e) {
-		return [self sendErrorAndClose: 400];
+		if (![self parseHost: head + _parser.headers[host].valueStart
+			      length: _parser.headers[host].valueLength])
+			return [self sendErrorAndClose: 400];
 	}
 
-	[path deleteEnclosingWhitespaces];
+	switch (of_http_parser_chunked(&_parser, head)) {
+	case -1:
+		return [self sendErrorAndClose: 501];
+	case 1:
+		_chunked = true;
+		break;
+	}
 
-	if (![path hasPrefix: @"/"])
+	switch (of_http_parser_content_length(&_parser, head, &contentLength)) {
+	case -1:
 		return [self sendErrorAndClose: 400];
+	case 1:
+		/*
+		 * Both would allow to smuggle a request past anything in
+		 * between which uses the other one to find the end of the body.
+		 */
+		if (_chunked)
+			return [self sendErrorAndClose: 400];
 
-	[path deleteCharactersInRange: of_range(0, 1)];
-	[path makeImmutable];
+		if (contentLength > [_server maxRequestBodySize])
+			return [self sendErrorAndClose: 413];
 
-	_headers = [[OFMutableDictionary alloc] init];
-	_path = [path copy];
-	_state = PARSING_HEADERS;
+		_contentLength = (size_t)contentLength;
+		break;
+	}
 
-	return true;
-}
+	if (_HTTPMinorVersion > 0)
+		_keepAliveRequested = !of_http_parser_has_token(&_parser, head,
+		    OF_HTTP_HEADER_CONNECTION, "close");
+	else
+		_keepAliveRequested = of_http_parser_has_token(&_parser, head,
+		    OF_HTTP_HEADER_CONNECTION, "keep-alive");
 
-- (bool)parseHeaders: (OFString*)line
-{
-	OFString *key, *value, *old;
-	size_t pos;
+	_headers = [of_http_parser_headers(&_parser, head) retain];
+	[_socket OF_consumeReadBuffer: _parser.length];
 
-	if ([line length] == 0) {
-		intmax_t contentLength;
+	if (!_chunked && _contentLength == 0) {
+		[self createResponse];
+		return false;
+	}
 
-		@try {
-			contentLength = [[_headers
-			    objectForKey: @"Content-Length"] decimalValue];
-		} @catch (OFInvalidFormatException *e) {
-			return [self sendErrorAndClose: 400];
-		}
+	_requestBody = [[OFHTTPServerRequestBody alloc]
+	    initWithSocket: _socket
+	     contentLength: _contentLength
+		   chunked: _chunked
+		 maxLength: [_server maxRequestBodySize]];
+
+	/*
+	 * Reading the body asynchronously must not start before the run loop
+	 * stopped observing the socket, which only happens once this returns,
+	 * as both share the same file descriptor.
+	 */
+	timer = [OFTimer timerWithTimeInterval: 0
+					target: self
+				      selector: @selector(handleRequestBody)
+				       repeats: false];
+	[_runLoop addTimer: timer];
 
-		if (contentLength > 0) {
-			char *buffer;
+	return false;
+}
 
-			buffer = [self allocMemoryWithSize: BUFFER_SIZE];
-			_body = [[OFDataArray alloc] init];
+- (bool)parseHost: (const char*)value
+	   length: (size_t)length
+{
+	size_t pos = length;
+	uint32_t port = 0;
 
-			[_socket asyncReadIntoBuffer: buffer
-					      length: BUFFER_SIZE
-					      target: self
-					    selector: @selector(socket:
-							  didReadIntoBuffer:
-							  length:exception:)];
-			[_timer setFireDate:
-			    [OFDate dateWithTimeIntervalSinceNow: 5]];
+	/* A colon inside of an IPv6 address does not start the port */
+	if (length > 0 && value[length - 1] != ']')
+		while (pos > 0 && value[pos - 1] != ':')
+			pos--;
 
+	if (pos == 0 || pos == length) {
+		if (pos == length && length > 0 && value[length - 1] == ':')
 			return false;
-		}
 
-		_state = SEND_RESPONSE;
+		_host = [[OFString alloc] initWithUTF8String: value
+						      length: length];
+		_port = 80;
+
 		return true;
 	}
 
-	pos = [line rangeOfString: @":"].location;
-	if (pos == OF_NOT_FOUND)
-		return [self sendErrorAndClose: 400];
-
-	key = [line substringWithRange: of_range(0, pos)];
-	value = [line substringWithRange:
-	    of_range(pos + 1, [line length] - pos - 1)];
-
-	key = normalizedKey([key stringByDeletingTrailingWhitespaces]);
-	value = [value stringByDeletingLeadingWhitespaces];
-
-	old = [_headers objectForKey: key];
-	if (old != nil)
-		value = [old stringByAppendingFormat: @",%@", value];
+	for (size_t i = pos; i < length; i++) {
+		if (value[i] < '0' || value[i] > '9')
+			return false;
 
-	[_headers setObject: value
-		     forKey: key];
+		port = port * 10 + (value[i] - '0');
 
-	if ([key isEqual: @"Host"]) {
-		pos = [value
-		    rangeOfString: @":"
-			  options: OF_STRING_SEARCH_BACKWARDS].location;
+		if (port > UINT16_MAX)
+			return false;
+	}
 
-		if (pos != OF_NOT_FOUND) {
-			[_host release];
-			_host = [[value substringWithRange:
-			    of_range(0, pos)] retain];
+	if (port == 0)
+		return false;
 
-			@try {
-				of_range_t range =
-				    of_range(pos + 1, [value length] - pos - 1);
-				intmax_t portTmp = [[value
-				    substringWithRange: range] decimalValue];
+	_host = [[OFString alloc] initWithUTF8String: value
+					      length: pos - 1];
+	_port = (uint16_t)port;
 
-				if (portTmp < 1 || portTmp > UINT16_MAX)
-					return [self sendErrorAndClose: 400];
+	return true;
+}
 
-				_port = (uint16_t)portTmp;
-			} @catch (OFInvalidFormatException *e) {
-				return [self sendErrorAndClose: 400];
-			}
-		} else {
-			[_host release];
-			_host = [value retain];
-			_port = 80;
+- (void)handleRequestBody
+{
+	@try {
+		if (_routed || [[_server delegate] respondsToSelector:
+		    @selector(server:didReceiveRequest:requestBody:response:)]) {
+			[self createResponse];
+			return;
 		}
+	} @catch (OFWriteFailedException *e) {
+		return;
 	}
 
-	return true;
+	/* The buffer is reused for all requests on this connection. */
+	if (_buffer == NULL)
+		_buffer = [self allocMemoryWithSize: BUFFER_SIZE];
+
+	_body = [[OFDataArray alloc] init];
+
+	[_timer invalidate];
+	[_timer release];
+	_timer = [[OFTimer
+	    scheduledTimerWithTimeInterval: 5
+				    target: _requestBody
+				  selector: @selector(cancelAsyncRequests)
+				   repeats: false] retain];
+
+	/*
+	 * The request body never returns more than the body, as the data that
+	 * follows belongs to the next pipelined request.
+	 */
+	[_requestBody asyncReadIntoBuffer: _buffer
+				   length: BUFFER_SIZE
+				   target: self
+				 selector: @selector(requestBody:
+					       didReadIntoBuffer:length:
+					       exception:)];
 }
 
--      (bool)socket: (OFTCPSocket*)socket
+-  (bool)requestBody: (OFStream*)requestBody
   didReadIntoBuffer: (char*)buffer
 	     length: (size_t)length
 	  exception: (OFException*)exception
 {
-	if ([socket isAtEndOfStream] || exception != nil)
-		return false;
+	@try {
+		if (exception != nil) {
+			if ([exception isKindOfClass:
+			    [OFOutOfRangeException class]])
+				[self sendErrorAndClose: 413];
+			else if ([exception isKindOfClass:
+			    [OFInvalidFormatException class]])
+				[self sendErrorAndClose: 400];
 
-	[_body addItems: buffer
-		  count: length];
+			return false;
+		}
 
-	if ([_body count] >= _contentLength) {
-		/*
-		 * Manually free the buffer here. While this is not required
-		 * now as the async read is the only thing referencing self and
-		 * the buffer is allocated on self, it is required once
-		 * Connection: keep-alive is implemented.
-		 */
-		[self freeMemory: buffer];
+		[_body addItems: buffer
+			  count: length];
 
-		@try {
+		if ([requestBody isAtEndOfStream]) {
 			[self createResponse];
-		} @catch (OFWriteFailedException *e) {
 			return false;
 		}
-
+	} @catch (OFWriteFailedException *e) {
 		return false;
 	}
 
@@ -606,12 +1564,14 @@ normalizedKey(OFString *key)
 
 - (bool)sendErrorAndClose: (short)statusCode
 {
-	OFString *date = [[OFDate date]
-	    dateStringWithFormat: @"%a, %d %b %Y %H:%M:%S GMT"];
+	char date[DATE_LENGTH + 1];
+
+	currentDate(date);
 
 	[_socket writeFormat: @"HTTP/1.1 %d %s\r\n"
-			      @"Date: %@\r\n"
+			      @"Date: %s\r\n"
 			      @"Server: %@\r\n"
+			      @"Connection: close\r\n"
 			      @"\r\n",
 			      statusCode, statusCodeToString(statusCode),
 			      date, [_server name]];
@@ -624,7 +1584,8 @@ normalizedKey(OFString *key)
 	OFURL *URL;
 	OFHTTPRequest *request;
 	OFHTTPServerResponse *response;
-	size_t pos;
+	id <OFHTTPServerDelegate> delegate;
+	bool keepAlive = _keepAliveRequested;
 
 	[_timer invalidate];
 	[_timer release];
@@ -641,22 +1602,12 @@ normalizedKey(OFString *key)
 		_port = [_server port];
 	}
 
-	URL = [OFURL URL];
-	[URL setScheme: @"http"];
-	[URL setHost: _host];
-	[URL setPort: _port];
-
-	if ((pos = [_path rangeOfString: @"?"].location) != OF_NOT_FOUND) {
-		OFString *path, *query;
-
-		path = [_path substringWithRange: of_range(0, pos)];
-		query = [_path substringWithRange:
-		    of_range(pos + 1, [_path length] - pos - 1)];
-
-		[URL setPath: path];
-		[URL setQuery: query];
-	} else
-		[URL setPath: _path];
+	URL = [[[OFURL alloc] OF_initWithScheme: @"http"
+					   host: _host
+					   port: _port
+				   pathAndQuery: [_path UTF8String]
+					 length: [_path UTF8StringLength]]
+	    autorelease];
 
 	request = [OFHTTPRequest requestWithURL: URL];
 	[request setMethod: _method];
@@ -666,19 +1617,127 @@ normalizedKey(OFString *key)
 	[request setBody: _body];
 	[request setRemoteAddress: [_socket remoteAddress]];
 
+	if (++_numberOfRequests >= [_server maxRequestsPerConnection])
+		keepAlive = false;
+
 	response = [[[OFHTTPServerResponse alloc]
 	    initWithSocket: _socket
 		    server: _server
-		   request: request] autorelease];
+		   request: request
+		connection: self
+		 keepAlive: keepAlive] autorelease];
+
+	if (_routed) {
+		_match.path = [_path UTF8String];
+		[_match.handler server: _server
+		     didReceiveRequest: request
+			   requestBody: _requestBody
+				 match: &_match
+			      response: response];
+		return;
+	}
+
+	delegate = [_server delegate];
+
+	/* Requests matching no route are for the delegate, if there is one */
+	if (delegate == nil && [_server router] != nil) {
+		[response setStatusCode: 404];
+		[response close];
+		return;
+	}
+
+	if ([delegate respondsToSelector:
+	    @selector(server:didReceiveRequest:requestBody:response:)])
+		[delegate server: _server
+	       didReceiveRequest: request
+		     requestBody: _requestBody
+			response: response];
+	else
+		[delegate server: _server
+	       didReceiveRequest: request
+			response: response];
+}
+
+- (void)responseDidFinishKeepingAlive: (bool)keepAlive
+{
+	OFTimer *timer;
 
-	[[_server delegate] server: _server
-		 didReceiveRequest: request
-			  response: response];
+	if (!keepAlive)
+		return;
+
+	/* What is left of the body would be taken for the next request. */
+	if (_requestBody != nil && ![_requestBody lowlevelIsAtEndOfStream])
+		return;
+
+	/*
+	 * The response might have been closed from another thread, but the
+	 * socket has to be read from the run loop handling the connection.
+	 * If there was a body, the run loop might still be observing it and
+	 * needs to stop doing so before the socket is observed again.
+	 */
+	if ([OFRunLoop currentRunLoop] == _runLoop && _requestBody == nil) {
+		[self awaitNextRequest];
+		return;
+	}
+
+	timer = [OFTimer timerWithTimeInterval: 0
+					target: self
+				      selector: @selector(awaitNextRequest)
+				       repeats: false];
+	[_runLoop addTimer: timer];
+}
+
+- (void)awaitNextRequest
+{
+	[_host release];
+	_host = nil;
+	[_path release];
+	_path = nil;
+	[_requestBody release];
+	_requestBody = nil;
+	[_body release];
+	_body = nil;
+	[_headers release];
+	_headers = nil;
+
+	of_http_parser_init(&_parser, false);
+	_port = 0;
+	_chunked = false;
+	_routed = false;
+	_contentLength = 0;
+
+	_timer = [[OFTimer
+	    scheduledTimerWithTimeInterval: [_server keepAliveTimeout]
+				    target: _socket
+				  selector: @selector(cancelAsyncRequests)
+				   repeats: false] retain];
+
+	[OFRunLoop OF_addAsyncFillReadBufferForStream: _socket
+						target: self
+					      selector: @selector(
+							    parseRequestFromSocket:
+							    exception:)];
 }
 @end
 
 @implementation OFHTTPServer
 @synthesize host = _host, port = _port, delegate = _delegate, name = _name;
+@synthesize keepAliveTimeout = _keepAliveTimeout;
+@synthesize maxRequestsPerConnection = _maxRequestsPerConnection;
+@synthesize maxRequestBodySize = _maxRequestBodySize;
+@synthesize compressesResponses = _compressesResponses;
+
+#if !defined(OF_HAVE_COMPILER_TLS) && defined(OF_HAVE_THREADS)
++ (void)initialize
+{
+	if (self != [OFHTTPServer class])
+		return;
+
+	if (!of_spinlock_new(&dateCacheLock))
+		@throw [OFInitializationFailedException
+		    exceptionWithClass: self];
+}
+#endif
 
 + (instancetype)server
 {
@@ -691,19 +1750,99 @@ normalizedKey(OFString *key)
 
 	_name = @"OFHTTPServer (ObjFW's HTTP server class "
 	    @"<https://heap.zone/objfw/>)";
+	_keepAliveTimeout = 10;
+	_maxRequestsPerConnection = 100;
+	_maxRequestBodySize = SIZE_MAX;
+	_compressionLevel = 6;
+#ifdef OF_HAVE_THREADS
+	_numberOfThreads = 1;
+#endif
 
 	return self;
 }
 
 - (void)dealloc
 {
+#ifdef OF_HAVE_THREADS
+	/*
+	 * -[OFRunLoop runUntilDate:] resets the stop flag, so stopping the run
+	 * loop directly is lost if a worker has not started running it yet.
+	 * A timer is kept until the run loop runs it, so use that instead.
+	 */
+	for (OFHTTPServer_Thread *thread in _threadPool)
+		[thread performSelector: @selector(OF_stop)
+			       onThread: thread
+			  waitUntilDone: false];
+
+	/*
+	 * The last connection might have been released by a worker thread, in
+	 * which case that worker cannot be joined. It still returns from its
+	 * run loop once the method returns and is detached when it releases
+	 * itself.
+	 */
+	for (OFHTTPServer_Thread *thread in _threadPool)
+		if (thread != [OFThread currentThread])
+			[thread join];
+
+	[_threadPool release];
+#endif
+
 	[_host release];
 	[_listeningSocket release];
 	[_name release];
+	[_router release];
 
 	[super dealloc];
 }
 
+- (void)setCompressionLevel: (int)compressionLevel
+{
+	if (compressionLevel < 0 || compressionLevel > 9)
+		@throw [OFInvalidArgumentException exception];
+
+	_compressionLevel = compressionLevel;
+}
+
+- (int)compressionLevel
+{
+	return _compressionLevel;
+}
+
+- (void)setRouter: (OFHTTPRouter*)router
+{
+	OFHTTPRouter *old;
+
+	if (_listeningSocket != nil)
+		@throw [OFAlreadyConnectedException exception];
+
+	old = _router;
+	_router = [router retain];
+	[old release];
+}
+
+- (OFHTTPRouter*)router
+{
+	return _router;
+}
+
+#ifdef OF_HAVE_THREADS
+- (void)setNumberOfThreads: (size_t)numberOfThreads
+{
+	if (numberOfThreads == 0)
+		@throw [OFInvalidArgumentException exception];
+
+	if (_listeningSocket != nil)
+		@throw [OFAlreadyConnectedException exception];
+
+	_numberOfThreads = numberOfThreads;
+}
+
+- (size_t)numberOfThreads
+{
+	return _numberOfThreads;
+}
+#endif
+
 - (void)start
 {
 	if (_host == nil)
@@ -712,6 +1851,26 @@ normalizedKey(OFString *key)
 	if (_listeningSocket != nil)
 		@throw [OFAlreadyConnectedException exception];
 
+#ifdef OF_HAVE_THREADS
+	/*
+	 * Threads are kept when the server is stopped, as they still handle
+	 * the existing connections.
+	 */
+	if (_numberOfThreads > 1) {
+		if (_threadPool == nil)
+			_threadPool = [[OFMutableArray alloc] init];
+
+		while ([_threadPool count] < _numberOfThreads) {
+			OFHTTPServer_Thread *thread =
+			    [OFHTTPServer_Thread thread];
+
+			[thread setName: @"OFHTTPServer worker"];
+			[thread start];
+			[_threadPool addObject: thread];
+		}
+	}
+#endif
+
 	_listeningSocket = [[OFTCPSocket alloc] init];
 	_port = [_listeningSocket bindToHost: _host
 					port: _port];
@@ -730,12 +1889,66 @@ normalizedKey(OFString *key)
 	_listeningSocket = nil;
 }
 
+#ifdef OF_HAVE_FILES
+- (void)sendFileAtPath: (OFString*)path
+	    forRequest: (OFHTTPRequest*)request
+	      response: (OFHTTPResponse*)response
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFFileManager *fileManager = [OFFileManager defaultManager];
+	OFMutableDictionary *headers;
+	OFString *GZIPPath = [path stringByAppendingString: @".gz"];
+	OFFile *file;
+	of_offset_t size;
+
+	headers = [[[response headers] mutableCopy] autorelease];
+	if (headers == nil)
+		headers = [OFMutableDictionary dictionary];
+
+	if ([headers objectForKey: @"Content-Type"] == nil)
+		[headers setObject: contentTypeForPath(path)
+			    forKey: @"Content-Type"];
+
+	if ([fileManager fileExistsAtPath: GZIPPath]) {
+		addVaryAcceptEncoding(headers);
+
+		if (acceptsGZIP(
+		    [[request headers] objectForKey: @"Accept-Encoding"])) {
+			path = GZIPPath;
+			[headers setObject: @"gzip"
+				    forKey: @"Content-Encoding"];
+		}
+	}
+
+	file = [OFFile fileWithPath: path
+			       mode: @"rb"];
+	size = [fileManager sizeOfFileAtPath: path];
+
+	[headers setObject: [OFString stringWithFormat: @"%jd", (intmax_t)size]
+		    forKey: @"Content-Length"];
+
+	[response setStatusCode: 200];
+	[response setHeaders: headers];
+
+	if ([request method] == OF_HTTP_REQUEST_METHOD_HEAD || size == 0)
+		[response close];
+	else if ([response isKindOfClass: [OFHTTPServerResponse class]])
+		[(OFHTTPServerResponse*)response OF_sendFile: file
+						      length: size];
+	else {
+		[file transferToStream: response
+				length: size];
+		[response close];
+	}
+
+	objc_autoreleasePoolPop(pool);
+}
+#endif
+
 - (bool)OF_socket: (OFTCPSocket*)socket
   didAcceptSocket: (OFTCPSocket*)clientSocket
 	exception: (OFException*)exception
 {
-	OFHTTPServer_Connection *connection;
-
 	if (exception != nil) {
 		if ([_delegate respondsToSelector:
 		    @selector(server:didReceiveExceptionOnListeningSocket:)])
@@ -745,14 +1958,46 @@ normalizedKey(OFString *key)
 		return false;
 	}
 
-	connection = [[[OFHTTPServer_Connection alloc]
-	    initWithSocket: clientSocket
-		    server: self] autorelease];
+#ifdef OF_HAVE_THREADS
+	if (_numberOfThreads > 1) {
+		OFHTTPServer_Thread *const *threads = [_threadPool objects];
+		OFHTTPServer_Thread *thread = threads[0];
+
+		for (size_t i = 1; i < _numberOfThreads; i++)
+			if (threads[i]->_connections < thread->_connections)
+				thread = threads[i];
+
+		addConnection(thread, 1);
+
+		@try {
+			[self performSelector: @selector(OF_handleClientSocket:)
+				     onThread: thread
+				   withObject: clientSocket
+				waitUntilDone: false];
+		} @catch (id e) {
+			addConnection(thread, -1);
+			@throw e;
+		}
+
+		return true;
+	}
+#endif
 
-	[clientSocket asyncReadLineWithTarget: connection
-				     selector: @selector(socket:didReadLine:
-						  exception:)];
+	[self OF_handleClientSocket: clientSocket];
 
 	return true;
 }
+
+- (void)OF_handleClientSocket: (OFTCPSocket*)clientSocket
+{
+	OFHTTPServer_Connection *connection = [[[OFHTTPServer_Connection alloc]
+	    initWithSocket: clientSocket
+		    server: self] autorelease];
+
+	[OFRunLoop OF_addAsyncFillReadBufferForStream: clientSocket
+						target: connection
+					      selector: @selector(
+							    parseRequestFromSocket:
+							    exception:)];
+}
 @end
@@ -25,6 +25,8 @@
 #import "OFInvalidArgumentException.h"
 #import "OFInvalidFormatException.h"
 
+#import "of_numconv.h"
+
 @interface OFINICategory_Pair: OFObject
 {
 @public
@@ -356,8 +358,11 @@ unescapeString(OFString *string)
 	    forKey: (OFString*)key
 {
 	void *pool = objc_autoreleasePoolPush();
+	char buffer[OF_INTMAX_STRING_SIZE];
+	size_t length = of_intmax_to_string(integer, buffer);
 
-	[self setString: [OFString stringWithFormat: @"%jd", integer]
+	[self setString: [OFString stringWithUTF8String: buffer
+						 length: length]
 		 forKey: key];
 
 	objc_autoreleasePoolPop(pool);
@@ -374,8 +379,11 @@ unescapeString(OFString *string)
 	  forKey: (OFString*)key
 {
 	void *pool = objc_autoreleasePoolPush();
+	char buffer[OF_DOUBLE_STRING_SIZE];
+	size_t length = of_float_to_string(float_, buffer);
 
-	[self setString: [OFString stringWithFormat: @"%g", float_]
+	[self setString: [OFString stringWithUTF8String: buffer
+						 length: length]
 		 forKey: key];
 
 	objc_autoreleasePoolPop(pool);
@@ -385,8 +393,11 @@ unescapeString(OFString *string)
 	   forKey: (OFString*)key
 {
 	void *pool = objc_autoreleasePoolPush();
+	char buffer[OF_DOUBLE_STRING_SIZE];
+	size_t length = of_double_to_string(double_, buffer);
 
-	[self setString: [OFString stringWithFormat: @"%g", double_]
+	[self setString: [OFString stringWithUTF8String: buffer
+						 length: length]
 		 forKey: key];
 
 	objc_autoreleasePoolPop(pool);
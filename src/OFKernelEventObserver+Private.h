@@ -18,6 +18,32 @@
 
 OF_ASSUME_NONNULL_BEGIN
 
+/*
+ * Implemented by delegates that let backends which can write asynchronously
+ * perform the next write of an object themselves. If the delegate returns a
+ * buffer, the backend writes as much of it as possible and reports the result
+ * with OF_object:didWriteLength:errNo: instead of calling
+ * objectIsReadyForWriting:. The buffer only needs to be valid for the call.
+ */
+@protocol OFKernelEventObserverWriteDelegate <OFKernelEventObserverDelegate>
+- (bool)OF_object: (id)object
+  getPendingWriteBuffer: (const void *_Nonnull *_Nonnull)buffer
+		 length: (size_t*)length;
+- (void)OF_object: (id)object
+   didWriteLength: (size_t)length
+	    errNo: (int)errNo;
+@end
+
+/*
+ * Implemented by delegates that can keep reading from an object until reading
+ * would block, which allows backends to observe non-blocking streams
+ * edge-triggered. Returns whether reading would block now. If not, the backend
+ * reports the object again without waiting for a new event.
+ */
+@protocol OFKernelEventObserverDrainDelegate <OFKernelEventObserverDelegate>
+- (bool)OF_readFromObjectUntilWouldBlock: (id)object;
+@end
+
 @interface OFKernelEventObserver ()
 - (void)OF_addObjectForReading: (id <OFReadyForReadingObserving>)object;
 - (void)OF_addObjectForWriting: (id <OFReadyForWritingObserving>)object;
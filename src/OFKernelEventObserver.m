@@ -40,6 +40,9 @@
 #ifdef HAVE_EPOLL
 # import "OFKernelEventObserver_epoll.h"
 #endif
+#ifdef HAVE_IO_URING
+# import "OFKernelEventObserver_io_uring.h"
+#endif
 #if defined(HAVE_POLL_H) || defined(OF_WII)
 # import "OFKernelEventObserver_poll.h"
 #endif
@@ -82,6 +85,13 @@ enum {
 
 + alloc
 {
+#ifdef HAVE_IO_URING
+	/* io_uring might be unavailable at runtime, e.g. in a sandbox */
+	if (self == [OFKernelEventObserver class] &&
+	    [OFKernelEventObserver_io_uring OF_isSupported])
+		return [OFKernelEventObserver_io_uring alloc];
+#endif
+
 	if (self == [OFKernelEventObserver class])
 #if defined(HAVE_KQUEUE)
 		return [OFKernelEventObserver_kqueue alloc];
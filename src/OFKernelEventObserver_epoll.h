@@ -18,12 +18,16 @@
 
 OF_ASSUME_NONNULL_BEGIN
 
+@class OFDataArray;
 @class OFMapTable;
 
 @interface OFKernelEventObserver_epoll: OFKernelEventObserver
 {
 	int _epfd;
-	OFMapTable *_FDToEvents;
+	OFMapTable *_FDToInterest;
+	OFDataArray *_changedFDs, *_readableFDs;
+	struct epoll_event *_eventList;
+	size_t _eventListSize;
 }
 @end
 
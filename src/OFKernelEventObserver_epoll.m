@@ -28,8 +28,9 @@
 #import "OFKernelEventObserver+Private.h"
 #import "OFKernelEventObserver_epoll.h"
 #import "OFArray.h"
+#import "OFDataArray.h"
 #import "OFMapTable.h"
-#import "OFNull.h"
+#import "OFStream.h"
 #ifdef OF_HAVE_THREADS
 # import "OFMutex.h"
 #endif
@@ -37,10 +38,36 @@
 #import "OFInitializationFailedException.h"
 #import "OFObserveFailedException.h"
 
-#define EVENTLIST_SIZE 64
+#define MIN_EVENTLIST_SIZE 64
+#define MAX_EVENTLIST_SIZE 4096
+
+/*
+ * Changes of interest are only recorded when they are requested and applied
+ * right before waiting. This way, removing and adding an object again in the
+ * same iteration of the run loop, which happens whenever a stream's last
+ * queued read finishes and its handler schedules the next one, does not
+ * result in any epoll_ctl() at all.
+ *
+ * Non-blocking streams which are only observed for reading are registered
+ * edge-triggered, as the delegate reads them until reading would block. Until
+ * it does, they are kept in the list of readable file descriptors and reported
+ * again without waiting, as the kernel will not report them again.
+ */
+struct interest {
+	id readObject, writeObject;
+	uint32_t events, registeredEvents;
+	id registeredObject;
+	bool changed, readable;
+};
 
 static const of_map_table_functions_t mapFunctions = { NULL };
 
+@interface OFKernelEventObserver_epoll ()
+- (void)OF_applyChanges;
+- (void)OF_forgetReadableFD: (int)fd;
+- (void)OF_readReadableObjects;
+@end
+
 @implementation OFKernelEventObserver_epoll
 - init
 {
@@ -62,13 +89,21 @@ static const of_map_table_functions_t mapFunctions = { NULL };
 			fcntl(_epfd, F_SETFD, flags | FD_CLOEXEC);
 #endif
 
-		_FDToEvents = [[OFMapTable alloc]
+		_FDToInterest = [[OFMapTable alloc]
 		    initWithKeyFunctions: mapFunctions
 			 objectFunctions: mapFunctions];
+		_changedFDs = [[OFDataArray alloc]
+		    initWithItemSize: sizeof(int)];
+		_readableFDs = [[OFDataArray alloc]
+		    initWithItemSize: sizeof(int)];
+
+		_eventListSize = MIN_EVENTLIST_SIZE;
+		_eventList = [self allocMemoryWithSize: sizeof(*_eventList)
+						 count: _eventListSize];
 
 		memset(&event, 0, sizeof(event));
 		event.events = EPOLLIN;
-		event.data.ptr = [OFNull null];
+		event.data.fd = _cancelFD[0];
 
 		if (epoll_ctl(_epfd, EPOLL_CTL_ADD, _cancelFD[0], &event) == -1)
 			@throw [OFInitializationFailedException exception];
@@ -84,100 +119,276 @@ static const of_map_table_functions_t mapFunctions = { NULL };
 {
 	close(_epfd);
 
-	[_FDToEvents release];
+	[_FDToInterest release];
+	[_changedFDs release];
+	[_readableFDs release];
 
 	[super dealloc];
 }
 
-- (void)OF_addObject: (id)object
+- (void)OF_setObject: (id)object
       fileDescriptor: (int)fd
-	      events: (int)addEvents
+	      events: (uint32_t)events
+		 add: (bool)add
 {
-	struct epoll_event event;
-	intptr_t events;
-
-	events = (intptr_t)[_FDToEvents
+	struct interest *interest = [_FDToInterest
 	    objectForKey: (void*)((intptr_t)fd + 1)];
 
-	memset(&event, 0, sizeof(event));
-	event.events = (int)events | addEvents;
-	event.data.ptr = object;
+	if (interest == NULL) {
+		if (!add)
+			return;
 
-	if (epoll_ctl(_epfd, (events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD),
-	    fd, &event) == -1)
-		@throw [OFObserveFailedException exceptionWithObserver: self
-								 errNo: errno];
+		interest = [self allocMemoryWithSize: sizeof(*interest)];
+		memset(interest, 0, sizeof(*interest));
 
-	[_FDToEvents setObject: (void*)(events | addEvents)
-			forKey: (void*)((intptr_t)fd + 1)];
-}
+		@try {
+			[_FDToInterest setObject: interest
+					  forKey: (void*)((intptr_t)fd + 1)];
+		} @catch (id e) {
+			[self freeMemory: interest];
+			@throw e;
+		}
+	}
 
-- (void)OF_removeObject: (id)object
-	 fileDescriptor: (int)fd
-		 events: (int)removeEvents
-{
-	intptr_t events;
+	if (add) {
+		interest->events |= events;
 
-	events = (intptr_t)[_FDToEvents
-	    objectForKey: (void*)((intptr_t)fd + 1)];
-	events &= ~removeEvents;
+		if (events & EPOLLIN)
+			interest->readObject = object;
+		if (events & EPOLLOUT)
+			interest->writeObject = object;
+	} else {
+		/*
+		 * If the file descriptor was closed and its number reused, the
+		 * new object might have been added before the old one is
+		 * removed, in which case the new one must stay.
+		 */
+		if ((events & EPOLLIN) && interest->readObject != object)
+			events &= ~EPOLLIN;
+		if ((events & EPOLLOUT) && interest->writeObject != object)
+			events &= ~EPOLLOUT;
+
+		if (events == 0)
+			return;
+
+		interest->events &= ~events;
+
+		if (events & EPOLLIN)
+			interest->readObject = nil;
+		if (events & EPOLLOUT)
+			interest->writeObject = nil;
+	}
 
-	if (events == 0) {
-		if (epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, NULL) == -1)
-			@throw [OFObserveFailedException
-			    exceptionWithObserver: self
-					    errNo: errno];
+	if (!interest->changed) {
+		[_changedFDs addItem: &fd];
+		interest->changed = true;
+	}
+}
 
-		[_FDToEvents removeObjectForKey: (void*)((intptr_t)fd + 1)];
-	} else {
+- (void)OF_applyChanges
+{
+	const int *changedFDs = [_changedFDs items];
+	size_t count = [_changedFDs count];
+	bool canDrain = [_delegate respondsToSelector:
+	    @selector(OF_readFromObjectUntilWouldBlock:)];
+
+	for (size_t i = 0; i < count; i++) {
+		int fd = changedFDs[i];
+		struct interest *interest = [_FDToInterest
+		    objectForKey: (void*)((intptr_t)fd + 1)];
+		id object;
+		uint32_t events;
 		struct epoll_event event;
+		int op;
+
+		interest->changed = false;
+
+		object = (interest->readObject != nil
+		    ? interest->readObject : interest->writeObject);
+
+		events = interest->events;
+		if (events == EPOLLIN && canDrain &&
+		    [object isKindOfClass: [OFStream class]] &&
+		    ![object isBlocking])
+			events |= EPOLLET;
+
+		/*
+		 * If the object changed, the old file descriptor might have
+		 * been closed and the number reused, in which case the kernel
+		 * already dropped the registration and this needs to be
+		 * registered again even if the events are the same.
+		 */
+		if (events == interest->registeredEvents &&
+		    (events == 0 || object == interest->registeredObject))
+			op = 0;
+		else if (events == 0)
+			op = EPOLL_CTL_DEL;
+		else if (interest->registeredEvents == 0)
+			op = EPOLL_CTL_ADD;
+		else
+			op = EPOLL_CTL_MOD;
 
 		memset(&event, 0, sizeof(event));
-		event.events = (int)events;
-		event.data.ptr = object;
+		event.events = events;
+		event.data.fd = fd;
+
+		if (op != 0 && epoll_ctl(_epfd, op, fd, &event) == -1) {
+			int errNo = errno;
+
+			/*
+			 * The file descriptor was closed or reused since it
+			 * was registered.
+			 */
+			if (op == EPOLL_CTL_DEL &&
+			    (errNo == EBADF || errNo == ENOENT))
+				errNo = 0;
+			else if (op == EPOLL_CTL_MOD && errNo == ENOENT &&
+			    epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &event) == 0)
+				errNo = 0;
+			else if (op == EPOLL_CTL_ADD && errNo == EEXIST &&
+			    epoll_ctl(_epfd, EPOLL_CTL_MOD, fd, &event) == 0)
+				errNo = 0;
+
+			if (errNo != 0) {
+				/* Keep the remaining changes for next time */
+				[_changedFDs removeItemsInRange:
+				    of_range(0, i + 1)];
+
+				interest->events =
+				    interest->registeredEvents & ~EPOLLET;
+
+				if (interest->events == 0) {
+					if (interest->readable)
+						[self OF_forgetReadableFD: fd];
+
+					[_FDToInterest removeObjectForKey:
+					    (void*)((intptr_t)fd + 1)];
+					[self freeMemory: interest];
+				}
+
+				@throw [OFObserveFailedException
+				    exceptionWithObserver: self
+						    errNo: errNo];
+			}
+		}
+
+		interest->registeredEvents = events;
+		interest->registeredObject = object;
+
+		if (events == 0) {
+			if (interest->readable)
+				[self OF_forgetReadableFD: fd];
 
-		if (epoll_ctl(_epfd, EPOLL_CTL_MOD, fd, &event) == -1)
-			@throw [OFObserveFailedException
-			    exceptionWithObserver: self
-					    errNo: errno];
+			[_FDToInterest removeObjectForKey:
+			    (void*)((intptr_t)fd + 1)];
+			[self freeMemory: interest];
+		}
+	}
+
+	[_changedFDs removeAllItems];
+}
 
-		[_FDToEvents setObject: (void*)events
-				forKey: (void*)((intptr_t)fd + 1)];
+- (void)OF_forgetReadableFD: (int)fd
+{
+	const int *readableFDs = [_readableFDs items];
+	size_t count = [_readableFDs count];
+
+	for (size_t i = 0; i < count; i++) {
+		if (readableFDs[i] == fd) {
+			[_readableFDs removeItemAtIndex: i];
+			return;
+		}
 	}
 }
 
+- (void)OF_readReadableObjects
+{
+	int *readableFDs = [_readableFDs items];
+	size_t count = [_readableFDs count], kept = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		struct interest *interest = [_FDToInterest
+		    objectForKey: (void*)((intptr_t)readableFDs[i] + 1)];
+		id object;
+		void *pool;
+		bool wouldBlock;
+
+		if (interest == NULL)
+			continue;
+
+		object = interest->readObject;
+
+		if (object == nil || !(interest->registeredEvents & EPOLLET)) {
+			interest->readable = false;
+			continue;
+		}
+
+		/*
+		 * If the stream has been made blocking, reading until it would
+		 * block would block the thread. Registering it level-triggered
+		 * again has the kernel report the remaining data.
+		 */
+		if ([object isBlocking]) {
+			interest->readable = false;
+
+			if (!interest->changed) {
+				[_changedFDs addItem: &readableFDs[i]];
+				interest->changed = true;
+			}
+
+			continue;
+		}
+
+		pool = objc_autoreleasePoolPush();
+		wouldBlock = [(id <OFKernelEventObserverDrainDelegate>)_delegate
+		    OF_readFromObjectUntilWouldBlock: object];
+		objc_autoreleasePoolPop(pool);
+
+		if (wouldBlock) {
+			interest->readable = false;
+			continue;
+		}
+
+		readableFDs[kept++] = readableFDs[i];
+	}
+
+	[_readableFDs removeItemsInRange: of_range(kept, count - kept)];
+}
+
 - (void)OF_addObjectForReading: (id <OFReadyForReadingObserving>)object
 {
-	[self OF_addObject: object
+	[self OF_setObject: object
 	    fileDescriptor: [object fileDescriptorForReading]
-		    events: EPOLLIN];
+		    events: EPOLLIN
+		       add: true];
 }
 
 - (void)OF_addObjectForWriting: (id <OFReadyForWritingObserving>)object
 {
-	[self OF_addObject: object
+	[self OF_setObject: object
 	    fileDescriptor: [object fileDescriptorForWriting]
-		    events: EPOLLOUT];
+		    events: EPOLLOUT
+		       add: true];
 }
 
 - (void)OF_removeObjectForReading: (id <OFReadyForReadingObserving>)object
 {
-	[self OF_removeObject: object
-	       fileDescriptor: [object fileDescriptorForReading]
-		       events: EPOLLIN];
+	[self OF_setObject: object
+	    fileDescriptor: [object fileDescriptorForReading]
+		    events: EPOLLIN
+		       add: false];
 }
 
 - (void)OF_removeObjectForWriting: (id <OFReadyForWritingObserving>)object
 {
-	[self OF_removeObject: object
-	       fileDescriptor: [object fileDescriptorForWriting]
-		       events: EPOLLOUT];
+	[self OF_setObject: object
+	    fileDescriptor: [object fileDescriptorForWriting]
+		    events: EPOLLOUT
+		       add: false];
 }
 
 - (void)observeForTimeInterval: (of_time_interval_t)timeInterval
 {
-	OFNull *nullObject = [OFNull null];
-	struct epoll_event eventList[EVENTLIST_SIZE];
 	int events;
 
 	[self OF_processQueue];
@@ -185,7 +396,13 @@ static const of_map_table_functions_t mapFunctions = { NULL };
 	if ([self OF_processReadBuffers])
 		return;
 
-	events = epoll_wait(_epfd, eventList, EVENTLIST_SIZE,
+	[self OF_applyChanges];
+
+	/* Objects that have not been read until they would block are ready */
+	if ([_readableFDs count] > 0)
+		timeInterval = 0;
+
+	events = epoll_wait(_epfd, _eventList, (int)_eventListSize,
 	    (timeInterval != -1 ? timeInterval * 1000 : -1));
 
 	if (events < 0)
@@ -193,38 +410,74 @@ static const of_map_table_functions_t mapFunctions = { NULL };
 								 errNo: errno];
 
 	for (int i = 0; i < events; i++) {
-		if (eventList[i].data.ptr == nullObject) {
+		struct interest *interest;
+		uint32_t revents = _eventList[i].events;
+
+		if (_eventList[i].data.fd == _cancelFD[0]) {
 			char buffer;
 
-			assert(eventList[i].events == EPOLLIN);
+			assert(revents == EPOLLIN);
 			OF_ENSURE(read(_cancelFD[0], &buffer, 1) == 1);
 
 			continue;
 		}
 
-		if (eventList[i].events & EPOLLIN) {
+		/*
+		 * Changes are only applied before waiting, so this is always
+		 * up to date with what was registered.
+		 */
+		interest = [_FDToInterest objectForKey:
+		    (void*)((intptr_t)_eventList[i].data.fd + 1)];
+
+		if (interest == NULL)
+			continue;
+
+		/* Errors and hangups are reported by reading or writing */
+		if (revents & (EPOLLERR | EPOLLHUP))
+			revents |= interest->registeredEvents;
+
+		/* Edge-triggered objects are read once all events are handled */
+		if ((revents & EPOLLIN) && interest->readObject != nil &&
+		    (interest->registeredEvents & EPOLLET)) {
+			if (!interest->readable) {
+				[_readableFDs addItem: &_eventList[i].data.fd];
+				interest->readable = true;
+			}
+		} else if ((revents & EPOLLIN) && interest->readObject != nil) {
 			void *pool = objc_autoreleasePoolPush();
 
 			if ([_delegate respondsToSelector:
 			    @selector(objectIsReadyForReading:)])
 				[_delegate objectIsReadyForReading:
-				    eventList[i].data.ptr];
+				    interest->readObject];
 
 			objc_autoreleasePoolPop(pool);
 		}
 
-		if (eventList[i].events & EPOLLOUT) {
+		if ((revents & EPOLLOUT) && interest->writeObject != nil) {
 			void *pool = objc_autoreleasePoolPush();
 
 			if ([_delegate respondsToSelector:
 			    @selector(objectIsReadyForWriting:)])
 				[_delegate objectIsReadyForWriting:
-				    eventList[i].data.ptr];
+				    interest->writeObject];
 
 			objc_autoreleasePoolPop(pool);
 		}
+	}
 
-		assert((eventList[i].events & ~(EPOLLIN | EPOLLOUT)) == 0);
+	/*
+	 * A full list means there might have been more events, so make room
+	 * for them in the next iteration.
+	 */
+	if ((size_t)events == _eventListSize &&
+	    _eventListSize < MAX_EVENTLIST_SIZE) {
+		_eventList = [self resizeMemory: _eventList
+					   size: sizeof(*_eventList)
+					  count: _eventListSize * 2];
+		_eventListSize *= 2;
 	}
+
+	[self OF_readReadableObjects];
 }
 @end
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2008, 2009, 2010, 2011, 2012, 2013, 2014, 2015, 2016
+ *   Jonathan Schleifer <js@heap.zone>
+ *
+ * All rights reserved.
+ *
+ * This file is part of ObjFW. It may be distributed under the terms of the
+ * Q Public License 1.0, which can be found in the file LICENSE.QPL included in
+ * the packaging of this file.
+ *
+ * Alternatively, it may be distributed under the terms of the GNU General
+ * Public License, either version 2 or 3, which can be found in the file
+ * LICENSE.GPLv2 or LICENSE.GPLv3 respectively included in the packaging of this
+ * file.
+ */
+
+#import "OFKernelEventObserver.h"
+
+OF_ASSUME_NONNULL_BEGIN
+
+@class OFMapTable;
+
+@interface OFKernelEventObserver_io_uring: OFKernelEventObserver
+{
+	int _ringFD;
+	void *_SQRing, *_CQRing, *_SQEs;
+	size_t _SQRingSize, _CQRingSize, _SQEsSize;
+	unsigned *_SQHead, *_SQTail, *_SQArray, _SQMask, _SQEntries;
+	unsigned *_CQHead, *_CQTail, _CQMask;
+	void *_CQEs;
+	unsigned _pendingSubmissions;
+	OFMapTable *_FDToPoll;
+#ifdef OF_HAVE_FILES
+	OFMapTable *_readFiles, *_writeFiles;
+#endif
+}
+
+/*!
+ * @brief Returns whether the running kernel supports io_uring with all
+ *	  features required by this observer.
+ *
+ * The result is determined once and then cached.
+ *
+ * @return Whether io_uring can be used
+ */
++ (bool)OF_isSupported;
+@end
+
+OF_ASSUME_NONNULL_END
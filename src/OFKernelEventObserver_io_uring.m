@@ -0,0 +1,939 @@
+/*
+ * Copyright (c) 2008, 2009, 2010, 2011, 2012, 2013, 2014, 2015, 2016
+ *   Jonathan Schleifer <js@heap.zone>
+ *
+ * All rights reserved.
+ *
+ * This file is part of ObjFW. It may be distributed under the terms of the
+ * Q Public License 1.0, which can be found in the file LICENSE.QPL included in
+ * the packaging of this file.
+ *
+ * Alternatively, it may be distributed under the terms of the GNU General
+ * Public License, either version 2 or 3, which can be found in the file
+ * LICENSE.GPLv2 or LICENSE.GPLv3 respectively included in the packaging of this
+ * file.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <linux/io_uring.h>
+
+#import "OFKernelEventObserver.h"
+#import "OFKernelEventObserver+Private.h"
+#import "OFKernelEventObserver_io_uring.h"
+#import "OFMapTable.h"
+#ifdef OF_HAVE_FILES
+# import "OFFile.h"
+# import "OFStream+Private.h"
+#endif
+
+#import "OFInitializationFailedException.h"
+#import "OFObserveFailedException.h"
+
+/*
+ * Polls are submitted as IORING_OP_POLL_ADD, which unlike epoll also works
+ * for regular files. They are one-shot and re-armed when they complete, so
+ * each file descriptor has exactly one poll in flight. Submissions are only
+ * queued in the submission ring and handed to the kernel together with the
+ * wait for completions, resulting in a single system call per iteration.
+ *
+ * Files are not polled, as they always count as ready and a read or write
+ * then blocks the run loop until the disk is done. Instead, they are read with
+ * IORING_OP_READ into the read buffer of the stream before reporting them as
+ * ready for reading, and the delegate is asked for the data of its next write
+ * to submit it as IORING_OP_WRITE. Both go through a buffer owned by the
+ * observer, as the operation can outlive the request that started it.
+ */
+
+#define RING_ENTRIES 256
+#define FILE_BUFFER_SIZE (64 * 1024)
+#define REQUIRED_FEATURES (IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG)
+
+/* User data which can never be a pointer to a poll_state */
+#define USER_DATA_IGNORE 1
+#define USER_DATA_CANCEL 2
+/*
+ * Set on pointers to a file_state, which are aligned like any allocation.
+ * USER_DATA_IGNORE is handled before looking at this bit.
+ */
+#define USER_DATA_FILE 1
+
+struct poll_state {
+	id readObject, writeObject;
+	int fd;
+	short events, armedEvents;
+	bool armed, removing, stale;
+};
+
+#ifdef OF_HAVE_FILES
+struct file_state {
+	id object;
+	char *buffer;
+	int fd;
+	bool write, inFlight, polling, removed, discard;
+};
+#endif
+
+static const of_map_table_functions_t mapFunctions = { NULL };
+
+static int
+ioUringSetup(unsigned entries, struct io_uring_params *params)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int
+ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags,
+    void *arg, size_t argSize)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete,
+	    flags, arg, argSize);
+}
+
+@interface OFKernelEventObserver_io_uring ()
+- (struct io_uring_sqe*)OF_nextSQE;
+- (void)OF_commitSQE;
+- (void)OF_submit;
+- (void)OF_armPoll: (struct poll_state*)state;
+- (void)OF_setEvents: (short)events
+	    forState: (struct poll_state*)state;
+- (void)OF_processCompletions;
+#ifdef OF_HAVE_FILES
+- (bool)OF_addFile: (id)object
+	     write: (bool)write;
+- (bool)OF_removeFile: (id)object
+		write: (bool)write;
+- (void)OF_freeFileState: (struct file_state*)state;
+- (void)OF_submitFileState: (struct file_state*)state
+		      poll: (bool)poll
+		    length: (size_t)length;
+- (void)OF_submitFileOperations;
+- (void)OF_completeFileState: (struct file_state*)state
+		      result: (int32_t)res;
+- (void)OF_cancelFileOperations;
+#endif
+@end
+
+@implementation OFKernelEventObserver_io_uring
++ (bool)OF_isSupported
+{
+	static int supported = -1;
+
+	if (supported == -1) {
+		struct io_uring_params params;
+		int fd;
+
+		memset(&params, 0, sizeof(params));
+
+		if ((fd = ioUringSetup(1, &params)) != -1) {
+			supported = ((params.features & REQUIRED_FEATURES) ==
+			    REQUIRED_FEATURES);
+			close(fd);
+		} else
+			supported = 0;
+	}
+
+	return supported;
+}
+
+- init
+{
+	self = [super init];
+
+	_ringFD = -1;
+
+	@try {
+		struct io_uring_params params;
+		struct io_uring_sqe *sqe;
+		char *SQRing, *CQRing;
+
+		memset(&params, 0, sizeof(params));
+
+		if ((_ringFD = ioUringSetup(RING_ENTRIES, &params)) == -1)
+			@throw [OFInitializationFailedException exception];
+
+		if ((params.features & REQUIRED_FEATURES) != REQUIRED_FEATURES)
+			@throw [OFInitializationFailedException exception];
+
+		_SQRingSize = params.sq_off.array +
+		    params.sq_entries * sizeof(unsigned);
+		_CQRingSize = params.cq_off.cqes +
+		    params.cq_entries * sizeof(struct io_uring_cqe);
+
+		if (params.features & IORING_FEAT_SINGLE_MMAP) {
+			if (_CQRingSize > _SQRingSize)
+				_SQRingSize = _CQRingSize;
+
+			_CQRingSize = _SQRingSize;
+		}
+
+		if ((_SQRing = mmap(NULL, _SQRingSize, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, _ringFD,
+		    IORING_OFF_SQ_RING)) == MAP_FAILED) {
+			_SQRing = NULL;
+			@throw [OFInitializationFailedException exception];
+		}
+
+		if (params.features & IORING_FEAT_SINGLE_MMAP)
+			_CQRing = _SQRing;
+		else if ((_CQRing = mmap(NULL, _CQRingSize,
+		    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFD,
+		    IORING_OFF_CQ_RING)) == MAP_FAILED) {
+			_CQRing = NULL;
+			@throw [OFInitializationFailedException exception];
+		}
+
+		_SQEsSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+		if ((_SQEs = mmap(NULL, _SQEsSize, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, _ringFD,
+		    IORING_OFF_SQES)) == MAP_FAILED) {
+			_SQEs = NULL;
+			@throw [OFInitializationFailedException exception];
+		}
+
+		SQRing = _SQRing;
+		_SQHead = (unsigned*)(void*)(SQRing + params.sq_off.head);
+		_SQTail = (unsigned*)(void*)(SQRing + params.sq_off.tail);
+		_SQArray = (unsigned*)(void*)(SQRing + params.sq_off.array);
+		_SQMask = *(unsigned*)(void*)(SQRing + params.sq_off.ring_mask);
+		_SQEntries =
+		    *(unsigned*)(void*)(SQRing + params.sq_off.ring_entries);
+
+		CQRing = _CQRing;
+		_CQHead = (unsigned*)(void*)(CQRing + params.cq_off.head);
+		_CQTail = (unsigned*)(void*)(CQRing + params.cq_off.tail);
+		_CQMask = *(unsigned*)(void*)(CQRing + params.cq_off.ring_mask);
+		_CQEs = CQRing + params.cq_off.cqes;
+
+		_FDToPoll = [[OFMapTable alloc]
+		    initWithKeyFunctions: mapFunctions
+			 objectFunctions: mapFunctions];
+#ifdef OF_HAVE_FILES
+		_readFiles = [[OFMapTable alloc]
+		    initWithKeyFunctions: mapFunctions
+			 objectFunctions: mapFunctions];
+		_writeFiles = [[OFMapTable alloc]
+		    initWithKeyFunctions: mapFunctions
+			 objectFunctions: mapFunctions];
+#endif
+
+		sqe = [self OF_nextSQE];
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = _cancelFD[0];
+		sqe->poll_events = POLLIN;
+		sqe->user_data = USER_DATA_CANCEL;
+		[self OF_commitSQE];
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+#ifdef OF_HAVE_FILES
+	OFMapTable *maps[2] = { _readFiles, _writeFiles };
+
+	/* The kernel might still be using the buffers */
+	[self OF_cancelFileOperations];
+
+	for (size_t i = 0; i < 2; i++) {
+		OFMapTableEnumerator *enumerator = [maps[i] objectEnumerator];
+		struct file_state *state;
+
+		while ((state = [enumerator nextObject]) != NULL) {
+			[self freeMemory: state->buffer];
+			[self freeMemory: state];
+		}
+	}
+
+	[_readFiles release];
+	[_writeFiles release];
+#endif
+
+	if (_SQEs != NULL)
+		munmap(_SQEs, _SQEsSize);
+	if (_CQRing != NULL && _CQRing != _SQRing)
+		munmap(_CQRing, _CQRingSize);
+	if (_SQRing != NULL)
+		munmap(_SQRing, _SQRingSize);
+
+	if (_ringFD != -1)
+		close(_ringFD);
+
+	[_FDToPoll release];
+
+	[super dealloc];
+}
+
+- (struct io_uring_sqe*)OF_nextSQE
+{
+	unsigned tail = *_SQTail, index;
+	struct io_uring_sqe *sqe;
+
+	/* The ring is full, so the kernel needs to consume some entries */
+	if (tail - __atomic_load_n(_SQHead, __ATOMIC_ACQUIRE) >= _SQEntries) {
+		[self OF_submit];
+
+		if (tail - __atomic_load_n(_SQHead, __ATOMIC_ACQUIRE) >=
+		    _SQEntries)
+			@throw [OFObserveFailedException
+			    exceptionWithObserver: self
+					    errNo: EBUSY];
+	}
+
+	index = tail & _SQMask;
+	sqe = (struct io_uring_sqe*)_SQEs + index;
+	memset(sqe, 0, sizeof(*sqe));
+	_SQArray[index] = index;
+
+	return sqe;
+}
+
+- (void)OF_commitSQE
+{
+	/*
+	 * The kernel is always a concurrent reader, so this needs a real
+	 * barrier even if ObjFW was built without threads.
+	 */
+	__atomic_store_n(_SQTail, *_SQTail + 1, __ATOMIC_RELEASE);
+	_pendingSubmissions++;
+}
+
+- (void)OF_submit
+{
+	while (_pendingSubmissions > 0) {
+		int ret = ioUringEnter(_ringFD, _pendingSubmissions, 0, 0,
+		    NULL, 0);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			@throw [OFObserveFailedException
+			    exceptionWithObserver: self
+					    errNo: errno];
+		}
+
+		if (ret == 0)
+			break;
+
+		_pendingSubmissions -= ret;
+	}
+}
+
+- (void)OF_armPoll: (struct poll_state*)state
+{
+	struct io_uring_sqe *sqe = [self OF_nextSQE];
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = state->fd;
+	sqe->poll_events = state->events;
+	sqe->user_data = (uintptr_t)state;
+	[self OF_commitSQE];
+
+	state->armed = true;
+	state->armedEvents = state->events;
+	state->removing = false;
+	state->stale = false;
+}
+
+- (void)OF_setEvents: (short)events
+	    forState: (struct poll_state*)state
+{
+	state->events = events;
+
+	if (!state->armed) {
+		if (events != 0)
+			[self OF_armPoll: state];
+		else {
+			[_FDToPoll removeObjectForKey:
+			    (void*)((intptr_t)state->fd + 1)];
+			[self freeMemory: state];
+		}
+
+		return;
+	}
+
+	/*
+	 * A poll which is already in flight cannot be changed. If it waits for
+	 * events that are no longer wanted, they are filtered out once it
+	 * completes. If it lacks events or refers to a file that has been
+	 * replaced, it is removed and re-armed once its cancellation
+	 * completes.
+	 */
+	if (!state->removing && (events == 0 ||
+	    (events & ~state->armedEvents) != 0 || state->stale)) {
+		struct io_uring_sqe *sqe = [self OF_nextSQE];
+
+		sqe->opcode = IORING_OP_POLL_REMOVE;
+		sqe->addr = (uintptr_t)state;
+		sqe->user_data = USER_DATA_IGNORE;
+		[self OF_commitSQE];
+
+		state->removing = true;
+	}
+}
+
+- (void)OF_addObject: (id)object
+      fileDescriptor: (int)fd
+	      events: (short)addEvents
+{
+	struct poll_state *state = [_FDToPoll
+	    objectForKey: (void*)((intptr_t)fd + 1)];
+
+	if (state == NULL) {
+		state = [self allocMemoryWithSize: sizeof(*state)];
+		memset(state, 0, sizeof(*state));
+		state->fd = fd;
+
+		@try {
+			[_FDToPoll setObject: state
+				      forKey: (void*)((intptr_t)fd + 1)];
+		} @catch (id e) {
+			[self freeMemory: state];
+			@throw e;
+		}
+	}
+
+	/*
+	 * If the file descriptor was closed and its number reused before the
+	 * old object was removed, the poll in flight still refers to the old
+	 * file and must not be reported for the new object.
+	 */
+	if (state->armed &&
+	    (((addEvents & POLLIN) && state->readObject != nil &&
+	    state->readObject != object) ||
+	    ((addEvents & POLLOUT) && state->writeObject != nil &&
+	    state->writeObject != object)))
+		state->stale = true;
+
+	if (addEvents & POLLIN)
+		state->readObject = object;
+	if (addEvents & POLLOUT)
+		state->writeObject = object;
+
+	[self OF_setEvents: state->events | addEvents
+		  forState: state];
+}
+
+- (void)OF_removeObject: (id)object
+	 fileDescriptor: (int)fd
+		 events: (short)removeEvents
+{
+	struct poll_state *state = [_FDToPoll
+	    objectForKey: (void*)((intptr_t)fd + 1)];
+
+	if (state == NULL)
+		return;
+
+	/* The number might already be used by an object added since */
+	if ((removeEvents & POLLIN) && state->readObject != object)
+		removeEvents &= ~POLLIN;
+	if ((removeEvents & POLLOUT) && state->writeObject != object)
+		removeEvents &= ~POLLOUT;
+
+	if (removeEvents == 0)
+		return;
+
+	if (removeEvents & POLLIN)
+		state->readObject = nil;
+	if (removeEvents & POLLOUT)
+		state->writeObject = nil;
+
+	[self OF_setEvents: state->events & ~removeEvents
+		  forState: state];
+}
+
+#ifdef OF_HAVE_FILES
+- (bool)OF_addFile: (id)object
+	     write: (bool)write
+{
+	OFMapTable *files = (write ? _writeFiles : _readFiles);
+	struct file_state *state;
+
+	if (![object isKindOfClass: [OFFile class]])
+		return false;
+
+	/* An operation for the previous observation might still be running */
+	if ((state = [files objectForKey: object]) != NULL) {
+		state->removed = false;
+		return true;
+	}
+
+	state = [self allocMemoryWithSize: sizeof(*state)];
+	memset(state, 0, sizeof(*state));
+	state->object = object;
+	state->fd = (write ? [object fileDescriptorForWriting]
+	    : [object fileDescriptorForReading]);
+	state->write = write;
+
+	@try {
+		state->buffer = [self allocMemoryWithSize: FILE_BUFFER_SIZE];
+
+		[files setObject: state
+			  forKey: object];
+	} @catch (id e) {
+		[self freeMemory: state->buffer];
+		[self freeMemory: state];
+		@throw e;
+	}
+
+	return true;
+}
+
+- (bool)OF_removeFile: (id)object
+		write: (bool)write
+{
+	struct file_state *state =
+	    [(write ? _writeFiles : _readFiles) objectForKey: object];
+
+	if (state == NULL)
+		return false;
+
+	/* A result that arrives after this is not reported anymore */
+	if (state->inFlight) {
+		state->removed = true;
+		state->discard = true;
+	} else
+		[self OF_freeFileState: state];
+
+	return true;
+}
+
+- (void)OF_freeFileState: (struct file_state*)state
+{
+	[(state->write ? _writeFiles : _readFiles)
+	    removeObjectForKey: state->object];
+
+	[self freeMemory: state->buffer];
+	[self freeMemory: state];
+}
+
+- (void)OF_submitFileState: (struct file_state*)state
+		      poll: (bool)poll
+		    length: (size_t)length
+{
+	struct io_uring_sqe *sqe = [self OF_nextSQE];
+
+	if (poll) {
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->poll_events = (state->write ? POLLOUT : POLLIN);
+	} else {
+		sqe->opcode = (state->write ? IORING_OP_WRITE : IORING_OP_READ);
+		sqe->addr = (uintptr_t)state->buffer;
+		sqe->len = (unsigned)length;
+		/* Uses and advances the file position like read() / write() */
+		sqe->off = (uint64_t)-1;
+	}
+
+	sqe->fd = state->fd;
+	sqe->user_data = (uintptr_t)state | USER_DATA_FILE;
+	[self OF_commitSQE];
+
+	/* The object needs to be around for the result */
+	[state->object retain];
+
+	state->inFlight = true;
+	state->polling = poll;
+	state->discard = false;
+}
+
+- (void)OF_submitFileOperations
+{
+	void *pool;
+	OFMapTableEnumerator *enumerator;
+	struct file_state *state;
+
+	if ([_readFiles count] == 0 && [_writeFiles count] == 0)
+		return;
+
+	pool = objc_autoreleasePoolPush();
+
+	enumerator = [_readFiles objectEnumerator];
+	while ((state = [enumerator nextObject]) != NULL) {
+		OFStream *stream = state->object;
+
+		/* Data that has already been read is handed out first */
+		if (state->inFlight || ([stream hasDataInReadBuffer] &&
+		    ![stream OF_isWaitingForDelimiter]))
+			continue;
+
+		[self OF_submitFileState: state
+				    poll: false
+				  length: FILE_BUFFER_SIZE];
+	}
+
+	enumerator = [_writeFiles objectEnumerator];
+	while ((state = [enumerator nextObject]) != NULL) {
+		const void *buffer;
+		size_t length;
+
+		if (state->inFlight)
+			continue;
+
+		/* Without data to write, only tell when writing is possible */
+		if (![_delegate respondsToSelector:
+		    @selector(OF_object:getPendingWriteBuffer:length:)] ||
+		    ![(id <OFKernelEventObserverWriteDelegate>)_delegate
+		    OF_object: state->object
+		    getPendingWriteBuffer: &buffer
+				   length: &length]) {
+			[self OF_submitFileState: state
+					    poll: true
+					  length: 0];
+			continue;
+		}
+
+		if (length > FILE_BUFFER_SIZE)
+			length = FILE_BUFFER_SIZE;
+
+		memcpy(state->buffer, buffer, length);
+
+		[self OF_submitFileState: state
+				    poll: false
+				  length: length];
+	}
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)OF_completeFileState: (struct file_state*)state
+		      result: (int32_t)res
+{
+	void *pool = objc_autoreleasePoolPush();
+	id object = [state->object autorelease];
+	bool report = !state->discard;
+
+	state->inFlight = false;
+
+	@try {
+		/* Data that has been read must not get lost */
+		if (!state->write && !state->polling && res > 0)
+			[object OF_appendToReadBuffer: state->buffer
+					       length: res];
+	} @finally {
+		if (state->removed)
+			[self OF_freeFileState: state];
+	}
+
+	if (!report) {
+		objc_autoreleasePoolPop(pool);
+		return;
+	}
+
+	/* Files in non-blocking mode that are not ready yet are polled */
+	if (res == -EAGAIN && !state->polling) {
+		[self OF_submitFileState: state
+				    poll: true
+				  length: 0];
+
+		objc_autoreleasePoolPop(pool);
+		return;
+	}
+
+	if (!state->write) {
+		/* Errors are found by the read of the delegate */
+		if ([_delegate respondsToSelector:
+		    @selector(objectIsReadyForReading:)])
+			[_delegate objectIsReadyForReading: object];
+	} else if (state->polling) {
+		if ([_delegate respondsToSelector:
+		    @selector(objectIsReadyForWriting:)])
+			[_delegate objectIsReadyForWriting: object];
+	} else
+		[(id <OFKernelEventObserverWriteDelegate>)_delegate
+		    OF_object: object
+		    didWriteLength: (res > 0 ? (size_t)res : 0)
+			     errNo: (res < 0 ? -res : 0)];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+/*
+ * Reads and writes of files cannot be abandoned like polls, as the kernel
+ * keeps using their buffer until they complete. They are canceled and their
+ * completions are waited for, so that the buffers can be freed.
+ */
+- (void)OF_cancelFileOperations
+{
+	OFMapTable *maps[2] = { _readFiles, _writeFiles };
+	struct io_uring_cqe *CQEs = _CQEs;
+	size_t inFlight = 0;
+
+	for (size_t i = 0; i < 2; i++) {
+		OFMapTableEnumerator *enumerator = [maps[i] objectEnumerator];
+		struct file_state *state;
+
+		while ((state = [enumerator nextObject]) != NULL) {
+			struct io_uring_sqe *sqe;
+
+			if (!state->inFlight)
+				continue;
+
+			inFlight++;
+
+			/* Without the cancellation, it just takes longer */
+			@try {
+				sqe = [self OF_nextSQE];
+			} @catch (id e) {
+				continue;
+			}
+
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->fd = -1;
+			sqe->addr = (uintptr_t)state | USER_DATA_FILE;
+			sqe->user_data = USER_DATA_IGNORE;
+			[self OF_commitSQE];
+		}
+	}
+
+	while (inFlight > 0) {
+		unsigned head, tail;
+		int ret = ioUringEnter(_ringFD, _pendingSubmissions, 1,
+		    IORING_ENTER_GETEVENTS, NULL, 0);
+
+		if (ret >= 0)
+			_pendingSubmissions -= ret;
+		else
+			OF_ENSURE(errno == EINTR || errno == EBUSY);
+
+		tail = __atomic_load_n(_CQTail, __ATOMIC_ACQUIRE);
+
+		for (head = *_CQHead; head != tail; head++) {
+			uint64_t userData = CQEs[head & _CQMask].user_data;
+			struct file_state *state;
+
+			if (userData == USER_DATA_IGNORE ||
+			    !(userData & USER_DATA_FILE))
+				continue;
+
+			state = (struct file_state*)(uintptr_t)
+			    (userData & ~(uint64_t)USER_DATA_FILE);
+			state->inFlight = false;
+			[state->object release];
+			inFlight--;
+		}
+
+		__atomic_store_n(_CQHead, head, __ATOMIC_RELEASE);
+	}
+}
+#endif
+
+- (void)OF_addObjectForReading: (id <OFReadyForReadingObserving>)object
+{
+#ifdef OF_HAVE_FILES
+	if ([self OF_addFile: object
+		       write: false])
+		return;
+#endif
+
+	[self OF_addObject: object
+	    fileDescriptor: [object fileDescriptorForReading]
+		    events: POLLIN];
+}
+
+- (void)OF_addObjectForWriting: (id <OFReadyForWritingObserving>)object
+{
+#ifdef OF_HAVE_FILES
+	if ([self OF_addFile: object
+		       write: true])
+		return;
+#endif
+
+	[self OF_addObject: object
+	    fileDescriptor: [object fileDescriptorForWriting]
+		    events: POLLOUT];
+}
+
+- (void)OF_removeObjectForReading: (id <OFReadyForReadingObserving>)object
+{
+#ifdef OF_HAVE_FILES
+	if ([self OF_removeFile: object
+			  write: false])
+		return;
+#endif
+
+	[self OF_removeObject: object
+	       fileDescriptor: [object fileDescriptorForReading]
+		       events: POLLIN];
+}
+
+- (void)OF_removeObjectForWriting: (id <OFReadyForWritingObserving>)object
+{
+#ifdef OF_HAVE_FILES
+	if ([self OF_removeFile: object
+			  write: true])
+		return;
+#endif
+
+	[self OF_removeObject: object
+	       fileDescriptor: [object fileDescriptorForWriting]
+		       events: POLLOUT];
+}
+
+- (void)OF_processCompletions
+{
+	struct io_uring_cqe *CQEs = _CQEs;
+	/*
+	 * Re-armed polls for file descriptors that are still ready complete
+	 * immediately, so only handle what is there now to not loop forever.
+	 */
+	unsigned tail = __atomic_load_n(_CQTail, __ATOMIC_ACQUIRE);
+
+	for (;;) {
+		unsigned head = *_CQHead;
+		struct poll_state *state;
+		uint64_t userData;
+		int32_t res;
+		id readObject, writeObject;
+
+		if (head == tail)
+			break;
+
+		userData = CQEs[head & _CQMask].user_data;
+		res = CQEs[head & _CQMask].res;
+
+		/*
+		 * Consume the entry before calling the delegate, so that it is
+		 * not handled twice if the delegate throws.
+		 */
+		__atomic_store_n(_CQHead, head + 1, __ATOMIC_RELEASE);
+
+		if (userData == USER_DATA_IGNORE)
+			continue;
+
+		if (userData == USER_DATA_CANCEL) {
+			struct io_uring_sqe *sqe;
+			char buffer;
+
+			OF_ENSURE(res > 0);
+			OF_ENSURE(read(_cancelFD[0], &buffer, 1) == 1);
+
+			sqe = [self OF_nextSQE];
+			sqe->opcode = IORING_OP_POLL_ADD;
+			sqe->fd = _cancelFD[0];
+			sqe->poll_events = POLLIN;
+			sqe->user_data = USER_DATA_CANCEL;
+			[self OF_commitSQE];
+
+			continue;
+		}
+
+#ifdef OF_HAVE_FILES
+		if (userData & USER_DATA_FILE) {
+			[self OF_completeFileState: (struct file_state*)
+			    (uintptr_t)(userData & ~(uint64_t)USER_DATA_FILE)
+					    result: res];
+			continue;
+		}
+#endif
+
+		state = (struct poll_state*)(uintptr_t)userData;
+		state->armed = false;
+
+		if (state->events == 0) {
+			[_FDToPoll removeObjectForKey:
+			    (void*)((intptr_t)state->fd + 1)];
+			[self freeMemory: state];
+			continue;
+		}
+
+		if (state->stale) {
+			[self OF_armPoll: state];
+			continue;
+		}
+
+		/*
+		 * Any other error means the file descriptor is unusable, e.g.
+		 * because it was closed before the poll was armed. The poll is
+		 * not armed again, but the objects are told, so that their next
+		 * read or write reports the error.
+		 */
+		if (res >= 0 || res == -ECANCELED)
+			[self OF_armPoll: state];
+		else
+			res = POLLERR;
+
+		if (res <= 0)
+			continue;
+
+		readObject = ((state->events & POLLIN) &&
+		    (res & (POLLIN | POLLERR | POLLHUP)) ?
+		    state->readObject : nil);
+		writeObject = ((state->events & POLLOUT) &&
+		    (res & (POLLOUT | POLLERR | POLLHUP)) ?
+		    state->writeObject : nil);
+
+		if (readObject != nil) {
+			void *pool = objc_autoreleasePoolPush();
+
+			if ([_delegate respondsToSelector:
+			    @selector(objectIsReadyForReading:)])
+				[_delegate objectIsReadyForReading: readObject];
+
+			objc_autoreleasePoolPop(pool);
+		}
+
+		if (writeObject != nil) {
+			void *pool = objc_autoreleasePoolPush();
+
+			if ([_delegate respondsToSelector:
+			    @selector(objectIsReadyForWriting:)])
+				[_delegate objectIsReadyForWriting:
+				    writeObject];
+
+			objc_autoreleasePoolPop(pool);
+		}
+	}
+}
+
+- (void)observeForTimeInterval: (of_time_interval_t)timeInterval
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec timeout;
+	int ret;
+
+	[self OF_processQueue];
+
+	if ([self OF_processReadBuffers])
+		return;
+
+#ifdef OF_HAVE_FILES
+	[self OF_submitFileOperations];
+#endif
+
+	memset(&arg, 0, sizeof(arg));
+
+	if (timeInterval >= 0) {
+		timeout.tv_sec = (long long)timeInterval;
+		timeout.tv_nsec = (long long)((timeInterval - timeout.tv_sec) *
+		    1000000000);
+		arg.ts = (uintptr_t)&timeout;
+	}
+
+	/* Submits everything queued since the last call and waits */
+	ret = ioUringEnter(_ringFD, _pendingSubmissions, 1,
+	    IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+
+	if (ret >= 0)
+		_pendingSubmissions -= ret;
+	else if (errno != ETIME && errno != EINTR && errno != EBUSY)
+		@throw [OFObserveFailedException exceptionWithObserver: self
+								 errNo: errno];
+
+	[self OF_processCompletions];
+}
+@end
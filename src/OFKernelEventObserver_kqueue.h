@@ -19,11 +19,13 @@
 OF_ASSUME_NONNULL_BEGIN
 
 @class OFDataArray;
+@class OFMapTable;
 @class OFMutableArray OF_GENERIC(ObjectType);
 
 @interface OFKernelEventObserver_kqueue: OFKernelEventObserver
 {
 	int _kernelQueue;
+	OFMapTable *_FDToReadObject, *_FDToWriteObject;
 }
 @end
 
@@ -32,6 +32,7 @@
 #import "OFKernelEventObserver_kqueue.h"
 #import "OFDataArray.h"
 #import "OFArray.h"
+#import "OFMapTable.h"
 #ifdef OF_HAVE_THREADS
 # import "OFMutex.h"
 #endif
@@ -42,6 +43,8 @@
 
 #define EVENTLIST_SIZE 64
 
+static const of_map_table_functions_t mapFunctions = { NULL };
+
 @implementation OFKernelEventObserver_kqueue
 - init
 {
@@ -65,6 +68,13 @@
 			fcntl(_kernelQueue, F_SETFD, flags | FD_CLOEXEC);
 #endif
 
+		_FDToReadObject = [[OFMapTable alloc]
+		    initWithKeyFunctions: mapFunctions
+			 objectFunctions: mapFunctions];
+		_FDToWriteObject = [[OFMapTable alloc]
+		    initWithKeyFunctions: mapFunctions
+			 objectFunctions: mapFunctions];
+
 		EV_SET(&event, _cancelFD[0], EVFILT_READ, EV_ADD, 0, 0, 0);
 
 		if (kevent(_kernelQueue, &event, 1, NULL, 0, NULL) != 0)
@@ -82,15 +92,19 @@
 {
 	close(_kernelQueue);
 
+	[_FDToReadObject release];
+	[_FDToWriteObject release];
+
 	[super dealloc];
 }
 
 - (void)OF_addObjectForReading: (id <OFReadyForReadingObserving>)object
 {
 	struct kevent event;
+	int fd = [object fileDescriptorForReading];
 
 	memset(&event, 0, sizeof(event));
-	event.ident = [object fileDescriptorForReading];
+	event.ident = fd;
 	event.filter = EVFILT_READ;
 	event.flags = EV_ADD;
 #ifndef OF_NETBSD
@@ -102,14 +116,18 @@
 	if (kevent(_kernelQueue, &event, 1, NULL, 0, NULL) != 0)
 		@throw [OFObserveFailedException exceptionWithObserver: self
 								 errNo: errno];
+
+	[_FDToReadObject setObject: object
+			    forKey: (void*)((intptr_t)fd + 1)];
 }
 
 - (void)OF_addObjectForWriting: (id <OFReadyForWritingObserving>)object
 {
 	struct kevent event;
+	int fd = [object fileDescriptorForWriting];
 
 	memset(&event, 0, sizeof(event));
-	event.ident = [object fileDescriptorForWriting];
+	event.ident = fd;
 	event.filter = EVFILT_WRITE;
 	event.flags = EV_ADD;
 #ifndef OF_NETBSD
@@ -121,18 +139,34 @@
 	if (kevent(_kernelQueue, &event, 1, NULL, 0, NULL) != 0)
 		@throw [OFObserveFailedException exceptionWithObserver: self
 								 errNo: errno];
+
+	[_FDToWriteObject setObject: object
+			    forKey: (void*)((intptr_t)fd + 1)];
 }
 
 - (void)OF_removeObjectForReading: (id <OFReadyForReadingObserving>)object
 {
 	struct kevent event;
+	int fd = [object fileDescriptorForReading];
+
+	/*
+	 * If the file descriptor was closed and its number reused, the new
+	 * object might have been added before the old one is removed, in which
+	 * case the new one must stay.
+	 */
+	if ([_FDToReadObject objectForKey: (void*)((intptr_t)fd + 1)] != object)
+		return;
+
+	[_FDToReadObject removeObjectForKey: (void*)((intptr_t)fd + 1)];
 
 	memset(&event, 0, sizeof(event));
-	event.ident = [object fileDescriptorForReading];
+	event.ident = fd;
 	event.filter = EVFILT_READ;
 	event.flags = EV_DELETE;
 
-	if (kevent(_kernelQueue, &event, 1, NULL, 0, NULL) != 0)
+	/* Closing the file descriptor already removed it */
+	if (kevent(_kernelQueue, &event, 1, NULL, 0, NULL) != 0 &&
+	    errno != EBADF && errno != ENOENT)
 		@throw [OFObserveFailedException exceptionWithObserver: self
 								 errNo: errno];
 }
@@ -140,13 +174,22 @@
 - (void)OF_removeObjectForWriting: (id <OFReadyForWritingObserving>)object
 {
 	struct kevent event;
+	int fd = [object fileDescriptorForWriting];
+
+	/* Same as for reading */
+	if ([_FDToWriteObject objectForKey: (void*)((intptr_t)fd + 1)] != object)
+		return;
+
+	[_FDToWriteObject removeObjectForKey: (void*)((intptr_t)fd + 1)];
 
 	memset(&event, 0, sizeof(event));
-	event.ident = [object fileDescriptorForWriting];
+	event.ident = fd;
 	event.filter = EVFILT_WRITE;
 	event.flags = EV_DELETE;
 
-	if (kevent(_kernelQueue, &event, 1, NULL, 0, NULL) != 0)
+	/* Closing the file descriptor already removed it */
+	if (kevent(_kernelQueue, &event, 1, NULL, 0, NULL) != 0 &&
+	    errno != EBADF && errno != ENOENT)
 		@throw [OFObserveFailedException exceptionWithObserver: self
 								 errNo: errno];
 }
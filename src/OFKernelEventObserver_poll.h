@@ -24,7 +24,7 @@ OF_ASSUME_NONNULL_BEGIN
 {
 	OFDataArray *_FDs;
 	int _maxFD;
-	id __unsafe_unretained *_FDToObject;
+	id __unsafe_unretained *_FDToReadObject, *_FDToWriteObject;
 }
 @end
 
@@ -20,6 +20,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <string.h>
 
 #ifdef HAVE_POLL_H
 # include <poll.h>
@@ -53,8 +54,13 @@
 		[_FDs addItem: &p];
 
 		_maxFD = _cancelFD[0];
-		_FDToObject = [self allocMemoryWithSize: sizeof(id)
-						  count: (size_t)_maxFD + 1];
+		_FDToReadObject = [self allocMemoryWithSize: sizeof(id)
+						      count: (size_t)_maxFD + 1];
+		_FDToWriteObject = [self
+		    allocMemoryWithSize: sizeof(id)
+				  count: (size_t)_maxFD + 1];
+		memset(_FDToReadObject, 0, sizeof(id) * ((size_t)_maxFD + 1));
+		memset(_FDToWriteObject, 0, sizeof(id) * ((size_t)_maxFD + 1));
 	} @catch (id e) {
 		[self release];
 		@throw e;
@@ -90,15 +96,28 @@
 		struct pollfd p = { fd, events, 0 };
 
 		if (fd > _maxFD) {
+			_FDToReadObject = [self
+			    resizeMemory: _FDToReadObject
+				    size: sizeof(id)
+				   count: (size_t)fd + 1];
+			_FDToWriteObject = [self
+			    resizeMemory: _FDToWriteObject
+				    size: sizeof(id)
+				   count: (size_t)fd + 1];
+			memset(_FDToReadObject + _maxFD + 1, 0,
+			    sizeof(id) * (size_t)(fd - _maxFD));
+			memset(_FDToWriteObject + _maxFD + 1, 0,
+			    sizeof(id) * (size_t)(fd - _maxFD));
 			_maxFD = fd;
-			_FDToObject = [self resizeMemory: _FDToObject
-						    size: sizeof(id)
-						   count: (size_t)_maxFD + 1];
 		}
 
-		_FDToObject[fd] = object;
 		[_FDs addItem: &p];
 	}
+
+	if (events & POLLIN)
+		_FDToReadObject[fd] = object;
+	if (events & POLLOUT)
+		_FDToWriteObject[fd] = object;
 }
 
 - (void)OF_removeObject: (id)object
@@ -108,14 +127,35 @@
 	struct pollfd *FDs = [_FDs items];
 	size_t nFDs = [_FDs count];
 
+	if (fd > _maxFD)
+		return;
+
+	/*
+	 * If the file descriptor was closed and its number reused, the new
+	 * object might have been added before the old one is removed, in which
+	 * case the new one must stay.
+	 */
+	if ((events & POLLIN) && _FDToReadObject[fd] != object)
+		events &= ~POLLIN;
+	if ((events & POLLOUT) && _FDToWriteObject[fd] != object)
+		events &= ~POLLOUT;
+
+	if (events & POLLIN)
+		_FDToReadObject[fd] = nil;
+	if (events & POLLOUT)
+		_FDToWriteObject[fd] = nil;
+
+	if (events == 0)
+		return;
+
 	for (size_t i = 0; i < nFDs; i++) {
 		if (FDs[i].fd == fd) {
 			FDs[i].events &= ~events;
 
 			if (FDs[i].events == 0) {
 				/*
-				 * TODO: Remove from and resize _FDToObject,
-				 *	 adjust _maxFD.
+				 * TODO: Resize _FDToReadObject and
+				 *	 _FDToWriteObject, adjust _maxFD.
 				 */
 				[_FDs removeItemAtIndex: i];
 			}
@@ -204,7 +244,7 @@
 			if ([_delegate respondsToSelector:
 			    @selector(objectIsReadyForReading:)])
 				[_delegate objectIsReadyForReading:
-				    _FDToObject[FDs[i].fd]];
+				    _FDToReadObject[FDs[i].fd]];
 
 			objc_autoreleasePoolPop(pool);
 		}
@@ -215,7 +255,7 @@
 			if ([_delegate respondsToSelector:
 			    @selector(objectIsReadyForWriting:)])
 				[_delegate objectIsReadyForWriting:
-				    _FDToObject[FDs[i].fd]];
+				    _FDToWriteObject[FDs[i].fd]];
 
 			objc_autoreleasePoolPop(pool);
 		}
@@ -114,6 +114,16 @@
 		@throw [OFOutOfRangeException exception];
 #endif
 
+	/*
+	 * If the file descriptor was closed and its number reused, the new
+	 * object might have been added before the old one is removed, in which
+	 * case the new one must stay.
+	 */
+	for (id otherObject in _readObjects)
+		if (otherObject != object &&
+		    [otherObject fileDescriptorForReading] == fd)
+			return;
+
 	FD_CLR((of_socket_t)fd, &_readFDs);
 }
 
@@ -131,6 +141,12 @@
 		@throw [OFOutOfRangeException exception];
 #endif
 
+	/* Same as for reading */
+	for (id otherObject in _writeObjects)
+		if (otherObject != object &&
+		    [otherObject fileDescriptorForWriting] == fd)
+			return;
+
 	FD_CLR((of_socket_t)fd, &_writeFDs);
 }
 
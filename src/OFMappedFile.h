@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2008, 2009, 2010, 2011, 2012, 2013, 2014, 2015, 2016
+ *   Jonathan Schleifer <js@heap.zone>
+ *
+ * All rights reserved.
+ *
+ * This file is part of ObjFW. It may be distributed under the terms of the
+ * Q Public License 1.0, which can be found in the file LICENSE.QPL included in
+ * the packaging of this file.
+ *
+ * Alternatively, it may be distributed under the terms of the GNU General
+ * Public License, either version 2 or 3, which can be found in the file
+ * LICENSE.GPLv2 or LICENSE.GPLv3 respectively included in the packaging of this
+ * file.
+ */
+
+#import "OFSeekableStream.h"
+
+OF_ASSUME_NONNULL_BEGIN
+
+@class OFString;
+
+/*!
+ * @brief The mode in which an OFMappedFile maps a file.
+ */
+typedef enum of_mapped_file_mode_t {
+	/*! The mapping is read-only */
+	OF_MAPPED_FILE_MODE_READ_ONLY,
+	/*!
+	 * The mapping is writable, but changes are private to the process and
+	 * never written back to the file
+	 */
+	OF_MAPPED_FILE_MODE_COPY_ON_WRITE
+} of_mapped_file_mode_t;
+
+/*!
+ * @brief An access pattern which can be advised for an OFMappedFile.
+ */
+typedef enum of_mapped_file_advice_t {
+	/*! No special treatment */
+	OF_MAPPED_FILE_ADVICE_NORMAL,
+	/*! The mapping will be accessed sequentially */
+	OF_MAPPED_FILE_ADVICE_SEQUENTIAL,
+	/*! The mapping will be accessed in random order */
+	OF_MAPPED_FILE_ADVICE_RANDOM,
+	/*! The mapping will be accessed soon and should be read ahead */
+	OF_MAPPED_FILE_ADVICE_WILL_NEED
+} of_mapped_file_advice_t;
+
+/*!
+ * @class OFMappedFile OFMappedFile.h ObjFW/OFMappedFile.h
+ *
+ * @brief A class which maps a file into memory.
+ *
+ * The contents of the file can either be accessed directly using
+ * @ref items or be read through the stream interface, which is served from
+ * the mapping without any further system calls.
+ *
+ * On systems without `mmap()`, the file is read into memory instead.
+ *
+ * @warning If the file is truncated while it is mapped, accessing the part of
+ *	    the mapping beyond the new end of the file might crash the process.
+ */
+@interface OFMappedFile: OFSeekableStream
+{
+	char *_items;
+	size_t _length, _position;
+	of_mapped_file_mode_t _mode;
+	bool _mapped;
+}
+
+/*!
+ * @brief Creates a new read-only OFMappedFile for the file at the specified
+ *	  path.
+ *
+ * @param path The path to the file to map
+ * @return A new autoreleased OFMappedFile
+ */
++ (instancetype)mappedFileWithPath: (OFString*)path;
+
+/*!
+ * @brief Creates a new OFMappedFile for the file at the specified path.
+ *
+ * @param path The path to the file to map
+ * @param mode The mode in which to map the file
+ * @return A new autoreleased OFMappedFile
+ */
++ (instancetype)mappedFileWithPath: (OFString*)path
+			      mode: (of_mapped_file_mode_t)mode;
+
+/*!
+ * @brief Initializes an already allocated OFMappedFile as a read-only mapping
+ *	  of the file at the specified path.
+ *
+ * @param path The path to the file to map
+ * @return An initialized OFMappedFile
+ */
+- initWithPath: (OFString*)path;
+
+/*!
+ * @brief Initializes an already allocated OFMappedFile with the file at the
+ *	  specified path.
+ *
+ * @param path The path to the file to map
+ * @param mode The mode in which to map the file
+ * @return An initialized OFMappedFile
+ */
+- initWithPath: (OFString*)path
+	  mode: (of_mapped_file_mode_t)mode;
+
+/*!
+ * @brief Returns the mode in which the file was mapped.
+ *
+ * @return The mode in which the file was mapped
+ */
+- (of_mapped_file_mode_t)mode;
+
+/*!
+ * @brief Returns the contents of the file.
+ *
+ * @warning The returned pointer is only valid until the OFMappedFile is closed
+ *	    or deallocated!
+ *
+ * @return The contents of the file
+ */
+- (const void*)items OF_RETURNS_INNER_POINTER;
+
+/*!
+ * @brief Returns the contents of the file for modification.
+ *
+ * This is only possible for mappings in the mode
+ * @ref OF_MAPPED_FILE_MODE_COPY_ON_WRITE.
+ *
+ * @warning The returned pointer is only valid until the OFMappedFile is closed
+ *	    or deallocated!
+ *
+ * @return The contents of the file for modification
+ */
+- (void*)mutableItems OF_RETURNS_INNER_POINTER;
+
+/*!
+ * @brief Returns the length of the mapping in bytes.
+ *
+ * @return The length of the mapping in bytes
+ */
+- (size_t)length;
+
+/*!
+ * @brief Advises the system on how the mapping will be accessed.
+ *
+ * This is only a hint and silently ignored if the system does not support it.
+ *
+ * @param advice The expected access pattern
+ */
+- (void)adviseAccessPattern: (of_mapped_file_advice_t)advice;
+
+/*!
+ * @brief Advises the system on how a range of the mapping will be accessed.
+ *
+ * This is only a hint and silently ignored if the system does not support it.
+ *
+ * @param advice The expected access pattern
+ * @param range The range of the mapping the advice applies to
+ */
+- (void)adviseAccessPattern: (of_mapped_file_advice_t)advice
+		    inRange: (of_range_t)range;
+@end
+
+OF_ASSUME_NONNULL_END
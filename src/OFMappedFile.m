@@ -0,0 +1,302 @@
+/*
+ * Copyright (c) 2008, 2009, 2010, 2011, 2012, 2013, 2014, 2015, 2016
+ *   Jonathan Schleifer <js@heap.zone>
+ *
+ * All rights reserved.
+ *
+ * This file is part of ObjFW. It may be distributed under the terms of the
+ * Q Public License 1.0, which can be found in the file LICENSE.QPL included in
+ * the packaging of this file.
+ *
+ * Alternatively, it may be distributed under the terms of the GNU General
+ * Public License, either version 2 or 3, which can be found in the file
+ * LICENSE.GPLv2 or LICENSE.GPLv3 respectively included in the packaging of this
+ * file.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
+#import "OFMappedFile.h"
+#import "OFFile.h"
+#import "OFString.h"
+#import "OFSystemInfo.h"
+
+#import "OFInvalidArgumentException.h"
+#import "OFNotImplementedException.h"
+#import "OFNotOpenException.h"
+#import "OFOpenItemFailedException.h"
+#import "OFOutOfRangeException.h"
+#import "OFReadFailedException.h"
+#import "OFSeekFailedException.h"
+
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+# define USE_MMAP
+#endif
+
+#ifndef MAP_FAILED
+# define MAP_FAILED ((void*)-1)
+#endif
+
+@implementation OFMappedFile
++ (instancetype)mappedFileWithPath: (OFString*)path
+{
+	return [[[self alloc] initWithPath: path] autorelease];
+}
+
++ (instancetype)mappedFileWithPath: (OFString*)path
+			      mode: (of_mapped_file_mode_t)mode
+{
+	return [[[self alloc] initWithPath: path
+				      mode: mode] autorelease];
+}
+
+- init
+{
+	OF_INVALID_INIT_METHOD
+}
+
+- initWithPath: (OFString*)path
+{
+	return [self initWithPath: path
+			     mode: OF_MAPPED_FILE_MODE_READ_ONLY];
+}
+
+- initWithPath: (OFString*)path
+	  mode: (of_mapped_file_mode_t)mode
+{
+	self = [super init];
+
+	@try {
+		void *pool = objc_autoreleasePoolPush();
+		OFFile *file;
+		of_offset_t size;
+
+		if (mode != OF_MAPPED_FILE_MODE_READ_ONLY &&
+		    mode != OF_MAPPED_FILE_MODE_COPY_ON_WRITE)
+			@throw [OFInvalidArgumentException exception];
+
+		_mode = mode;
+
+		file = [OFFile fileWithPath: path
+				       mode: @"rb"];
+		size = [file seekToOffset: 0
+				   whence: SEEK_END];
+
+		if (sizeof(of_offset_t) > sizeof(size_t) &&
+		    size > (of_offset_t)SIZE_MAX)
+			@throw [OFOutOfRangeException exception];
+
+		_length = (size_t)size;
+
+		/* mmap() does not allow empty mappings */
+		if (_length > 0) {
+#ifdef USE_MMAP
+			int prot = PROT_READ;
+
+			if (mode == OF_MAPPED_FILE_MODE_COPY_ON_WRITE)
+				prot |= PROT_WRITE;
+
+			_items = mmap(NULL, _length, prot, MAP_PRIVATE,
+			    [file fileDescriptorForReading], 0);
+
+			if (_items != MAP_FAILED)
+				_mapped = true;
+			else
+				_items = NULL;
+#endif
+
+			/*
+			 * Either there is no mmap() or the file system does not
+			 * support it, so read the file into memory instead.
+			 */
+			if (!_mapped) {
+				[file seekToOffset: 0
+					    whence: SEEK_SET];
+
+				_items = [self allocMemoryWithSize: _length];
+				[file readIntoBuffer: _items
+					 exactLength: _length];
+			}
+		}
+
+		objc_autoreleasePoolPop(pool);
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+#ifdef USE_MMAP
+	if (_mapped)
+		munmap(_items, _length);
+#endif
+
+	[super dealloc];
+}
+
+- (of_mapped_file_mode_t)mode
+{
+	return _mode;
+}
+
+- (const void*)items
+{
+	if (_items == NULL && _length > 0)
+		@throw [OFNotOpenException exceptionWithObject: self];
+
+	return _items;
+}
+
+- (void*)mutableItems
+{
+	if (_mode != OF_MAPPED_FILE_MODE_COPY_ON_WRITE)
+		@throw [OFNotImplementedException exceptionWithSelector: _cmd
+								 object: self];
+
+	if (_items == NULL && _length > 0)
+		@throw [OFNotOpenException exceptionWithObject: self];
+
+	return _items;
+}
+
+- (size_t)length
+{
+	return _length;
+}
+
+- (void)adviseAccessPattern: (of_mapped_file_advice_t)advice
+{
+	[self adviseAccessPattern: advice
+			  inRange: of_range(0, _length)];
+}
+
+- (void)adviseAccessPattern: (of_mapped_file_advice_t)advice
+		    inRange: (of_range_t)range
+{
+#if defined(USE_MMAP) && defined(HAVE_MADVISE)
+	size_t pageSize, start;
+	int flag;
+#endif
+
+	if (range.length > SIZE_MAX - range.location ||
+	    range.location + range.length > _length)
+		@throw [OFOutOfRangeException exception];
+
+#if defined(USE_MMAP) && defined(HAVE_MADVISE)
+	if (!_mapped || range.length == 0)
+		return;
+
+	switch (advice) {
+	case OF_MAPPED_FILE_ADVICE_NORMAL:
+		flag = MADV_NORMAL;
+		break;
+	case OF_MAPPED_FILE_ADVICE_SEQUENTIAL:
+		flag = MADV_SEQUENTIAL;
+		break;
+	case OF_MAPPED_FILE_ADVICE_RANDOM:
+		flag = MADV_RANDOM;
+		break;
+	case OF_MAPPED_FILE_ADVICE_WILL_NEED:
+		flag = MADV_WILLNEED;
+		break;
+	default:
+		@throw [OFInvalidArgumentException exception];
+	}
+
+	/* madvise() requires the start to be aligned to a page */
+	pageSize = [OFSystemInfo pageSize];
+	start = range.location - range.location % pageSize;
+
+	/* This is only a hint, so failing is not an error */
+	madvise(_items + start, range.location + range.length - start, flag);
+#endif
+}
+
+- (bool)lowlevelIsAtEndOfStream
+{
+	return (_items == NULL || _position >= _length);
+}
+
+- (size_t)lowlevelReadIntoBuffer: (void*)buffer
+			  length: (size_t)length
+{
+	if (_items == NULL && _length > 0)
+		@throw [OFReadFailedException exceptionWithObject: self
+						  requestedLength: length
+							    errNo: EBADF];
+
+	if (_position >= _length)
+		return 0;
+
+	if (length > _length - _position)
+		length = _length - _position;
+
+	memcpy(buffer, _items + _position, length);
+	_position += length;
+
+	return length;
+}
+
+- (of_offset_t)lowlevelSeekToOffset: (of_offset_t)offset
+			     whence: (int)whence
+{
+	of_offset_t base;
+
+	switch (whence) {
+	case SEEK_SET:
+		base = 0;
+		break;
+	case SEEK_CUR:
+		base = (of_offset_t)_position;
+		break;
+	case SEEK_END:
+		base = (of_offset_t)_length;
+		break;
+	default:
+		@throw [OFSeekFailedException exceptionWithStream: self
+							   offset: offset
+							   whence: whence
+							    errNo: EINVAL];
+	}
+
+	if (offset < -base || (sizeof(of_offset_t) > sizeof(size_t) &&
+	    base + offset > (of_offset_t)SIZE_MAX))
+		@throw [OFSeekFailedException exceptionWithStream: self
+							   offset: offset
+							   whence: whence
+							    errNo: EINVAL];
+
+	_position = (size_t)(base + offset);
+
+	return (of_offset_t)_position;
+}
+
+- (void)close
+{
+	if (_items != NULL) {
+#ifdef USE_MMAP
+		if (_mapped)
+			munmap(_items, _length);
+		else
+#endif
+			[self freeMemory: _items];
+	}
+
+	_items = NULL;
+	_mapped = false;
+	_position = 0;
+
+	[super close];
+}
+@end
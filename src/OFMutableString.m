@@ -24,6 +24,7 @@
 #include <sys/types.h>
 
 #import "OFString.h"
+#import "OFString+Private.h"
 #import "OFMutableString_UTF8.h"
 
 #import "OFInvalidArgumentException.h"
@@ -420,13 +421,14 @@ tolowerWrapper(int c)
 - (void)appendFormat: (OFConstantString*)format
 	   arguments: (va_list)arguments
 {
-	char *UTF8String;
+	char buffer[256], *UTF8String;
 	int UTF8StringLength;
 
 	if (format == nil)
 		@throw [OFInvalidArgumentException exception];
 
-	if ((UTF8StringLength = of_vasprintf(&UTF8String, [format UTF8String],
+	if ((UTF8StringLength = of_vasprintf_buffer(buffer, sizeof(buffer),
+	    &UTF8String, [format UTF8String], [format OF_isConstantString],
 	    arguments)) == -1)
 		@throw [OFInvalidFormatException exception];
 
@@ -434,7 +436,8 @@ tolowerWrapper(int c)
 		[self appendUTF8String: UTF8String
 				length: UTF8StringLength];
 	} @finally {
-		free(UTF8String);
+		if (UTF8String != buffer)
+			free(UTF8String);
 	}
 }
 
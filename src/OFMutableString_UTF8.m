@@ -22,6 +22,7 @@
 #include <assert.h>
 
 #import "OFString.h"
+#import "OFString+Private.h"
 #import "OFString_UTF8.h"
 #import "OFMutableString_UTF8.h"
 
@@ -31,7 +32,9 @@
 #import "OFOutOfMemoryException.h"
 #import "OFOutOfRangeException.h"
 
+#import "of_ascii.h"
 #import "of_asprintf.h"
+#import "of_memmem.h"
 #import "unicode.h"
 
 @implementation OFMutableString_UTF8
@@ -59,19 +62,38 @@
 		  wordStartTableSize: (size_t)startTableSize
 		 wordMiddleTableSize: (size_t)middleTableSize
 {
+	void (*convertASCII)(char*, size_t) = NULL;
 	of_unichar_t *unicodeString;
-	size_t unicodeLen, newCStringLength;
+	size_t unicodeLen, prefixLength, newCStringLength;
 	size_t i, j;
 	char *newCString;
 	bool isStart = true;
 
+#ifdef OF_HAVE_UNICODE_TABLES
+	/*
+	 * When converting to lower or upper case, only the ASCII letters of
+	 * ASCII runs need to be converted, which does not need the tables.
+	 */
+	if (startTable == middleTable) {
+		if (startTable == of_unicode_lowercase_table)
+			convertASCII = of_ascii_tolower;
+		else if (startTable == of_unicode_uppercase_table)
+			convertASCII = of_ascii_toupper;
+	}
+#endif
+
+	_s->hashed = false;
+
 	if (!_s->isUTF8) {
 		uint8_t t;
 		const of_unichar_t *const *table;
 
 		assert(startTableSize >= 1 && middleTableSize >= 1);
 
-		_s->hashed = false;
+		if (convertASCII != NULL) {
+			convertASCII(_s->cString, _s->cStringLength);
+			return;
+		}
 
 		for (i = 0; i < _s->cStringLength; i++) {
 			if (isStart)
@@ -98,12 +120,76 @@
 		return;
 	}
 
-	unicodeLen = [self length];
+	/*
+	 * Convert in place for as long as no character changes the length of
+	 * its encoding, which is the common case.
+	 */
+	i = 0;
+	while (i < _s->cStringLength) {
+		const of_unichar_t *const *table;
+		size_t tableSize;
+		of_unichar_t c, tc;
+		ssize_t cLen;
+		char buffer[4];
+
+		if (convertASCII != NULL) {
+			size_t ASCIILength = of_ascii_length(_s->cString + i,
+			    _s->cStringLength - i);
+
+			convertASCII(_s->cString + i, ASCIILength);
+
+			if ((i += ASCIILength) >= _s->cStringLength)
+				break;
+		}
+
+		if (isStart) {
+			table = startTable;
+			tableSize = startTableSize;
+		} else {
+			table = middleTable;
+			tableSize = middleTableSize;
+		}
+
+		cLen = of_string_utf8_decode(_s->cString + i,
+		    _s->cStringLength - i, &c);
+
+		if (cLen <= 0 || c > 0x10FFFF)
+			@throw [OFInvalidEncodingException exception];
+
+		tc = c;
+		if (c >> 8 < tableSize && table[c >> 8][c & 0xFF] != 0)
+			tc = table[c >> 8][c & 0xFF];
+
+		if (of_string_utf8_encode(tc, buffer) != (size_t)cLen)
+			break;
+
+		memcpy(_s->cString + i, buffer, cLen);
+		i += cLen;
+
+		switch (c) {
+		case ' ':
+		case '\t':
+		case '\n':
+		case '\r':
+			isStart = true;
+			break;
+		default:
+			isStart = false;
+			break;
+		}
+	}
+
+	if (i >= _s->cStringLength)
+		return;
+
+	/* The length changes, so build a new string for the rest */
+	prefixLength = i;
+	unicodeLen = _s->length - of_string_utf8_get_index(_s->cString, i);
 	unicodeString = [self allocMemoryWithSize: sizeof(of_unichar_t)
 					    count: unicodeLen];
 
-	i = j = 0;
-	newCStringLength = 0;
+	j = 0;
+	newCStringLength = prefixLength;
 
 	while (i < _s->cStringLength) {
 		const of_unichar_t *const *table;
@@ -113,7 +199,7 @@
 
 		if (isStart) {
 			table = startTable;
-			tableSize = middleTableSize;
+			tableSize = startTableSize;
 		} else {
 			table = middleTable;
 			tableSize = middleTableSize;
@@ -170,7 +256,8 @@
 		@throw e;
 	}
 
-	j = 0;
+	memcpy(newCString, _s->cString, prefixLength);
+	j = prefixLength;
 
 	for (i = 0; i < unicodeLen; i++) {
 		size_t d;
@@ -189,7 +276,6 @@
 	[self freeMemory: unicodeString];
 
 	[self freeMemory: _s->cString];
-	_s->hashed = false;
 	_s->cString = newCString;
 	_s->cStringLength = newCStringLength;
 
@@ -426,13 +512,14 @@
 - (void)appendFormat: (OFConstantString*)format
 	   arguments: (va_list)arguments
 {
-	char *UTF8String;
+	char buffer[256], *UTF8String;
 	int UTF8StringLength;
 
 	if (format == nil)
 		@throw [OFInvalidArgumentException exception];
 
-	if ((UTF8StringLength = of_vasprintf(&UTF8String, [format UTF8String],
+	if ((UTF8StringLength = of_vasprintf_buffer(buffer, sizeof(buffer),
+	    &UTF8String, [format UTF8String], [format OF_isConstantString],
 	    arguments)) == -1)
 		@throw [OFInvalidFormatException exception];
 
@@ -440,7 +527,8 @@
 		[self appendUTF8String: UTF8String
 				length: UTF8StringLength];
 	} @finally {
-		free(UTF8String);
+		if (UTF8String != buffer)
+			free(UTF8String);
 	}
 }
 
@@ -650,7 +738,8 @@
 	const char *replacementString = [replacement UTF8String];
 	size_t searchLength = [string UTF8StringLength];
 	size_t replacementLength = [replacement UTF8StringLength];
-	size_t last, newCStringLength, newLength;
+	size_t i, end, last, newCStringLength, newLength;
+	const char *found;
 	char *newCString;
 
 	if (range.length > SIZE_MAX - range.location ||
@@ -665,17 +754,19 @@
 		    _s->cStringLength - range.location);
 	}
 
-	if ([string UTF8StringLength] > range.length)
+	if (searchLength == 0 || searchLength > range.length)
 		return;
 
 	newCString = NULL;
 	newCStringLength = 0;
 	newLength = _s->length;
 	last = 0;
+	i = range.location;
+	end = range.location + range.length;
 
-	for (size_t i = range.location; i <= range.length - searchLength; i++) {
-		if (memcmp(_s->cString + i, searchString, searchLength) != 0)
-			continue;
+	while ((found = of_memmem(_s->cString + i, end - i,
+	    searchString, searchLength)) != NULL) {
+		i = found - _s->cString;
 
 		@try {
 			newCString = [self
@@ -694,10 +785,14 @@
 		newCStringLength += i - last + replacementLength;
 		newLength = newLength - [string length] + [replacement length];
 
-		i += searchLength - 1;
-		last = i + 1;
+		i += searchLength;
+		last = i;
 	}
 
+	/* Nothing to replace */
+	if (newCString == NULL)
+		return;
+
 	@try {
 		newCString = [self resizeMemory: newCString
 					   size: newCStringLength +
@@ -18,6 +18,7 @@
 
 #include <inttypes.h>
 #include <math.h>
+#include <string.h>
 
 #import "OFNumber.h"
 #import "OFString.h"
@@ -29,6 +30,8 @@
 #import "OFInvalidFormatException.h"
 #import "OFOutOfRangeException.h"
 
+#import "of_numconv.h"
+
 #define RETURN_AS(t)							\
 	switch (_type) {						\
 	case OF_NUMBER_TYPE_BOOL:					\
@@ -871,7 +874,9 @@
 
 - (OFString*)description
 {
-	OFMutableString *ret;
+	/* Two more bytes for appending ".0" */
+	char buffer[OF_DOUBLE_STRING_SIZE + 2];
+	size_t length;
 
 	switch (_type) {
 	case OF_NUMBER_TYPE_BOOL:
@@ -888,7 +893,8 @@
 	case OF_NUMBER_TYPE_SIZE:
 	case OF_NUMBER_TYPE_UINTMAX:
 	case OF_NUMBER_TYPE_UINTPTR:
-		return [OFString stringWithFormat: @"%ju", [self uIntMaxValue]];
+		length = of_uintmax_to_string([self uIntMaxValue], buffer);
+		break;
 	case OF_NUMBER_TYPE_CHAR:
 	case OF_NUMBER_TYPE_SHORT:
 	case OF_NUMBER_TYPE_INT:
@@ -902,29 +908,33 @@
 	case OF_NUMBER_TYPE_INTMAX:
 	case OF_NUMBER_TYPE_PTRDIFF:
 	case OF_NUMBER_TYPE_INTPTR:
-		return [OFString stringWithFormat: @"%jd", [self intMaxValue]];
+		length = of_intmax_to_string([self intMaxValue], buffer);
+		break;
 	case OF_NUMBER_TYPE_FLOAT:
-		ret = [OFMutableString stringWithFormat: @"%g", _value.float_];
-
-		if (![ret containsString: @"."])
-			[ret appendString: @".0"];
-
-		[ret makeImmutable];
-
-		return ret;
 	case OF_NUMBER_TYPE_DOUBLE:
-		ret = [OFMutableString stringWithFormat: @"%g",
-							 _value.double_];
-
-		if (![ret containsString: @"."])
-			[ret appendString: @".0"];
-
-		[ret makeImmutable];
+		if (_type == OF_NUMBER_TYPE_FLOAT)
+			length = of_float_to_string(_value.float_, buffer);
+		else
+			length = of_double_to_string(_value.double_, buffer);
+
+		/*
+		 * Make integral values recognizable as floating point. This
+		 * excludes exponents as well as nan and inf.
+		 */
+		if (memchr(buffer, '.', length) == NULL &&
+		    memchr(buffer, 'e', length) == NULL &&
+		    memchr(buffer, 'n', length) == NULL) {
+			buffer[length++] = '.';
+			buffer[length++] = '0';
+		}
 
-		return ret;
+		break;
 	default:
 		@throw [OFInvalidFormatException exception];
 	}
+
+	return [OFString stringWithUTF8String: buffer
+				       length: length];
 }
 
 - (OFXMLElement*)XMLElementBySerializing
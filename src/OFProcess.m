@@ -495,6 +495,8 @@ extern char **environ;
 		     length: (size_t)length
 {
 #ifndef OF_WINDOWS
+	size_t bytesWritten = 0;
+
 	if (_writePipe[1] == -1 || _atEndOfStream)
 		@throw [OFWriteFailedException exceptionWithObject: self
 						   requestedLength: length];
@@ -502,10 +504,19 @@ extern char **environ;
 	if (length > SSIZE_MAX)
 		@throw [OFOutOfRangeException exception];
 
-	if (write(_writePipe[1], buffer, length) != (ssize_t)length)
-		@throw [OFWriteFailedException exceptionWithObject: self
-						   requestedLength: length
-							     errNo: errno];
+	while (bytesWritten < length) {
+		ssize_t ret = write(_writePipe[1],
+		    (const char*)buffer + bytesWritten, length - bytesWritten);
+
+		if (ret < 0)
+			@throw [OFWriteFailedException
+			    exceptionWithObject: self
+				requestedLength: length
+				   bytesWritten: bytesWritten
+					  errNo: errno];
+
+		bytesWritten += ret;
+	}
 #else
 	DWORD ret;
 
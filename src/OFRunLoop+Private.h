@@ -18,6 +18,7 @@
 #import "OFStream.h"
 #ifdef OF_HAVE_SOCKETS
 # import "OFUDPSocket.h"
+# import "OFDNSResolver.h"
 #endif
 
 OF_ASSUME_NONNULL_BEGIN
@@ -39,9 +40,33 @@ OF_ASSUME_NONNULL_BEGIN
 			    encoding: (of_string_encoding_t)encoding
 			      target: (id)target
 			    selector: (SEL)selector;
++ (void)OF_addAsyncWriteForStream: (OFStream*)stream
+			   buffer: (const void*)buffer
+			   length: (size_t)length
+			   target: (id)target
+			 selector: (SEL)selector;
++ (void)OF_addAsyncWriteForStream: (OFStream*)stream
+			dataArray: (OFDataArray*)dataArray;
++ (void)OF_addAsyncTransferFromStream: (OFStream*)source
+			     toStream: (OFStream*)destination
+			       length: (uint64_t)length
+			       target: (id)target
+			     selector: (SEL)selector;
 + (void)OF_addAsyncAcceptForTCPSocket: (OFTCPSocket*)socket
 			       target: (id)target
 			     selector: (SEL)selector;
++ (void)OF_addAsyncConnectForSocket: (id <OFReadyForWritingObserving>)socket
+			     target: (id)target
+			   selector: (SEL)selector;
+/*
+ * Fills the stream's read buffer and then calls the selector, which gets the
+ * stream and an exception and returns whether to call it again once more data
+ * arrived. This allows parsing the data in the read buffer in place, see
+ * OFStream+Private.h.
+ */
++ (void)OF_addAsyncFillReadBufferForStream: (OFStream*)stream
+				    target: (id)target
+				  selector: (SEL)selector;
 + (void)OF_addAsyncReceiveForUDPSocket: (OFUDPSocket*)socket
 				buffer: (void*)buffer
 				length: (size_t)length
@@ -59,6 +84,14 @@ OF_ASSUME_NONNULL_BEGIN
 + (void)OF_addAsyncReadLineForStream: (OFStream*)stream
 			    encoding: (of_string_encoding_t)encoding
 			       block: (of_stream_async_read_line_block_t)block;
++ (void)OF_addAsyncWriteForStream: (OFStream*)stream
+			   buffer: (const void*)buffer
+			   length: (size_t)length
+			    block: (of_stream_async_write_block_t)block;
++ (void)OF_addAsyncTransferFromStream: (OFStream*)source
+			     toStream: (OFStream*)destination
+			       length: (uint64_t)length
+				block: (of_stream_async_transfer_block_t)block;
 + (void)OF_addAsyncAcceptForTCPSocket: (OFTCPSocket*)socket
 				block: (of_tcp_socket_async_accept_block_t)
 					   block;
@@ -69,6 +102,7 @@ OF_ASSUME_NONNULL_BEGIN
 					    block;
 # endif
 + (void)OF_cancelAsyncRequestsForObject: (id)object;
++ (OFDNSResolver*)OF_DNSResolver;
 #endif
 - (void)OF_removeTimer: (OFTimer*)timer;
 @end
@@ -28,6 +28,7 @@ OF_ASSUME_NONNULL_BEGIN
 #endif
 #ifdef OF_HAVE_SOCKETS
 @class OFKernelEventObserver;
+@class OFDNSResolver;
 #endif
 @class OFMutableDictionary OF_GENERIC(KeyType, ObjectType);
 @class OFTimer;
@@ -49,7 +50,8 @@ OF_ASSUME_NONNULL_BEGIN
 #endif
 #if defined(OF_HAVE_SOCKETS)
 	OFKernelEventObserver *_kernelEventObserver;
-	OFMutableDictionary *_readQueues;
+	OFMutableDictionary *_readQueues, *_writeQueues;
+	OFDNSResolver *_DNSResolver;
 #elif defined(OF_HAVE_THREADS)
 	OFCondition *_condition;
 #endif
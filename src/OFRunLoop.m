@@ -17,12 +17,16 @@
 #include "config.h"
 
 #include <assert.h>
+#include <errno.h>
 
 #import "OFRunLoop.h"
 #import "OFRunLoop+Private.h"
+#import "OFStream+Private.h"
 #import "OFDictionary.h"
+#import "OFDataArray.h"
 #ifdef OF_HAVE_SOCKETS
 # import "OFKernelEventObserver.h"
+# import "OFKernelEventObserver+Private.h"
 #endif
 #import "OFThread.h"
 #ifdef OF_HAVE_THREADS
@@ -34,8 +38,25 @@
 #import "OFTimer+Private.h"
 #import "OFDate.h"
 
+#import "OFAcceptFailedException.h"
+#import "OFReadFailedException.h"
+#import "OFWriteFailedException.h"
+
+#define TRANSFER_BUFFER_SIZE (64 * 1024)
+#define MAX_READS_PER_EVENT 16
+
 static OFRunLoop *mainRunLoop = nil;
 
+#ifdef OF_HAVE_SOCKETS
+@interface OFRunLoop () <OFKernelEventObserverWriteDelegate,
+    OFKernelEventObserverDrainDelegate>
+- (bool)OF_readFromObject: (id)object;
+- (void)OF_object: (id)object
+   didWriteLength: (size_t)length
+	exception: (OFException*)exception;
+@end
+#endif
+
 #ifdef OF_HAVE_SOCKETS
 @interface OFRunLoop_QueueItem: OFObject
 {
@@ -77,6 +98,34 @@ static OFRunLoop *mainRunLoop = nil;
 }
 @end
 
+@interface OFRunLoop_WriteQueueItem: OFRunLoop_QueueItem
+{
+@public
+# ifdef OF_HAVE_BLOCKS
+	of_stream_async_write_block_t _block;
+# endif
+	OFDataArray *_dataArray;
+	const void *_buffer;
+	size_t _length, _writtenLength;
+}
+@end
+
+@interface OFRunLoop_TransferQueueItem: OFRunLoop_QueueItem
+{
+@public
+# ifdef OF_HAVE_BLOCKS
+	of_stream_async_transfer_block_t _block;
+# endif
+	OFStream *_source;
+	uint64_t _length, _transferred;
+	char *_buffer;
+	size_t _bufferLength, _bufferOffset;
+	bool _useBuffer;
+}
+
+- (bool)transferToStream: (OFStream*)stream;
+@end
+
 @interface OFRunLoop_AcceptQueueItem: OFRunLoop_QueueItem
 {
 @public
@@ -86,6 +135,12 @@ static OFRunLoop *mainRunLoop = nil;
 }
 @end
 
+@interface OFRunLoop_ConnectQueueItem: OFRunLoop_QueueItem
+@end
+
+@interface OFRunLoop_FillReadBufferQueueItem: OFRunLoop_QueueItem
+@end
+
 @interface OFRunLoop_UDPReceiveQueueItem: OFRunLoop_QueueItem
 {
 @public
@@ -139,6 +194,113 @@ static OFRunLoop *mainRunLoop = nil;
 # endif
 @end
 
+@implementation OFRunLoop_WriteQueueItem
+- (void)dealloc
+{
+# ifdef OF_HAVE_BLOCKS
+	[_block release];
+# endif
+	[_dataArray release];
+
+	[super dealloc];
+}
+@end
+
+@implementation OFRunLoop_TransferQueueItem
+- (void)dealloc
+{
+# ifdef OF_HAVE_BLOCKS
+	[_block release];
+# endif
+	[_source release];
+
+	[super dealloc];
+}
+
+/*
+ * Advances the transfer by one step without blocking on the destination and
+ * returns whether the transfer is done.
+ */
+- (bool)transferToStream: (OFStream*)stream
+{
+	if (_bufferOffset == _bufferLength) {
+		uint64_t remaining = _length - _transferred;
+		size_t length;
+
+		if (remaining == 0)
+			return true;
+
+		if (!_useBuffer) {
+			ssize_t ret = [_source
+			    OF_kernelTransferToStream: stream
+					       length: (remaining > SIZE_MAX
+							   ? SIZE_MAX
+							   : (size_t)remaining)];
+
+			if (ret > 0) {
+				_transferred += ret;
+				return (_transferred == _length);
+			}
+
+			if (ret < 0 && (errno == EWOULDBLOCK ||
+			    errno == EAGAIN))
+				return false;
+
+			if (ret < 0 && errno != ENOSYS && errno != EINVAL &&
+			    errno != EOPNOTSUPP)
+				@throw [OFWriteFailedException
+				    exceptionWithObject: stream
+					requestedLength: 0
+					   bytesWritten: 0
+						  errNo: errno];
+
+			/*
+			 * Either the kernel cannot do it or the end of the
+			 * stream was reached, which the buffered path below
+			 * finds out about.
+			 */
+			_useBuffer = true;
+		}
+
+		if ([_source isAtEndOfStream])
+			return true;
+
+		if (_buffer == NULL)
+			_buffer = [self allocMemoryWithSize:
+			    TRANSFER_BUFFER_SIZE];
+
+		length = TRANSFER_BUFFER_SIZE;
+		if (remaining < length)
+			length = (size_t)remaining;
+
+		_bufferLength = [_source readIntoBuffer: _buffer
+						 length: length];
+		_bufferOffset = 0;
+
+		if (_bufferLength == 0)
+			return [_source isAtEndOfStream];
+	}
+
+	@try {
+		[stream writeBuffer: _buffer + _bufferOffset
+			     length: _bufferLength - _bufferOffset];
+	} @catch (OFWriteFailedException *e) {
+		if ([e errNo] != EWOULDBLOCK && [e errNo] != EAGAIN)
+			@throw e;
+
+		_bufferOffset += [e bytesWritten];
+		_transferred += [e bytesWritten];
+
+		return false;
+	}
+
+	_transferred += _bufferLength - _bufferOffset;
+	_bufferOffset = _bufferLength = 0;
+
+	return (_transferred == _length);
+}
+@end
+
 @implementation OFRunLoop_AcceptQueueItem
 # ifdef OF_HAVE_BLOCKS
 - (void)dealloc
@@ -150,6 +312,12 @@ static OFRunLoop *mainRunLoop = nil;
 # endif
 @end
 
+@implementation OFRunLoop_ConnectQueueItem
+@end
+
+@implementation OFRunLoop_FillReadBufferQueueItem
+@end
+
 @implementation OFRunLoop_UDPReceiveQueueItem
 # ifdef OF_HAVE_BLOCKS
 - (void)dealloc
@@ -160,6 +328,22 @@ static OFRunLoop *mainRunLoop = nil;
 }
 # endif
 @end
+
+/* Whether the exception only means that the read would have blocked */
+static bool
+wouldBlock(OFException *exception)
+{
+	int errNo;
+
+	if ([exception isKindOfClass: [OFReadFailedException class]])
+		errNo = [(OFReadFailedException*)exception errNo];
+	else if ([exception isKindOfClass: [OFAcceptFailedException class]])
+		errNo = [(OFAcceptFailedException*)exception errNo];
+	else
+		return false;
+
+	return (errNo == EWOULDBLOCK || errNo == EAGAIN);
+}
 #endif
 
 @implementation OFRunLoop
@@ -205,6 +389,28 @@ static OFRunLoop *mainRunLoop = nil;
 									\
 	objc_autoreleasePoolPop(pool);
 
+# define ADD_WRITE(type, object, code)					\
+	void *pool = objc_autoreleasePoolPush();			\
+	OFRunLoop *runLoop = [self currentRunLoop];			\
+	OFList *queue = [runLoop->_writeQueues objectForKey: object];	\
+	type *queueItem;						\
+									\
+	if (queue == nil) {						\
+		queue = [OFList list];					\
+		[runLoop->_writeQueues setObject: queue			\
+					  forKey: object];		\
+	}								\
+									\
+	if ([queue count] == 0)						\
+		[runLoop->_kernelEventObserver				\
+		    addObjectForWriting: object];			\
+									\
+	queueItem = [[[type alloc] init] autorelease];			\
+	code								\
+	[queue appendObject: queueItem];				\
+									\
+	objc_autoreleasePoolPop(pool);
+
 + (void)OF_addAsyncReadForStream: (OFStream*)stream
 			  buffer: (void*)buffer
 			  length: (size_t)length
@@ -245,6 +451,44 @@ static OFRunLoop *mainRunLoop = nil;
 	})
 }
 
++ (void)OF_addAsyncWriteForStream: (OFStream*)stream
+			   buffer: (const void*)buffer
+			   length: (size_t)length
+			   target: (id)target
+			 selector: (SEL)selector
+{
+	ADD_WRITE(OFRunLoop_WriteQueueItem, stream, {
+		queueItem->_target = [target retain];
+		queueItem->_selector = selector;
+		queueItem->_buffer = buffer;
+		queueItem->_length = length;
+	})
+}
+
++ (void)OF_addAsyncWriteForStream: (OFStream*)stream
+			dataArray: (OFDataArray*)dataArray
+{
+	ADD_WRITE(OFRunLoop_WriteQueueItem, stream, {
+		queueItem->_dataArray = [dataArray retain];
+		queueItem->_buffer = [dataArray items];
+		queueItem->_length = [dataArray count] * [dataArray itemSize];
+	})
+}
+
++ (void)OF_addAsyncTransferFromStream: (OFStream*)source
+			     toStream: (OFStream*)destination
+			       length: (uint64_t)length
+			       target: (id)target
+			     selector: (SEL)selector
+{
+	ADD_WRITE(OFRunLoop_TransferQueueItem, destination, {
+		queueItem->_target = [target retain];
+		queueItem->_selector = selector;
+		queueItem->_source = [source retain];
+		queueItem->_length = length;
+	})
+}
+
 + (void)OF_addAsyncAcceptForTCPSocket: (OFTCPSocket*)stream
 			       target: (id)target
 			     selector: (SEL)selector
@@ -255,6 +499,26 @@ static OFRunLoop *mainRunLoop = nil;
 	})
 }
 
++ (void)OF_addAsyncConnectForSocket: (id <OFReadyForWritingObserving>)socket
+			     target: (id)target
+			   selector: (SEL)selector
+{
+	ADD_WRITE(OFRunLoop_ConnectQueueItem, socket, {
+		queueItem->_target = [target retain];
+		queueItem->_selector = selector;
+	})
+}
+
++ (void)OF_addAsyncFillReadBufferForStream: (OFStream*)stream
+				    target: (id)target
+				  selector: (SEL)selector
+{
+	ADD_READ(OFRunLoop_FillReadBufferQueueItem, stream, {
+		queueItem->_target = [target retain];
+		queueItem->_selector = selector;
+	})
+}
+
 + (void)OF_addAsyncReceiveForUDPSocket: (OFUDPSocket*)socket
 				buffer: (void*)buffer
 				length: (size_t)length
@@ -304,6 +568,30 @@ static OFRunLoop *mainRunLoop = nil;
 	})
 }
 
++ (void)OF_addAsyncWriteForStream: (OFStream*)stream
+			   buffer: (const void*)buffer
+			   length: (size_t)length
+			    block: (of_stream_async_write_block_t)block
+{
+	ADD_WRITE(OFRunLoop_WriteQueueItem, stream, {
+		queueItem->_block = [block copy];
+		queueItem->_buffer = buffer;
+		queueItem->_length = length;
+	})
+}
+
++ (void)OF_addAsyncTransferFromStream: (OFStream*)source
+			     toStream: (OFStream*)destination
+			       length: (uint64_t)length
+				block: (of_stream_async_transfer_block_t)block
+{
+	ADD_WRITE(OFRunLoop_TransferQueueItem, destination, {
+		queueItem->_block = [block copy];
+		queueItem->_source = [source retain];
+		queueItem->_length = length;
+	})
+}
+
 + (void)OF_addAsyncAcceptForTCPSocket: (OFTCPSocket*)stream
 				block: (of_tcp_socket_async_accept_block_t)block
 {
@@ -326,6 +614,7 @@ static OFRunLoop *mainRunLoop = nil;
 }
 # endif
 # undef ADD_READ
+# undef ADD_WRITE
 
 + (void)OF_cancelAsyncRequestsForObject: (id)object
 {
@@ -340,8 +629,25 @@ static OFRunLoop *mainRunLoop = nil;
 		[runLoop->_readQueues removeObjectForKey: object];
 	}
 
+	if ((queue = [runLoop->_writeQueues objectForKey: object]) != nil) {
+		assert([queue count] > 0);
+
+		[runLoop->_kernelEventObserver removeObjectForWriting: object];
+		[runLoop->_writeQueues removeObjectForKey: object];
+	}
+
 	objc_autoreleasePoolPop(pool);
 }
+
++ (OFDNSResolver*)OF_DNSResolver
+{
+	OFRunLoop *runLoop = [self currentRunLoop];
+
+	if (runLoop->_DNSResolver == nil)
+		runLoop->_DNSResolver = [[OFDNSResolver alloc] init];
+
+	return runLoop->_DNSResolver;
+}
 #endif
 
 - init
@@ -359,6 +665,7 @@ static OFRunLoop *mainRunLoop = nil;
 		[_kernelEventObserver setDelegate: self];
 
 		_readQueues = [[OFMutableDictionary alloc] init];
+		_writeQueues = [[OFMutableDictionary alloc] init];
 #elif defined(OF_HAVE_THREADS)
 		_condition = [[OFCondition alloc] init];
 #endif
@@ -379,6 +686,8 @@ static OFRunLoop *mainRunLoop = nil;
 #if defined(OF_HAVE_SOCKETS)
 	[_kernelEventObserver release];
 	[_readQueues release];
+	[_writeQueues release];
+	[_DNSResolver release];
 #elif defined(OF_HAVE_THREADS)
 	[_condition release];
 #endif
@@ -431,7 +740,11 @@ static OFRunLoop *mainRunLoop = nil;
 }
 
 #ifdef OF_HAVE_SOCKETS
-- (void)objectIsReadyForReading: (id)object
+/*
+ * Handles the first read request of the object. Returns whether reading would
+ * have blocked, in which case the request is left untouched.
+ */
+- (bool)OF_readFromObject: (id)object
 {
 	OFList *queue = [_readQueues objectForKey: object];
 	of_list_object_t *listObject;
@@ -454,6 +767,9 @@ static OFRunLoop *mainRunLoop = nil;
 			exception = e;
 		}
 
+		if (wouldBlock(exception))
+			return true;
+
 # ifdef OF_HAVE_BLOCKS
 		if (queueItem->_block != NULL) {
 			if (!queueItem->_block(object, queueItem->_buffer,
@@ -506,6 +822,9 @@ static OFRunLoop *mainRunLoop = nil;
 			exception = e;
 		}
 
+		if (wouldBlock(exception))
+			return true;
+
 		queueItem->_readLength += length;
 		if (queueItem->_readLength == queueItem->_exactLength ||
 		    [object isAtEndOfStream] || exception != nil) {
@@ -568,6 +887,9 @@ static OFRunLoop *mainRunLoop = nil;
 			exception = e;
 		}
 
+		if (wouldBlock(exception))
+			return true;
+
 		if (line != nil || [object isAtEndOfStream] ||
 		    exception != nil) {
 # ifdef OF_HAVE_BLOCKS
@@ -622,6 +944,9 @@ static OFRunLoop *mainRunLoop = nil;
 			exception = e;
 		}
 
+		if (wouldBlock(exception))
+			return true;
+
 # ifdef OF_HAVE_BLOCKS
 		if (queueItem->_block != NULL) {
 			if (!queueItem->_block(object, newSocket, exception)) {
@@ -673,6 +998,9 @@ static OFRunLoop *mainRunLoop = nil;
 			exception = e;
 		}
 
+		if (wouldBlock(exception))
+			return true;
+
 # ifdef OF_HAVE_BLOCKS
 		if (queueItem->_block != NULL) {
 			if (!queueItem->_block(object, queueItem->_buffer,
@@ -710,8 +1038,251 @@ static OFRunLoop *mainRunLoop = nil;
 # ifdef OF_HAVE_BLOCKS
 		}
 # endif
+	} else if ([listObject->object isKindOfClass:
+	    [OFRunLoop_FillReadBufferQueueItem class]]) {
+		OFRunLoop_FillReadBufferQueueItem *queueItem =
+		    listObject->object;
+		OFException *exception = nil;
+		bool (*func)(id, SEL, OFStream*, OFException*);
+
+		/*
+		 * If there is data in the read buffer that has not been looked
+		 * at yet, this was called for it instead of the stream being
+		 * readable, so reading would block.
+		 */
+		if (![object hasDataInReadBuffer] ||
+		    [object OF_isWaitingForDelimiter]) {
+			@try {
+				[object OF_fillReadBuffer];
+			} @catch (OFException *e) {
+				exception = e;
+			}
+		}
+
+		if (wouldBlock(exception))
+			return true;
+
+		func = (bool(*)(id, SEL, OFStream*, OFException*))
+		    [queueItem->_target methodForSelector:
+		    queueItem->_selector];
+
+		if (!func(queueItem->_target, queueItem->_selector, object,
+		    exception)) {
+			[queue removeListObject: listObject];
+
+			if ([queue count] == 0) {
+				[_kernelEventObserver
+				    removeObjectForReading: object];
+				[_readQueues removeObjectForKey: object];
+			}
+		}
 	} else
 		assert(0);
+
+	return false;
+}
+
+- (void)objectIsReadyForReading: (id)object
+{
+	[self OF_readFromObject: object];
+}
+
+/*
+ * Edge-triggered observers only report an object again once new data arrives,
+ * so its read requests are handled until reading would block. To not starve
+ * other objects and timers, at most MAX_READS_PER_EVENT are handled at once.
+ */
+- (bool)OF_readFromObjectUntilWouldBlock: (id)object
+{
+	/* The last handler might release the object */
+	[[object retain] autorelease];
+
+	for (size_t i = 0; i < MAX_READS_PER_EVENT; i++) {
+		if ([_readQueues objectForKey: object] == nil)
+			return false;
+
+		if ([self OF_readFromObject: object])
+			return true;
+	}
+
+	return false;
+}
+
+- (void)objectIsReadyForWriting: (id)object
+{
+	OFList *queue = [_writeQueues objectForKey: object];
+	of_list_object_t *listObject;
+
+	assert(queue != nil);
+
+	listObject = [queue firstListObject];
+
+	if ([listObject->object isKindOfClass:
+	    [OFRunLoop_WriteQueueItem class]]) {
+		OFRunLoop_WriteQueueItem *queueItem = listObject->object;
+		size_t length;
+		OFException *exception = nil;
+
+		@try {
+			[object writeBuffer: (const char*)queueItem->_buffer +
+					     queueItem->_writtenLength
+				     length: queueItem->_length -
+					     queueItem->_writtenLength];
+			length = queueItem->_length - queueItem->_writtenLength;
+		} @catch (OFWriteFailedException *e) {
+			length = [e bytesWritten];
+
+			if ([e errNo] != EWOULDBLOCK && [e errNo] != EAGAIN)
+				exception = e;
+		} @catch (OFException *e) {
+			length = 0;
+			exception = e;
+		}
+
+		[self OF_object: object
+		 didWriteLength: length
+		      exception: exception];
+		return;
+	} else if ([listObject->object isKindOfClass:
+	    [OFRunLoop_TransferQueueItem class]]) {
+		OFRunLoop_TransferQueueItem *queueItem = listObject->object;
+		OFException *exception = nil;
+
+		@try {
+			if (![queueItem transferToStream: object])
+				return;
+		} @catch (OFException *e) {
+			exception = e;
+		}
+
+# ifdef OF_HAVE_BLOCKS
+		if (queueItem->_block != NULL)
+			queueItem->_block(queueItem->_source, object,
+			    queueItem->_transferred, exception);
+		else
+# endif
+		if (queueItem->_target != nil) {
+			void (*func)(id, SEL, OFStream*, OFStream*, uint64_t,
+			    OFException*) = (void(*)(id, SEL, OFStream*,
+			    OFStream*, uint64_t, OFException*))
+			    [queueItem->_target methodForSelector:
+			    queueItem->_selector];
+
+			func(queueItem->_target, queueItem->_selector,
+			    queueItem->_source, object,
+			    queueItem->_transferred, exception);
+		}
+	} else if ([listObject->object isKindOfClass:
+	    [OFRunLoop_ConnectQueueItem class]]) {
+		OFRunLoop_ConnectQueueItem *queueItem = listObject->object;
+		void (*func)(id, SEL, id) = (void(*)(id, SEL, id))
+		    [queueItem->_target methodForSelector:
+		    queueItem->_selector];
+
+		func(queueItem->_target, queueItem->_selector, object);
+	} else
+		assert(0);
+
+	[queue removeListObject: listObject];
+
+	if ([queue count] == 0) {
+		[_kernelEventObserver removeObjectForWriting: object];
+		[_writeQueues removeObjectForKey: object];
+	}
+}
+
+- (void)OF_object: (id)object
+   didWriteLength: (size_t)length
+	exception: (OFException*)exception
+{
+	OFList *queue = [_writeQueues objectForKey: object];
+	of_list_object_t *listObject;
+	OFRunLoop_WriteQueueItem *queueItem;
+
+	assert(queue != nil);
+
+	listObject = [queue firstListObject];
+	queueItem = listObject->object;
+
+	queueItem->_writtenLength += length;
+
+	/* Wait until the stream is writable again to write the rest */
+	if (queueItem->_writtenLength < queueItem->_length && exception == nil)
+		return;
+
+	length = 0;
+# ifdef OF_HAVE_BLOCKS
+	if (queueItem->_block != NULL)
+		length = queueItem->_block(object, &queueItem->_buffer,
+		    queueItem->_writtenLength, exception);
+	else
+# endif
+	if (queueItem->_target != nil) {
+		size_t (*func)(id, SEL, OFStream*, const void**, size_t,
+		    OFException*) = (size_t(*)(id, SEL, OFStream*, const void**,
+		    size_t, OFException*))
+		    [queueItem->_target methodForSelector:
+		    queueItem->_selector];
+
+		length = func(queueItem->_target, queueItem->_selector, object,
+		    &queueItem->_buffer, queueItem->_writtenLength, exception);
+	}
+
+	if (length > 0) {
+		queueItem->_length = length;
+		queueItem->_writtenLength = 0;
+		return;
+	}
+
+	[queue removeListObject: listObject];
+
+	if ([queue count] == 0) {
+		[_kernelEventObserver removeObjectForWriting: object];
+		[_writeQueues removeObjectForKey: object];
+	}
+}
+
+- (bool)OF_object: (id)object
+  getPendingWriteBuffer: (const void**)buffer
+		 length: (size_t*)length
+{
+	OFRunLoop_WriteQueueItem *queueItem =
+	    [[_writeQueues objectForKey: object] firstObject];
+
+	/* A write buffer would have to be flushed first */
+	if (![queueItem isKindOfClass: [OFRunLoop_WriteQueueItem class]] ||
+	    [object isWriteBuffered])
+		return false;
+
+	*buffer = (const char*)queueItem->_buffer + queueItem->_writtenLength;
+	*length = queueItem->_length - queueItem->_writtenLength;
+
+	return true;
+}
+
+- (void)OF_object: (id)object
+   didWriteLength: (size_t)length
+	    errNo: (int)errNo
+{
+	OFRunLoop_WriteQueueItem *queueItem =
+	    [[_writeQueues objectForKey: object] firstObject];
+	OFException *exception = nil;
+
+	/* The write might have been cancelled while it was in progress */
+	if (![queueItem isKindOfClass: [OFRunLoop_WriteQueueItem class]])
+		return;
+
+	if (errNo != 0)
+		exception = [OFWriteFailedException
+		    exceptionWithObject: object
+			requestedLength: queueItem->_length -
+					 queueItem->_writtenLength
+			   bytesWritten: length
+				  errNo: errNo];
+
+	[self OF_object: object
+	 didWriteLength: length
+	      exception: exception];
 }
 #endif
 
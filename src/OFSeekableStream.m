@@ -54,8 +54,8 @@
 	offset = [self lowlevelSeekToOffset: offset
 				     whence: whence];
 
-	[self freeMemory: _readBufferMemory];
-	_readBuffer = _readBufferMemory = NULL;
+	/* Drop the buffered data, but keep the buffer for the next read. */
+	_readBuffer = _readBufferMemory;
 	_readBufferLength = 0;
 
 	return offset;
@@ -145,6 +145,8 @@ of_log(OFConstantString *format, ...)
 - (void)lowlevelWriteBuffer: (const void*)buffer
 		     length: (size_t)length
 {
+	size_t bytesWritten = 0;
+
 	if (_fd == -1 || _atEndOfStream)
 		@throw [OFWriteFailedException exceptionWithObject: self
 						   requestedLength: length];
@@ -152,20 +154,29 @@ of_log(OFConstantString *format, ...)
 #ifndef OF_WINDOWS
 	if (length > SSIZE_MAX)
 		@throw [OFOutOfRangeException exception];
-
-	if (write(_fd, buffer, length) != (ssize_t)length)
-		@throw [OFWriteFailedException exceptionWithObject: self
-						   requestedLength: length
-							     errNo: errno];
 #else
 	if (length > INT_MAX)
 		@throw [OFOutOfRangeException exception];
+#endif
 
-	if (write(_fd, buffer, (int)length) != (int)length)
-		@throw [OFWriteFailedException exceptionWithObject: self
-						   requestedLength: length
-							     errNo: errno];
+	while (bytesWritten < length) {
+#ifndef OF_WINDOWS
+		ssize_t ret = write(_fd, (const char*)buffer + bytesWritten,
+		    length - bytesWritten);
+#else
+		int ret = write(_fd, (const char*)buffer + bytesWritten,
+		    (int)(length - bytesWritten));
 #endif
+
+		if (ret < 0)
+			@throw [OFWriteFailedException
+			    exceptionWithObject: self
+				requestedLength: length
+				   bytesWritten: bytesWritten
+					  errNo: errno];
+
+		bytesWritten += ret;
+	}
 }
 
 - (int)fileDescriptorForReading
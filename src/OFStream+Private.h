@@ -14,12 +14,57 @@
  * file.
  */
 
+#include <sys/types.h>
+
 #import "OFStream.h"
 
 OF_ASSUME_NONNULL_BEGIN
 
 @interface OFStream ()
-@property (readonly) bool OF_isWaitingForDelimiter;
+@property (setter=OF_setWaitingForDelimiter:) bool OF_isWaitingForDelimiter;
+
+#if defined(HAVE_WRITEV) && defined(HAVE_SYS_UIO_H)
+- (void)OF_writeBuffers: (const of_stream_buffer_t*)buffers
+		  count: (size_t)count
+	 fileDescriptor: (int)fd;
+#endif
+
+/*
+ * Return the file descriptor if the data read from / written to it is exactly
+ * the data of the stream, so that it can be passed to the kernel directly, or
+ * -1 otherwise.
+ */
+- (int)OF_rawFileDescriptorForReading;
+- (int)OF_rawFileDescriptorForWriting;
+
+/*
+ * Copies up to length bytes to the stream inside the kernel if both streams
+ * have a raw file descriptor. Returns the number of bytes copied, 0 at the end
+ * of the stream, or -1 with errno set. ENOSYS means that the streams do not
+ * support this, in which case the data needs to be copied through a buffer.
+ */
+- (ssize_t)OF_kernelTransferToStream: (OFStream*)stream
+			      length: (size_t)length;
+
+/*
+ * Allow parsing the read buffer in place: OF_fillReadBuffer appends data read
+ * from the stream and returns how much was read, OF_consumeReadBuffer: removes
+ * data from the front once it has been parsed. If only incomplete data is in
+ * the read buffer, OF_setWaitingForDelimiter: should be set to true so that
+ * the run loop waits until more data arrived.
+ */
+- (size_t)OF_fillReadBuffer;
+- (const char*)OF_readBuffer;
+- (size_t)OF_readBufferLength;
+- (void)OF_consumeReadBuffer: (size_t)length;
+
+/*
+ * Appends data that has been read from the file descriptor of the stream by
+ * someone else, like an observer that completed the read asynchronously, to
+ * the read buffer, as if OF_fillReadBuffer had read it.
+ */
+- (void)OF_appendToReadBuffer: (const void*)buffer
+		       length: (size_t)length;
 @end
 
 OF_ASSUME_NONNULL_END
@@ -37,6 +37,18 @@ OF_ASSUME_NONNULL_BEGIN
 @class OFDataArray;
 @class OFException;
 
+/*!
+ * @struct of_stream_buffer_t OFStream.h ObjFW/OFStream.h
+ *
+ * @brief A buffer for a gather write with @ref OFStream::writeBuffers:count:.
+ */
+typedef struct {
+	/*! The data to write */
+	const void *buffer;
+	/*! The length of the data to write */
+	size_t length;
+} of_stream_buffer_t;
+
 #if defined(OF_HAVE_SOCKETS) && defined(OF_HAVE_BLOCKS)
 /*!
  * @brief A block which is called when data was read from the stream.
@@ -63,6 +75,39 @@ typedef bool (^of_stream_async_read_block_t)(OFStream *stream, void *buffer,
  */
 typedef bool (^of_stream_async_read_line_block_t)(OFStream *stream,
     OFString *_Nullable line, OFException *_Nullable exception);
+
+/*!
+ * @brief A block which is called when data was written to the stream.
+ *
+ * @param stream The stream to which data was written
+ * @param buffer A pointer to the buffer which was written to the stream. This
+ *		 can be changed to point to a different buffer to be used on the
+ *		 next write.
+ * @param bytesWritten The number of bytes which have been written. This
+ *		       matches the length specified on the asynchronous write
+ *		       if no exception was encountered.
+ * @param exception An exception which occurred while writing or `nil` on
+ *		    success
+ * @return The length to repeat the write with or 0 if it should not repeat.
+ *	   The buffer may be changed, so that every time a new buffer and length
+ *	   can be specified while the callback stays the same.
+ */
+typedef size_t (^of_stream_async_write_block_t)(OFStream *stream,
+    const void *_Nonnull *_Nonnull buffer, size_t bytesWritten,
+    OFException *_Nullable exception);
+
+/*!
+ * @brief A block which is called when a transfer between two streams is done.
+ *
+ * @param source The stream from which the data was read
+ * @param destination The stream to which the data was written
+ * @param bytesTransferred The number of bytes which have been transferred
+ * @param exception An exception which occurred during the transfer or `nil` on
+ *		    success
+ */
+typedef void (^of_stream_async_transfer_block_t)(OFStream *source,
+    OFStream *destination, uint64_t bytesTransferred,
+    OFException *_Nullable exception);
 #endif
 
 /*!
@@ -95,7 +140,8 @@ typedef bool (^of_stream_async_read_line_block_t)(OFStream *stream,
 @private
 #endif
 	char *_readBuffer, *_readBufferMemory, *_writeBuffer;
-	size_t _readBufferLength, _writeBufferLength;
+	size_t _readBufferLength, _readBufferCapacity, _readBufferSize;
+	size_t _writeBufferLength, _writeBufferSize;
 	bool _writeBuffered, _waitingForDelimiter;
 @protected
 	bool _blocking;
@@ -749,6 +795,25 @@ typedef bool (^of_stream_async_read_line_block_t)(OFStream *stream,
 - (nullable OFString*)tryReadTillDelimiter: (OFString*)delimiter
 				  encoding: (of_string_encoding_t)encoding;
 
+/*!
+ * @brief Returns the size of the read buffer.
+ *
+ * @return The size of the read buffer
+ */
+- (size_t)readBufferSize;
+
+/*!
+ * @brief Sets the size of the read buffer.
+ *
+ * Reads smaller than the read buffer fill it with a single read from the
+ * underlying stream and are then served from it, while bigger reads bypass it.
+ * The buffer is reused for all reads and only grows if a line or a string up to
+ * a delimiter does not fit into it. The default is the page size.
+ *
+ * @param size The size of the read buffer, which must not be 0
+ */
+- (void)setReadBufferSize: (size_t)size;
+
 /*!
  * @brief Returns a boolen whether writes are buffered.
  *
@@ -763,6 +828,28 @@ typedef bool (^of_stream_async_read_line_block_t)(OFStream *stream,
  */
 - (void)setWriteBuffered: (bool)enable;
 
+/*!
+ * @brief Returns the size of the write buffer.
+ *
+ * @return The size of the write buffer
+ */
+- (size_t)writeBufferSize;
+
+/*!
+ * @brief Sets the size of the write buffer.
+ *
+ * If the write buffer is enabled, writes are collected in it until they would
+ * not fit anymore, at which point the buffer is flushed. Writes that are at
+ * least as big as the buffer are not copied, but written together with the
+ * buffered data. The default is the page size.
+ *
+ * If there is data in the write buffer, it is flushed before the size is
+ * changed.
+ *
+ * @param size The size of the write buffer, which must not be 0
+ */
+- (void)setWriteBufferSize: (size_t)size;
+
 /*!
  * @brief Writes everythig in the write buffer to the stream.
  */
@@ -777,6 +864,195 @@ typedef bool (^of_stream_async_read_line_block_t)(OFStream *stream,
 - (void)writeBuffer: (const void*)buffer
 	     length: (size_t)length;
 
+/*!
+ * @brief Writes multiple buffers into the stream.
+ *
+ * The buffers are written in order, as if @ref writeBuffer:length: had been
+ * called for each of them, but streams backed by a file descriptor write all
+ * of them with a single system call where possible.
+ *
+ * @param buffers The buffers to write into the stream
+ * @param count The number of buffers
+ */
+- (void)writeBuffers: (const of_stream_buffer_t*)buffers
+	       count: (size_t)count;
+
+/*!
+ * @brief Writes everything that is left in the stream into the specified
+ *	  stream.
+ *
+ * @see transferToStream:length:
+ *
+ * @param stream The stream to write the data to
+ * @return The number of bytes transferred
+ */
+- (uint64_t)transferToStream: (OFStream*)stream;
+
+/*!
+ * @brief Writes up to the specified number of bytes from the stream into the
+ *	  specified stream.
+ *
+ * If the stream is an OFFile and the destination is an OFFile or a socket, the
+ * data is copied inside the kernel where the operating system supports it
+ * (using `copy_file_range()` or `sendfile()`), so that it never needs to be
+ * copied to user space. Otherwise, it is copied through a buffer that is used
+ * for the whole transfer.
+ *
+ * To send a part of a file, seek to its start first. If the destination is in
+ * non-blocking mode, the kernel copy waits for it to become writable instead
+ * of failing.
+ *
+ * @param stream The stream to write the data to
+ * @param length The maximum number of bytes to transfer. Fewer bytes are
+ *		 transferred if the end of the stream is reached before.
+ * @return The number of bytes transferred
+ */
+- (uint64_t)transferToStream: (OFStream*)stream
+		      length: (uint64_t)length;
+
+#ifdef OF_HAVE_SOCKETS
+/*!
+ * @brief Asynchronously writes up to the specified number of bytes from the
+ *	  stream into the specified stream.
+ *
+ * The transfer is queued with the asynchronous writes of the destination and
+ * advances whenever the destination is ready for writing. It is meant for
+ * streams that can always be read without blocking, like files.
+ *
+ * @see transferToStream:length:
+ *
+ * @param stream The stream to write the data to. It should be in non-blocking
+ *		 mode, see @ref setBlocking:.
+ * @param length The maximum number of bytes to transfer. Fewer bytes are
+ *		 transferred if the end of the stream is reached before.
+ * @param target The target on which the selector should be called when the
+ *		 transfer is done or an exception occurred
+ * @param selector The selector to call on the target. The signature must be
+ *		   `void (OFStream *source, OFStream *destination,
+ *		   uint64_t bytesTransferred, OFException *exception)`.
+ */
+- (void)asyncTransferToStream: (OFStream*)stream
+		       length: (uint64_t)length
+		       target: (id)target
+		     selector: (SEL)selector;
+
+# ifdef OF_HAVE_BLOCKS
+/*!
+ * @brief Asynchronously writes up to the specified number of bytes from the
+ *	  stream into the specified stream.
+ *
+ * The transfer is queued with the asynchronous writes of the destination and
+ * advances whenever the destination is ready for writing. It is meant for
+ * streams that can always be read without blocking, like files.
+ *
+ * @see transferToStream:length:
+ *
+ * @param stream The stream to write the data to. It should be in non-blocking
+ *		 mode, see @ref setBlocking:.
+ * @param length The maximum number of bytes to transfer. Fewer bytes are
+ *		 transferred if the end of the stream is reached before.
+ * @param block The block to call when the transfer is done or an exception
+ *		occurred
+ */
+- (void)asyncTransferToStream: (OFStream*)stream
+		       length: (uint64_t)length
+			block: (of_stream_async_transfer_block_t)block;
+# endif
+#endif
+
+#ifdef OF_HAVE_SOCKETS
+/*!
+ * @brief Asynchronously writes a buffer into the stream.
+ *
+ * The data is written whenever the stream is ready for writing, so that the
+ * run loop is not blocked by a slow peer. This requires the stream to be in
+ * non-blocking mode (see @ref setBlocking:) - otherwise, each write blocks
+ * until all of the data has been accepted. Writes are performed in the order
+ * they have been requested.
+ *
+ * @note The stream must implement @ref fileDescriptorForWriting and return a
+ *	 valid file descriptor in order for this to work!
+ *
+ * @param buffer The buffer from which the data is written into the stream.
+ *		 The buffer must not be free'd before the async write completed!
+ * @param length The length of the data that should be written
+ * @param target The target on which the selector should be called when the
+ *		 data has been written or an exception occurred. The method
+ *		 returns the length for the next write with the same callback or
+ *		 0 if it should not repeat.
+ * @param selector The selector to call on the target. The signature must be
+ *		   `size_t (OFStream *stream, const void **buffer,
+ *		   size_t bytesWritten, OFException *exception)`.
+ */
+- (void)asyncWriteBuffer: (const void*)buffer
+		  length: (size_t)length
+		  target: (id)target
+		selector: (SEL)selector;
+
+# ifdef OF_HAVE_BLOCKS
+/*!
+ * @brief Asynchronously writes a buffer into the stream.
+ *
+ * The data is written whenever the stream is ready for writing, so that the
+ * run loop is not blocked by a slow peer. This requires the stream to be in
+ * non-blocking mode (see @ref setBlocking:) - otherwise, each write blocks
+ * until all of the data has been accepted. Writes are performed in the order
+ * they have been requested.
+ *
+ * @note The stream must implement @ref fileDescriptorForWriting and return a
+ *	 valid file descriptor in order for this to work!
+ *
+ * @param buffer The buffer from which the data is written into the stream.
+ *		 The buffer must not be free'd before the async write completed!
+ * @param length The length of the data that should be written
+ * @param block The block to call when the data has been written or an
+ *		exception occurred. It returns the length for the next write
+ *		with the same block or 0 if it should not repeat.
+ */
+- (void)asyncWriteBuffer: (const void*)buffer
+		  length: (size_t)length
+		   block: (of_stream_async_write_block_t)block;
+# endif
+
+/*!
+ * @brief Asynchronously writes an OFDataArray into the stream.
+ *
+ * The data array is copied, so it can be modified or released right away.
+ * If writing fails, the remaining data is discarded. Use
+ * @ref asyncWriteBuffer:length:target:selector: if you need to be notified
+ * about the write.
+ *
+ * @param dataArray The OFDataArray to write into the stream
+ */
+- (void)asyncWriteDataArray: (OFDataArray*)dataArray;
+
+/*!
+ * @brief Asynchronously writes a string into the stream, without the trailing
+ *	  zero.
+ *
+ * If writing fails, the remaining data is discarded. Use
+ * @ref asyncWriteBuffer:length:target:selector: if you need to be notified
+ * about the write.
+ *
+ * @param string The string to write into the stream
+ */
+- (void)asyncWriteString: (OFString*)string;
+
+/*!
+ * @brief Asynchronously writes a string into the stream in the specified
+ *	  encoding, without the trailing zero.
+ *
+ * If writing fails, the remaining data is discarded. Use
+ * @ref asyncWriteBuffer:length:target:selector: if you need to be notified
+ * about the write.
+ *
+ * @param string The string to write into the stream
+ * @param encoding The encoding in which to write the string to the stream
+ */
+- (void)asyncWriteString: (OFString*)string
+		encoding: (of_string_encoding_t)encoding;
+#endif
+
 /*!
  * @brief Writes a uint8_t into the stream.
  *
@@ -1155,6 +1431,23 @@ typedef bool (^of_stream_async_read_line_block_t)(OFStream *stream,
 - (void)lowlevelWriteBuffer: (const void*)buffer
 		     length: (size_t)length;
 
+/*!
+ * @brief Performs a lowlevel gather write.
+ *
+ * The default implementation calls @ref lowlevelWriteBuffer:length: for every
+ * buffer.
+ *
+ * @warning Do not call this directly!
+ *
+ * @note Override this method if the stream can write multiple buffers more
+ *	 efficiently than one after another.
+ *
+ * @param buffers The buffers with the data to write
+ * @param count The number of buffers
+ */
+- (void)lowlevelWriteBuffers: (const of_stream_buffer_t*)buffers
+		       count: (size_t)count;
+
 /*!
  * @brief Returns whether the lowlevel is at the end of the stream.
  *
@@ -20,6 +20,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -32,10 +33,23 @@
 #ifndef OF_WINDOWS
 # include <signal.h>
 #endif
+#if defined(HAVE_WRITEV) && defined(HAVE_SYS_UIO_H)
+# include <sys/uio.h>
+#endif
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+# include <sys/sendfile.h>
+#endif
+#ifdef HAVE_POLL_H
+# include <poll.h>
+#endif
+#ifdef HAVE_COPY_FILE_RANGE
+# include <unistd.h>
+#endif
 
 #import "OFStream.h"
 #import "OFStream+Private.h"
 #import "OFString.h"
+#import "OFString+Private.h"
 #import "OFDataArray.h"
 #import "OFSystemInfo.h"
 #import "OFRunLoop.h"
@@ -46,10 +60,77 @@
 #import "OFNotImplementedException.h"
 #import "OFOutOfRangeException.h"
 #import "OFSetOptionFailedException.h"
+#import "OFWriteFailedException.h"
 
 #import "of_asprintf.h"
+#import "of_memmem.h"
+
+#define TRANSFER_BUFFER_SIZE (64 * 1024)
+/* Linux never transfers more than this at once anyway */
+#define KERNEL_TRANSFER_MAX 0x7FFFF000
+
+#if defined(HAVE_WRITEV) && defined(HAVE_SYS_UIO_H)
+# if defined(IOV_MAX) && IOV_MAX < 64
+#  define IOV_BATCH_SIZE IOV_MAX
+# else
+#  define IOV_BATCH_SIZE 64
+# endif
+#endif
+
+/*
+ * Returns the first newline or \0 at or after searchStart, whichever comes
+ * first.
+ */
+static const char*
+findLineEnd(const char *buffer, size_t length, size_t searchStart)
+{
+	const char *lineEnd, *nul;
+
+	if (searchStart >= length)
+		return NULL;
+
+	lineEnd = memchr(buffer + searchStart, '\n', length - searchStart);
+	nul = memchr(buffer + searchStart, '\0', (lineEnd != NULL
+	    ? (size_t)(lineEnd - buffer) : length) - searchStart);
+
+	return (nul != NULL ? nul : lineEnd);
+}
+
+/*
+ * Looks for the delimiter or a \0 at or after searchStart and returns the
+ * length of the data before it and the length to remove from the buffer.
+ */
+static bool
+findDelimiter(const char *buffer, size_t length, size_t searchStart,
+    const char *delimiter, size_t delimiterLength, size_t *retLength,
+    size_t *consumedLength)
+{
+	const char *found, *nul;
+	size_t searchEnd;
+
+	if (searchStart >= length)
+		return false;
+
+	found = of_memmem(buffer + searchStart, length - searchStart,
+	    delimiter, delimiterLength);
+	searchEnd = (found != NULL
+	    ? (size_t)(found - buffer) + delimiterLength : length);
+	nul = memchr(buffer + searchStart, '\0', searchEnd - searchStart);
 
-#define MIN_READ_SIZE 512
+	if (nul != NULL) {
+		*retLength = nul - buffer;
+		*consumedLength = *retLength + 1;
+		return true;
+	}
+
+	if (found != NULL) {
+		*retLength = found - buffer;
+		*consumedLength = *retLength + delimiterLength;
+		return true;
+	}
+
+	return false;
+}
 
 @implementation OFStream
 @synthesize OF_isWaitingForDelimiter = _waitingForDelimiter;
@@ -76,6 +157,7 @@
 
 	self = [super init];
 
+	_readBufferSize = _writeBufferSize = [OFSystemInfo pageSize];
 	_blocking = true;
 
 	return self;
@@ -98,6 +180,90 @@
 	OF_UNRECOGNIZED_SELECTOR
 }
 
+- (void)lowlevelWriteBuffers: (const of_stream_buffer_t*)buffers
+		       count: (size_t)count
+{
+	size_t requestedLength = 0, bytesWritten = 0;
+
+	for (size_t i = 0; i < count; i++)
+		requestedLength += buffers[i].length;
+
+	for (size_t i = 0; i < count; i++) {
+		@try {
+			[self lowlevelWriteBuffer: buffers[i].buffer
+					   length: buffers[i].length];
+		} @catch (OFWriteFailedException *e) {
+			@throw [OFWriteFailedException
+			    exceptionWithObject: self
+				requestedLength: requestedLength
+				   bytesWritten: bytesWritten +
+						 [e bytesWritten]
+					  errNo: [e errNo]];
+		}
+
+		bytesWritten += buffers[i].length;
+	}
+}
+
+#if defined(HAVE_WRITEV) && defined(HAVE_SYS_UIO_H)
+- (void)OF_writeBuffers: (const of_stream_buffer_t*)buffers
+		  count: (size_t)count
+	 fileDescriptor: (int)fd
+{
+	size_t requestedLength = 0, bytesWritten = 0, i = 0, offset = 0;
+
+	for (size_t j = 0; j < count; j++)
+		requestedLength += buffers[j].length;
+
+	while (i < count) {
+		struct iovec iov[IOV_BATCH_SIZE];
+		size_t iovCount = 0, iovLength = 0;
+		ssize_t ret;
+
+		/*
+		 * Never pass more than SSIZE_MAX bytes at once, as writev()
+		 * fails with EINVAL otherwise.
+		 */
+		for (size_t j = i; j < count && iovCount < IOV_BATCH_SIZE;
+		    j++) {
+			size_t skip = (j == i ? offset : 0);
+			size_t length = buffers[j].length - skip;
+
+			if (length > SSIZE_MAX - iovLength) {
+				if (iovCount > 0)
+					break;
+
+				length = SSIZE_MAX;
+			}
+
+			iov[iovCount].iov_base =
+			    (char*)buffers[j].buffer + skip;
+			iov[iovCount].iov_len = length;
+			iovCount++;
+			iovLength += length;
+		}
+
+		if ((ret = writev(fd, iov, (int)iovCount)) < 0)
+			@throw [OFWriteFailedException
+			    exceptionWithObject: self
+				requestedLength: requestedLength
+				   bytesWritten: bytesWritten
+					  errNo: errno];
+
+		bytesWritten += ret;
+
+		/* Skip everything that has been written completely */
+		while (i < count && (size_t)ret >= buffers[i].length - offset) {
+			ret -= buffers[i].length - offset;
+			offset = 0;
+			i++;
+		}
+
+		offset += ret;
+	}
+}
+#endif
+
 - copy
 {
 	return [self retain];
@@ -111,62 +277,138 @@
 	return [self lowlevelIsAtEndOfStream];
 }
 
-- (size_t)readIntoBuffer: (void*)buffer
-		  length: (size_t)length
+- (void)OF_makeRoomInReadBuffer: (size_t)length
 {
-	if (_readBufferLength == 0) {
-		/*
-		 * For small sizes, it is cheaper to read more and cache the
-		 * remainder - even if that means more copying of data - than
-		 * to do a syscall for every read.
-		 */
-		if (length < MIN_READ_SIZE) {
-			char tmp[MIN_READ_SIZE], *readBuffer;
-			size_t bytesRead;
+	size_t offset;
 
-			bytesRead = [self
-			    lowlevelReadIntoBuffer: tmp
-					    length: MIN_READ_SIZE];
+	if (_readBufferMemory == NULL) {
+		_readBufferMemory = [self allocMemoryWithSize: _readBufferSize];
+		_readBuffer = _readBufferMemory;
+		_readBufferCapacity = _readBufferSize;
+	}
 
-			if (bytesRead > length) {
-				memcpy(buffer, tmp, length);
+	offset = _readBuffer - _readBufferMemory;
+
+	/*
+	 * Moving the buffered data to the front is enough unless it does not
+	 * fit anymore, which only happens for lines longer than the read
+	 * buffer.
+	 */
+	if (_readBufferCapacity - offset - _readBufferLength < length) {
+		if (offset > 0) {
+			memmove(_readBufferMemory, _readBuffer,
+			    _readBufferLength);
+			_readBuffer = _readBufferMemory;
+		}
 
-				readBuffer = [self allocMemoryWithSize:
-				    bytesRead - length];
-				memcpy(readBuffer, tmp + length,
-				    bytesRead - length);
+		if (_readBufferCapacity - _readBufferLength < length) {
+			size_t capacity;
 
-				_readBuffer = _readBufferMemory = readBuffer;
-				_readBufferLength = bytesRead - length;
+			if (_readBufferLength > SIZE_MAX - length ||
+			    _readBufferCapacity > SIZE_MAX / 2)
+				@throw [OFOutOfRangeException exception];
 
-				return length;
-			} else {
-				memcpy(buffer, tmp, bytesRead);
-				return bytesRead;
-			}
-		}
+			capacity = _readBufferCapacity * 2;
+			if (capacity < _readBufferLength + length)
+				capacity = _readBufferLength + length;
 
-		return [self lowlevelReadIntoBuffer: buffer
-					     length: length];
+			_readBufferMemory = [self
+			    resizeMemory: _readBufferMemory
+				    size: capacity];
+			_readBuffer = _readBufferMemory;
+			_readBufferCapacity = capacity;
+		}
 	}
+}
 
-	if (length >= _readBufferLength) {
-		size_t ret = _readBufferLength;
-		memcpy(buffer, _readBuffer, _readBufferLength);
+- (size_t)OF_fillReadBuffer
+{
+	size_t bytesRead;
 
-		[self freeMemory: _readBufferMemory];
-		_readBuffer = _readBufferMemory = NULL;
-		_readBufferLength = 0;
+	/*
+	 * Moving the buffered data to the front frees all the room the buffer
+	 * has. Only if the buffered data fills all of it, room is made for a
+	 * read of the configured size. Otherwise, every partial line would
+	 * grow the buffer.
+	 */
+	[self OF_makeRoomInReadBuffer:
+	    (_readBufferLength < _readBufferCapacity
+	    ? _readBufferCapacity - _readBufferLength : _readBufferSize)];
 
-		return ret;
-	} else {
-		memcpy(buffer, _readBuffer, length);
+	bytesRead = [self
+	    lowlevelReadIntoBuffer: _readBuffer + _readBufferLength
+			    length: _readBufferCapacity -
+				    (_readBuffer - _readBufferMemory) -
+				    _readBufferLength];
+	_readBufferLength += bytesRead;
 
-		_readBuffer += length;
-		_readBufferLength -= length;
+	return bytesRead;
+}
+
+- (void)OF_appendToReadBuffer: (const void*)buffer
+		       length: (size_t)length
+{
+	[self OF_makeRoomInReadBuffer: length];
+
+	memcpy(_readBuffer + _readBufferLength, buffer, length);
+	_readBufferLength += length;
+
+	_waitingForDelimiter = false;
+}
+
+- (const char*)OF_readBuffer
+{
+	return _readBuffer;
+}
+
+- (size_t)OF_readBufferLength
+{
+	return _readBufferLength;
+}
 
-		return length;
+- (void)OF_consumeReadBuffer: (size_t)length
+{
+	if (length > _readBufferLength)
+		@throw [OFOutOfRangeException exception];
+
+	_readBuffer += length;
+	_readBufferLength -= length;
+
+	if (_readBufferLength == 0)
+		_readBuffer = _readBufferMemory;
+}
+
+- (size_t)readIntoBuffer: (void*)buffer
+		  length: (size_t)length
+{
+	if (_readBufferLength == 0) {
+		/*
+		 * Reads at least as big as the read buffer go directly into
+		 * the destination, as buffering them would only mean copying
+		 * the data twice. For smaller reads, it is cheaper to fill the
+		 * read buffer and serve the following reads from it than to do
+		 * a syscall for every read.
+		 */
+		if (length >= _readBufferSize)
+			return [self lowlevelReadIntoBuffer: buffer
+						     length: length];
+
+		if ([self OF_fillReadBuffer] == 0)
+			return 0;
 	}
+
+	if (length > _readBufferLength)
+		length = _readBufferLength;
+
+	memcpy(buffer, _readBuffer, length);
+
+	_readBuffer += length;
+	_readBufferLength -= length;
+
+	if (_readBufferLength == 0)
+		_readBuffer = _readBufferMemory;
+
+	return length;
 }
 
 - (void)readIntoBuffer: (void*)buffer
@@ -174,6 +416,18 @@
 {
 	size_t readLength = 0;
 
+	if (length <= _readBufferLength) {
+		memcpy(buffer, _readBuffer, length);
+
+		_readBuffer += length;
+		_readBufferLength -= length;
+
+		if (_readBufferLength == 0)
+			_readBuffer = _readBufferMemory;
+
+		return;
+	}
+
 	while (readLength < length)
 		readLength += [self readIntoBuffer: (char*)buffer + readLength
 					    length: length - readLength];
@@ -580,155 +834,75 @@
 
 - (OFString*)tryReadLineWithEncoding: (of_string_encoding_t)encoding
 {
-	size_t pageSize, bufferLength, retLength;
-	char *retCString, *buffer, *readBuffer;
+	size_t searchStart = 0, lineLength, retLength;
+	const char *lineEnd;
 	OFString *ret;
 
-	/* Look if there's a line or \0 in our buffer */
-	if (!_waitingForDelimiter && _readBuffer != NULL) {
-		for (size_t i = 0; i < _readBufferLength; i++) {
-			if OF_UNLIKELY (_readBuffer[i] == '\n' ||
-			    _readBuffer[i] == '\0') {
-				retLength = i;
-
-				if (i > 0 && _readBuffer[i - 1] == '\r')
-					retLength--;
+	/*
+	 * If we are waiting for a delimiter, the buffered data has already
+	 * been searched.
+	 */
+	if (_waitingForDelimiter)
+		searchStart = _readBufferLength;
 
-				ret = [OFString stringWithCString: _readBuffer
-							 encoding: encoding
-							   length: retLength];
-
-				_readBuffer += i + 1;
-				_readBufferLength -= i + 1;
-
-				_waitingForDelimiter = false;
-				return ret;
-			}
-		}
-	}
+	lineEnd = findLineEnd(_readBuffer, _readBufferLength, searchStart);
 
-	/* Read and see if we got a newline or \0 */
-	pageSize = [OFSystemInfo pageSize];
-	buffer = [self allocMemoryWithSize: pageSize];
-
-	@try {
+	if (lineEnd == NULL) {
 		if ([self lowlevelIsAtEndOfStream]) {
-			if (_readBuffer == NULL) {
+			if (_readBufferLength == 0) {
 				_waitingForDelimiter = false;
 				return nil;
 			}
 
 			retLength = _readBufferLength;
 
-			if (retLength > 0 && _readBuffer[retLength - 1] == '\r')
+			if (_readBuffer[retLength - 1] == '\r')
 				retLength--;
 
 			ret = [OFString stringWithCString: _readBuffer
 						 encoding: encoding
 						   length: retLength];
 
-			[self freeMemory: _readBufferMemory];
-			_readBuffer = _readBufferMemory = NULL;
+			_readBuffer = _readBufferMemory;
 			_readBufferLength = 0;
 
 			_waitingForDelimiter = false;
 			return ret;
 		}
 
-		bufferLength = [self lowlevelReadIntoBuffer: buffer
-						     length: pageSize];
-
-		/* Look if there's a newline or \0 */
-		for (size_t i = 0; i < bufferLength; i++) {
-			if OF_UNLIKELY (buffer[i] == '\n' ||
-			    buffer[i] == '\0') {
-				retLength = _readBufferLength + i;
-				retCString = [self
-				    allocMemoryWithSize: retLength];
-
-				if (_readBuffer != NULL)
-					memcpy(retCString, _readBuffer,
-					    _readBufferLength);
-				memcpy(retCString + _readBufferLength,
-				    buffer, i);
-
-				if (retLength > 0 &&
-				    retCString[retLength - 1] == '\r')
-					retLength--;
-
-				@try {
-					char *rcs = retCString;
-					size_t rl = retLength;
-
-					ret = [OFString
-					    stringWithCString: rcs
-						     encoding: encoding
-						       length: rl];
-				} @catch (id e) {
-					if (bufferLength > 0) {
-						/*
-						 * Append data to _readBuffer
-						 * to prevent loss of data due
-						 * to wrong encoding.
-						 */
-						readBuffer = [self
-						    allocMemoryWithSize:
-						    _readBufferLength +
-						    bufferLength];
-
-						memcpy(readBuffer, _readBuffer,
-						    _readBufferLength);
-						memcpy(readBuffer +
-						    _readBufferLength,
-						    buffer, bufferLength);
-
-						[self freeMemory:
-						    _readBufferMemory];
-						_readBuffer = readBuffer;
-						_readBufferMemory = readBuffer;
-						_readBufferLength +=
-						    bufferLength;
-					}
-
-					@throw e;
-				} @finally {
-					[self freeMemory: retCString];
-				}
-
-				readBuffer = [self
-				    allocMemoryWithSize: bufferLength - i - 1];
-				if (readBuffer != NULL)
-					memcpy(readBuffer, buffer + i + 1,
-					    bufferLength - i - 1);
-
-				[self freeMemory: _readBufferMemory];
-				_readBuffer = _readBufferMemory = readBuffer;
-				_readBufferLength = bufferLength - i - 1;
+		searchStart = _readBufferLength;
+		[self OF_fillReadBuffer];
 
-				_waitingForDelimiter = false;
-				return ret;
-			}
+		lineEnd = findLineEnd(_readBuffer, _readBufferLength,
+		    searchStart);
+
+		if (lineEnd == NULL) {
+			_waitingForDelimiter = true;
+			return nil;
 		}
+	}
 
-		/* There was no newline or \0 */
-		if (bufferLength > 0) {
-			readBuffer = [self allocMemoryWithSize:
-			    _readBufferLength + bufferLength];
+	/*
+	 * The line is only removed from the read buffer once the string has
+	 * been created, so that no data is lost if it has the wrong encoding.
+	 */
+	lineLength = retLength = lineEnd - _readBuffer;
 
-			memcpy(readBuffer, _readBuffer, _readBufferLength);
-			memcpy(readBuffer + _readBufferLength,
-			    buffer, bufferLength);
+	if (retLength > 0 && _readBuffer[retLength - 1] == '\r')
+		retLength--;
 
-			[self freeMemory: _readBufferMemory];
-			_readBuffer = _readBufferMemory = readBuffer;
-			_readBufferLength += bufferLength;
-		}
-	} @finally {
-		[self freeMemory: buffer];
-	}
+	ret = [OFString stringWithCString: _readBuffer
+				 encoding: encoding
+				   length: retLength];
+
+	_readBuffer += lineLength + 1;
+	_readBufferLength -= lineLength + 1;
 
-	_waitingForDelimiter = true;
-	return nil;
+	if (_readBufferLength == 0)
+		_readBuffer = _readBufferMemory;
+
+	_waitingForDelimiter = false;
+	return ret;
 }
 
 - (OFString*)readLine
@@ -792,48 +966,27 @@
 			 encoding: (of_string_encoding_t)encoding
 {
 	const char *delimiterCString;
-	size_t j, delimiterLength, pageSize, bufferLength, retLength;
-	char *retCString, *buffer, *readBuffer;
+	size_t delimiterLength, searchStart = 0, retLength, consumedLength;
 	OFString *ret;
 
 	delimiterCString = [delimiter cStringWithEncoding: encoding];
 	delimiterLength = [delimiter cStringLengthWithEncoding: encoding];
-	j = 0;
 
 	if (delimiterLength == 0)
 		@throw [OFInvalidArgumentException exception];
 
-	/* Look if there's something in our buffer */
-	if (!_waitingForDelimiter && _readBuffer != NULL) {
-		for (size_t i = 0; i < _readBufferLength; i++) {
-			if (_readBuffer[i] != delimiterCString[j++])
-				j = 0;
+	/*
+	 * If we are waiting for a delimiter, the buffered data has already
+	 * been searched, except for a delimiter that was only partially
+	 * received.
+	 */
+	if (_waitingForDelimiter && _readBufferLength >= delimiterLength)
+		searchStart = _readBufferLength - delimiterLength + 1;
 
-			if (j == delimiterLength || _readBuffer[i] == '\0') {
-				if (_readBuffer[i] == '\0')
-					delimiterLength = 1;
-
-				ret = [OFString
-				    stringWithCString: _readBuffer
-					     encoding: encoding
-					      length: i + 1 - delimiterLength];
-
-				_readBuffer += i + 1;
-				_readBufferLength -= i + 1;
-
-				_waitingForDelimiter = false;
-				return ret;
-			}
-		}
-	}
-
-	/* Read and see if we got a delimiter or \0 */
-	pageSize = [OFSystemInfo pageSize];
-	buffer = [self allocMemoryWithSize: pageSize];
-
-	@try {
+	if (!findDelimiter(_readBuffer, _readBufferLength, searchStart,
+	    delimiterCString, delimiterLength, &retLength, &consumedLength)) {
 		if ([self lowlevelIsAtEndOfStream]) {
-			if (_readBuffer == NULL) {
+			if (_readBufferLength == 0) {
 				_waitingForDelimiter = false;
 				return nil;
 			}
@@ -842,91 +995,42 @@
 						 encoding: encoding
 						   length: _readBufferLength];
 
-			[self freeMemory: _readBufferMemory];
-			_readBuffer = _readBufferMemory = NULL;
+			_readBuffer = _readBufferMemory;
 			_readBufferLength = 0;
 
 			_waitingForDelimiter = false;
 			return ret;
 		}
 
-		bufferLength = [self lowlevelReadIntoBuffer: buffer
-						     length: pageSize];
-
-		/* Look if there's a delimiter or \0 */
-		for (size_t i = 0; i < bufferLength; i++) {
-			if (buffer[i] != delimiterCString[j++])
-				j = 0;
-
-			if (j == delimiterLength || buffer[i] == '\0') {
-				if (buffer[i] == '\0')
-					delimiterLength = 1;
-
-				retLength = _readBufferLength + i + 1 -
-				    delimiterLength;
-				retCString = [self
-				    allocMemoryWithSize: retLength];
-
-				if (_readBuffer != NULL &&
-				    _readBufferLength <= retLength)
-					memcpy(retCString, _readBuffer,
-					    _readBufferLength);
-				else if (_readBuffer != NULL)
-					memcpy(retCString, _readBuffer,
-					    retLength);
-				if (i >= delimiterLength)
-					memcpy(retCString + _readBufferLength,
-					    buffer, i + 1 - delimiterLength);
-
-				@try {
-					char *rcs = retCString;
-					size_t rl = retLength;
-
-					ret = [OFString
-					    stringWithCString: rcs
-						     encoding: encoding
-						       length: rl];
-				} @finally {
-					[self freeMemory: retCString];
-				}
-
-				readBuffer = [self allocMemoryWithSize:
-				    bufferLength - i - 1];
-				if (readBuffer != NULL)
-					memcpy(readBuffer, buffer + i + 1,
-					    bufferLength - i - 1);
-
-				[self freeMemory: _readBufferMemory];
-				_readBuffer = _readBufferMemory = readBuffer;
-				_readBufferLength = bufferLength - i - 1;
+		if (_readBufferLength >= delimiterLength)
+			searchStart = _readBufferLength - delimiterLength + 1;
+		else
+			searchStart = 0;
 
-				_waitingForDelimiter = false;
-				return ret;
-			}
+		[self OF_fillReadBuffer];
+
+		if (!findDelimiter(_readBuffer, _readBufferLength, searchStart,
+		    delimiterCString, delimiterLength, &retLength,
+		    &consumedLength)) {
+			_waitingForDelimiter = true;
+			return nil;
 		}
+	}
 
-		/* Neither the delimiter nor \0 was found */
-		if (bufferLength > 0) {
-			readBuffer = [self allocMemoryWithSize:
-			    _readBufferLength + bufferLength];
+	ret = [OFString stringWithCString: _readBuffer
+				 encoding: encoding
+				   length: retLength];
 
-			memcpy(readBuffer, _readBuffer, _readBufferLength);
-			memcpy(readBuffer + _readBufferLength,
-			    buffer, bufferLength);
+	_readBuffer += consumedLength;
+	_readBufferLength -= consumedLength;
 
-			[self freeMemory: _readBufferMemory];
-			_readBuffer = _readBufferMemory = readBuffer;
-			_readBufferLength += bufferLength;
-		}
-	} @finally {
-		[self freeMemory: buffer];
-	}
+	if (_readBufferLength == 0)
+		_readBuffer = _readBufferMemory;
 
-	_waitingForDelimiter = true;
-	return nil;
+	_waitingForDelimiter = false;
+	return ret;
 }
 
-
 - (OFString*)readTillDelimiter: (OFString*)delimiter
 {
 	return [self readTillDelimiter: delimiter
@@ -953,6 +1057,26 @@
 				 encoding: OF_STRING_ENCODING_UTF_8];
 }
 
+- (size_t)readBufferSize
+{
+	return _readBufferSize;
+}
+
+- (void)setReadBufferSize: (size_t)size
+{
+	if (size == 0)
+		@throw [OFInvalidArgumentException exception];
+
+	_readBufferSize = size;
+
+	/* Only resize once the buffered data has been consumed. */
+	if (_readBufferLength == 0) {
+		[self freeMemory: _readBufferMemory];
+		_readBuffer = _readBufferMemory = NULL;
+		_readBufferCapacity = 0;
+	}
+}
+
 - (bool)isWriteBuffered
 {
 	return _writeBuffered;
@@ -963,33 +1087,508 @@
 	_writeBuffered = enable;
 }
 
-- (void)flushWriteBuffer
+- (size_t)writeBufferSize
 {
-	if (_writeBuffer == NULL)
-		return;
+	return _writeBufferSize;
+}
+
+- (void)setWriteBufferSize: (size_t)size
+{
+	if (size == 0)
+		@throw [OFInvalidArgumentException exception];
 
-	[self lowlevelWriteBuffer: _writeBuffer
-			   length: _writeBufferLength];
+	[self flushWriteBuffer];
 
 	[self freeMemory: _writeBuffer];
 	_writeBuffer = NULL;
-	_writeBufferLength = 0;
+	_writeBufferSize = size;
+}
+
+/*
+ * Writes the buffered data followed by the specified buffers with a single
+ * gather write.
+ */
+- (void)OF_flushWriteBufferWithBuffers: (const of_stream_buffer_t*)buffers
+				 count: (size_t)count
+{
+	of_stream_buffer_t stackBuffers[8], *allBuffers = stackBuffers;
+
+	if (_writeBufferLength == 0) {
+		[self lowlevelWriteBuffers: buffers
+				     count: count];
+		return;
+	}
+
+	if (count >= sizeof(stackBuffers) / sizeof(*stackBuffers)) {
+		if (count == SIZE_MAX)
+			@throw [OFOutOfRangeException exception];
+
+		allBuffers = [self allocMemoryWithSize: sizeof(*allBuffers)
+						 count: count + 1];
+	}
+
+	@try {
+		allBuffers[0].buffer = _writeBuffer;
+		allBuffers[0].length = _writeBufferLength;
+
+		if (count > 0)
+			memcpy(allBuffers + 1, buffers,
+			    count * sizeof(*buffers));
+
+		@try {
+			[self lowlevelWriteBuffers: allBuffers
+					     count: count + 1];
+		} @catch (OFWriteFailedException *e) {
+			size_t bytesWritten = [e bytesWritten];
+			size_t bufferedLength = _writeBufferLength;
+
+			/* Keep what has not been written for the next flush */
+			if (bytesWritten < _writeBufferLength) {
+				memmove(_writeBuffer,
+				    _writeBuffer + bytesWritten,
+				    _writeBufferLength - bytesWritten);
+				_writeBufferLength -= bytesWritten;
+			} else
+				_writeBufferLength = 0;
+
+			if (count == 0)
+				@throw e;
+
+			/*
+			 * The buffered data was already reported as written by
+			 * the writes that buffered it, so only the buffers
+			 * passed in count.
+			 */
+			@throw [OFWriteFailedException
+			    exceptionWithObject: self
+				requestedLength: [e requestedLength] -
+						 bufferedLength
+				   bytesWritten: (bytesWritten > bufferedLength
+						     ? bytesWritten -
+						     bufferedLength : 0)
+					  errNo: [e errNo]];
+		}
+
+		_writeBufferLength = 0;
+	} @finally {
+		if (allBuffers != stackBuffers)
+			[self freeMemory: allBuffers];
+	}
+}
+
+- (void)flushWriteBuffer
+{
+	if (_writeBufferLength == 0)
+		return;
+
+	[self OF_flushWriteBufferWithBuffers: NULL
+				       count: 0];
 }
 
 - (void)writeBuffer: (const void*)buffer
 	     length: (size_t)length
 {
-	if (!_writeBuffered)
+	if (!_writeBuffered) {
 		[self lowlevelWriteBuffer: buffer
 				   length: length];
-	else {
-		_writeBuffer = [self resizeMemory: _writeBuffer
-					     size: _writeBufferLength + length];
-		memcpy(_writeBuffer + _writeBufferLength, buffer, length);
-		_writeBufferLength += length;
+		return;
 	}
+
+	if (length > _writeBufferSize - _writeBufferLength) {
+		/*
+		 * Data that would not fit into an empty write buffer either is
+		 * not copied, but written together with the buffered data.
+		 */
+		if (length >= _writeBufferSize) {
+			of_stream_buffer_t buffers[1] = {{ buffer, length }};
+
+			[self OF_flushWriteBufferWithBuffers: buffers
+						       count: 1];
+			return;
+		}
+
+		@try {
+			[self flushWriteBuffer];
+		} @catch (OFWriteFailedException *e) {
+			/* None of the data passed in has been written yet */
+			@throw [OFWriteFailedException
+			    exceptionWithObject: self
+				requestedLength: length
+				   bytesWritten: 0
+					  errNo: [e errNo]];
+		}
+	}
+
+	if (_writeBuffer == NULL)
+		_writeBuffer = [self allocMemoryWithSize: _writeBufferSize];
+
+	memcpy(_writeBuffer + _writeBufferLength, buffer, length);
+	_writeBufferLength += length;
+}
+
+- (void)writeBuffers: (const of_stream_buffer_t*)buffers
+	       count: (size_t)count
+{
+	size_t length = 0;
+
+	if (!_writeBuffered) {
+		[self lowlevelWriteBuffers: buffers
+				     count: count];
+		return;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		if (buffers[i].length > SIZE_MAX - length)
+			@throw [OFOutOfRangeException exception];
+
+		length += buffers[i].length;
+	}
+
+	if (length > _writeBufferSize - _writeBufferLength) {
+		[self OF_flushWriteBufferWithBuffers: buffers
+					       count: count];
+		return;
+	}
+
+	if (_writeBuffer == NULL)
+		_writeBuffer = [self allocMemoryWithSize: _writeBufferSize];
+
+	for (size_t i = 0; i < count; i++) {
+		if (buffers[i].length == 0)
+			continue;
+
+		memcpy(_writeBuffer + _writeBufferLength, buffers[i].buffer,
+		    buffers[i].length);
+		_writeBufferLength += buffers[i].length;
+	}
+}
+
+- (int)OF_rawFileDescriptorForReading
+{
+	return -1;
+}
+
+- (int)OF_rawFileDescriptorForWriting
+{
+	return -1;
+}
+
+- (ssize_t)OF_kernelTransferToStream: (OFStream*)stream
+			      length: (size_t)length
+{
+#if defined(HAVE_COPY_FILE_RANGE) || \
+    (defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H))
+	int inFD, outFD;
+# ifdef HAVE_COPY_FILE_RANGE
+	ssize_t ret;
+# endif
+
+	/* Buffered data must not be overtaken. */
+	if (_readBufferLength > 0 || stream->_writeBufferLength > 0 ||
+	    (inFD = [self OF_rawFileDescriptorForReading]) == -1 ||
+	    (outFD = [stream OF_rawFileDescriptorForWriting]) == -1) {
+		errno = ENOSYS;
+		return -1;
+	}
+
+	if (length > KERNEL_TRANSFER_MAX)
+		length = KERNEL_TRANSFER_MAX;
+
+# ifdef HAVE_COPY_FILE_RANGE
+	/* Only works between regular files, but can share extents there. */
+	ret = copy_file_range(inFD, NULL, outFD, NULL, length, 0);
+
+	if (ret >= 0 || (errno != EINVAL && errno != EXDEV &&
+	    errno != ENOSYS && errno != EBADF && errno != EOPNOTSUPP))
+		return ret;
+# endif
+# if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+	return sendfile(outFD, inFD, NULL, length);
+# else
+	errno = ENOSYS;
+	return -1;
+# endif
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+- (bool)OF_waitForWritingToStream: (OFStream*)stream
+{
+#ifdef HAVE_POLL_H
+	struct pollfd pfd;
+
+	pfd.fd = [stream OF_rawFileDescriptorForWriting];
+	pfd.events = POLLOUT;
+
+	while (poll(&pfd, 1, -1) == -1)
+		if (errno != EINTR)
+			return false;
+
+	return true;
+#else
+	return false;
+#endif
 }
 
+- (uint64_t)transferToStream: (OFStream*)stream
+{
+	return [self transferToStream: stream
+			       length: UINT64_MAX];
+}
+
+/*
+ * Writes the buffer to the stream, waiting for the stream the way a blocking
+ * write would if it is in non-blocking mode and full.
+ */
+- (void)OF_writeBuffer: (const char*)buffer
+		length: (size_t)length
+	      toStream: (OFStream*)stream
+{
+	size_t bytesWritten = 0;
+
+	for (;;) {
+		int errNo;
+
+		@try {
+			[stream writeBuffer: buffer + bytesWritten
+				     length: length - bytesWritten];
+			return;
+		} @catch (OFWriteFailedException *e) {
+			errNo = [e errNo];
+
+			if ((errNo != EWOULDBLOCK && errNo != EAGAIN) ||
+			    ![self OF_waitForWritingToStream: stream])
+				@throw [OFWriteFailedException
+				    exceptionWithObject: stream
+					requestedLength: length
+					   bytesWritten: bytesWritten +
+							 [e bytesWritten]
+						  errNo: errNo];
+
+			bytesWritten += [e bytesWritten];
+		}
+	}
+}
+
+- (uint64_t)transferToStream: (OFStream*)stream
+		      length: (uint64_t)length
+{
+	uint64_t transferred = 0;
+	char *buffer;
+
+	@try {
+		/*
+		 * Data that has already been read into the read buffer comes
+		 * first.
+		 */
+		if (_readBufferLength > 0 && length > 0) {
+			size_t bufferLength = (_readBufferLength < length
+			    ? _readBufferLength : (size_t)length);
+
+			[self OF_writeBuffer: _readBuffer
+				      length: bufferLength
+				    toStream: stream];
+
+			_readBuffer += bufferLength;
+			_readBufferLength -= bufferLength;
+			transferred += bufferLength;
+
+			if (_readBufferLength == 0)
+				_readBuffer = _readBufferMemory;
+		}
+
+		if (transferred == length)
+			return transferred;
+
+		/* Unwritten data stays buffered, so flushing can be retried */
+		for (;;) {
+			int errNo;
+
+			@try {
+				[stream flushWriteBuffer];
+				break;
+			} @catch (OFWriteFailedException *e) {
+				errNo = [e errNo];
+
+				if ((errNo == EWOULDBLOCK || errNo == EAGAIN) &&
+				    [self OF_waitForWritingToStream: stream])
+					continue;
+
+				@throw [OFWriteFailedException
+				    exceptionWithObject: stream
+					requestedLength: 0
+					   bytesWritten: 0
+						  errNo: errNo];
+			}
+		}
+
+		while (transferred < length) {
+			uint64_t remaining = length - transferred;
+			ssize_t ret = [self
+			    OF_kernelTransferToStream: stream
+					       length: (remaining > SIZE_MAX
+							   ? SIZE_MAX
+							   : (size_t)remaining)];
+
+			if (ret < 0) {
+				if (errno == ENOSYS || errno == EINVAL ||
+				    errno == EOPNOTSUPP)
+					break;
+
+				/*
+				 * The destination is in non-blocking mode and
+				 * full. Wait for it the way a blocking write
+				 * would have.
+				 */
+				if ((errno == EWOULDBLOCK ||
+				    errno == EAGAIN) &&
+				    [self OF_waitForWritingToStream: stream])
+					continue;
+
+				@throw [OFWriteFailedException
+				    exceptionWithObject: stream
+					requestedLength: 0
+					   bytesWritten: 0
+						  errNo: errno];
+			}
+
+			/* Let the loop below find out about the end of stream. */
+			if (ret == 0)
+				break;
+
+			transferred += ret;
+		}
+
+		if (transferred == length || [self isAtEndOfStream])
+			return transferred;
+
+		buffer = [self allocMemoryWithSize: TRANSFER_BUFFER_SIZE];
+		@try {
+			while (transferred < length &&
+			    ![self isAtEndOfStream]) {
+				size_t bufferLength = TRANSFER_BUFFER_SIZE;
+
+				if (length - transferred < bufferLength)
+					bufferLength =
+					    (size_t)(length - transferred);
+
+				bufferLength = [self
+				    readIntoBuffer: buffer
+					    length: bufferLength];
+				[self OF_writeBuffer: buffer
+					      length: bufferLength
+					    toStream: stream];
+
+				transferred += bufferLength;
+			}
+		} @finally {
+			[self freeMemory: buffer];
+		}
+	} @catch (OFWriteFailedException *e) {
+		/*
+		 * Report what has been transferred in total, not only what the
+		 * failed write managed to write.
+		 */
+		uint64_t bytesWritten = transferred + [e bytesWritten];
+
+		@throw [OFWriteFailedException
+		    exceptionWithObject: stream
+			requestedLength: (length > SIZE_MAX
+					     ? SIZE_MAX : (size_t)length)
+			   bytesWritten: (bytesWritten > SIZE_MAX
+					     ? SIZE_MAX : (size_t)bytesWritten)
+				  errNo: [e errNo]];
+	}
+
+	return transferred;
+}
+
+#ifdef OF_HAVE_SOCKETS
+- (void)asyncTransferToStream: (OFStream*)stream
+		       length: (uint64_t)length
+		       target: (id)target
+		     selector: (SEL)selector
+{
+	[OFRunLoop OF_addAsyncTransferFromStream: self
+					toStream: stream
+					  length: length
+					  target: target
+					selector: selector];
+}
+
+# ifdef OF_HAVE_BLOCKS
+- (void)asyncTransferToStream: (OFStream*)stream
+		       length: (uint64_t)length
+			block: (of_stream_async_transfer_block_t)block
+{
+	[OFRunLoop OF_addAsyncTransferFromStream: self
+					toStream: stream
+					  length: length
+					   block: block];
+}
+# endif
+
+- (void)asyncWriteBuffer: (const void*)buffer
+		  length: (size_t)length
+		  target: (id)target
+		selector: (SEL)selector
+{
+	[OFRunLoop OF_addAsyncWriteForStream: self
+				      buffer: buffer
+				      length: length
+				      target: target
+				    selector: selector];
+}
+
+# ifdef OF_HAVE_BLOCKS
+- (void)asyncWriteBuffer: (const void*)buffer
+		  length: (size_t)length
+		   block: (of_stream_async_write_block_t)block
+{
+	[OFRunLoop OF_addAsyncWriteForStream: self
+				      buffer: buffer
+				      length: length
+				       block: block];
+}
+# endif
+
+- (void)asyncWriteDataArray: (OFDataArray*)dataArray
+{
+	OFDataArray *copy = [dataArray copy];
+
+	@try {
+		[OFRunLoop OF_addAsyncWriteForStream: self
+					   dataArray: copy];
+	} @finally {
+		[copy release];
+	}
+}
+
+- (void)asyncWriteString: (OFString*)string
+{
+	[self asyncWriteString: string
+		      encoding: OF_STRING_ENCODING_UTF_8];
+}
+
+- (void)asyncWriteString: (OFString*)string
+		encoding: (of_string_encoding_t)encoding
+{
+	void *pool = objc_autoreleasePoolPush();
+	size_t length = [string cStringLengthWithEncoding: encoding];
+	OFDataArray *dataArray = [OFDataArray dataArrayWithCapacity: length];
+
+	[dataArray addItems: [string cStringWithEncoding: encoding]
+		      count: length];
+
+	[OFRunLoop OF_addAsyncWriteForStream: self
+				   dataArray: dataArray];
+
+	objc_autoreleasePoolPop(pool);
+}
+#endif
+
 - (void)writeInt8: (uint8_t)int8
 {
 	[self writeBuffer: (char*)&int8
@@ -1407,13 +2006,14 @@
 - (size_t)writeFormat: (OFConstantString*)format
 	    arguments: (va_list)arguments
 {
-	char *UTF8String;
+	char buffer[256], *UTF8String;
 	int length;
 
 	if (format == nil)
 		@throw [OFInvalidArgumentException exception];
 
-	if ((length = of_vasprintf(&UTF8String, [format UTF8String],
+	if ((length = of_vasprintf_buffer(buffer, sizeof(buffer), &UTF8String,
+	    [format UTF8String], [format OF_isConstantString],
 	    arguments)) == -1)
 		@throw [OFInvalidFormatException exception];
 
@@ -1421,7 +2021,8 @@
 		[self writeBuffer: UTF8String
 			   length: length];
 	} @finally {
-		free(UTF8String);
+		if (UTF8String != buffer)
+			free(UTF8String);
 	}
 
 	return length;
@@ -1522,25 +2123,36 @@
 - (void)unreadFromBuffer: (const void*)buffer
 		  length: (size_t)length
 {
-	char *readBuffer;
+	size_t offset = _readBuffer - _readBufferMemory;
 
 	if (length > SIZE_MAX - _readBufferLength)
 		@throw [OFOutOfRangeException exception];
 
-	readBuffer = [self allocMemoryWithSize: _readBufferLength + length];
-	memcpy(readBuffer, buffer, length);
-	memcpy(readBuffer + length, _readBuffer, _readBufferLength);
+	if (offset < length) {
+		if (_readBufferCapacity - _readBufferLength < length) {
+			_readBufferMemory = [self
+			    resizeMemory: _readBufferMemory
+				    size: _readBufferLength + length];
+			_readBufferCapacity = _readBufferLength + length;
+		}
 
-	[self freeMemory: _readBufferMemory];
-	_readBuffer = _readBufferMemory = readBuffer;
+		memmove(_readBufferMemory + length, _readBufferMemory + offset,
+		    _readBufferLength);
+		offset = length;
+	}
+
+	_readBuffer = _readBufferMemory + offset - length;
+	memcpy(_readBuffer, buffer, length);
 	_readBufferLength += length;
+
+	_waitingForDelimiter = false;
 }
 
 - (void)close
 {
 	[self freeMemory: _readBufferMemory];
 	_readBuffer = _readBufferMemory = NULL;
-	_readBufferLength = 0;
+	_readBufferLength = _readBufferCapacity = 0;
 
 	[self freeMemory: _writeBuffer];
 	_writeBuffer = NULL;
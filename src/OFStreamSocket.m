@@ -22,6 +22,7 @@
 #include <string.h>
 
 #import "OFStreamSocket.h"
+#import "OFStream+Private.h"
 
 #import "OFInitializationFailedException.h"
 #import "OFNotOpenException.h"
@@ -92,6 +93,8 @@
 - (void)lowlevelWriteBuffer: (const void*)buffer
 		     length: (size_t)length
 {
+	size_t bytesWritten = 0;
+
 	if (_socket == INVALID_SOCKET)
 		@throw [OFNotOpenException exceptionWithObject: self];
 
@@ -103,23 +106,76 @@
 #ifndef OF_WINDOWS
 	if (length > SSIZE_MAX)
 		@throw [OFOutOfRangeException exception];
-
-	if (send(_socket, buffer, length, 0) != (ssize_t)length)
-		@throw [OFWriteFailedException
-		    exceptionWithObject: self
-			requestedLength: length
-				  errNo: of_socket_errno()];
 #else
 	if (length > INT_MAX)
 		@throw [OFOutOfRangeException exception];
+#endif
 
-	if (send(_socket, buffer, (int)length, 0) != (int)length)
-		@throw [OFWriteFailedException
-		    exceptionWithObject: self
-			requestedLength: length
-				  errNo: of_socket_errno()];
+	/*
+	 * A non-blocking socket might accept less than the requested length.
+	 * Report how much was written so that the caller can continue from
+	 * there once the socket is writable again.
+	 */
+	while (bytesWritten < length) {
+#ifndef OF_WINDOWS
+		ssize_t ret = send(_socket, (const char*)buffer + bytesWritten,
+		    length - bytesWritten, 0);
+#else
+		int ret = send(_socket, (const char*)buffer + bytesWritten,
+		    (int)(length - bytesWritten), 0);
+#endif
+
+		if (ret < 0)
+			@throw [OFWriteFailedException
+			    exceptionWithObject: self
+				requestedLength: length
+				   bytesWritten: bytesWritten
+					  errNo: of_socket_errno()];
+
+		bytesWritten += ret;
+	}
+}
+
+#ifndef OF_WINDOWS
+- (int)OF_rawFileDescriptorForWriting
+{
+	static IMP lowlevelWriteBuffer = NULL;
+
+	if (lowlevelWriteBuffer == NULL)
+		lowlevelWriteBuffer = [OFStreamSocket instanceMethodForSelector:
+		    @selector(lowlevelWriteBuffer:length:)];
+
+	/*
+	 * Subclasses that need to transform the data, like TLS sockets, only
+	 * override lowlevelWriteBuffer:length:, so the socket must not be
+	 * written to directly for them.
+	 */
+	if (_socket == INVALID_SOCKET || _atEndOfStream ||
+	    [self methodForSelector: @selector(lowlevelWriteBuffer:length:)] !=
+	    lowlevelWriteBuffer)
+		return -1;
+
+	return _socket;
+}
 #endif
+
+#if defined(HAVE_WRITEV) && defined(HAVE_SYS_UIO_H)
+- (void)lowlevelWriteBuffers: (const of_stream_buffer_t*)buffers
+		       count: (size_t)count
+{
+	int fd = [self OF_rawFileDescriptorForWriting];
+
+	if (fd == -1) {
+		[super lowlevelWriteBuffers: buffers
+				      count: count];
+		return;
+	}
+
+	[self OF_writeBuffers: buffers
+			count: count
+	       fileDescriptor: fd];
 }
+#endif
 
 #ifdef OF_WINDOWS
 - (void)setBlocking: (bool)enable
@@ -16,6 +16,7 @@
 
 #include "config.h"
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -29,7 +30,12 @@
 #import "OFNumber.h"
 #import "OFNull.h"
 
+#import "OFInvalidFormatException.h"
 #import "OFInvalidJSONException.h"
+#import "OFOutOfMemoryException.h"
+#import "OFOutOfRangeException.h"
+
+#import "of_numconv.h"
 
 int _OFString_JSONValue_reference;
 
@@ -141,12 +147,31 @@ static inline OFString*
 parseString(const char **pointer, const char *stop, size_t *line)
 {
 	char *buffer;
+	const char *end;
 	size_t i = 0;
 	char delimiter = **pointer;
 
 	if (++(*pointer) + 1 >= stop)
 		return nil;
 
+	/*
+	 * Strings without escapes can be created directly from the input,
+	 * without going through a temporary buffer.
+	 */
+	for (end = *pointer; end < stop; end++)
+		if (*end == delimiter || *end == '\\' ||
+		    *end == '\n' || *end == '\r')
+			break;
+
+	if (end < stop && *end == delimiter) {
+		OFString *ret = [OFString stringWithUTF8String: *pointer
+							length: end - *pointer];
+
+		*pointer = end + 1;
+
+		return ret;
+	}
+
 	if ((buffer = malloc(stop - *pointer)) == NULL)
 		return nil;
 
@@ -528,14 +553,15 @@ static inline OFNumber*
 parseNumber(const char **pointer, const char *stop, size_t *line)
 {
 	bool isHex = (*pointer + 1 < stop && (*pointer)[1] == 'x');
-	bool hasDecimal = false;
+	bool isFloat = false;
+	OFNumber *number = nil;
 	size_t i;
-	OFString *string;
-	OFNumber *number;
+	int error = 0;
 
 	for (i = 0; *pointer + i < stop; i++) {
-		if ((*pointer)[i] == '.')
-			hasDecimal = true;
+		if ((*pointer)[i] == '.' || (!isHex &&
+		    ((*pointer)[i] == 'e' || (*pointer)[i] == 'E')))
+			isFloat = true;
 
 		if ((*pointer)[i] == ' ' || (*pointer)[i] == '\t' ||
 		    (*pointer)[i] == '\r' || (*pointer)[i] == '\n' ||
@@ -548,29 +574,40 @@ parseNumber(const char **pointer, const char *stop, size_t *line)
 		}
 	}
 
-	string = [[OFString alloc] initWithUTF8String: *pointer
-					       length: i];
+	/* Parse the bytes in place instead of creating a string first */
+	if (isFloat) {
+		double value;
+
+		if ((error = of_parse_double(*pointer, i, &value)) == 0)
+			number = [OFNumber numberWithDouble: value];
+	} else if (isHex) {
+		uintmax_t value;
+
+		if ((error = of_parse_hexadecimal(*pointer, i, &value)) == 0)
+			number = [OFNumber numberWithIntMax: value];
+	} else if (i == 8 && memcmp(*pointer, "Infinity", 8) == 0)
+		number = [OFNumber numberWithDouble: INFINITY];
+	else if (i == 9 && memcmp(*pointer, "-Infinity", 9) == 0)
+		number = [OFNumber numberWithDouble: -INFINITY];
+	else {
+		intmax_t value;
+
+		if ((error = of_parse_decimal(*pointer, i, &value)) == 0)
+			number = [OFNumber numberWithIntMax: value];
+	}
+
 	*pointer += i;
 
-	@try {
-		if (hasDecimal)
-			number = [OFNumber numberWithDouble:
-			    [string doubleValue]];
-		else if (isHex)
-			number = [OFNumber numberWithIntMax:
-			    [string hexadecimalValue]];
-		else if ([string isEqual: @"Infinity"])
-			number = [OFNumber numberWithDouble: INFINITY];
-		else if ([string isEqual: @"-Infinity"])
-			number = [OFNumber numberWithDouble: -INFINITY];
-		else
-			number = [OFNumber numberWithIntMax:
-			    [string decimalValue]];
-	} @finally {
-		[string release];
+	switch (error) {
+	case 0:
+		return number;
+	case ERANGE:
+		@throw [OFOutOfRangeException exception];
+	case ENOMEM:
+		@throw [OFOutOfMemoryException exception];
+	default:
+		@throw [OFInvalidFormatException exception];
 	}
-
-	return number;
 }
 
 static id
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2008, 2009, 2010, 2011, 2012, 2013, 2014, 2015, 2016
+ *   Jonathan Schleifer <js@heap.zone>
+ *
+ * All rights reserved.
+ *
+ * This file is part of ObjFW. It may be distributed under the terms of the
+ * Q Public License 1.0, which can be found in the file LICENSE.QPL included in
+ * the packaging of this file.
+ *
+ * Alternatively, it may be distributed under the terms of the GNU General
+ * Public License, either version 2 or 3, which can be found in the file
+ * LICENSE.GPLv2 or LICENSE.GPLv3 respectively included in the packaging of this
+ * file.
+ */
+
+#import "OFString.h"
+
+OF_ASSUME_NONNULL_BEGIN
+
+@interface OFString ()
+/*
+ * Returns whether the string is a constant string, whose UTF-8 string is never
+ * freed or modified.
+ */
+- (bool)OF_isConstantString;
+@end
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*
+ * Decodes the URL encoded bytes into the buffer, which needs to have room for
+ * length bytes, and returns the number of bytes written. If plusIsSpace is
+ * true, + is decoded as a space, as it is in form data. Throws an
+ * OFInvalidFormatException if the encoding is invalid.
+ */
+extern size_t of_url_decode(char *buffer, const char *string, size_t length,
+    bool plusIsSpace);
+#ifdef __cplusplus
+}
+#endif
+
+OF_ASSUME_NONNULL_END
@@ -21,6 +21,7 @@
 #include <ctype.h>
 
 #import "OFString+URLEncoding.h"
+#import "OFString+Private.h"
 
 #import "OFInvalidFormatException.h"
 #import "OFOutOfMemoryException.h"
@@ -28,6 +29,46 @@
 /* Reference for static linking */
 int _OFString_URLEncoding_reference;
 
+size_t
+of_url_decode(char *buffer, const char *string, size_t length,
+    bool plusIsSpace)
+{
+	size_t i = 0;
+
+	for (size_t j = 0; j < length; j++) {
+		unsigned char byte = 0;
+
+		if (string[j] != '%') {
+			buffer[i++] =
+			    (plusIsSpace && string[j] == '+' ? ' ' : string[j]);
+			continue;
+		}
+
+		if (length - j < 3)
+			@throw [OFInvalidFormatException exception];
+
+		for (uint8_t k = 1; k <= 2; k++) {
+			char c = string[j + k];
+
+			byte <<= 4;
+
+			if (c >= '0' && c <= '9')
+				byte |= c - '0';
+			else if (c >= 'A' && c <= 'F')
+				byte |= c - 'A' + 10;
+			else if (c >= 'a' && c <= 'f')
+				byte |= c - 'a' + 10;
+			else
+				@throw [OFInvalidFormatException exception];
+		}
+
+		buffer[i++] = byte;
+		j += 2;
+	}
+
+	return i;
+}
+
 @implementation OFString (URLEncoding)
 - (OFString*)stringByURLEncoding
 {
@@ -90,64 +131,26 @@ int _OFString_URLEncoding_reference;
 - (OFString*)stringByURLDecoding
 {
 	void *pool = objc_autoreleasePoolPush();
+	size_t length = [self UTF8StringLength];
 	OFString *ret;
-	const char *string = [self UTF8String];
 	char *retCString;
-	char byte = 0;
-	int state = 0;
-	size_t i;
 
-	if ((retCString = malloc([self UTF8StringLength] + 1)) == NULL)
+	if ((retCString = malloc(length + 1)) == NULL)
 		@throw [OFOutOfMemoryException
-		    exceptionWithRequestedSize: [self UTF8StringLength] + 1];
-
-	for (i = 0; *string; string++) {
-		switch (state) {
-		case 0:
-			if (*string == '%')
-				state = 1;
-			else
-				retCString[i++] = *string;
-			break;
-		case 1:
-		case 2:;
-			uint8_t shift = (state == 1 ? 4 : 0);
-
-			if (*string >= '0' && *string <= '9')
-				byte += (*string - '0') << shift;
-			else if (*string >= 'A' && *string <= 'F')
-				byte += (*string - 'A' + 10) << shift;
-			else if (*string >= 'a' && *string <= 'f')
-				byte += (*string - 'a' + 10) << shift;
-			else {
-				free(retCString);
-				@throw [OFInvalidFormatException exception];
-			}
-
-			if (++state == 3) {
-				retCString[i++] = byte;
-				state = 0;
-				byte = 0;
-			}
-
-			break;
-		}
-	}
-	retCString[i] = '\0';
+		    exceptionWithRequestedSize: length + 1];
 
-	objc_autoreleasePoolPop(pool);
+	@try {
+		length = of_url_decode(retCString, [self UTF8String], length,
+		    false);
 
-	if (state != 0) {
-		free(retCString);
-		@throw [OFInvalidFormatException exception];
-	}
+		objc_autoreleasePoolPop(pool);
 
-	@try {
 		ret = [OFString stringWithUTF8String: retCString
-					      length: i];
+					      length: length];
 	} @finally {
 		free(retCString);
 	}
+
 	return ret;
 }
 @end
@@ -25,6 +25,7 @@
 #include <sys/stat.h>
 
 #import "OFString.h"
+#import "OFString+Private.h"
 #import "OFString_UTF8.h"
 #import "OFString_UTF8+Private.h"
 #import "OFArray.h"
@@ -56,16 +57,9 @@
 #import "OFUnsupportedProtocolException.h"
 
 #import "of_asprintf.h"
+#import "of_numconv.h"
 #import "unicode.h"
 
-/*
- * It seems strtod is buggy on Win32.
- * However, the MinGW version __strtod seems to be ok.
- */
-#ifdef __MINGW32__
-# define strtod __strtod
-#endif
-
 @interface OFString ()
 - (size_t)OF_getCString: (char*)cString
 	      maxLength: (size_t)maxLength
@@ -264,6 +258,21 @@ standardizePath(OFArray *components, OFString *currentDirectory,
 	return [ret autorelease];
 }
 
+static void
+checkNumberParsing(int error)
+{
+	switch (error) {
+	case 0:
+		return;
+	case ERANGE:
+		@throw [OFOutOfRangeException exception];
+	case ENOMEM:
+		@throw [OFOutOfMemoryException exception];
+	default:
+		@throw [OFInvalidFormatException exception];
+	}
+}
+
 static struct {
 	Class isa;
 } placeholder;
@@ -1236,6 +1245,11 @@ static struct {
 	return [self cStringLengthWithEncoding: OF_STRING_ENCODING_UTF_8];
 }
 
+- (bool)OF_isConstantString
+{
+	return false;
+}
+
 - (of_unichar_t)characterAtIndex: (size_t)index
 {
 	OF_UNRECOGNIZED_SELECTOR
@@ -2164,51 +2178,10 @@ static struct {
 - (intmax_t)decimalValue
 {
 	void *pool = objc_autoreleasePoolPush();
-	const of_unichar_t *characters = [self characters];
-	size_t i = 0, length = [self length];
-	intmax_t value = 0;
-	bool expectWhitespace = false;
-
-	while (length > 0 && (*characters == ' ' || *characters == '\t' ||
-	    *characters == '\n' || *characters == '\r' ||
-	    *characters == '\f')) {
-		characters++;
-		length--;
-	}
+	intmax_t value;
 
-	if (length == 0) {
-		objc_autoreleasePoolPop(pool);
-		return 0;
-	}
-
-	if (characters[0] == '-' || characters[0] == '+')
-		i++;
-
-	for (; i < length; i++) {
-		if (expectWhitespace) {
-			if (characters[i] != ' ' && characters[i] != '\t' &&
-			    characters[i] != '\n' && characters[i] != '\r' &&
-			    characters[i] != '\f')
-				@throw [OFInvalidFormatException exception];
-			continue;
-		}
-
-		if (characters[i] >= '0' && characters[i] <= '9') {
-			if (INTMAX_MAX / 10 < value ||
-			    INTMAX_MAX - value * 10 < characters[i] - '0')
-				@throw [OFOutOfRangeException exception];
-
-			value = (value * 10) + (characters[i] - '0');
-		} else if (characters[i] == ' ' || characters[i] == '\t' ||
-		    characters[i] == '\n' || characters[i] == '\r' ||
-		    characters[i] == '\f')
-			expectWhitespace = true;
-		else
-			@throw [OFInvalidFormatException exception];
-	}
-
-	if (characters[0] == '-')
-		value *= -1;
+	checkNumberParsing(of_parse_decimal([self UTF8String],
+	    [self UTF8StringLength], &value));
 
 	objc_autoreleasePoolPop(pool);
 
@@ -2218,64 +2191,10 @@ static struct {
 - (uintmax_t)hexadecimalValue
 {
 	void *pool = objc_autoreleasePoolPush();
-	const of_unichar_t *characters = [self characters];
-	size_t i = 0, length = [self length];
-	uintmax_t value = 0;
-	bool expectWhitespace = false, foundValue = false;
-
-	while (length > 0 && (*characters == ' ' || *characters == '\t' ||
-	    *characters == '\n' || *characters == '\r' ||
-	    *characters == '\f')) {
-		characters++;
-		length--;
-	}
+	uintmax_t value;
 
-	if (length == 0) {
-		objc_autoreleasePoolPop(pool);
-		return 0;
-	}
-
-	if (length >= 2 && characters[0] == '0' && characters[1] == 'x')
-		i = 2;
-	else if (length >= 1 && (characters[0] == 'x' || characters[0] == '$'))
-		i = 1;
-
-	for (; i < length; i++) {
-		uintmax_t newValue;
-
-		if (expectWhitespace) {
-			if (characters[i] != ' ' && characters[i] != '\t' &&
-			    characters[i] != '\n' && characters[i] != '\r' &&
-			    characters[i] != '\f')
-				@throw [OFInvalidFormatException exception];
-			continue;
-		}
-
-		if (characters[i] >= '0' && characters[i] <= '9') {
-			newValue = (value << 4) | (characters[i] - '0');
-			foundValue = true;
-		} else if (characters[i] >= 'A' && characters[i] <= 'F') {
-			newValue = (value << 4) | (characters[i] - 'A' + 10);
-			foundValue = true;
-		} else if (characters[i] >= 'a' && characters[i] <= 'f') {
-			newValue = (value << 4) | (characters[i] - 'a' + 10);
-			foundValue = true;
-		} else if (characters[i] == 'h' || characters[i] == ' ' ||
-		    characters[i] == '\t' || characters[i] == '\n' ||
-		    characters[i] == '\r' || characters[i] == '\f') {
-			expectWhitespace = true;
-			continue;
-		} else
-			@throw [OFInvalidFormatException exception];
-
-		if (newValue < value)
-			@throw [OFOutOfRangeException exception];
-
-		value = newValue;
-	}
-
-	if (!foundValue)
-		@throw [OFInvalidFormatException exception];
+	checkNumberParsing(of_parse_hexadecimal([self UTF8String],
+	    [self UTF8StringLength], &value));
 
 	objc_autoreleasePoolPop(pool);
 
@@ -2285,49 +2204,10 @@ static struct {
 - (uintmax_t)octalValue
 {
 	void *pool = objc_autoreleasePoolPush();
-	const of_unichar_t *characters = [self characters];
-	size_t i = 0, length = [self length];
-	uintmax_t value = 0;
-	bool expectWhitespace = false;
-
-	while (length > 0 && (*characters == ' ' || *characters == '\t' ||
-	    *characters == '\n' || *characters == '\r' ||
-	    *characters == '\f')) {
-		characters++;
-		length--;
-	}
+	uintmax_t value;
 
-	if (length == 0) {
-		objc_autoreleasePoolPop(pool);
-		return 0;
-	}
-
-	for (; i < length; i++) {
-		uintmax_t newValue;
-
-		if (expectWhitespace) {
-			if (characters[i] != ' ' && characters[i] != '\t' &&
-			    characters[i] != '\n' && characters[i] != '\r' &&
-			    characters[i] != '\f')
-				@throw [OFInvalidFormatException exception];
-			continue;
-		}
-
-		if (characters[i] >= '0' && characters[i] <= '7')
-			newValue = (value << 3) | (characters[i] - '0');
-		else if (characters[i] == ' ' || characters[i] == '\t' ||
-		    characters[i] == '\n' || characters[i] == '\r' ||
-		    characters[i] == '\f') {
-			expectWhitespace = true;
-			continue;
-		} else
-			@throw [OFInvalidFormatException exception];
-
-		if (newValue < value)
-			@throw [OFOutOfRangeException exception];
-
-		value = newValue;
-	}
+	checkNumberParsing(of_parse_octal([self UTF8String],
+	    [self UTF8StringLength], &value));
 
 	objc_autoreleasePoolPop(pool);
 
@@ -2337,23 +2217,10 @@ static struct {
 - (float)floatValue
 {
 	void *pool = objc_autoreleasePoolPush();
-	const char *UTF8String = [self UTF8String];
-	char *endPointer = NULL;
 	float value;
 
-	while (*UTF8String == ' ' || *UTF8String == '\t' ||
-	    *UTF8String == '\n' || *UTF8String == '\r' || *UTF8String == '\f')
-		UTF8String++;
-
-	value = strtof(UTF8String, &endPointer);
-
-	/* Check if there are any invalid chars left */
-	if (endPointer != NULL)
-		for (; *endPointer != '\0'; endPointer++)
-			if (*endPointer != ' ' && *endPointer != '\t' &&
-			    *endPointer != '\n' && *endPointer != '\r' &&
-			    *endPointer != '\f')
-				@throw [OFInvalidFormatException exception];
+	checkNumberParsing(of_parse_float([self UTF8String],
+	    [self UTF8StringLength], &value));
 
 	objc_autoreleasePoolPop(pool);
 
@@ -2363,23 +2230,10 @@ static struct {
 - (double)doubleValue
 {
 	void *pool = objc_autoreleasePoolPush();
-	const char *UTF8String = [self UTF8String];
-	char *endPointer = NULL;
 	double value;
 
-	while (*UTF8String == ' ' || *UTF8String == '\t' ||
-	    *UTF8String == '\n' || *UTF8String == '\r' || *UTF8String == '\f')
-		UTF8String++;
-
-	value = strtod(UTF8String, &endPointer);
-
-	/* Check if there are any invalid chars left */
-	if (endPointer != NULL)
-		for (; *endPointer != '\0'; endPointer++)
-			if (*endPointer != ' ' && *endPointer != '\t' &&
-			    *endPointer != '\n' && *endPointer != '\r' &&
-			    *endPointer != '\f')
-				@throw [OFInvalidFormatException exception];
+	checkNumberParsing(of_parse_double([self UTF8String],
+	    [self UTF8StringLength], &value));
 
 	objc_autoreleasePoolPop(pool);
 
@@ -22,6 +22,10 @@ OF_ASSUME_NONNULL_BEGIN
 - (instancetype)OF_initWithUTF8String: (const char*)UTF8String
 			       length: (size_t)UTF8StringLength
 			      storage: (char*)storage;
+- (instancetype)OF_initWithUTF8StringNoCopy: (const char*)UTF8String
+				     length: (size_t)UTF8StringLength;
+- (size_t)OF_storageLength;
+- (OFString*)OF_substringWithUTF8Range: (of_range_t)range;
 @end
 
 OF_ASSUME_NONNULL_END
@@ -23,8 +23,10 @@
 
 #include <sys/types.h>
 
+#import "OFString+Private.h"
 #import "OFString_UTF8.h"
 #import "OFString_UTF8+Private.h"
+#import "OFString_UTF8_substring.h"
 #import "OFMutableString_UTF8.h"
 #import "OFArray.h"
 
@@ -35,33 +37,20 @@
 #import "OFOutOfMemoryException.h"
 #import "OFOutOfRangeException.h"
 
+#import "of_ascii.h"
 #import "of_asprintf.h"
+#import "of_memmem.h"
 #import "unicode.h"
 
 extern const of_char16_t of_iso_8859_15[128];
 extern const of_char16_t of_windows_1252[128];
 extern const of_char16_t of_codepage_437[128];
 
-static inline int
-memcasecmp(const char *first, const char *second, size_t length)
-{
-	for (size_t i = 0; i < length; i++) {
-		unsigned char f = first[i];
-		unsigned char s = second[i];
-
-		if (f <= 0x7F)
-			f = toupper(f);
-		if (s <= 0x7F)
-			s = toupper(s);
-
-		if (f > s)
-			return OF_ORDERED_DESCENDING;
-		if (f < s)
-			return OF_ORDERED_ASCENDING;
-	}
-
-	return OF_ORDERED_SAME;
-}
+/*
+ * Substrings shorter than this are always copied, as referencing the storage of
+ * the original string would not save any memory.
+ */
+#define SHARED_SUBSTRING_MIN_LENGTH 32
 
 int
 of_string_utf8_check(const char *UTF8String, size_t UTF8Length, size_t *length)
@@ -208,6 +197,22 @@ of_string_utf8_get_position(const char *string, size_t index, size_t length)
 	return self;
 }
 
+- (instancetype)OF_initWithUTF8StringNoCopy: (const char*)UTF8String
+				     length: (size_t)UTF8StringLength
+{
+	self = [super init];
+
+	/* Only used for parts of strings, which are known to be valid */
+	_s = &_storage;
+
+	_s->cString = (char*)UTF8String;
+	_s->cStringLength = UTF8StringLength;
+	_s->length = of_string_utf8_get_index(UTF8String, UTF8StringLength);
+	_s->isUTF8 = (_s->length != UTF8StringLength);
+
+	return self;
+}
+
 - initWithCString: (const char*)cString
 	 encoding: (of_string_encoding_t)encoding
 	   length: (size_t)cStringLength
@@ -385,20 +390,26 @@ of_string_utf8_get_position(const char *string, size_t index, size_t length)
 	self = [super init];
 
 	@try {
+		const char *cString;
+
 		_s = &_storage;
 
 		_s->cStringLength = [string UTF8StringLength];
 
 		if ([string isKindOfClass: [OFString_UTF8 class]] ||
-		    [string isKindOfClass: [OFMutableString_UTF8 class]])
+		    [string isKindOfClass: [OFMutableString_UTF8 class]]) {
 			_s->isUTF8 = ((OFString_UTF8*)string)->_s->isUTF8;
-		else
+			cString = ((OFString_UTF8*)string)->_s->cString;
+		} else {
 			_s->isUTF8 = true;
+			cString = [string UTF8String];
+		}
 
 		_s->length = [string length];
 
 		_s->cString = [self allocMemoryWithSize: _s->cStringLength + 1];
-		memcpy(_s->cString, [string UTF8String], _s->cStringLength + 1);
+		memcpy(_s->cString, cString, _s->cStringLength);
+		_s->cString[_s->cStringLength] = '\0';
 	} @catch (id e) {
 		[self release];
 		@throw e;
@@ -609,7 +620,7 @@ of_string_utf8_get_position(const char *string, size_t index, size_t length)
 	self = [super init];
 
 	@try {
-		char *tmp;
+		char buffer[256], *tmp;
 		int cStringLength;
 
 		if (format == nil)
@@ -617,8 +628,9 @@ of_string_utf8_get_position(const char *string, size_t index, size_t length)
 
 		_s = &_storage;
 
-		if ((cStringLength = of_vasprintf(&tmp, [format UTF8String],
-		    arguments)) == -1)
+		if ((cStringLength = of_vasprintf_buffer(buffer,
+		    sizeof(buffer), &tmp, [format UTF8String],
+		    [format OF_isConstantString], arguments)) == -1)
 			@throw [OFInvalidFormatException exception];
 
 		_s->cStringLength = cStringLength;
@@ -637,7 +649,8 @@ of_string_utf8_get_position(const char *string, size_t index, size_t length)
 			    allocMemoryWithSize: cStringLength + 1];
 			memcpy(_s->cString, tmp, cStringLength + 1);
 		} @finally {
-			free(tmp);
+			if (tmp != buffer)
+				free(tmp);
 		}
 	} @catch (id e) {
 		[self release];
@@ -668,7 +681,8 @@ of_string_utf8_get_position(const char *string, size_t index, size_t length)
 		if (_s->cStringLength + 1 > maxLength)
 			@throw [OFOutOfRangeException exception];
 
-		memcpy(cString, _s->cString, _s->cStringLength + 1);
+		memcpy(cString, _s->cString, _s->cStringLength);
+		cString[_s->cStringLength] = '\0';
 
 		return _s->cStringLength;
 	default:
@@ -721,6 +735,7 @@ of_string_utf8_get_position(const char *string, size_t index, size_t length)
 - (bool)isEqual: (id)object
 {
 	OFString_UTF8 *otherString;
+	const char *otherCString;
 
 	if (object == self)
 		return true;
@@ -734,13 +749,17 @@ of_string_utf8_get_position(const char *string, size_t index, size_t length)
 	    [otherString length] != _s->length)
 		return false;
 
-	if (([otherString isKindOfClass: [OFString_UTF8 class]] ||
-	    [otherString isKindOfClass: [OFMutableString_UTF8 class]]) &&
-	    _s->hashed && otherString->_s->hashed &&
-	    _s->hash != otherString->_s->hash)
-		return false;
+	if ([otherString isKindOfClass: [OFString_UTF8 class]] ||
+	    [otherString isKindOfClass: [OFMutableString_UTF8 class]]) {
+		if (_s->hashed && otherString->_s->hashed &&
+		    _s->hash != otherString->_s->hash)
+			return false;
 
-	if (strcmp(_s->cString, [otherString UTF8String]) != 0)
+		otherCString = otherString->_s->cString;
+	} else
+		otherCString = [otherString UTF8String];
+
+	if (memcmp(_s->cString, otherCString, _s->cStringLength) != 0)
 		return false;
 
 	return true;
@@ -782,7 +801,6 @@ of_string_utf8_get_position(const char *string, size_t index, size_t length)
 {
 	const char *otherCString;
 	size_t i, j, otherCStringLength, minimumCStringLength;
-	int compare;
 
 	if (otherString == self)
 		return OF_ORDERED_SAME;
@@ -796,11 +814,15 @@ of_string_utf8_get_position(const char *string, size_t index, size_t length)
 #ifdef OF_HAVE_UNICODE_TABLES
 	if (!_s->isUTF8) {
 #endif
+		unsigned char c1, c2;
+
 		minimumCStringLength = (_s->cStringLength > otherCStringLength
 		    ? otherCStringLength : _s->cStringLength);
 
-		if ((compare = memcasecmp(_s->cString, otherCString,
-		    minimumCStringLength)) == 0) {
+		i = of_ascii_casematch(_s->cString, otherCString,
+		    minimumCStringLength);
+
+		if (i == minimumCStringLength) {
 			if (_s->cStringLength > otherCStringLength)
 				return OF_ORDERED_DESCENDING;
 			if (_s->cStringLength < otherCStringLength)
@@ -808,7 +830,15 @@ of_string_utf8_get_position(const char *string, size_t index, size_t length)
 			return OF_ORDERED_SAME;
 		}
 
-		if (compare > 0)
+		c1 = _s->cString[i];
+		c2 = otherCString[i];
+
+		if (c1 <= 0x7F)
+			c1 = toupper(c1);
+		if (c2 <= 0x7F)
+			c2 = toupper(c2);
+
+		if (c1 > c2)
 			return OF_ORDERED_DESCENDING;
 		else
 			return OF_ORDERED_ASCENDING;
@@ -820,6 +850,33 @@ of_string_utf8_get_position(const char *string, size_t index, size_t length)
 	while (i < _s->cStringLength && j < otherCStringLength) {
 		of_unichar_t c1, c2;
 		ssize_t l1, l2;
+		size_t equal;
+
+		/*
+		 * Skip everything that is equal when ignoring the case of ASCII
+		 * letters without decoding it and only go through the tables
+		 * for the first character that differs.
+		 */
+		minimumCStringLength =
+		    (_s->cStringLength - i > otherCStringLength - j
+		    ? otherCStringLength - j : _s->cStringLength - i);
+		equal = of_ascii_casematch(_s->cString + i, otherCString + j,
+		    minimumCStringLength);
+
+		if (equal == minimumCStringLength) {
+			i += equal;
+			j += equal;
+			break;
+		}
+
+		/* Go back to the start of the character that differs */
+		while (equal > 0 &&
+		    ((_s->cString[i + equal] & 0xC0) == 0x80 ||
+		    (otherCString[j + equal] & 0xC0) == 0x80))
+			equal--;
+
+		i += equal;
+		j += equal;
 
 		l1 = of_string_utf8_decode(_s->cString + i,
 		    _s->cStringLength - i, &c1);
@@ -939,6 +996,7 @@ of_string_utf8_get_position(const char *string, size_t index, size_t length)
 	const char *cString = [string UTF8String];
 	size_t cStringLength = [string UTF8StringLength];
 	size_t rangeLocation, rangeLength;
+	const char *found;
 
 	if (range.length > SIZE_MAX - range.location ||
 	    range.location + range.length > _s->length)
@@ -961,35 +1019,21 @@ of_string_utf8_get_position(const char *string, size_t index, size_t length)
 	if (cStringLength > rangeLength)
 		return of_range(OF_NOT_FOUND, 0);
 
-	if (options & OF_STRING_SEARCH_BACKWARDS) {
-		for (size_t i = rangeLength - cStringLength;; i--) {
-			if (memcmp(_s->cString + rangeLocation + i, cString,
-			    cStringLength) == 0) {
-				range.location += of_string_utf8_get_index(
-				    _s->cString + rangeLocation, i);
-				range.length = [string length];
+	if (options & OF_STRING_SEARCH_BACKWARDS)
+		found = of_memrmem(_s->cString + rangeLocation, rangeLength,
+		    cString, cStringLength);
+	else
+		found = of_memmem(_s->cString + rangeLocation, rangeLength,
+		    cString, cStringLength);
 
-				return range;
-			}
+	if (found == NULL)
+		return of_range(OF_NOT_FOUND, 0);
 
-			/* Did not match and we're at the last char */
-			if (i == 0)
-				return of_range(OF_NOT_FOUND, 0);
-		}
-	} else {
-		for (size_t i = 0; i <= rangeLength - cStringLength; i++) {
-			if (memcmp(_s->cString + rangeLocation + i, cString,
-			    cStringLength) == 0) {
-				range.location += of_string_utf8_get_index(
-				    _s->cString + rangeLocation, i);
-				range.length = [string length];
-
-				return range;
-			}
-		}
-	}
+	range.location += of_string_utf8_get_index(_s->cString + rangeLocation,
+	    found - (_s->cString + rangeLocation));
+	range.length = [string length];
 
-	return of_range(OF_NOT_FOUND, 0);
+	return range;
 }
 
 - (bool)containsString: (OFString*)string
@@ -1003,11 +1047,8 @@ of_string_utf8_get_position(const char *string, size_t index, size_t length)
 	if (cStringLength > _s->cStringLength)
 		return false;
 
-	for (size_t i = 0; i <= _s->cStringLength - cStringLength; i++)
-		if (memcmp(_s->cString + i, cString, cStringLength) == 0)
-			return true;
-
-	return false;
+	return (of_memmem(_s->cString, _s->cStringLength,
+	    cString, cStringLength) != NULL);
 }
 
 - (OFString*)substringWithRange: (of_range_t)range
@@ -1025,8 +1066,32 @@ of_string_utf8_get_position(const char *string, size_t index, size_t length)
 		    _s->cStringLength);
 	}
 
-	return [OFString stringWithUTF8String: _s->cString + start
-				       length: end - start];
+	return [self OF_substringWithUTF8Range: of_range(start, end - start)];
+}
+
+- (size_t)OF_storageLength
+{
+	return _s->cStringLength;
+}
+
+- (OFString*)OF_substringWithUTF8Range: (of_range_t)range
+{
+	/*
+	 * Only reference the storage if the substring is a large part of the
+	 * string owning it, so that a small substring does not keep a large
+	 * string alive. Mutable strings inherit this method, but their storage
+	 * must never be referenced.
+	 */
+	if (range.length >= SHARED_SUBSTRING_MIN_LENGTH &&
+	    range.length >= [self OF_storageLength] / 4 &&
+	    [self isKindOfClass: [OFString_UTF8 class]])
+		return [[[OFString_UTF8_substring alloc]
+		    initWithString: self
+			UTF8String: _s->cString + range.location
+			    length: range.length] autorelease];
+
+	return [OFString stringWithUTF8String: _s->cString + range.location
+				       length: range.length];
 }
 
 - (bool)hasPrefix: (OFString*)prefix
@@ -1059,12 +1124,13 @@ of_string_utf8_get_position(const char *string, size_t index, size_t length)
 	size_t cStringLength = [delimiter UTF8StringLength];
 	bool skipEmpty = (options & OF_STRING_SKIP_EMPTY);
 	size_t last;
+	const char *found;
 	OFString *component;
 
 	array = [OFMutableArray array];
 	pool = objc_autoreleasePoolPush();
 
-	if (cStringLength > _s->cStringLength) {
+	if (cStringLength == 0 || cStringLength > _s->cStringLength) {
 		[array addObject: [[self copy] autorelease]];
 		objc_autoreleasePoolPop(pool);
 
@@ -1072,19 +1138,19 @@ of_string_utf8_get_position(const char *string, size_t index, size_t length)
 	}
 
 	last = 0;
-	for (size_t i = 0; i <= _s->cStringLength - cStringLength; i++) {
-		if (memcmp(_s->cString + i, cString, cStringLength) != 0)
-			continue;
+	while ((found = of_memmem(_s->cString + last, _s->cStringLength - last,
+	    cString, cStringLength)) != NULL) {
+		size_t i = found - _s->cString;
 
-		component = [OFString stringWithUTF8String: _s->cString + last
-						    length: i - last];
+		component = [self OF_substringWithUTF8Range:
+		    of_range(last, i - last)];
 		if (!skipEmpty || [component length] > 0)
 			[array addObject: component];
 
-		i += cStringLength - 1;
-		last = i + 1;
+		last = i + cStringLength;
 	}
-	component = [OFString stringWithUTF8String: _s->cString + last];
+	component = [self OF_substringWithUTF8Range:
+	    of_range(last, _s->cStringLength - last)];
 	if (!skipEmpty || [component length] > 0)
 		[array addObject: component];
 
@@ -1113,15 +1179,14 @@ of_string_utf8_get_position(const char *string, size_t index, size_t length)
 
 	for (i = 0; i < pathCStringLength; i++) {
 		if (OF_IS_PATH_DELIMITER(_s->cString[i])) {
-			[ret addObject:
-			    [OFString stringWithUTF8String: _s->cString + last
-						    length: i - last]];
+			[ret addObject: [self OF_substringWithUTF8Range:
+			    of_range(last, i - last)]];
 			last = i + 1;
 		}
 	}
 
-	[ret addObject: [OFString stringWithUTF8String: _s->cString + last
-						length: i - last]];
+	[ret addObject: [self OF_substringWithUTF8Range:
+	    of_range(last, i - last)]];
 
 #ifdef OF_WINDOWS
 	if ([ret count] >= 2 && [[ret objectAtIndex: 0] hasSuffix: @":"]) {
@@ -1268,10 +1333,11 @@ of_string_utf8_get_position(const char *string, size_t index, size_t length)
 {
 	void *pool;
 	const char *cString = _s->cString;
+	const char *cStringEnd = _s->cString + _s->cStringLength;
 	const char *last = cString;
 	bool stop = false, lastCarriageReturn = false;
 
-	while (!stop && *cString != 0) {
+	while (!stop && cString < cStringEnd) {
 		if (lastCarriageReturn && *cString == '\n') {
 			lastCarriageReturn = false;
 
@@ -1284,9 +1350,9 @@ of_string_utf8_get_position(const char *string, size_t index, size_t length)
 		if (*cString == '\n' || *cString == '\r') {
 			pool = objc_autoreleasePoolPush();
 
-			block([OFString
-			    stringWithUTF8String: last
-					  length: cString - last], &stop);
+			block([self OF_substringWithUTF8Range:
+			    of_range(last - _s->cString, cString - last)],
+			    &stop);
 			last = cString + 1;
 
 			objc_autoreleasePoolPop(pool);
@@ -1299,8 +1365,8 @@ of_string_utf8_get_position(const char *string, size_t index, size_t length)
 	pool = objc_autoreleasePoolPush();
 
 	if (!stop)
-		block([OFString stringWithUTF8String: last
-					      length: cString - last], &stop);
+		block([self OF_substringWithUTF8Range:
+		    of_range(last - _s->cString, cString - last)], &stop);
 
 	objc_autoreleasePoolPop(pool);
 }
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2008, 2009, 2010, 2011, 2012, 2013, 2014, 2015, 2016
+ *   Jonathan Schleifer <js@heap.zone>
+ *
+ * All rights reserved.
+ *
+ * This file is part of ObjFW. It may be distributed under the terms of the
+ * Q Public License 1.0, which can be found in the file LICENSE.QPL included in
+ * the packaging of this file.
+ *
+ * Alternatively, it may be distributed under the terms of the GNU General
+ * Public License, either version 2 or 3, which can be found in the file
+ * LICENSE.GPLv2 or LICENSE.GPLv3 respectively included in the packaging of this
+ * file.
+ */
+
+#import "OFString_UTF8.h"
+
+OF_ASSUME_NONNULL_BEGIN
+
+/*
+ * An immutable string that references a range of the storage of another
+ * OFString_UTF8 instead of copying it. The storage is not terminated, so a
+ * terminated copy is created the first time -[UTF8String] is called.
+ */
+@interface OFString_UTF8_substring: OFString_UTF8
+{
+	OFString_UTF8 *_string;
+	char *volatile _Nullable _terminatedCString;
+}
+
+/*
+ * UTF8String must point into the storage of string and the range must start
+ * and end on character boundaries.
+ */
+- initWithString: (OFString_UTF8*)string
+      UTF8String: (const char*)UTF8String
+	  length: (size_t)UTF8StringLength;
+@end
+
+OF_ASSUME_NONNULL_END
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2008, 2009, 2010, 2011, 2012, 2013, 2014, 2015, 2016
+ *   Jonathan Schleifer <js@heap.zone>
+ *
+ * All rights reserved.
+ *
+ * This file is part of ObjFW. It may be distributed under the terms of the
+ * Q Public License 1.0, which can be found in the file LICENSE.QPL included in
+ * the packaging of this file.
+ *
+ * Alternatively, it may be distributed under the terms of the GNU General
+ * Public License, either version 2 or 3, which can be found in the file
+ * LICENSE.GPLv2 or LICENSE.GPLv3 respectively included in the packaging of this
+ * file.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#import "OFString_UTF8_substring.h"
+#import "OFString_UTF8+Private.h"
+
+#import "OFInvalidEncodingException.h"
+#import "OFOutOfMemoryException.h"
+
+#import "atomic.h"
+
+@implementation OFString_UTF8_substring
+- initWithString: (OFString_UTF8*)string
+      UTF8String: (const char*)UTF8String
+	  length: (size_t)UTF8StringLength
+{
+	self = [super OF_initWithUTF8StringNoCopy: UTF8String
+					   length: UTF8StringLength];
+
+	/* Always reference the string that owns the storage */
+	if ([string isKindOfClass: [OFString_UTF8_substring class]])
+		string = ((OFString_UTF8_substring*)string)->_string;
+
+	_string = [string retain];
+
+	return self;
+}
+
+- (void)dealloc
+{
+	free(_terminatedCString);
+	[_string release];
+
+	[super dealloc];
+}
+
+- (size_t)OF_storageLength
+{
+	return [_string UTF8StringLength];
+}
+
+- (const char*)UTF8String
+{
+	char *cString;
+
+	if (_terminatedCString != NULL) {
+		of_memory_barrier_consumer();
+		return _terminatedCString;
+	}
+
+	if ((cString = malloc(_s->cStringLength + 1)) == NULL)
+		@throw [OFOutOfMemoryException
+		    exceptionWithRequestedSize: _s->cStringLength + 1];
+
+	memcpy(cString, _s->cString, _s->cStringLength);
+	cString[_s->cStringLength] = '\0';
+
+	of_memory_barrier_producer();
+
+	if (!of_atomic_ptr_cmpswap((void *volatile*)&_terminatedCString,
+	    NULL, cString))
+		free(cString);
+
+	return _terminatedCString;
+}
+
+- (const char*)cStringWithEncoding: (of_string_encoding_t)encoding
+{
+	switch (encoding) {
+	case OF_STRING_ENCODING_ASCII:
+		if (_s->isUTF8)
+			@throw [OFInvalidEncodingException exception];
+		/* intentional fall-through */
+	case OF_STRING_ENCODING_UTF_8:
+		return [self UTF8String];
+	default:
+		return [super cStringWithEncoding: encoding];
+	}
+}
+@end
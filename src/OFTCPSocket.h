@@ -24,6 +24,7 @@ OF_ASSUME_NONNULL_BEGIN
 
 @class OFTCPSocket;
 @class OFString;
+@class OFDNSResolver;
 
 #ifdef OF_HAVE_BLOCKS
 /*!
@@ -65,6 +66,7 @@ typedef bool (^of_tcp_socket_async_accept_block_t)(OFTCPSocket *socket,
 	socklen_t _addressLength;
 	OFString *_SOCKS5Host;
 	uint16_t _SOCKS5Port;
+	OFDNSResolver *_DNSResolver;
 #ifdef OF_WII
 	uint16_t _port;
 #endif
@@ -80,6 +82,14 @@ typedef bool (^of_tcp_socket_async_accept_block_t)(OFTCPSocket *socket,
  */
 @property uint16_t SOCKS5Port;
 
+/*!
+ * The resolver to use for asynchronously connecting.
+ *
+ * If it is `nil`, which is the default, the resolver of the current run loop
+ * is used.
+ */
+@property OF_NULLABLE_PROPERTY (retain) OFDNSResolver *DNSResolver;
+
 /*!
  * @brief Sets the global SOCKS5 proxy host to use when creating a new socket
  *
@@ -122,6 +132,14 @@ typedef bool (^of_tcp_socket_async_accept_block_t)(OFTCPSocket *socket,
 /*!
  * @brief Asyncronously connect the OFTCPSocket to the specified destination.
  *
+ * Unless a SOCKS5 proxy is used or the platform is Windows, the host is
+ * resolved using the @ref OFDNSResolver of the current run loop and connecting
+ * happens in the run loop as well, without the need for a thread.
+ *
+ * If the host has multiple addresses, the next address is tried in parallel
+ * if connecting to the previous one did not succeed within 250 ms, alternating
+ * between IPv6 and IPv4. The first connection to be established is used.
+ *
  * @param host The host to connect to
  * @param port The port on the host to connect to
  * @param target The target on which to call the selector once the connection
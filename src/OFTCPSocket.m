@@ -27,8 +27,17 @@
 
 #include <fcntl.h>
 
+#ifdef HAVE_POLL_H
+# include <poll.h>
+#endif
+#include <sys/time.h>
+
 #import "OFTCPSocket.h"
 #import "OFTCPSocket+SOCKS5.h"
+#import "OFDNSResolver.h"
+#import "OFArray.h"
+#import "OFDataArray.h"
+#import "OFDate.h"
 #import "OFString.h"
 #import "OFThread.h"
 #import "OFTimer.h"
@@ -63,6 +72,333 @@ Class of_tls_socket_class = Nil;
 static OFString *defaultSOCKS5Host = nil;
 static uint16_t defaultSOCKS5Port = 1080;
 
+/*
+ * Windows reports a failed non-blocking connect as an exception instead of
+ * making the socket writable and has no resolv.conf, so it uses a thread, too.
+ */
+#if !defined(OF_WINDOWS) && !defined(OF_WII) && !defined(OF_NINTENDO_3DS)
+# ifdef OF_HAVE_THREADS
+#  define USE_NONBLOCKING_CONNECT
+# endif
+# ifdef HAVE_POLL_H
+#  define RACE_BLOCKING_CONNECT
+# endif
+#endif
+
+/*
+ * As recommended by RFC 8305: If an attempt has not succeeded after the delay,
+ * the next address is tried in parallel. The timeout makes sure a single
+ * blackholed address cannot stall the connection for the TCP timeout.
+ */
+#define CONNECTION_ATTEMPT_DELAY 0.25
+#define CONNECTION_ATTEMPT_TIMEOUT 30
+
+#ifdef USE_NONBLOCKING_CONNECT
+@interface OFTCPSocket ()
+- (void)OF_setSocket: (of_socket_t)socket;
+@end
+
+/*
+ * A connection attempt to a single address. The file descriptor of an attempt
+ * never changes, even after it has been closed or handed over to the socket.
+ * If the next attempt or the socket already uses the same number when the
+ * attempt is removed from the run loop, the kernel event observer tells them
+ * apart by the object and keeps the newer one.
+ */
+@interface OFTCPSocket_ConnectAttempt: OFObject <OFReadyForWritingObserving,
+    OFCopying>
+{
+@public
+	int _fd;
+	OFTimer *_timeoutTimer;
+}
+@end
+
+@interface OFTCPSocket_AsyncConnectContext: OFObject
+{
+	OFTCPSocket *_socket;
+	OFString *_host;
+	uint16_t _port;
+	id _target;
+	SEL _selector;
+# ifdef OF_HAVE_BLOCKS
+	of_tcp_socket_async_connect_block_t _block;
+# endif
+	OFDataArray *_addresses;
+	size_t _addressIndex;
+	OFMutableArray *_attempts;
+	OFTimer *_delayTimer;
+	bool _done;
+	int _errNo;
+}
+
+- initWithSocket: (OFTCPSocket*)socket
+	    host: (OFString*)host
+	    port: (uint16_t)port
+	  target: (id)target
+	selector: (SEL)selector;
+# ifdef OF_HAVE_BLOCKS
+- initWithSocket: (OFTCPSocket*)socket
+	    host: (OFString*)host
+	    port: (uint16_t)port
+	   block: (of_tcp_socket_async_connect_block_t)block;
+# endif
+- (void)start;
+- (void)resolvedHost: (OFString*)host
+	   addresses: (OFDataArray*)addresses
+	   exception: (OFException*)exception;
+- (void)startNextAttempt;
+- (void)attemptBecameWritable: (OFTCPSocket_ConnectAttempt*)attempt;
+- (void)attemptTimedOut: (OFTCPSocket_ConnectAttempt*)attempt;
+- (void)removeAttempt: (OFTCPSocket_ConnectAttempt*)attempt;
+- (void)cancelAttempts;
+- (void)didConnectWithFileDescriptor: (int)fd;
+- (void)didConnectWithException: (OFException*)exception;
+@end
+#endif
+
+#if defined(USE_NONBLOCKING_CONNECT) || defined(RACE_BLOCKING_CONNECT)
+/*
+ * Reorders the addresses so that the address families alternate, starting
+ * with the family of the first address, as recommended by RFC 8305.
+ */
+static void
+interleaveAddresses(of_udp_socket_address_t *addresses, size_t count)
+{
+	of_udp_socket_address_t *sorted;
+	size_t first = 0, other = 0, j = 0;
+	sa_family_t family;
+
+	if (count < 3)
+		return;
+
+	if ((sorted = malloc(count * sizeof(*sorted))) == NULL)
+		return;
+
+	family = addresses[0].address.ss_family;
+
+	while (j < count) {
+		while (first < count &&
+		    addresses[first].address.ss_family != family)
+			first++;
+		if (first < count)
+			sorted[j++] = addresses[first++];
+
+		while (other < count &&
+		    addresses[other].address.ss_family == family)
+			other++;
+		if (other < count)
+			sorted[j++] = addresses[other++];
+	}
+
+	memcpy(addresses, sorted, count * sizeof(*sorted));
+	free(sorted);
+}
+
+/*
+ * Starts a non-blocking connect to the address. Returns the file descriptor
+ * or -1 on error. If the connection could be established immediately,
+ * connected is set to true.
+ */
+static int
+startConnectAttempt(const of_udp_socket_address_t *address, bool *connected,
+    int *errNo)
+{
+	int fd, flags;
+
+	*connected = false;
+
+	if ((fd = socket(address->address.ss_family,
+	    SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
+		*errNo = of_socket_errno();
+		return -1;
+	}
+
+# if SOCK_CLOEXEC == 0 && defined(HAVE_FCNTL) && defined(FD_CLOEXEC)
+	if ((flags = fcntl(fd, F_GETFD, 0)) != -1)
+		fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+# endif
+
+	if ((flags = fcntl(fd, F_GETFL, 0)) == -1 ||
+	    fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		*errNo = errno;
+		close(fd);
+		return -1;
+	}
+
+	if (connect(fd, (const struct sockaddr*)&address->address,
+	    address->length) == 0) {
+		*connected = true;
+		return fd;
+	}
+
+	if (of_socket_errno() != EINPROGRESS) {
+		*errNo = of_socket_errno();
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Returns 0 if the connect succeeded and the error otherwise. */
+static int
+connectAttemptError(int fd)
+{
+	int errNo = 0;
+	socklen_t length = (socklen_t)sizeof(errNo);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &errNo, &length) == -1)
+		return of_socket_errno();
+
+	return errNo;
+}
+
+static void
+setBlocking(int fd)
+{
+	int flags;
+
+	/* The socket was only non-blocking for connecting */
+	if ((flags = fcntl(fd, F_GETFL, 0)) != -1)
+		fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+}
+#endif
+
+#ifdef RACE_BLOCKING_CONNECT
+static of_time_interval_t
+now(void)
+{
+	struct timeval t;
+
+	gettimeofday(&t, NULL);
+
+	return t.tv_sec + (of_time_interval_t)t.tv_usec / 1000000;
+}
+
+/*
+ * The blocking counterpart to OFTCPSocket_AsyncConnectContext: Races the
+ * connection attempts using poll() and returns the file descriptor of the
+ * winner or -1.
+ */
+static int
+raceConnect(of_udp_socket_address_t *addresses, size_t count, int *errNo)
+{
+	struct pollfd *fds;
+	of_time_interval_t *deadlines, nextStart = 0;
+	size_t next = 0, active = 0, i;
+	int fd = -1;
+
+	interleaveAddresses(addresses, count);
+
+	fds = malloc(count * sizeof(*fds));
+	deadlines = malloc(count * sizeof(*deadlines));
+
+	if (fds == NULL || deadlines == NULL) {
+		free(fds);
+		free(deadlines);
+		*errNo = ENOMEM;
+		return -1;
+	}
+
+	while (fd == -1) {
+		of_time_interval_t current = now(), timeout;
+		int events;
+
+		if (next < count && (active == 0 || current >= nextStart)) {
+			bool connected;
+			int newFD = startConnectAttempt(&addresses[next++],
+			    &connected, errNo);
+
+			if (newFD == -1)
+				continue;
+
+			if (connected) {
+				fd = newFD;
+				break;
+			}
+
+			fds[active].fd = newFD;
+			fds[active].events = POLLOUT;
+			fds[active].revents = 0;
+			deadlines[active++] =
+			    current + CONNECTION_ATTEMPT_TIMEOUT;
+			nextStart = current + CONNECTION_ATTEMPT_DELAY;
+
+			continue;
+		}
+
+		if (active == 0)
+			break;
+
+		timeout = deadlines[0];
+		for (i = 1; i < active; i++)
+			if (deadlines[i] < timeout)
+				timeout = deadlines[i];
+		if (next < count && nextStart < timeout)
+			timeout = nextStart;
+
+		timeout -= current;
+		if (timeout < 0)
+			timeout = 0;
+
+		events = poll(fds, (nfds_t)active, (int)(timeout * 1000) + 1);
+
+		if (events == -1) {
+			if (errno == EINTR)
+				continue;
+
+			*errNo = errno;
+			break;
+		}
+
+		current = now();
+
+		for (i = 0; i < active; i++) {
+			int error;
+
+			if (fds[i].revents == 0) {
+				if (current < deadlines[i])
+					continue;
+
+				error = ETIMEDOUT;
+			} else if ((error = connectAttemptError(fds[i].fd)) ==
+			    0) {
+				fd = fds[i].fd;
+
+				active--;
+				fds[i] = fds[active];
+				deadlines[i] = deadlines[active];
+
+				break;
+			}
+
+			*errNo = error;
+			close(fds[i].fd);
+
+			active--;
+			fds[i] = fds[active];
+			deadlines[i] = deadlines[active];
+			i--;
+
+			/* Don't wait for the delay if an attempt failed */
+			nextStart = current;
+		}
+	}
+
+	for (i = 0; i < active; i++)
+		close(fds[i].fd);
+
+	free(fds);
+	free(deadlines);
+
+	if (fd != -1)
+		setBlocking(fd);
+
+	return fd;
+}
+#endif
+
 #ifdef OF_HAVE_THREADS
 @interface OFTCPSocket_ConnectThread: OFThread
 {
@@ -197,8 +533,306 @@ static uint16_t defaultSOCKS5Port = 1080;
 @end
 #endif
 
+#ifdef USE_NONBLOCKING_CONNECT
+@implementation OFTCPSocket_ConnectAttempt
+- (void)dealloc
+{
+	[_timeoutTimer release];
+
+	[super dealloc];
+}
+
+- copy
+{
+	return [self retain];
+}
+
+- (int)fileDescriptorForWriting
+{
+	return _fd;
+}
+@end
+
+@implementation OFTCPSocket_AsyncConnectContext
+- initWithSocket: (OFTCPSocket*)socket
+	    host: (OFString*)host
+	    port: (uint16_t)port
+	  target: (id)target
+	selector: (SEL)selector
+{
+	self = [super init];
+
+	@try {
+		_socket = [socket retain];
+		_host = [host copy];
+		_port = port;
+		_target = [target retain];
+		_selector = selector;
+		_attempts = [[OFMutableArray alloc] init];
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+# ifdef OF_HAVE_BLOCKS
+- initWithSocket: (OFTCPSocket*)socket
+	    host: (OFString*)host
+	    port: (uint16_t)port
+	   block: (of_tcp_socket_async_connect_block_t)block
+{
+	self = [super init];
+
+	@try {
+		_socket = [socket retain];
+		_host = [host copy];
+		_port = port;
+		_block = [block copy];
+		_attempts = [[OFMutableArray alloc] init];
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+# endif
+
+- (void)dealloc
+{
+	[_socket release];
+	[_host release];
+	[_target release];
+# ifdef OF_HAVE_BLOCKS
+	[_block release];
+# endif
+	[_addresses release];
+	[_attempts release];
+	[_delayTimer release];
+
+	[super dealloc];
+}
+
+- (void)start
+{
+	OFDNSResolver *resolver = [_socket DNSResolver];
+
+	if (resolver == nil)
+		resolver = [OFRunLoop OF_DNSResolver];
+
+	[resolver asyncResolveHost: _host
+			    target: self
+			  selector: @selector(resolvedHost:addresses:exception:)];
+}
+
+- (void)resolvedHost: (OFString*)host
+	   addresses: (OFDataArray*)addresses
+	   exception: (OFException*)exception
+{
+	of_udp_socket_address_t *items;
+	size_t i, count;
+
+	if (exception != nil) {
+		[self didConnectWithException: exception];
+		return;
+	}
+
+	_addresses = [addresses copy];
+	items = [_addresses items];
+	count = [_addresses count];
+
+	for (i = 0; i < count; i++) {
+		switch (items[i].address.ss_family) {
+		case AF_INET:
+			((struct sockaddr_in*)&items[i].address)->sin_port =
+			    OF_BSWAP16_IF_LE(_port);
+			break;
+# ifdef OF_HAVE_IPV6
+		case AF_INET6:
+			((struct sockaddr_in6*)&items[i].address)->sin6_port =
+			    OF_BSWAP16_IF_LE(_port);
+			break;
+# endif
+		}
+	}
+
+	/* The resolver returns all IPv4 addresses first, prefer IPv6 */
+	for (i = 0; i < count; i++) {
+		if (items[i].address.ss_family != AF_INET) {
+			of_udp_socket_address_t tmp = items[i];
+
+			memmove(items + 1, items, i * sizeof(*items));
+			items[0] = tmp;
+			break;
+		}
+	}
+
+	interleaveAddresses(items, count);
+
+	[self startNextAttempt];
+}
+
+- (void)startNextAttempt
+{
+	[_delayTimer invalidate];
+	[_delayTimer release];
+	_delayTimer = nil;
+
+	while (_addressIndex < [_addresses count]) {
+		of_udp_socket_address_t *address =
+		    [_addresses itemAtIndex: _addressIndex++];
+		OFTCPSocket_ConnectAttempt *attempt;
+		bool connected;
+		int fd;
+
+		if ((fd = startConnectAttempt(address, &connected,
+		    &_errNo)) == -1)
+			continue;
+
+		if (connected) {
+			[self didConnectWithFileDescriptor: fd];
+			return;
+		}
+
+		attempt = [[[OFTCPSocket_ConnectAttempt alloc] init]
+		    autorelease];
+		attempt->_fd = fd;
+		attempt->_timeoutTimer = [[OFTimer
+		    scheduledTimerWithTimeInterval: CONNECTION_ATTEMPT_TIMEOUT
+					    target: self
+					  selector: @selector(attemptTimedOut:)
+					    object: attempt
+					   repeats: false] retain];
+		[_attempts addObject: attempt];
+
+		[OFRunLoop OF_addAsyncConnectForSocket: attempt
+						target: self
+					      selector: @selector(
+							    attemptBecameWritable:)];
+
+		if (_addressIndex < [_addresses count])
+			_delayTimer = [[OFTimer
+			    scheduledTimerWithTimeInterval:
+			    CONNECTION_ATTEMPT_DELAY
+						    target: self
+						  selector: @selector(
+							      startNextAttempt)
+						   repeats: false] retain];
+
+		return;
+	}
+
+	/* No more addresses to try and none left in progress */
+	if ([_attempts count] == 0)
+		[self didConnectWithException:
+		    [OFConnectionFailedException exceptionWithHost: _host
+							      port: _port
+							    socket: _socket
+							     errNo: _errNo]];
+}
+
+- (void)attemptBecameWritable: (OFTCPSocket_ConnectAttempt*)attempt
+{
+	int errNo;
+
+	[[attempt retain] autorelease];
+	[self removeAttempt: attempt];
+
+	/* Another attempt won while this one was already queued */
+	if (_done) {
+		close(attempt->_fd);
+		return;
+	}
+
+	if ((errNo = connectAttemptError(attempt->_fd)) != 0) {
+		_errNo = errNo;
+		close(attempt->_fd);
+
+		/* Don't wait for the delay if an attempt failed */
+		[self startNextAttempt];
+		return;
+	}
+
+	[self didConnectWithFileDescriptor: attempt->_fd];
+}
+
+- (void)attemptTimedOut: (OFTCPSocket_ConnectAttempt*)attempt
+{
+	[[attempt retain] autorelease];
+	[self removeAttempt: attempt];
+
+	[OFRunLoop OF_cancelAsyncRequestsForObject: attempt];
+	close(attempt->_fd);
+	_errNo = ETIMEDOUT;
+
+	[self startNextAttempt];
+}
+
+- (void)removeAttempt: (OFTCPSocket_ConnectAttempt*)attempt
+{
+	[attempt->_timeoutTimer invalidate];
+	[_attempts removeObjectIdenticalTo: attempt];
+}
+
+- (void)cancelAttempts
+{
+	for (OFTCPSocket_ConnectAttempt *attempt in _attempts) {
+		[attempt->_timeoutTimer invalidate];
+		[OFRunLoop OF_cancelAsyncRequestsForObject: attempt];
+		close(attempt->_fd);
+	}
+
+	[_attempts removeAllObjects];
+}
+
+- (void)didConnectWithFileDescriptor: (int)fd
+{
+	_done = true;
+
+	[_delayTimer invalidate];
+	[_delayTimer release];
+	_delayTimer = nil;
+
+	/*
+	 * The losers can't be removed from the run loop here, as they might
+	 * have become writable in the same iteration.
+	 */
+	if ([_attempts count] > 0)
+		[OFTimer scheduledTimerWithTimeInterval: 0
+						 target: self
+					       selector: @selector(cancelAttempts)
+						repeats: false];
+
+	[_socket OF_setSocket: fd];
+	[self didConnectWithException: nil];
+}
+
+- (void)didConnectWithException: (OFException*)exception
+{
+	_done = true;
+
+# ifdef OF_HAVE_BLOCKS
+	if (_block != NULL)
+		_block(_socket, exception);
+	else {
+# endif
+		void (*func)(id, SEL, OFTCPSocket*, OFException*) =
+		    (void(*)(id, SEL, OFTCPSocket*, OFException*))[_target
+		    methodForSelector: _selector];
+
+		func(_target, _selector, _socket, exception);
+# ifdef OF_HAVE_BLOCKS
+	}
+# endif
+}
+@end
+#endif
+
 @implementation OFTCPSocket
 @synthesize SOCKS5Host = _SOCKS5Host, SOCKS5Port = _SOCKS5Port;
+@synthesize DNSResolver = _DNSResolver;
 
 + (void)setSOCKS5Host: (OFString*)host
 {
@@ -241,6 +875,7 @@ static uint16_t defaultSOCKS5Port = 1080;
 - (void)dealloc
 {
 	[_SOCKS5Host release];
+	[_DNSResolver release];
 
 	[super dealloc];
 }
@@ -264,6 +899,31 @@ static uint16_t defaultSOCKS5Port = 1080;
 
 	results = of_resolve_host(host, port, SOCK_STREAM);
 
+#ifdef RACE_BLOCKING_CONNECT
+	@try {
+		of_udp_socket_address_t *addresses;
+		size_t count = 0;
+
+		for (iter = results; *iter != NULL; iter++)
+			count++;
+
+		addresses = [self allocMemoryWithSize: sizeof(*addresses)
+						count: count];
+
+		for (iter = results; *iter != NULL; iter++) {
+			memcpy(&addresses[iter - results].address,
+			    (*iter)->address, (*iter)->addressLength);
+			addresses[iter - results].length =
+			    (*iter)->addressLength;
+		}
+
+		_socket = raceConnect(addresses, count, &errNo);
+
+		[self freeMemory: addresses];
+	} @finally {
+		of_resolver_free(results);
+	}
+#else
 	for (iter = results; *iter != NULL; iter++) {
 		of_resolver_result_t *result = *iter;
 #if SOCK_CLOEXEC == 0 && defined(HAVE_FCNTL) && defined(FD_CLOEXEC)
@@ -297,6 +957,7 @@ static uint16_t defaultSOCKS5Port = 1080;
 	}
 
 	of_resolver_free(results);
+#endif
 
 	if (_socket == INVALID_SOCKET)
 		@throw [OFConnectionFailedException exceptionWithHost: host
@@ -317,6 +978,25 @@ static uint16_t defaultSOCKS5Port = 1080;
 {
 	void *pool = objc_autoreleasePoolPush();
 
+# ifdef USE_NONBLOCKING_CONNECT
+	if (_SOCKS5Host == nil) {
+		if (_socket != INVALID_SOCKET)
+			@throw [OFAlreadyConnectedException
+			    exceptionWithSocket: self];
+
+		[[[[OFTCPSocket_AsyncConnectContext alloc]
+		    initWithSocket: self
+			      host: host
+			      port: port
+			    target: target
+			  selector: selector] autorelease] start];
+
+		objc_autoreleasePoolPop(pool);
+		return;
+	}
+# endif
+
+	/* The SOCKS5 handshake is blocking, so it needs a thread */
 	[[[[OFTCPSocket_ConnectThread alloc]
 	    initWithSourceThread: [OFThread currentThread]
 			  socket: self
@@ -335,6 +1015,23 @@ static uint16_t defaultSOCKS5Port = 1080;
 {
 	void *pool = objc_autoreleasePoolPush();
 
+#  ifdef USE_NONBLOCKING_CONNECT
+	if (_SOCKS5Host == nil) {
+		if (_socket != INVALID_SOCKET)
+			@throw [OFAlreadyConnectedException
+			    exceptionWithSocket: self];
+
+		[[[[OFTCPSocket_AsyncConnectContext alloc]
+		    initWithSocket: self
+			      host: host
+			      port: port
+			     block: block] autorelease] start];
+
+		objc_autoreleasePoolPop(pool);
+		return;
+	}
+#  endif
+
 	[[[[OFTCPSocket_ConnectThread alloc]
 	    initWithSourceThread: [OFThread currentThread]
 			  socket: self
@@ -347,6 +1044,14 @@ static uint16_t defaultSOCKS5Port = 1080;
 # endif
 #endif
 
+#ifdef USE_NONBLOCKING_CONNECT
+- (void)OF_setSocket: (of_socket_t)socket
+{
+	setBlocking(socket);
+	_socket = socket;
+}
+#endif
+
 - (uint16_t)bindToHost: (OFString*)host
 		  port: (uint16_t)port
 {
@@ -22,9 +22,12 @@
 #import "OFStream.h"
 #ifdef OF_HAVE_FILES
 # import "OFFile.h"
+# import "OFMappedFile.h"
 #endif
 
 #import "OFInvalidFormatException.h"
+#import "OFOutOfMemoryException.h"
+#import "OFOutOfRangeException.h"
 
 @implementation OFTarArchive: OFObject
 + (instancetype)archiveWithStream: (OFStream*)stream
@@ -54,8 +57,22 @@
 	self = [super init];
 
 	@try {
-		_stream = [[OFFile alloc] initWithPath: path
-						  mode: @"rb"];
+		/*
+		 * Archives are read from the mapping, which avoids a system
+		 * call per read. Archives that are too big for the address
+		 * space are read normally.
+		 */
+		@try {
+			_stream = [[OFMappedFile alloc] initWithPath: path];
+			[(OFMappedFile*)_stream adviseAccessPattern:
+			    OF_MAPPED_FILE_ADVICE_SEQUENTIAL];
+		} @catch (OFOutOfRangeException *e) {
+			_stream = [[OFFile alloc] initWithPath: path
+							  mode: @"rb"];
+		} @catch (OFOutOfMemoryException *e) {
+			_stream = [[OFFile alloc] initWithPath: path
+							  mode: @"rb"];
+		}
 	} @catch (id e) {
 		[self release];
 		@throw e;
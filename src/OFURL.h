@@ -20,17 +20,38 @@
 OF_ASSUME_NONNULL_BEGIN
 
 @class OFString;
+@class OFDictionary OF_GENERIC(KeyType, ObjectType);
+
+#ifdef OF_HAVE_BLOCKS
+/*!
+ * @brief A block for enumerating the parameters of the query of a URL.
+ *
+ * @param key The URL decoded key of the parameter
+ * @param value The URL decoded value of the parameter
+ * @param stop A pointer to a variable that can be set to true to stop the
+ *	       enumeration
+ */
+typedef void (^of_url_query_enumeration_block_t)(OFString *key,
+    OFString *value, bool *stop);
+#endif
 
 /*!
  * @class OFURL OFURL.h ObjFW/OFURL.h
  *
  * @brief A class for parsing URLs and accessing parts of it.
+ *
+ * Parsing a URL only records where its parts are. The strings for the parts
+ * are created when they are accessed for the first time.
  */
 @interface OFURL: OFObject <OFCopying, OFSerialization>
 {
 	OFString *_scheme, *_host;
 	uint16_t _port;
 	OFString *_user, *_password, *_path, *_parameters, *_query, *_fragment;
+	/* The parts that have not been accessed yet, as ranges of this */
+	char *_UTF8String;
+	of_range_t _schemeRange, _hostRange, _userRange, _passwordRange;
+	of_range_t _pathRange, _parametersRange, _queryRange, _fragmentRange;
 }
 
 /*!
@@ -78,6 +99,16 @@ OF_ASSUME_NONNULL_BEGIN
  */
 @property OF_NULLABLE_PROPERTY (copy) OFString *fragment;
 
+/*!
+ * The parameters of the query part of the URL.
+ *
+ * The query is split into `key=value` pairs separated by `&`. Keys and values
+ * are URL decoded, with `+` decoded as a space. A pair without `=` has an
+ * empty value and if a key appears more than once, the last value is used.
+ */
+@property OF_NULLABLE_PROPERTY (readonly)
+    OFDictionary OF_GENERIC(OFString*, OFString*) *queryDictionary;
+
 /*!
  * @brief Creates a new URL.
  *
@@ -137,6 +168,20 @@ OF_ASSUME_NONNULL_BEGIN
  * @return The URL as a string
  */
 - (OFString*)string;
+
+#ifdef OF_HAVE_BLOCKS
+/*!
+ * @brief Enumerates the parameters of the query part of the URL in the order
+ *	  they appear.
+ *
+ * Keys and values are decoded the same way as for @ref queryDictionary, but
+ * parameters appearing more than once are all enumerated.
+ *
+ * @param block The block to call for each parameter
+ */
+- (void)enumerateQueryParametersUsingBlock:
+    (of_url_query_enumeration_block_t)block;
+#endif
 @end
 
 OF_ASSUME_NONNULL_END
@@ -21,18 +21,241 @@
 #include <ctype.h>
 
 #import "OFURL.h"
+#import "OFURL+Private.h"
 #import "OFString.h"
+#import "OFString+Private.h"
 #import "OFArray.h"
+#import "OFDictionary.h"
 #import "OFXMLElement.h"
 
+#import "OFInitializationFailedException.h"
 #import "OFInvalidArgumentException.h"
 #import "OFInvalidFormatException.h"
 #import "OFOutOfMemoryException.h"
 
+#import "of_numconv.h"
+
+#ifdef OF_HAVE_THREADS
+# import "threading.h"
+#endif
+
+typedef void (*query_parameter_function_t)(OFString *key, OFString *value,
+    void *context, bool *stop);
+
+static const of_range_t noRange = { OF_NOT_FOUND, 0 };
+
+#ifdef OF_HAVE_THREADS
+# define NUM_SPINLOCKS 8	/* needs to be a power of 2 */
+# define SPINLOCK_HASH(p) ((unsigned)((uintptr_t)p >> 4) & (NUM_SPINLOCKS - 1))
+static of_spinlock_t spinlocks[NUM_SPINLOCKS];
+#endif
+
+static OF_INLINE void
+lockPart(OFString **part)
+{
+#ifdef OF_HAVE_THREADS
+	OF_ENSURE(of_spinlock_lock(&spinlocks[SPINLOCK_HASH(part)]));
+#endif
+}
+
+static OF_INLINE void
+unlockPart(OFString **part)
+{
+#ifdef OF_HAVE_THREADS
+	OF_ENSURE(of_spinlock_unlock(&spinlocks[SPINLOCK_HASH(part)]));
+#endif
+}
+
+/*
+ * Returns the part, creating the string for it if it has not been accessed
+ * before. Like the atomic accessors this replaces, it holds a spinlock for the
+ * part, so that two threads never create the same part.
+ */
+static OFString*
+lazyPart(const char *UTF8String, OFString **part, of_range_t *range)
+{
+	OFString *ret;
+
+	lockPart(part);
+	@try {
+		if (range->location != OF_NOT_FOUND) {
+			*part = [[OFString alloc]
+			    initWithUTF8String: UTF8String + range->location
+					length: range->length];
+			*range = noRange;
+		}
+
+		ret = [[*part retain] autorelease];
+	} @finally {
+		unlockPart(part);
+	}
+
+	return ret;
+}
+
+static void
+setPart(OFString **part, of_range_t *range, OFString *value)
+{
+	OFString *old;
+
+	value = [value copy];
+
+	lockPart(part);
+	old = *part;
+	*part = value;
+	*range = noRange;
+	unlockPart(part);
+
+	[old release];
+}
+
+/*
+ * Copies the part, keeping it as a range if it has not been accessed yet.
+ */
+static void
+copyPart(OFString **part, of_range_t *range, OFString **copy,
+    of_range_t *copyRange)
+{
+	lockPart(part);
+	@try {
+		*copy = [*part copy];
+		*copyRange = *range;
+	} @finally {
+		unlockPart(part);
+	}
+}
+
+/*
+ * Returns the bytes of the part without creating the string for it if it has
+ * not been accessed yet, or false if there is no such part.
+ */
+static bool
+partBytes(const char *UTF8String, OFString **part, of_range_t *range,
+    const char **bytes, size_t *length)
+{
+	OFString *string = nil;
+
+	lockPart(part);
+	@try {
+		if (range->location != OF_NOT_FOUND) {
+			*bytes = UTF8String + range->location;
+			*length = range->length;
+			return true;
+		}
+
+		string = [[*part retain] autorelease];
+	} @finally {
+		unlockPart(part);
+	}
+
+	if (string == nil)
+		return false;
+
+	*bytes = [string UTF8String];
+	*length = [string UTF8StringLength];
+	return true;
+}
+
+static bool
+rangeIsString(of_range_t range, const char *UTF8String, const char *string)
+{
+	size_t length = strlen(string);
+
+	return (range.location != OF_NOT_FOUND && range.length == length &&
+	    memcmp(UTF8String + range.location, string, length) == 0);
+}
+
+static void
+parseQuery(const char *query, size_t length,
+    query_parameter_function_t function, void *context)
+{
+	void *pool = objc_autoreleasePoolPush();
+	char *buffer;
+	size_t i = 0;
+	bool stop = false;
+
+	/* Decoding never makes anything longer */
+	if ((buffer = malloc(length > 0 ? length : 1)) == NULL)
+		@throw [OFOutOfMemoryException exceptionWithRequestedSize: length];
+
+	@try {
+		while (i < length && !stop) {
+			const char *pair = query + i, *separator;
+			size_t pairLength, keyLength, bufferLength;
+			OFString *key, *value;
+
+			if ((separator = memchr(pair, '&', length - i)) != NULL)
+				pairLength = separator - pair;
+			else
+				pairLength = length - i;
+
+			i += pairLength + 1;
+
+			if (pairLength == 0)
+				continue;
+
+			if ((separator = memchr(pair, '=', pairLength)) != NULL)
+				keyLength = separator - pair;
+			else
+				keyLength = pairLength;
+
+			bufferLength = of_url_decode(buffer, pair, keyLength,
+			    true);
+			key = [OFString stringWithUTF8String: buffer
+						      length: bufferLength];
+
+			if (separator != NULL) {
+				bufferLength = of_url_decode(buffer,
+				    separator + 1, pairLength - keyLength - 1,
+				    true);
+				value = [OFString
+				    stringWithUTF8String: buffer
+						  length: bufferLength];
+			} else
+				value = @"";
+
+			function(key, value, context, &stop);
+		}
+	} @finally {
+		free(buffer);
+	}
+
+	objc_autoreleasePoolPop(pool);
+}
+
+static void
+addQueryParameter(OFString *key, OFString *value, void *context, bool *stop)
+{
+	[(OFMutableDictionary*)context setObject: value
+					  forKey: key];
+}
+
+#ifdef OF_HAVE_BLOCKS
+static void
+callQueryBlock(OFString *key, OFString *value, void *context, bool *stop)
+{
+	of_url_query_enumeration_block_t block =
+	    (of_url_query_enumeration_block_t)context;
+
+	block(key, value, stop);
+}
+#endif
+
 @implementation OFURL
-@synthesize scheme = _scheme, host = _host, port = _port, user = _user;
-@synthesize password = _password, path = _path, parameters = _parameters;
-@synthesize query = _query, fragment = _fragment;
+@synthesize port = _port;
+
+#ifdef OF_HAVE_THREADS
++ (void)initialize
+{
+	if (self != [OFURL class])
+		return;
+
+	for (size_t i = 0; i < NUM_SPINLOCKS; i++)
+		if (!of_spinlock_new(&spinlocks[i]))
+			@throw [OFInitializationFailedException
+			    exceptionWithClass: self];
+}
+#endif
 
 + (instancetype)URL
 {
@@ -64,135 +287,121 @@
 	return URL;
 }
 
-- initWithString: (OFString*)string
+- init
 {
-	char *UTF8String, *UTF8String2 = NULL;
-
 	self = [super init];
 
-	@try {
-		void *pool = objc_autoreleasePoolPush();
-		char *tmp, *tmp2;
+	_schemeRange = _hostRange = _userRange = _passwordRange = noRange;
+	_pathRange = _parametersRange = _queryRange = _fragmentRange = noRange;
 
-		if ((UTF8String2 = of_strdup([string UTF8String])) == NULL)
-			@throw [OFOutOfMemoryException
-			     exceptionWithRequestedSize:
-			     [string UTF8StringLength]];
+	return self;
+}
 
-		UTF8String = UTF8String2;
+- initWithString: (OFString*)string
+{
+	self = [self init];
 
-		if ((tmp = strstr(UTF8String, "://")) == NULL)
-			@throw [OFInvalidFormatException exception];
+	@try {
+		size_t length = [string UTF8StringLength], i, end;
+		char *UTF8String, *tmp;
+
+		_UTF8String = UTF8String = [self allocMemoryWithSize: length + 1];
+		memcpy(UTF8String, [string UTF8String], length + 1);
 
-		for (tmp2 = UTF8String; tmp2 < tmp; tmp2++)
-			*tmp2 = tolower((unsigned char)*tmp2);
+		for (i = 0; i + 2 < length; i++)
+			if (UTF8String[i] == ':' && UTF8String[i + 1] == '/' &&
+			    UTF8String[i + 2] == '/')
+				break;
 
-		_scheme = [[OFString alloc]
-		    initWithUTF8String: UTF8String
-				length: tmp - UTF8String];
+		if (i + 2 >= length)
+			@throw [OFInvalidFormatException exception];
 
-		UTF8String = tmp + 3;
+		for (size_t j = 0; j < i; j++)
+			UTF8String[j] = tolower((unsigned char)UTF8String[j]);
 
-		if ([_scheme isEqual: @"file"]) {
-			_path = [[OFString alloc]
-			    initWithUTF8String: UTF8String];
+		_schemeRange = of_range(0, i);
+		i += 3;
 
-			objc_autoreleasePoolPop(pool);
+		if (rangeIsString(_schemeRange, UTF8String, "file")) {
+			_pathRange = of_range(i, length - i);
 			return self;
 		}
 
-		if ((tmp = strchr(UTF8String, '/')) != NULL) {
-			*tmp = '\0';
-			tmp++;
-		}
-
-		if ((tmp2 = strchr(UTF8String, '@')) != NULL) {
-			char *tmp3;
+		/* The authority ends where the path starts */
+		if ((tmp = memchr(UTF8String + i, '/', length - i)) != NULL)
+			end = tmp - UTF8String;
+		else
+			end = length;
 
-			*tmp2 = '\0';
-			tmp2++;
+		if ((tmp = memchr(UTF8String + i, '@', end - i)) != NULL) {
+			size_t at = tmp - UTF8String;
 
-			if ((tmp3 = strchr(UTF8String, ':')) != NULL) {
-				*tmp3 = '\0';
-				tmp3++;
+			if ((tmp = memchr(UTF8String + i, ':', at - i)) !=
+			    NULL) {
+				size_t colon = tmp - UTF8String;
 
-				_user = [[OFString alloc]
-				    initWithUTF8String: UTF8String];
-				_password = [[OFString alloc]
-				    initWithUTF8String: tmp3];
+				_userRange = of_range(i, colon - i);
+				_passwordRange = of_range(colon + 1,
+				    at - colon - 1);
 			} else
-				_user = [[OFString alloc]
-				    initWithUTF8String: UTF8String];
+				_userRange = of_range(i, at - i);
 
-			UTF8String = tmp2;
+			i = at + 1;
 		}
 
-		if ((tmp2 = strchr(UTF8String, ':')) != NULL) {
-			void *pool;
-			OFString *portString;
+		if ((tmp = memchr(UTF8String + i, ':', end - i)) != NULL) {
+			size_t colon = tmp - UTF8String;
+			intmax_t port;
 
-			*tmp2 = '\0';
-			tmp2++;
+			_hostRange = of_range(i, colon - i);
 
-			_host = [[OFString alloc]
-			    initWithUTF8String: UTF8String];
-
-			pool = objc_autoreleasePoolPush();
-			portString = [OFString stringWithUTF8String: tmp2];
-
-			if ([portString decimalValue] > 65535)
+			if (of_parse_decimal(UTF8String + colon + 1,
+			    end - colon - 1, &port) != 0 || port < 0 ||
+			    port > 65535)
 				@throw [OFInvalidFormatException exception];
 
-			_port = [portString decimalValue];
-
-			objc_autoreleasePoolPop(pool);
+			_port = (uint16_t)port;
 		} else {
-			_host = [[OFString alloc]
-			    initWithUTF8String: UTF8String];
+			_hostRange = of_range(i, end - i);
 
-			if ([_scheme isEqual: @"http"])
+			if (rangeIsString(_schemeRange, UTF8String, "http"))
 				_port = 80;
-			else if ([_scheme isEqual: @"https"])
+			else if (rangeIsString(_schemeRange, UTF8String, "https"))
 				_port = 443;
-			else if ([_scheme isEqual: @"ftp"])
+			else if (rangeIsString(_schemeRange, UTF8String, "ftp"))
 				_port = 21;
 		}
 
-		if ((UTF8String = tmp) != NULL) {
-			if ((tmp = strchr(UTF8String, '#')) != NULL) {
-				*tmp = '\0';
-
-				_fragment = [[OFString alloc]
-				    initWithUTF8String: tmp + 1];
+		if (end < length) {
+			if ((tmp = memchr(UTF8String + end, '#',
+			    length - end)) != NULL) {
+				_fragmentRange = of_range(
+				    tmp - UTF8String + 1,
+				    length - (tmp - UTF8String) - 1);
+				length = tmp - UTF8String;
 			}
 
-			if ((tmp = strchr(UTF8String, '?')) != NULL) {
-				*tmp = '\0';
-
-				_query = [[OFString alloc]
-				    initWithUTF8String: tmp + 1];
+			if ((tmp = memchr(UTF8String + end, '?',
+			    length - end)) != NULL) {
+				_queryRange = of_range(tmp - UTF8String + 1,
+				    length - (tmp - UTF8String) - 1);
+				length = tmp - UTF8String;
 			}
 
-			if ((tmp = strchr(UTF8String, ';')) != NULL) {
-				*tmp = '\0';
-
-				_parameters = [[OFString alloc]
-				    initWithUTF8String: tmp + 1];
+			if ((tmp = memchr(UTF8String + end, ';',
+			    length - end)) != NULL) {
+				_parametersRange = of_range(
+				    tmp - UTF8String + 1,
+				    length - (tmp - UTF8String) - 1);
+				length = tmp - UTF8String;
 			}
 
-			UTF8String--;
-			*UTF8String = '/';
-
-			_path = [[OFString alloc]
-			    initWithUTF8String: UTF8String];
+			/* The path includes the / that ends the authority */
+			_pathRange = of_range(end, length - end);
 		}
-
-		objc_autoreleasePoolPop(pool);
 	} @catch (id e) {
 		[self release];
 		@throw e;
-	} @finally {
-		free(UTF8String2);
 	}
 
 	return self;
@@ -201,62 +410,56 @@
 - initWithString: (OFString*)string
    relativeToURL: (OFURL*)URL
 {
-	char *UTF8String, *UTF8String2 = NULL;
-
 	if ([string containsString: @"://"])
 		return [self initWithString: string];
 
-	self = [super init];
+	self = [self init];
 
 	@try {
 		void *pool = objc_autoreleasePoolPush();
-		char *tmp;
+		size_t length = [string UTF8StringLength];
+		char *UTF8String, *tmp;
 
-		_scheme = [URL->_scheme copy];
-		_host = [URL->_host copy];
+		_scheme = [[URL scheme] copy];
+		_host = [[URL host] copy];
 		_port = URL->_port;
-		_user = [URL->_user copy];
-		_password = [URL->_password copy];
+		_user = [[URL user] copy];
+		_password = [[URL password] copy];
 
-		if ((UTF8String2 = of_strdup([string UTF8String])) == NULL)
-			@throw [OFOutOfMemoryException
-			     exceptionWithRequestedSize:
-			     [string UTF8StringLength]];
+		_UTF8String = UTF8String = [self allocMemoryWithSize: length + 1];
+		memcpy(UTF8String, [string UTF8String], length + 1);
 
-		UTF8String = UTF8String2;
-
-		if ((tmp = strchr(UTF8String, '#')) != NULL) {
-			*tmp = '\0';
-			_fragment = [[OFString alloc]
-			    initWithUTF8String: tmp + 1];
+		if ((tmp = memchr(UTF8String, '#', length)) != NULL) {
+			_fragmentRange = of_range(tmp - UTF8String + 1,
+			    length - (tmp - UTF8String) - 1);
+			length = tmp - UTF8String;
 		}
 
-		if ((tmp = strchr(UTF8String, '?')) != NULL) {
-			*tmp = '\0';
-			_query = [[OFString alloc]
-			    initWithUTF8String: tmp + 1];
+		if ((tmp = memchr(UTF8String, '?', length)) != NULL) {
+			_queryRange = of_range(tmp - UTF8String + 1,
+			    length - (tmp - UTF8String) - 1);
+			length = tmp - UTF8String;
 		}
 
-		if ((tmp = strchr(UTF8String, ';')) != NULL) {
-			*tmp = '\0';
-			_parameters = [[OFString alloc]
-			    initWithUTF8String: tmp + 1];
+		if ((tmp = memchr(UTF8String, ';', length)) != NULL) {
+			_parametersRange = of_range(tmp - UTF8String + 1,
+			    length - (tmp - UTF8String) - 1);
+			length = tmp - UTF8String;
 		}
 
-		if (*UTF8String == '/')
-			_path = [[OFString alloc]
-			    initWithUTF8String: UTF8String];
+		if (length > 0 && *UTF8String == '/')
+			_pathRange = of_range(0, length);
 		else {
-			OFString *path, *s;
+			OFString *path, *s, *basePath = [URL path];
 
-			path = [OFString stringWithUTF8String: UTF8String];
+			path = [OFString stringWithUTF8String: UTF8String
+						       length: length];
 
-			if ([URL->_path hasSuffix: @"/"])
-				s = [URL->_path stringByAppendingString: path];
+			if ([basePath hasSuffix: @"/"])
+				s = [basePath stringByAppendingString: path];
 			else
 				s = [OFString stringWithFormat: @"%@/../%@",
-								URL->_path,
-								path];
+								basePath, path];
 
 			_path = [[s stringByStandardizingURLPath] copy];
 		}
@@ -265,8 +468,39 @@
 	} @catch (id e) {
 		[self release];
 		@throw e;
-	} @finally {
-		free(UTF8String2);
+	}
+
+	return self;
+}
+
+- OF_initWithScheme: (OFString*)scheme
+	       host: (OFString*)host
+	       port: (uint16_t)port
+       pathAndQuery: (const char*)pathAndQuery
+	     length: (size_t)length
+{
+	self = [self init];
+
+	@try {
+		const char *query = memchr(pathAndQuery, '?', length);
+
+		_scheme = [scheme copy];
+		_host = [host copy];
+		_port = port;
+
+		_UTF8String = [self allocMemoryWithSize: length + 1];
+		memcpy(_UTF8String, pathAndQuery, length);
+		_UTF8String[length] = '\0';
+
+		if (query != NULL) {
+			_pathRange = of_range(0, query - pathAndQuery);
+			_queryRange = of_range(query - pathAndQuery + 1,
+			    length - (query - pathAndQuery) - 1);
+		} else
+			_pathRange = of_range(0, length);
+	} @catch (id e) {
+		[self release];
+		@throw e;
 	}
 
 	return self;
@@ -306,36 +540,118 @@
 	[super dealloc];
 }
 
+- (OFString*)scheme
+{
+	return lazyPart(_UTF8String, &_scheme, &_schemeRange);
+}
+
+- (void)setScheme: (OFString*)scheme
+{
+	setPart(&_scheme, &_schemeRange, scheme);
+}
+
+- (OFString*)host
+{
+	return lazyPart(_UTF8String, &_host, &_hostRange);
+}
+
+- (void)setHost: (OFString*)host
+{
+	setPart(&_host, &_hostRange, host);
+}
+
+- (OFString*)user
+{
+	return lazyPart(_UTF8String, &_user, &_userRange);
+}
+
+- (void)setUser: (OFString*)user
+{
+	setPart(&_user, &_userRange, user);
+}
+
+- (OFString*)password
+{
+	return lazyPart(_UTF8String, &_password, &_passwordRange);
+}
+
+- (void)setPassword: (OFString*)password
+{
+	setPart(&_password, &_passwordRange, password);
+}
+
+- (OFString*)path
+{
+	return lazyPart(_UTF8String, &_path, &_pathRange);
+}
+
+- (void)setPath: (OFString*)path
+{
+	setPart(&_path, &_pathRange, path);
+}
+
+- (OFString*)parameters
+{
+	return lazyPart(_UTF8String, &_parameters, &_parametersRange);
+}
+
+- (void)setParameters: (OFString*)parameters
+{
+	setPart(&_parameters, &_parametersRange, parameters);
+}
+
+- (OFString*)query
+{
+	return lazyPart(_UTF8String, &_query, &_queryRange);
+}
+
+- (void)setQuery: (OFString*)query
+{
+	setPart(&_query, &_queryRange, query);
+}
+
+- (OFString*)fragment
+{
+	return lazyPart(_UTF8String, &_fragment, &_fragmentRange);
+}
+
+- (void)setFragment: (OFString*)fragment
+{
+	setPart(&_fragment, &_fragmentRange, fragment);
+}
+
 - (bool)isEqual: (id)object
 {
 	OFURL *URL;
+	OFString *part, *otherPart;
 
 	if (![object isKindOfClass: [OFURL class]])
 		return false;
 
 	URL = object;
 
-	if (![URL->_scheme isEqual: _scheme])
+	if (![[URL scheme] isEqual: [self scheme]])
 		return false;
-	if (![URL->_host isEqual: _host])
+	if (![[URL host] isEqual: [self host]])
 		return false;
 	if (URL->_port != _port)
 		return false;
-	if (URL->_user != _user && ![URL->_user isEqual: _user])
+	if ((part = [self user]) != (otherPart = [URL user]) &&
+	    ![otherPart isEqual: part])
 		return false;
-	if (URL->_password != _password &&
-	    ![URL->_password isEqual: _password])
+	if ((part = [self password]) != (otherPart = [URL password]) &&
+	    ![otherPart isEqual: part])
 		return false;
-	if (![URL->_path isEqual: _path])
+	if (![[URL path] isEqual: [self path]])
 		return false;
-	if (URL->_parameters != _parameters &&
-	    ![URL->_parameters isEqual: _parameters])
+	if ((part = [self parameters]) != (otherPart = [URL parameters]) &&
+	    ![otherPart isEqual: part])
 		return false;
-	if (URL->_query != _query &&
-	    ![URL->_query isEqual: _query])
+	if ((part = [self query]) != (otherPart = [URL query]) &&
+	    ![otherPart isEqual: part])
 		return false;
-	if (URL->_fragment != _fragment &&
-	    ![URL->_fragment isEqual: _fragment])
+	if ((part = [self fragment]) != (otherPart = [URL fragment]) &&
+	    ![otherPart isEqual: part])
 		return false;
 
 	return true;
@@ -347,16 +663,16 @@
 
 	OF_HASH_INIT(hash);
 
-	OF_HASH_ADD_HASH(hash, [_scheme hash]);
-	OF_HASH_ADD_HASH(hash, [_host hash]);
+	OF_HASH_ADD_HASH(hash, [[self scheme] hash]);
+	OF_HASH_ADD_HASH(hash, [[self host] hash]);
 	OF_HASH_ADD(hash, (_port & 0xFF00) >> 8);
 	OF_HASH_ADD(hash, _port & 0xFF);
-	OF_HASH_ADD_HASH(hash, [_user hash]);
-	OF_HASH_ADD_HASH(hash, [_password hash]);
-	OF_HASH_ADD_HASH(hash, [_path hash]);
-	OF_HASH_ADD_HASH(hash, [_parameters hash]);
-	OF_HASH_ADD_HASH(hash, [_query hash]);
-	OF_HASH_ADD_HASH(hash, [_fragment hash]);
+	OF_HASH_ADD_HASH(hash, [[self user] hash]);
+	OF_HASH_ADD_HASH(hash, [[self password] hash]);
+	OF_HASH_ADD_HASH(hash, [[self path] hash]);
+	OF_HASH_ADD_HASH(hash, [[self parameters] hash]);
+	OF_HASH_ADD_HASH(hash, [[self query] hash]);
+	OF_HASH_ADD_HASH(hash, [[self fragment] hash]);
 
 	OF_HASH_FINALIZE(hash);
 
@@ -368,15 +684,29 @@
 	OFURL *copy = [[[self class] alloc] init];
 
 	@try {
-		copy->_scheme = [_scheme copy];
-		copy->_host = [_host copy];
+		/* Parts that have not been accessed yet stay that way */
+		if (_UTF8String != NULL) {
+			size_t length = strlen(_UTF8String);
+
+			copy->_UTF8String = [copy
+			    allocMemoryWithSize: length + 1];
+			memcpy(copy->_UTF8String, _UTF8String, length + 1);
+		}
+
+		copyPart(&_scheme, &_schemeRange,
+		    &copy->_scheme, &copy->_schemeRange);
+		copyPart(&_host, &_hostRange, &copy->_host, &copy->_hostRange);
 		copy->_port = _port;
-		copy->_user = [_user copy];
-		copy->_password = [_password copy];
-		copy->_path = [_path copy];
-		copy->_parameters = [_parameters copy];
-		copy->_query = [_query copy];
-		copy->_fragment = [_fragment copy];
+		copyPart(&_user, &_userRange, &copy->_user, &copy->_userRange);
+		copyPart(&_password, &_passwordRange,
+		    &copy->_password, &copy->_passwordRange);
+		copyPart(&_path, &_pathRange, &copy->_path, &copy->_pathRange);
+		copyPart(&_parameters, &_parametersRange,
+		    &copy->_parameters, &copy->_parametersRange);
+		copyPart(&_query, &_queryRange,
+		    &copy->_query, &copy->_queryRange);
+		copyPart(&_fragment, &_fragmentRange,
+		    &copy->_fragment, &copy->_fragmentRange);
 	} @catch (id e) {
 		[copy release];
 		@throw e;
@@ -389,45 +719,49 @@
 {
 	OFMutableString *ret = [OFMutableString string];
 	void *pool = objc_autoreleasePoolPush();
+	OFString *scheme = [self scheme], *user = [self user];
+	OFString *password = [self password], *host = [self host];
+	OFString *path = [self path], *parameters = [self parameters];
+	OFString *query = [self query], *fragment = [self fragment];
 
-	[ret appendFormat: @"%@://", _scheme];
+	[ret appendFormat: @"%@://", scheme];
 
-	if ([_scheme isEqual: @"file"]) {
-		if (_path != nil)
-			[ret appendString: _path];
+	if ([scheme isEqual: @"file"]) {
+		if (path != nil)
+			[ret appendString: path];
 
 		objc_autoreleasePoolPop(pool);
 		return ret;
 	}
 
-	if (_user != nil && _password != nil)
-		[ret appendFormat: @"%@:%@@", _user, _password];
-	else if (_user != nil)
-		[ret appendFormat: @"%@@", _user];
+	if (user != nil && password != nil)
+		[ret appendFormat: @"%@:%@@", user, password];
+	else if (user != nil)
+		[ret appendFormat: @"%@@", user];
 
-	if (_host != nil)
-		[ret appendString: _host];
+	if (host != nil)
+		[ret appendString: host];
 
-	if (!(([_scheme isEqual: @"http"] && _port == 80) ||
-	    ([_scheme isEqual: @"https"] && _port == 443) ||
-	    ([_scheme isEqual: @"ftp"] && _port == 21)))
+	if (!(([scheme isEqual: @"http"] && _port == 80) ||
+	    ([scheme isEqual: @"https"] && _port == 443) ||
+	    ([scheme isEqual: @"ftp"] && _port == 21)))
 		[ret appendFormat: @":%u", _port];
 
-	if (_path != nil) {
-		if (![_path hasPrefix: @"/"])
+	if (path != nil) {
+		if (![path hasPrefix: @"/"])
 			@throw [OFInvalidFormatException exception];
 
-		[ret appendString: _path];
+		[ret appendString: path];
 	}
 
-	if (_parameters != nil)
-		[ret appendFormat: @";%@", _parameters];
+	if (parameters != nil)
+		[ret appendFormat: @";%@", parameters];
 
-	if (_query != nil)
-		[ret appendFormat: @"?%@", _query];
+	if (query != nil)
+		[ret appendFormat: @"?%@", query];
 
-	if (_fragment != nil)
-		[ret appendFormat: @"#%@", _fragment];
+	if (fragment != nil)
+		[ret appendFormat: @"#%@", fragment];
 
 	objc_autoreleasePoolPop(pool);
 
@@ -436,6 +770,36 @@
 	return ret;
 }
 
+- (OFDictionary*)queryDictionary
+{
+	OFMutableDictionary *ret;
+	const char *query;
+	size_t length;
+
+	/* Parsed from the bytes, so the query does not need to be created */
+	if (!partBytes(_UTF8String, &_query, &_queryRange, &query, &length))
+		return nil;
+
+	ret = [OFMutableDictionary dictionary];
+	parseQuery(query, length, addQueryParameter, ret);
+
+	[ret makeImmutable];
+
+	return ret;
+}
+
+#ifdef OF_HAVE_BLOCKS
+- (void)enumerateQueryParametersUsingBlock:
+    (of_url_query_enumeration_block_t)block
+{
+	const char *query;
+	size_t length;
+
+	if (partBytes(_UTF8String, &_query, &_queryRange, &query, &length))
+		parseQuery(query, length, callQueryBlock, (void*)block);
+}
+#endif
+
 - (OFString*)description
 {
 	return [OFString stringWithFormat: @"<%@: %@>",
@@ -29,12 +29,14 @@
 #import "OFStream.h"
 #ifdef OF_HAVE_FILES
 # import "OFFile.h"
+# import "OFMappedFile.h"
 #endif
 #import "OFSystemInfo.h"
 
 #import "OFInitializationFailedException.h"
 #import "OFInvalidFormatException.h"
 #import "OFMalformedXMLException.h"
+#import "OFOutOfMemoryException.h"
 #import "OFOutOfRangeException.h"
 #import "OFUnboundPrefixException.h"
 
@@ -286,8 +288,34 @@ resolveAttributeNamespace(OFXMLAttribute *attribute, OFArray *namespaces,
 #ifdef OF_HAVE_FILES
 - (void)parseFile: (OFString*)path
 {
-	OFFile *file = [[OFFile alloc] initWithPath: path
-					       mode: @"rb"];
+	OFMappedFile *mappedFile;
+	OFFile *file;
+
+	@try {
+		mappedFile = [[OFMappedFile alloc] initWithPath: path];
+	} @catch (OFOutOfRangeException *e) {
+		/* Too big to be mapped, so parse it as a stream instead */
+		mappedFile = nil;
+	} @catch (OFOutOfMemoryException *e) {
+		mappedFile = nil;
+	}
+
+	if (mappedFile != nil) {
+		@try {
+			[mappedFile adviseAccessPattern:
+			    OF_MAPPED_FILE_ADVICE_SEQUENTIAL];
+
+			[self parseBuffer: [mappedFile items]
+				   length: [mappedFile length]];
+		} @finally {
+			[mappedFile release];
+		}
+
+		return;
+	}
+
+	file = [[OFFile alloc] initWithPath: path
+				       mode: @"rb"];
 
 	@try {
 		[self parseStream: file];
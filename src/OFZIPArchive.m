@@ -27,17 +27,20 @@
 #import "OFSeekableStream.h"
 #ifdef OF_HAVE_FILES
 # import "OFFile.h"
+# import "OFMappedFile.h"
 #endif
 #import "OFDeflateStream.h"
 #import "OFDeflate64Stream.h"
 
 #import "crc32.h"
+#import "of_memmem.h"
 
 #import "OFChecksumFailedException.h"
 #import "OFInvalidArgumentException.h"
 #import "OFInvalidFormatException.h"
 #import "OFNotImplementedException.h"
 #import "OFOpenItemFailedException.h"
+#import "OFOutOfMemoryException.h"
 #import "OFOutOfRangeException.h"
 #import "OFReadFailedException.h"
 #import "OFSeekFailedException.h"
@@ -176,8 +179,20 @@ seekOrThrowInvalidFormat(OFSeekableStream *stream,
 	self = [super init];
 
 	@try {
-		_stream = [[OFFile alloc] initWithPath: path
-						  mode: @"rb"];
+		/*
+		 * Mapping the file allows finding the end of the central
+		 * directory without a system call for every byte. Files that
+		 * are too big for the address space are read normally.
+		 */
+		@try {
+			_stream = [[OFMappedFile alloc] initWithPath: path];
+		} @catch (OFOutOfRangeException *e) {
+			_stream = [[OFFile alloc] initWithPath: path
+							  mode: @"rb"];
+		} @catch (OFOutOfMemoryException *e) {
+			_stream = [[OFFile alloc] initWithPath: path
+							  mode: @"rb"];
+		}
 
 		[self OF_readZIPInfo];
 		[self OF_readEntries];
@@ -208,14 +223,41 @@ seekOrThrowInvalidFormat(OFSeekableStream *stream,
 	of_offset_t offset = -22;
 	bool valid = false;
 
-	do {
+#ifdef OF_HAVE_FILES
+	if ([_stream isKindOfClass: [OFMappedFile class]]) {
+		OFMappedFile *mappedFile = (OFMappedFile*)_stream;
+		const char *items = [mappedFile items];
+		size_t length = [mappedFile length];
+		size_t start;
+		const char *signature;
+
+		if (length < 22)
+			@throw [OFInvalidFormatException exception];
+
+		/* Same search window as below, but directly in memory */
+		start = (length > 65557 ? length - 65557 : 0);
+		signature = of_memrmem(items + start, length - 18 - start,
+		    "PK\x05\x06", 4);
+
+		if (signature == NULL)
+			@throw [OFInvalidFormatException exception];
+
+		seekOrThrowInvalidFormat(_stream,
+		    (of_offset_t)(signature - items) + 4, SEEK_SET);
+		valid = true;
+	}
+#endif
+
+	while (!valid && offset >= -65557) {
 		seekOrThrowInvalidFormat(_stream, offset, SEEK_END);
 
 		if ([_stream readLittleEndianInt32] == 0x06054B50) {
 			valid = true;
 			break;
 		}
-	} while (--offset >= -65557);
+
+		offset--;
+	}
 
 	if (!valid)
 		@throw [OFInvalidFormatException exception];
@@ -56,6 +56,7 @@
 # import "OFFile.h"
 # import "OFFileManager.h"
 # import "OFINIFile.h"
+# import "OFMappedFile.h"
 # import "OFSettings.h"
 #endif
 #ifdef OF_HAVE_SOCKETS
@@ -64,12 +65,14 @@
 # import "OFUDPSocket.h"
 # import "OFTLSSocket.h"
 # import "OFKernelEventObserver.h"
+# import "OFDNSResolver.h"
 
 # import "OFHTTPRequest.h"
 # import "OFHTTPResponse.h"
 # import "OFHTTPCookie.h"
 # import "OFHTTPClient.h"
 # import "OFHTTPServer.h"
+# import "OFHTTPRouter.h"
 #endif
 
 #ifdef OF_HAVE_PROCESSES
@@ -23,4 +23,47 @@
  * @brief An exception indicating that writing to an object failed.
  */
 @interface OFWriteFailedException: OFReadOrWriteFailedException
+{
+	size_t _bytesWritten;
+}
+
+/*!
+ * The number of bytes already written before the write failed.
+ *
+ * This can be used to make sure that a retry does not write data that has
+ * already been written.
+ */
+@property (readonly) size_t bytesWritten;
+
+/*!
+ * @brief Creates a new, autoreleased write failed exception.
+ *
+ * @param object The object to which writing failed
+ * @param requestedLength The requested length of the data that could not be
+ *			  written
+ * @param bytesWritten The amount of bytes already written before the write
+ *		       failed
+ * @param errNo The errno of the error that occurred
+ * @return A new, autoreleased write failed exception
+ */
++ (instancetype)exceptionWithObject: (id)object
+		    requestedLength: (size_t)requestedLength
+		       bytesWritten: (size_t)bytesWritten
+			      errNo: (int)errNo;
+
+/*!
+ * @brief Initializes an already allocated write failed exception.
+ *
+ * @param object The object to which writing failed
+ * @param requestedLength The requested length of the data that could not be
+ *			  written
+ * @param bytesWritten The amount of bytes already written before the write
+ *		       failed
+ * @param errNo The errno of the error that occurred
+ * @return An initialized write failed exception
+ */
+-  initWithObject: (id)object
+  requestedLength: (size_t)requestedLength
+     bytesWritten: (size_t)bytesWritten
+	    errNo: (int)errNo;
 @end
@@ -20,6 +20,33 @@
 #import "OFString.h"
 
 @implementation OFWriteFailedException
+@synthesize bytesWritten = _bytesWritten;
+
++ (instancetype)exceptionWithObject: (id)object
+		    requestedLength: (size_t)requestedLength
+		       bytesWritten: (size_t)bytesWritten
+			      errNo: (int)errNo
+{
+	return [[[self alloc] initWithObject: object
+			     requestedLength: requestedLength
+				bytesWritten: bytesWritten
+				       errNo: errNo] autorelease];
+}
+
+-  initWithObject: (id)object
+  requestedLength: (size_t)requestedLength
+     bytesWritten: (size_t)bytesWritten
+	    errNo: (int)errNo
+{
+	self = [super initWithObject: object
+		     requestedLength: requestedLength
+			       errNo: errNo];
+
+	_bytesWritten = bytesWritten;
+
+	return self;
+}
+
 - (OFString*)description
 {
 	if (_errNo != 0)
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2008, 2009, 2010, 2011, 2012, 2013, 2014, 2015, 2016
+ *   Jonathan Schleifer <js@heap.zone>
+ *
+ * All rights reserved.
+ *
+ * This file is part of ObjFW. It may be distributed under the terms of the
+ * Q Public License 1.0, which can be found in the file LICENSE.QPL included in
+ * the packaging of this file.
+ *
+ * Alternatively, it may be distributed under the terms of the GNU General
+ * Public License, either version 2 or 3, which can be found in the file
+ * LICENSE.GPLv2 or LICENSE.GPLv3 respectively included in the packaging of this
+ * file.
+ */
+
+#include "config.h"
+
+#import "of_adler32.h"
+
+#define ADLER32_BASE 65521
+/*
+ * The most bytes that can be added before the sums need to be reduced, as
+ * 255 * n * (n + 1) / 2 + (n + 1) * (ADLER32_BASE - 1) still fits into 32 bits.
+ */
+#define ADLER32_MAX_RUN 5552
+
+uint32_t
+of_adler32(uint32_t adler, const unsigned char *bytes, size_t length)
+{
+	uint32_t a = adler & 0xFFFF, b = adler >> 16;
+
+	while (length > 0) {
+		size_t run = (length < ADLER32_MAX_RUN
+		    ? length : ADLER32_MAX_RUN);
+
+		length -= run;
+
+		while (run-- > 0) {
+			a += *bytes++;
+			b += a;
+		}
+
+		a %= ADLER32_BASE;
+		b %= ADLER32_BASE;
+	}
+
+	return (b << 16) | a;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2008, 2009, 2010, 2011, 2012, 2013, 2014, 2015, 2016
+ *   Jonathan Schleifer <js@heap.zone>
+ *
+ * All rights reserved.
+ *
+ * This file is part of ObjFW. It may be distributed under the terms of the
+ * Q Public License 1.0, which can be found in the file LICENSE.QPL included in
+ * the packaging of this file.
+ *
+ * Alternatively, it may be distributed under the terms of the GNU General
+ * Public License, either version 2 or 3, which can be found in the file
+ * LICENSE.GPLv2 or LICENSE.GPLv3 respectively included in the packaging of this
+ * file.
+ */
+
+#ifndef __STDC_LIMIT_MACROS
+# define __STDC_LIMIT_MACROS
+#endif
+#ifndef __STDC_CONSTANT_MACROS
+# define __STDC_CONSTANT_MACROS
+#endif
+
+#include <stddef.h>
+
+#import "macros.h"
+
+OF_ASSUME_NONNULL_BEGIN
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/* Returns the number of leading bytes that are ASCII. */
+extern size_t of_ascii_length(const char *buffer, size_t length);
+
+/*
+ * Converts the ASCII letters in the buffer to lower or upper case in place.
+ * All other bytes are left untouched.
+ */
+extern void of_ascii_tolower(char *buffer, size_t length);
+extern void of_ascii_toupper(char *buffer, size_t length);
+
+/*
+ * Returns the number of leading bytes that are equal when ignoring the case of
+ * ASCII letters.
+ */
+extern size_t of_ascii_casematch(const char *first, const char *second,
+    size_t length);
+#ifdef __cplusplus
+}
+#endif
+
+OF_ASSUME_NONNULL_END
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2008, 2009, 2010, 2011, 2012, 2013, 2014, 2015, 2016
+ *   Jonathan Schleifer <js@heap.zone>
+ *
+ * All rights reserved.
+ *
+ * This file is part of ObjFW. It may be distributed under the terms of the
+ * Q Public License 1.0, which can be found in the file LICENSE.QPL included in
+ * the packaging of this file.
+ *
+ * Alternatively, it may be distributed under the terms of the GNU General
+ * Public License, either version 2 or 3, which can be found in the file
+ * LICENSE.GPLv2 or LICENSE.GPLv3 respectively included in the packaging of this
+ * file.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+# include <emmintrin.h>
+# define HAVE_SSE2_ASCII
+#endif
+
+#import "of_ascii.h"
+
+static OF_INLINE char
+lowerASCII(char c)
+{
+	return (c >= 'A' && c <= 'Z' ? c | 0x20 : c);
+}
+
+static OF_INLINE char
+upperASCII(char c)
+{
+	return (c >= 'a' && c <= 'z' ? c & ~0x20 : c);
+}
+
+#ifdef HAVE_SSE2_ASCII
+/*
+ * Returns a mask of the bytes in the range [from, to]. Both must be ASCII, so
+ * that the signed comparisons never match bytes >= 0x80.
+ */
+static OF_INLINE __m128i
+rangeMask(__m128i block, char from, char to)
+{
+	return _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8(from - 1)),
+	    _mm_cmplt_epi8(block, _mm_set1_epi8(to + 1)));
+}
+
+static OF_INLINE __m128i
+lowerBlock(__m128i block)
+{
+	return _mm_or_si128(block,
+	    _mm_and_si128(rangeMask(block, 'A', 'Z'), _mm_set1_epi8(0x20)));
+}
+#endif
+
+size_t
+of_ascii_length(const char *buffer, size_t length)
+{
+	size_t i = 0;
+
+#ifdef HAVE_SSE2_ASCII
+	for (; length - i >= 16; i += 16) {
+		unsigned int mask = _mm_movemask_epi8(
+		    _mm_loadu_si128((const __m128i*)(buffer + i)));
+
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+#endif
+
+	for (; i < length; i++)
+		if (buffer[i] & 0x80)
+			break;
+
+	return i;
+}
+
+void
+of_ascii_tolower(char *buffer, size_t length)
+{
+	size_t i = 0;
+
+#ifdef HAVE_SSE2_ASCII
+	for (; length - i >= 16; i += 16) {
+		__m128i block = _mm_loadu_si128((const __m128i*)(buffer + i));
+
+		_mm_storeu_si128((__m128i*)(buffer + i), lowerBlock(block));
+	}
+#endif
+
+	for (; i < length; i++)
+		buffer[i] = lowerASCII(buffer[i]);
+}
+
+void
+of_ascii_toupper(char *buffer, size_t length)
+{
+	size_t i = 0;
+
+#ifdef HAVE_SSE2_ASCII
+	for (; length - i >= 16; i += 16) {
+		__m128i block = _mm_loadu_si128((const __m128i*)(buffer + i));
+
+		block = _mm_andnot_si128(_mm_and_si128(
+		    rangeMask(block, 'a', 'z'), _mm_set1_epi8(0x20)), block);
+		_mm_storeu_si128((__m128i*)(buffer + i), block);
+	}
+#endif
+
+	for (; i < length; i++)
+		buffer[i] = upperASCII(buffer[i]);
+}
+
+size_t
+of_ascii_casematch(const char *first, const char *second, size_t length)
+{
+	size_t i = 0;
+
+#ifdef HAVE_SSE2_ASCII
+	for (; length - i >= 16; i += 16) {
+		__m128i block1 = _mm_loadu_si128((const __m128i*)(first + i));
+		__m128i block2 = _mm_loadu_si128((const __m128i*)(second + i));
+		unsigned int mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(
+		    lowerBlock(block1), lowerBlock(block2))) & 0xFFFF;
+
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+#endif
+
+	for (; i < length; i++)
+		if (lowerASCII(first[i]) != lowerASCII(second[i]))
+			break;
+
+	return i;
+}
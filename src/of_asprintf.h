@@ -22,6 +22,8 @@
 #endif
 
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
 
 #import "macros.h"
 
@@ -34,6 +36,16 @@ extern int of_asprintf(
     char *_Nullable *_Nonnull, const char *_Nonnull, ...);
 extern int of_vasprintf(
     char *_Nullable *_Nonnull, const char *_Nonnull, va_list);
+/*
+ * Like of_vasprintf(), but uses the specified buffer if the result fits, so
+ * that no memory needs to be allocated. The string is set to either the buffer
+ * or allocated memory, which needs to be freed if it is not the buffer.
+ *
+ * If constantFormat is true, the format string must never be freed or
+ * modified, which allows to cache it in compiled form.
+ */
+extern int of_vasprintf_buffer(char *_Nullable, size_t,
+    char *_Nullable *_Nonnull, const char *_Nonnull, bool, va_list);
 #ifdef __cplusplus
 }
 #endif
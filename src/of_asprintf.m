@@ -16,6 +16,7 @@
 
 #include "config.h"
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -27,459 +28,766 @@
 
 #import "OFString.h"
 
+#import "of_asprintf.h"
+#import "of_numconv.h"
+#import "atomic.h"
+
 #define MAX_SUBFORMAT_LEN 64
+/* Number of compiled format strings that are cached, must be a power of 2 */
+#define PROGRAM_CACHE_SIZE 256
+#define PROGRAM_CACHE_PROBES 16
+
+enum length_modifier {
+	LENGTH_MODIFIER_NONE,
+	LENGTH_MODIFIER_HH,
+	LENGTH_MODIFIER_H,
+	LENGTH_MODIFIER_L,
+	LENGTH_MODIFIER_LL,
+	LENGTH_MODIFIER_J,
+	LENGTH_MODIFIER_Z,
+	LENGTH_MODIFIER_T,
+	LENGTH_MODIFIER_CAPITAL_L
+};
 
-#ifndef HAVE_ASPRINTF
 /*
- * (v)asprintf might be declared, but HAVE_ASPRINTF not defined because
- * configure determined it is broken. In this case, we must make sure there is
- * no name clash.
+ * A literal followed by a conversion. The last token of a format string has no
+ * conversion if the format string does not end with one.
  */
-# define asprintf asprintf_
-# define vasprintf vasprintf_
-#endif
-
-struct context {
-	const char *format;
-	size_t formatLen;
+struct token {
+	const char *literal;
+	size_t literalLength;
 	char subformat[MAX_SUBFORMAT_LEN + 1];
-	size_t subformatLen;
-	va_list arguments;
-	char *buffer;
-	size_t bufferLen;
-	size_t i, last;
-	enum {
-		STATE_STRING,
-		STATE_FORMAT_FLAGS,
-		STATE_FORMAT_FIELD_WIDTH,
-		STATE_FORMAT_LENGTH_MODIFIER,
-		STATE_FORMAT_CONVERSION_SPECIFIER
-	} state;
-	enum {
-		LENGTH_MODIFIER_NONE,
-		LENGTH_MODIFIER_HH,
-		LENGTH_MODIFIER_H,
-		LENGTH_MODIFIER_L,
-		LENGTH_MODIFIER_LL,
-		LENGTH_MODIFIER_J,
-		LENGTH_MODIFIER_Z,
-		LENGTH_MODIFIER_T,
-		LENGTH_MODIFIER_CAPITAL_L
-	} lengthModifier;
+	/* '\0' if there is no conversion */
+	char conversion;
+	enum length_modifier lengthModifier;
+	/* Whether there are flags, a field width or a precision */
+	bool hasOptions;
 };
 
-#ifndef HAVE_ASPRINTF
-static int
-vasprintf(char **string, const char *format, va_list arguments)
-{
-	int length;
-	va_list argumentsCopy;
-
-	va_copy(argumentsCopy, arguments);
-
-	if ((length = vsnprintf(NULL, 0, format, argumentsCopy)) < 0)
-		return length;
-	if ((*string = malloc((size_t)length + 1)) == NULL)
-		return -1;
-
-	return vsnprintf(*string, (size_t)length + 1, format, arguments);
-}
+/* A format string compiled into tokens, so that it needs to be parsed once. */
+struct program {
+	const char *format;
+	size_t tokensCount;
+	struct token tokens[];
+};
 
-static int
-asprintf(char **string, const char *format, ...)
-{
-	int ret;
+struct context {
 	va_list arguments;
+	char *buffer;
+	size_t bufferLen, bufferSize;
+	/* The buffer provided by the caller, which must not be freed */
+	char *initialBuffer;
+};
 
-	va_start(arguments, format);
-	ret = vasprintf(string, format, arguments);
-	va_end(arguments);
-
-	return ret;
-}
-#endif
-
-static bool
-appendString(struct context *ctx, const char *append, size_t appendLen)
-{
-	char *newBuf;
-
-	if (appendLen == 0)
-		return true;
-
-	if ((newBuf = realloc(ctx->buffer,
-	    ctx->bufferLen + appendLen + 1)) == NULL)
-		return false;
-
-	memcpy(newBuf + ctx->bufferLen, append, appendLen);
-
-	ctx->buffer = newBuf;
-	ctx->bufferLen += appendLen;
-
-	return true;
-}
+static struct program *volatile programs[PROGRAM_CACHE_SIZE];
 
 static bool
-appendSubformat(struct context *ctx, const char *subformat,
-    size_t subformatLen)
+appendSubformat(struct token *token, size_t *subformatLen,
+    const char *subformat, size_t length)
 {
-	if (ctx->subformatLen + subformatLen > MAX_SUBFORMAT_LEN)
+	if (*subformatLen + length > MAX_SUBFORMAT_LEN)
 		return false;
 
-	memcpy(ctx->subformat + ctx->subformatLen, subformat, subformatLen);
-	ctx->subformatLen += subformatLen;
-	ctx->subformat[ctx->subformatLen] = 0;
+	memcpy(token->subformat + *subformatLen, subformat, length);
+	*subformatLen += length;
+	token->subformat[*subformatLen] = '\0';
 
 	return true;
 }
 
 static bool
-stringState(struct context *ctx)
-{
-	if (ctx->format[ctx->i] == '%') {
-		if (ctx->i > 0)
-			if (!appendString(ctx, ctx->format + ctx->last,
-			    ctx->i - ctx->last))
-				return false;
-
-		if (!appendSubformat(ctx, ctx->format + ctx->i, 1))
-			return false;
-
-		ctx->last = ctx->i + 1;
-		ctx->state = STATE_FORMAT_FLAGS;
-	}
-
-	return true;
-}
-
-static bool
-formatFlagsState(struct context *ctx)
-{
-	switch (ctx->format[ctx->i]) {
-	case '-':
-	case '+':
-	case ' ':
-	case '#':
-	case '0':
-		if (!appendSubformat(ctx, ctx->format + ctx->i, 1))
-			return false;
-
-		break;
-	default:
-		ctx->state = STATE_FORMAT_FIELD_WIDTH;
-		ctx->i--;
-
-		break;
-	}
-
-	return true;
-}
-
-static bool
-formatFieldWidthState(struct context *ctx)
-{
-	if ((ctx->format[ctx->i] >= '0' && ctx->format[ctx->i] <= '9') ||
-	    ctx->format[ctx->i] == '*' || ctx->format[ctx->i] == '.') {
-		if (!appendSubformat(ctx, ctx->format + ctx->i, 1))
-			return false;
-	} else {
-		ctx->state = STATE_FORMAT_LENGTH_MODIFIER;
-		ctx->i--;
-	}
-
-	return true;
-}
-
-static bool
-formatLengthModifierState(struct context *ctx)
+parseLengthModifier(const char *format, size_t formatLen, size_t *i,
+    struct token *token, size_t *subformatLen)
 {
 	/* Only one allowed */
-	switch (ctx->format[ctx->i]) {
+	switch (format[*i]) {
 	case 'h': /* and also hh */
-		if (ctx->formatLen > ctx->i + 1 &&
-		    ctx->format[ctx->i + 1] == 'h') {
-			if (!appendSubformat(ctx, ctx->format + ctx->i, 2))
+		if (formatLen > *i + 1 && format[*i + 1] == 'h') {
+			if (!appendSubformat(token, subformatLen,
+			    format + *i, 2))
 				return false;
 
-			ctx->i++;
-			ctx->lengthModifier = LENGTH_MODIFIER_HH;
+			(*i)++;
+			token->lengthModifier = LENGTH_MODIFIER_HH;
 		} else {
-			if (!appendSubformat(ctx, ctx->format + ctx->i, 1))
+			if (!appendSubformat(token, subformatLen,
+			    format + *i, 1))
 				return false;
 
-			ctx->lengthModifier = LENGTH_MODIFIER_H;
+			token->lengthModifier = LENGTH_MODIFIER_H;
 		}
 
 		break;
 	case 'l': /* and also ll */
-		if (ctx->formatLen > ctx->i + 1 &&
-		    ctx->format[ctx->i + 1] == 'l') {
+		if (formatLen > *i + 1 && format[*i + 1] == 'l') {
 #ifndef OF_WINDOWS
-			if (!appendSubformat(ctx, ctx->format + ctx->i, 2))
+			if (!appendSubformat(token, subformatLen,
+			    format + *i, 2))
 				return false;
 #else
-			if (!appendSubformat(ctx, "I64", 3))
+			if (!appendSubformat(token, subformatLen, "I64", 3))
 				return false;
 #endif
 
-			ctx->i++;
-			ctx->lengthModifier = LENGTH_MODIFIER_LL;
+			(*i)++;
+			token->lengthModifier = LENGTH_MODIFIER_LL;
 		} else {
-			if (!appendSubformat(ctx, ctx->format + ctx->i, 1))
+			if (!appendSubformat(token, subformatLen,
+			    format + *i, 1))
 				return false;
 
-			ctx->lengthModifier = LENGTH_MODIFIER_L;
+			token->lengthModifier = LENGTH_MODIFIER_L;
 		}
 
 		break;
 	case 'j':
 #if defined(OF_WINDOWS)
-		if (!appendSubformat(ctx, "I64", 3))
+		if (!appendSubformat(token, subformatLen, "I64", 3))
 			return false;
 #elif defined(_NEWLIB_VERSION)
-		if (!appendSubformat(ctx, "ll", 2))
+		if (!appendSubformat(token, subformatLen, "ll", 2))
 			return false;
 #else
-		if (!appendSubformat(ctx, ctx->format + ctx->i, 1))
+		if (!appendSubformat(token, subformatLen, format + *i, 1))
 			return false;
 #endif
 
-		ctx->lengthModifier = LENGTH_MODIFIER_J;
+		token->lengthModifier = LENGTH_MODIFIER_J;
 
 		break;
 	case 'z':
 #if defined(OF_WINDOWS)
-		if (!appendSubformat(ctx, "I", 1))
+		if (!appendSubformat(token, subformatLen, "I", 1))
 			return false;
 #elif defined(_NEWLIB_VERSION)
-		if (!appendSubformat(ctx, "l", 1))
+		if (!appendSubformat(token, subformatLen, "l", 1))
 			return false;
 #else
-		if (!appendSubformat(ctx, ctx->format + ctx->i, 1))
+		if (!appendSubformat(token, subformatLen, format + *i, 1))
 			return false;
 #endif
 
-		ctx->lengthModifier = LENGTH_MODIFIER_Z;
+		token->lengthModifier = LENGTH_MODIFIER_Z;
 
 		break;
 	case 't':
 #if defined(OF_WINDOWS)
-		if (!appendSubformat(ctx, "I", 1))
+		if (!appendSubformat(token, subformatLen, "I", 1))
 			return false;
 #elif defined(_NEWLIB_VERSION)
-		if (!appendSubformat(ctx, "l", 1))
+		if (!appendSubformat(token, subformatLen, "l", 1))
 			return false;
 #else
-		if (!appendSubformat(ctx, ctx->format + ctx->i, 1))
+		if (!appendSubformat(token, subformatLen, format + *i, 1))
 			return false;
 #endif
 
-		ctx->lengthModifier = LENGTH_MODIFIER_T;
+		token->lengthModifier = LENGTH_MODIFIER_T;
 
 		break;
 	case 'L':
-		if (!appendSubformat(ctx, ctx->format + ctx->i, 1))
+		if (!appendSubformat(token, subformatLen, format + *i, 1))
 			return false;
 
-		ctx->lengthModifier = LENGTH_MODIFIER_CAPITAL_L;
+		token->lengthModifier = LENGTH_MODIFIER_CAPITAL_L;
 
 		break;
 #ifdef OF_WINDOWS
 	case 'I': /* win32 strangeness (I64 instead of ll or j) */
-		if (ctx->formatLen > ctx->i + 2 &&
-		    ctx->format[ctx->i + 1] == '6' &&
-		    ctx->format[ctx->i + 2] == '4') {
-			if (!appendSubformat(ctx, ctx->format + ctx->i, 3))
+		if (formatLen > *i + 2 && format[*i + 1] == '6' &&
+		    format[*i + 2] == '4') {
+			if (!appendSubformat(token, subformatLen,
+			    format + *i, 3))
 				return false;
 
-			ctx->i += 2;
-			ctx->lengthModifier = LENGTH_MODIFIER_LL;
+			(*i) += 2;
+			token->lengthModifier = LENGTH_MODIFIER_LL;
 		} else
-			ctx->i--;
+			return true;
 
 		break;
 #endif
 #ifdef OF_IOS
 	case 'q': /* iOS uses this for PRI?64 */
-		if (!appendSubformat(ctx, ctx->format + ctx->i, 1))
+		if (!appendSubformat(token, subformatLen, format + *i, 1))
 			return false;
 
-		ctx->lengthModifier = LENGTH_MODIFIER_LL;
+		token->lengthModifier = LENGTH_MODIFIER_LL;
 
 		break;
 #endif
 	default:
-		ctx->i--;
-
-		break;
+		return true;
 	}
 
-	ctx->state = STATE_FORMAT_CONVERSION_SPECIFIER;
+	(*i)++;
+
 	return true;
 }
 
 static bool
-formatConversionSpecifierState(struct context *ctx)
+isValidConversion(char conversion, enum length_modifier lengthModifier)
 {
-	char *tmp = NULL;
-	int tmpLen = 0;
+	switch (conversion) {
+	case '@':
+	case 'C':
+	case 'S':
+	case 'p':
+	case '%':
+		return (lengthModifier == LENGTH_MODIFIER_NONE);
+	case 'd':
+	case 'i':
+	case 'o':
+	case 'u':
+	case 'x':
+	case 'X':
+	case 'n':
+		return (lengthModifier != LENGTH_MODIFIER_CAPITAL_L);
+	case 'f':
+	case 'F':
+	case 'e':
+	case 'E':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		return (lengthModifier == LENGTH_MODIFIER_NONE ||
+		    lengthModifier == LENGTH_MODIFIER_L ||
+		    lengthModifier == LENGTH_MODIFIER_CAPITAL_L);
+	case 'c':
+	case 's':
+		return (lengthModifier == LENGTH_MODIFIER_NONE ||
+		    lengthModifier == LENGTH_MODIFIER_L);
+	default:
+		return false;
+	}
+}
 
-	if (!appendSubformat(ctx, ctx->format + ctx->i, 1))
+/* Parses the literal up to the next conversion and the conversion. */
+static bool
+parseToken(const char *format, size_t formatLen, size_t *i,
+    struct token *token)
+{
+	const char *percent = memchr(format + *i, '%', formatLen - *i);
+	size_t subformatLen = 0;
+
+	token->literal = format + *i;
+	token->subformat[0] = '\0';
+	token->conversion = '\0';
+	token->lengthModifier = LENGTH_MODIFIER_NONE;
+	token->hasOptions = false;
+
+	if (percent == NULL) {
+		token->literalLength = formatLen - *i;
+		*i = formatLen;
+
+		return true;
+	}
+
+	token->literalLength = percent - (format + *i);
+	*i = percent - format;
+
+	if (!appendSubformat(token, &subformatLen, "%", 1))
 		return false;
+	(*i)++;
 
-	switch (ctx->format[ctx->i]) {
-	case '@':
-		if (ctx->lengthModifier != LENGTH_MODIFIER_NONE)
+	/* Flags */
+	while (*i < formatLen && (format[*i] == '-' || format[*i] == '+' ||
+	    format[*i] == ' ' || format[*i] == '#' || format[*i] == '0')) {
+		if (!appendSubformat(token, &subformatLen, format + *i, 1))
 			return false;
 
-		ctx->subformat[ctx->subformatLen - 1] = 's';
+		token->hasOptions = true;
+		(*i)++;
+	}
 
-		@try {
-			id object;
+	/* Field width and precision */
+	while (*i < formatLen && ((format[*i] >= '0' && format[*i] <= '9') ||
+	    format[*i] == '*' || format[*i] == '.')) {
+		if (!appendSubformat(token, &subformatLen, format + *i, 1))
+			return false;
 
-			if ((object = va_arg(ctx->arguments, id)) != nil) {
-				void *pool = objc_autoreleasePoolPush();
+		token->hasOptions = true;
+		(*i)++;
+	}
 
-				tmpLen = asprintf(&tmp, ctx->subformat,
-				    [[object description] UTF8String]);
+	if (*i < formatLen && !parseLengthModifier(format, formatLen, i,
+	    token, &subformatLen))
+		return false;
 
-				objc_autoreleasePoolPop(pool);
-			} else
-				tmpLen = asprintf(&tmp, ctx->subformat,
-				    "(nil)");
-		} @catch (id e) {
-			free(ctx->buffer);
-			@throw e;
-		}
+	if (*i >= formatLen)
+		return false;
 
-		break;
+	if (!isValidConversion(format[*i], token->lengthModifier))
+		return false;
+
+	token->conversion = format[*i];
+
+	switch (token->conversion) {
+	case '@':
 	case 'C':
-		if (ctx->lengthModifier != LENGTH_MODIFIER_NONE)
+	case 'S':
+		if (!appendSubformat(token, &subformatLen, "s", 1))
 			return false;
 
-		ctx->subformat[ctx->subformatLen - 1] = 's';
+		break;
+	default:
+		if (!appendSubformat(token, &subformatLen, format + *i, 1))
+			return false;
 
-		{
-			char buffer[5];
-			size_t len = of_string_utf8_encode(
-			    va_arg(ctx->arguments, of_unichar_t), buffer);
+		break;
+	}
 
-			if (len == 0)
-				return false;
+	(*i)++;
+
+	return true;
+}
+
+static struct program*
+compileProgram(const char *format)
+{
+	size_t formatLen = strlen(format), tokensCount = 0, i = 0;
+	struct program *program;
+	struct token token;
+
+	while (i < formatLen) {
+		if (!parseToken(format, formatLen, &i, &token))
+			return NULL;
+
+		tokensCount++;
+	}
+
+	if ((program = malloc(sizeof(*program) +
+	    tokensCount * sizeof(struct token))) == NULL)
+		return NULL;
+
+	program->format = format;
+	program->tokensCount = tokensCount;
+
+	for (i = 0, tokensCount = 0; i < formatLen; tokensCount++)
+		parseToken(format, formatLen, &i,
+		    &program->tokens[tokensCount]);
+
+	return program;
+}
+
+/*
+ * Returns the compiled program for a format string that is never freed or
+ * modified, so that its address identifies it. Programs are never evicted;
+ * once the cache is full, NULL is returned for new format strings.
+ */
+static const struct program*
+cachedProgram(const char *format)
+{
+	uintptr_t hash = (uintptr_t)format;
+
+	hash ^= hash >> 7;
+	hash ^= hash >> 17;
+
+	for (size_t i = 0; i < PROGRAM_CACHE_PROBES; i++) {
+		size_t index = (hash + i) & (PROGRAM_CACHE_SIZE - 1);
+		struct program *program = programs[index];
+
+		if (program == NULL) {
+			if ((program = compileProgram(format)) == NULL)
+				return NULL;
+
+			of_memory_barrier_producer();
 
-			buffer[len] = 0;
-			tmpLen = asprintf(&tmp, ctx->subformat, buffer);
+			if (of_atomic_ptr_cmpswap(
+			    (void *volatile*)&programs[index], NULL, program))
+				return program;
+
+			/* Another thread was faster */
+			free(program);
+			program = programs[index];
 		}
 
-		break;
-	case 'S':
-		if (ctx->lengthModifier != LENGTH_MODIFIER_NONE)
+		of_memory_barrier_consumer();
+
+		if (program->format == format)
+			return program;
+	}
+
+	return NULL;
+}
+
+/* Makes sure there is room for length more bytes and a terminating zero. */
+static bool
+reserve(struct context *ctx, size_t length)
+{
+	char *newBuffer;
+	size_t newSize;
+
+	if (ctx->bufferSize - ctx->bufferLen > length)
+		return true;
+
+	if (SIZE_MAX - ctx->bufferLen - 1 < length)
+		return false;
+
+	newSize = ctx->bufferLen + length + 1;
+	if (newSize < ctx->bufferSize * 2)
+		newSize = ctx->bufferSize * 2;
+
+	if (ctx->buffer == ctx->initialBuffer) {
+		if ((newBuffer = malloc(newSize)) == NULL)
 			return false;
 
-		ctx->subformat[ctx->subformatLen - 1] = 's';
+		if (ctx->bufferLen > 0)
+			memcpy(newBuffer, ctx->buffer, ctx->bufferLen);
+	} else if ((newBuffer = realloc(ctx->buffer, newSize)) == NULL)
+		return false;
 
-		{
-			const of_unichar_t *arg =
-			    va_arg(ctx->arguments, const of_unichar_t*);
-			size_t j, len = of_string_utf32_length(arg);
-			char *buffer;
+	ctx->buffer = newBuffer;
+	ctx->bufferSize = newSize;
 
-			if (SIZE_MAX / 4 < len || (SIZE_MAX / 4) - len < 1)
-				return false;
+	return true;
+}
 
-			if ((buffer = malloc((len * 4) + 1)) == NULL)
-				return false;
+static bool
+appendString(struct context *ctx, const char *append, size_t appendLen)
+{
+	if (appendLen == 0)
+		return true;
 
-			j = 0;
-			for (size_t i = 0; i < len; i++) {
-				size_t clen = of_string_utf8_encode(arg[i],
-				    buffer + j);
+	if (!reserve(ctx, appendLen))
+		return false;
 
-				if (clen == 0) {
-					free(buffer);
-					return false;
-				}
+	memcpy(ctx->buffer + ctx->bufferLen, append, appendLen);
+	ctx->bufferLen += appendLen;
 
-				j += clen;
-			}
-			buffer[j] = 0;
+	return true;
+}
 
-			tmpLen = asprintf(&tmp, ctx->subformat, buffer);
+/* Formats a single argument with the libc directly into the buffer. */
+static bool
+appendFormatted(struct context *ctx, const char *subformat, ...)
+{
+	va_list arguments;
+	int length;
+
+	if (!reserve(ctx, 0))
+		return false;
+
+	va_start(arguments, subformat);
+	length = vsnprintf(ctx->buffer + ctx->bufferLen,
+	    ctx->bufferSize - ctx->bufferLen, subformat, arguments);
+	va_end(arguments);
+
+	if (length < 0)
+		return false;
+
+	if ((size_t)length >= ctx->bufferSize - ctx->bufferLen) {
+		if (!reserve(ctx, length))
+			return false;
 
+		va_start(arguments, subformat);
+		length = vsnprintf(ctx->buffer + ctx->bufferLen,
+		    ctx->bufferSize - ctx->bufferLen, subformat, arguments);
+		va_end(arguments);
+
+		if (length < 0)
+			return false;
+	}
+
+	ctx->bufferLen += length;
+
+	return true;
+}
+
+static bool
+appendDecimal(struct context *ctx, intmax_t value)
+{
+	if (!reserve(ctx, OF_INTMAX_STRING_SIZE))
+		return false;
+
+	ctx->bufferLen += of_intmax_to_string(value,
+	    ctx->buffer + ctx->bufferLen);
+
+	return true;
+}
+
+static bool
+appendUnsignedDecimal(struct context *ctx, uintmax_t value)
+{
+	if (!reserve(ctx, OF_INTMAX_STRING_SIZE))
+		return false;
+
+	ctx->bufferLen += of_uintmax_to_string(value,
+	    ctx->buffer + ctx->bufferLen);
+
+	return true;
+}
+
+static bool
+appendObject(struct context *ctx, const struct token *token)
+{
+	id object = va_arg(ctx->arguments, id);
+	void *pool;
+	bool ret;
+
+	if (object == nil)
+		return appendFormatted(ctx, token->subformat, "(nil)");
+
+	pool = objc_autoreleasePoolPush();
+
+	@try {
+		OFString *description = [object description];
+
+		if (token->hasOptions)
+			ret = appendFormatted(ctx, token->subformat,
+			    [description UTF8String]);
+		else
+			ret = appendString(ctx, [description UTF8String],
+			    [description UTF8StringLength]);
+	} @catch (id e) {
+		if (ctx->buffer != ctx->initialBuffer)
+			free(ctx->buffer);
+
+		@throw e;
+	}
+
+	objc_autoreleasePoolPop(pool);
+
+	return ret;
+}
+
+static bool
+appendCharacter(struct context *ctx, const struct token *token)
+{
+	char buffer[5];
+	size_t len = of_string_utf8_encode(
+	    va_arg(ctx->arguments, of_unichar_t), buffer);
+
+	if (len == 0)
+		return false;
+
+	buffer[len] = 0;
+
+	if (token->hasOptions)
+		return appendFormatted(ctx, token->subformat, buffer);
+
+	return appendString(ctx, buffer, len);
+}
+
+static bool
+appendUnicodeString(struct context *ctx, const struct token *token)
+{
+	const of_unichar_t *arg = va_arg(ctx->arguments, const of_unichar_t*);
+	size_t j, len = of_string_utf32_length(arg);
+	char *buffer;
+	bool ret;
+
+	if (SIZE_MAX / 4 < len || (SIZE_MAX / 4) - len < 1)
+		return false;
+
+	if ((buffer = malloc((len * 4) + 1)) == NULL)
+		return false;
+
+	j = 0;
+	for (size_t i = 0; i < len; i++) {
+		size_t clen = of_string_utf8_encode(arg[i], buffer + j);
+
+		if (clen == 0) {
 			free(buffer);
+			return false;
 		}
 
+		j += clen;
+	}
+	buffer[j] = 0;
+
+	if (token->hasOptions)
+		ret = appendFormatted(ctx, token->subformat, buffer);
+	else
+		ret = appendString(ctx, buffer, j);
+
+	free(buffer);
+
+	return ret;
+}
+
+static bool
+storeLength(struct context *ctx, const struct token *token)
+{
+	switch (token->lengthModifier) {
+	case LENGTH_MODIFIER_NONE:
+		*va_arg(ctx->arguments, int*) = (int)ctx->bufferLen;
 		break;
-	case 'd':
-	case 'i':
-		switch (ctx->lengthModifier) {
-		case LENGTH_MODIFIER_NONE:
-		case LENGTH_MODIFIER_HH:
-		case LENGTH_MODIFIER_H:
-			tmpLen = asprintf(&tmp, ctx->subformat,
-			    va_arg(ctx->arguments, int));
-			break;
-		case LENGTH_MODIFIER_L:
-			tmpLen = asprintf(&tmp, ctx->subformat,
-			    va_arg(ctx->arguments, long));
-			break;
-		case LENGTH_MODIFIER_LL:
-			tmpLen = asprintf(&tmp, ctx->subformat,
-			    va_arg(ctx->arguments, long long));
-			break;
-		case LENGTH_MODIFIER_J:
-			tmpLen = asprintf(&tmp, ctx->subformat,
-			    va_arg(ctx->arguments, intmax_t));
-			break;
-		case LENGTH_MODIFIER_Z:
-			tmpLen = asprintf(&tmp, ctx->subformat,
-			    va_arg(ctx->arguments, ssize_t));
-			break;
-		case LENGTH_MODIFIER_T:
-			tmpLen = asprintf(&tmp, ctx->subformat,
-			    va_arg(ctx->arguments, ptrdiff_t));
-			break;
-		default:
-			return false;
-		}
+	case LENGTH_MODIFIER_HH:
+		*va_arg(ctx->arguments, signed char*) =
+		    (signed char)ctx->bufferLen;
+		break;
+	case LENGTH_MODIFIER_H:
+		*va_arg(ctx->arguments, short*) = (short)ctx->bufferLen;
+		break;
+	case LENGTH_MODIFIER_L:
+		*va_arg(ctx->arguments, long*) = (long)ctx->bufferLen;
+		break;
+	case LENGTH_MODIFIER_LL:
+		*va_arg(ctx->arguments, long long*) =
+		    (long long)ctx->bufferLen;
+		break;
+	case LENGTH_MODIFIER_J:
+		*va_arg(ctx->arguments, intmax_t*) = (intmax_t)ctx->bufferLen;
+		break;
+	case LENGTH_MODIFIER_Z:
+		*va_arg(ctx->arguments, size_t*) = (size_t)ctx->bufferLen;
+		break;
+	case LENGTH_MODIFIER_T:
+		*va_arg(ctx->arguments, ptrdiff_t*) =
+		    (ptrdiff_t)ctx->bufferLen;
+		break;
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+static bool
+executeSignedConversion(struct context *ctx, const struct token *token)
+{
+	intmax_t value;
+
+	switch (token->lengthModifier) {
+	case LENGTH_MODIFIER_NONE:
+		value = va_arg(ctx->arguments, int);
+		break;
+	case LENGTH_MODIFIER_HH:
+		value = (signed char)va_arg(ctx->arguments, int);
+		break;
+	case LENGTH_MODIFIER_H:
+		value = (short)va_arg(ctx->arguments, int);
+		break;
+	case LENGTH_MODIFIER_L:
+		value = va_arg(ctx->arguments, long);
+		break;
+	case LENGTH_MODIFIER_LL:
+		value = va_arg(ctx->arguments, long long);
+		break;
+	case LENGTH_MODIFIER_J:
+		value = va_arg(ctx->arguments, intmax_t);
+		break;
+	case LENGTH_MODIFIER_Z:
+		value = va_arg(ctx->arguments, ssize_t);
+		break;
+	case LENGTH_MODIFIER_T:
+		value = va_arg(ctx->arguments, ptrdiff_t);
+		break;
+	default:
+		return false;
+	}
+
+	if (!token->hasOptions)
+		return appendDecimal(ctx, value);
+
+	switch (token->lengthModifier) {
+	case LENGTH_MODIFIER_NONE:
+	case LENGTH_MODIFIER_HH:
+	case LENGTH_MODIFIER_H:
+		return appendFormatted(ctx, token->subformat, (int)value);
+	case LENGTH_MODIFIER_L:
+		return appendFormatted(ctx, token->subformat, (long)value);
+	case LENGTH_MODIFIER_LL:
+		return appendFormatted(ctx, token->subformat,
+		    (long long)value);
+	case LENGTH_MODIFIER_J:
+		return appendFormatted(ctx, token->subformat, value);
+	case LENGTH_MODIFIER_Z:
+		return appendFormatted(ctx, token->subformat, (ssize_t)value);
+	case LENGTH_MODIFIER_T:
+		return appendFormatted(ctx, token->subformat,
+		    (ptrdiff_t)value);
+	default:
+		return false;
+	}
+}
 
+static bool
+executeUnsignedConversion(struct context *ctx, const struct token *token)
+{
+	uintmax_t value;
+
+	switch (token->lengthModifier) {
+	case LENGTH_MODIFIER_NONE:
+		value = va_arg(ctx->arguments, unsigned int);
+		break;
+	case LENGTH_MODIFIER_HH:
+		value = (unsigned char)va_arg(ctx->arguments, unsigned int);
+		break;
+	case LENGTH_MODIFIER_H:
+		value = (unsigned short)va_arg(ctx->arguments, unsigned int);
+		break;
+	case LENGTH_MODIFIER_L:
+		value = va_arg(ctx->arguments, unsigned long);
+		break;
+	case LENGTH_MODIFIER_LL:
+		value = va_arg(ctx->arguments, unsigned long long);
 		break;
+	case LENGTH_MODIFIER_J:
+		value = va_arg(ctx->arguments, uintmax_t);
+		break;
+	case LENGTH_MODIFIER_Z:
+		value = va_arg(ctx->arguments, size_t);
+		break;
+	case LENGTH_MODIFIER_T:
+		value = va_arg(ctx->arguments, ptrdiff_t);
+		break;
+	default:
+		return false;
+	}
+
+	if (token->conversion == 'u' && !token->hasOptions)
+		return appendUnsignedDecimal(ctx, value);
+
+	switch (token->lengthModifier) {
+	case LENGTH_MODIFIER_NONE:
+	case LENGTH_MODIFIER_HH:
+	case LENGTH_MODIFIER_H:
+		return appendFormatted(ctx, token->subformat,
+		    (unsigned int)value);
+	case LENGTH_MODIFIER_L:
+		return appendFormatted(ctx, token->subformat,
+		    (unsigned long)value);
+	case LENGTH_MODIFIER_LL:
+		return appendFormatted(ctx, token->subformat,
+		    (unsigned long long)value);
+	case LENGTH_MODIFIER_J:
+		return appendFormatted(ctx, token->subformat, value);
+	case LENGTH_MODIFIER_Z:
+		return appendFormatted(ctx, token->subformat, (size_t)value);
+	case LENGTH_MODIFIER_T:
+		return appendFormatted(ctx, token->subformat,
+		    (ptrdiff_t)value);
+	default:
+		return false;
+	}
+}
+
+static bool
+executeToken(struct context *ctx, const struct token *token)
+{
+	if (!appendString(ctx, token->literal, token->literalLength))
+		return false;
+
+	switch (token->conversion) {
+	case '\0':
+		return true;
+	case '@':
+		return appendObject(ctx, token);
+	case 'C':
+		return appendCharacter(ctx, token);
+	case 'S':
+		return appendUnicodeString(ctx, token);
+	case 'd':
+	case 'i':
+		return executeSignedConversion(ctx, token);
 	case 'o':
 	case 'u':
 	case 'x':
 	case 'X':
-		switch (ctx->lengthModifier) {
-		case LENGTH_MODIFIER_NONE:
-		case LENGTH_MODIFIER_HH:
-		case LENGTH_MODIFIER_H:
-			tmpLen = asprintf(&tmp, ctx->subformat,
-			    va_arg(ctx->arguments, unsigned int));
-			break;
-		case LENGTH_MODIFIER_L:
-			tmpLen = asprintf(&tmp, ctx->subformat,
-			    va_arg(ctx->arguments, unsigned long));
-			break;
-		case LENGTH_MODIFIER_LL:
-			tmpLen = asprintf(&tmp, ctx->subformat,
-			    va_arg(ctx->arguments, unsigned long long));
-			break;
-		case LENGTH_MODIFIER_J:
-			tmpLen = asprintf(&tmp, ctx->subformat,
-			    va_arg(ctx->arguments, uintmax_t));
-			break;
-		case LENGTH_MODIFIER_Z:
-			tmpLen = asprintf(&tmp, ctx->subformat,
-			    va_arg(ctx->arguments, size_t));
-			break;
-		case LENGTH_MODIFIER_T:
-			tmpLen = asprintf(&tmp, ctx->subformat,
-			    va_arg(ctx->arguments, ptrdiff_t));
-			break;
-		default:
-			return false;
-		}
-
-		break;
+		return executeUnsignedConversion(ctx, token);
 	case 'f':
 	case 'F':
 	case 'e':
@@ -488,185 +796,93 @@ formatConversionSpecifierState(struct context *ctx)
 	case 'G':
 	case 'a':
 	case 'A':
-		switch (ctx->lengthModifier) {
-		case LENGTH_MODIFIER_NONE:
-		case LENGTH_MODIFIER_L:
-			tmpLen = asprintf(&tmp, ctx->subformat,
-			    va_arg(ctx->arguments, double));
-			break;
-		case LENGTH_MODIFIER_CAPITAL_L:
-			tmpLen = asprintf(&tmp, ctx->subformat,
+		if (token->lengthModifier == LENGTH_MODIFIER_CAPITAL_L)
+			return appendFormatted(ctx, token->subformat,
 			    va_arg(ctx->arguments, long double));
-			break;
-		default:
-			return false;
-		}
 
-		break;
+		return appendFormatted(ctx, token->subformat,
+		    va_arg(ctx->arguments, double));
 	case 'c':
-		switch (ctx->lengthModifier) {
-		case LENGTH_MODIFIER_NONE:
-			tmpLen = asprintf(&tmp, ctx->subformat,
-			    va_arg(ctx->arguments, int));
-			break;
-		case LENGTH_MODIFIER_L:
+		if (token->lengthModifier == LENGTH_MODIFIER_L)
 #if WINT_MAX >= INT_MAX
-			tmpLen = asprintf(&tmp, ctx->subformat,
+			return appendFormatted(ctx, token->subformat,
 			    va_arg(ctx->arguments, wint_t));
 #else
-			tmpLen = asprintf(&tmp, ctx->subformat,
+			return appendFormatted(ctx, token->subformat,
 			    va_arg(ctx->arguments, int));
 #endif
-			break;
-		default:
-			return false;
-		}
 
-		break;
+		return appendFormatted(ctx, token->subformat,
+		    va_arg(ctx->arguments, int));
 	case 's':
-		switch (ctx->lengthModifier) {
-		case LENGTH_MODIFIER_NONE:
-			tmpLen = asprintf(&tmp, ctx->subformat,
-			    va_arg(ctx->arguments, const char*));
-			break;
-		case LENGTH_MODIFIER_L:
-			tmpLen = asprintf(&tmp, ctx->subformat,
+		if (token->lengthModifier == LENGTH_MODIFIER_L)
+			return appendFormatted(ctx, token->subformat,
 			    va_arg(ctx->arguments, const wchar_t*));
-			break;
-		default:
-			return false;
-		}
 
-		break;
-	case 'p':
-		if (ctx->lengthModifier != LENGTH_MODIFIER_NONE)
-			return false;
+		{
+			const char *string = va_arg(ctx->arguments,
+			    const char*);
 
-		tmpLen = asprintf(&tmp, ctx->subformat,
-		    va_arg(ctx->arguments, void*));
+			if (!token->hasOptions && string != NULL)
+				return appendString(ctx, string,
+				    strlen(string));
 
-		break;
-	case 'n':
-		switch (ctx->lengthModifier) {
-		case LENGTH_MODIFIER_NONE:
-			*va_arg(ctx->arguments, int*) =
-			    (int)ctx->bufferLen;
-			break;
-		case LENGTH_MODIFIER_HH:
-			*va_arg(ctx->arguments, signed char*) =
-			    (signed char)ctx->bufferLen;
-			break;
-		case LENGTH_MODIFIER_H:
-			*va_arg(ctx->arguments, short*) =
-			    (short)ctx->bufferLen;
-			break;
-		case LENGTH_MODIFIER_L:
-			*va_arg(ctx->arguments, long*) =
-			    (long)ctx->bufferLen;
-			break;
-		case LENGTH_MODIFIER_LL:
-			*va_arg(ctx->arguments, long long*) =
-			    (long long)ctx->bufferLen;
-			break;
-		case LENGTH_MODIFIER_J:
-			*va_arg(ctx->arguments, intmax_t*) =
-			    (intmax_t)ctx->bufferLen;
-			break;
-		case LENGTH_MODIFIER_Z:
-			*va_arg(ctx->arguments, size_t*) =
-			    (size_t)ctx->bufferLen;
-			break;
-		case LENGTH_MODIFIER_T:
-			*va_arg(ctx->arguments, ptrdiff_t*) =
-			    (ptrdiff_t)ctx->bufferLen;
-			break;
-		default:
-			return false;
+			return appendFormatted(ctx, token->subformat, string);
 		}
-
-		break;
+	case 'p':
+		return appendFormatted(ctx, token->subformat,
+		    va_arg(ctx->arguments, void*));
+	case 'n':
+		return storeLength(ctx, token);
 	case '%':
-		if (ctx->lengthModifier != LENGTH_MODIFIER_NONE)
-			return false;
-
-		if (!appendString(ctx, "%", 1))
-			return false;
-
-		break;
+		return appendString(ctx, "%", 1);
 	default:
 		return false;
 	}
+}
 
-	if (tmpLen == -1)
-		return false;
+static int
+formatString(struct context *ctx, char **string, const char *format,
+    bool constantFormat)
+{
+	const struct program *program = NULL;
 
-	if (tmp != NULL) {
-		if (!appendString(ctx, tmp, tmpLen)) {
-			free(tmp);
-			return false;
-		}
+	if (constantFormat)
+		program = cachedProgram(format);
 
-		free(tmp);
+	if (program != NULL) {
+		for (size_t i = 0; i < program->tokensCount; i++)
+			if (!executeToken(ctx, &program->tokens[i]))
+				goto error;
+	} else {
+		size_t formatLen = strlen(format), i = 0;
+		struct token token;
+
+		while (i < formatLen)
+			if (!parseToken(format, formatLen, &i, &token) ||
+			    !executeToken(ctx, &token))
+				goto error;
 	}
 
-	memset(ctx->subformat, 0, MAX_SUBFORMAT_LEN);
-	ctx->subformatLen = 0;
-	ctx->lengthModifier = LENGTH_MODIFIER_NONE;
+	if (!reserve(ctx, 0) || ctx->bufferLen > INT_MAX)
+		goto error;
 
-	ctx->last = ctx->i + 1;
-	ctx->state = STATE_STRING;
+	ctx->buffer[ctx->bufferLen] = '\0';
 
-	return true;
-}
+	*string = ctx->buffer;
+	return (int)ctx->bufferLen;
 
-static bool (*states[])(struct context*) = {
-	stringState,
-	formatFlagsState,
-	formatFieldWidthState,
-	formatLengthModifierState,
-	formatConversionSpecifierState
-};
+error:
+	if (ctx->buffer != ctx->initialBuffer)
+		free(ctx->buffer);
+
+	return -1;
+}
 
 int
 of_vasprintf(char **string, const char *format, va_list arguments)
 {
-	struct context ctx;
-
-	ctx.format = format;
-	ctx.formatLen = strlen(format);
-	memset(ctx.subformat, 0, MAX_SUBFORMAT_LEN + 1);
-	ctx.subformatLen = 0;
-	va_copy(ctx.arguments, arguments);
-	ctx.bufferLen = 0;
-	ctx.last = 0;
-	ctx.state = STATE_STRING;
-	ctx.lengthModifier = LENGTH_MODIFIER_NONE;
-
-	if ((ctx.buffer = malloc(1)) == NULL)
-		return -1;
-
-	for (ctx.i = 0; ctx.i < ctx.formatLen; ctx.i++) {
-		if (!states[ctx.state](&ctx)) {
-			free(ctx.buffer);
-			return -1;
-		}
-	}
-
-	if (ctx.state != STATE_STRING) {
-		free(ctx.buffer);
-		return -1;
-	}
-
-	if (!appendString(&ctx, ctx.format + ctx.last,
-	    ctx.formatLen - ctx.last)) {
-		free(ctx.buffer);
-		return -1;
-	}
-
-	ctx.buffer[ctx.bufferLen] = 0;
-
-	*string = ctx.buffer;
-	return (ctx.bufferLen <= INT_MAX ? (int)ctx.bufferLen : -1);
+	return of_vasprintf_buffer(NULL, 0, string, format, false, arguments);
 }
 
 int
@@ -681,3 +897,22 @@ of_asprintf(char **string, const char *format, ...)
 
 	return ret;
 }
+
+int
+of_vasprintf_buffer(char *buffer, size_t bufferSize, char **string,
+    const char *format, bool constantFormat, va_list arguments)
+{
+	struct context ctx;
+	int ret;
+
+	va_copy(ctx.arguments, arguments);
+	ctx.buffer = ctx.initialBuffer = buffer;
+	ctx.bufferLen = 0;
+	ctx.bufferSize = (buffer != NULL ? bufferSize : 0);
+
+	ret = formatString(&ctx, string, format, constantFormat);
+
+	va_end(ctx.arguments);
+
+	return ret;
+}
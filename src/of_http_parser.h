@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2008, 2009, 2010, 2011, 2012, 2013, 2014, 2015, 2016
+ *   Jonathan Schleifer <js@heap.zone>
+ *
+ * All rights reserved.
+ *
+ * This file is part of ObjFW. It may be distributed under the terms of the
+ * Q Public License 1.0, which can be found in the file LICENSE.QPL included in
+ * the packaging of this file.
+ *
+ * Alternatively, it may be distributed under the terms of the GNU General
+ * Public License, either version 2 or 3, which can be found in the file
+ * LICENSE.GPLv2 or LICENSE.GPLv3 respectively included in the packaging of this
+ * file.
+ */
+
+#ifndef __STDC_LIMIT_MACROS
+# define __STDC_LIMIT_MACROS
+#endif
+#ifndef __STDC_CONSTANT_MACROS
+# define __STDC_CONSTANT_MACROS
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+
+#import "macros.h"
+#import "OFHTTPRequest.h"
+
+/*
+ * An incremental parser for the head of HTTP/1.x requests and responses. It
+ * works on the data in place and only records where the parts of the head
+ * are, so parsing does not allocate anything. The buffer passed to
+ * of_http_parser_parse() always has to start at the beginning of the head, but
+ * may grow (and move) between calls, as parsing continues where it stopped.
+ */
+
+#define OF_HTTP_PARSER_MAX_HEADERS 100
+#define OF_HTTP_PARSER_MAX_LENGTH 65536
+
+OF_ASSUME_NONNULL_BEGIN
+
+@class OFDictionary OF_GENERIC(KeyType, ObjectType);
+@class OFString;
+
+typedef enum {
+	/* The head is not complete yet */
+	OF_HTTP_PARSER_INCOMPLETE,
+	/* The head is complete, its length is in length */
+	OF_HTTP_PARSER_DONE,
+	/* The head is malformed */
+	OF_HTTP_PARSER_INVALID,
+	/* The request method is not known */
+	OF_HTTP_PARSER_UNKNOWN_METHOD,
+	/* Too many headers or the head is too long */
+	OF_HTTP_PARSER_TOO_LARGE
+} of_http_parser_status_t;
+
+/* Header names which can be looked up without comparing strings */
+typedef enum {
+	OF_HTTP_HEADER_OTHER,
+	OF_HTTP_HEADER_ACCEPT,
+	OF_HTTP_HEADER_ACCEPT_ENCODING,
+	OF_HTTP_HEADER_AUTHORIZATION,
+	OF_HTTP_HEADER_CONNECTION,
+	OF_HTTP_HEADER_CONTENT_ENCODING,
+	OF_HTTP_HEADER_CONTENT_LENGTH,
+	OF_HTTP_HEADER_CONTENT_TYPE,
+	OF_HTTP_HEADER_COOKIE,
+	OF_HTTP_HEADER_DATE,
+	OF_HTTP_HEADER_HOST,
+	OF_HTTP_HEADER_LOCATION,
+	OF_HTTP_HEADER_SERVER,
+	OF_HTTP_HEADER_SET_COOKIE,
+	OF_HTTP_HEADER_TRANSFER_ENCODING,
+	OF_HTTP_HEADER_USER_AGENT
+} of_http_header_t;
+
+/* Offsets are relative to the beginning of the head */
+typedef struct {
+	size_t nameStart, nameLength;
+	size_t valueStart, valueLength;
+	of_http_header_t header;
+} of_http_parser_header_t;
+
+typedef struct {
+	bool response;
+	int state;
+	size_t position, tokenStart, valueEnd;
+	/* Set when the status is OF_HTTP_PARSER_DONE */
+	size_t length;
+	uint8_t major, minor;
+	/* Only for requests */
+	of_http_request_method_t method;
+	size_t targetStart, targetLength;
+	/* Only for responses */
+	short statusCode;
+	of_http_parser_header_t headers[OF_HTTP_PARSER_MAX_HEADERS];
+	size_t numHeaders;
+} of_http_parser_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+extern void of_http_parser_init(of_http_parser_t *parser, bool response);
+extern of_http_parser_status_t of_http_parser_parse(of_http_parser_t *parser,
+    const char *buffer, size_t length);
+
+/*
+ * Returns the index of the first header with the specified name or -1 if
+ * there is none.
+ */
+extern ssize_t of_http_parser_find_header(const of_http_parser_t *parser,
+    of_http_header_t header, size_t start);
+
+/*
+ * Returns whether any of the specified headers contains the token in its
+ * comma-separated list, ignoring case.
+ */
+extern bool of_http_parser_has_token(const of_http_parser_t *parser,
+    const char *head, of_http_header_t header, const char *token);
+
+/*
+ * Parses the Content-Length header. Returns 0 if there is none, 1 if it was
+ * stored in length and -1 if it is invalid or there is more than one.
+ */
+extern int of_http_parser_content_length(const of_http_parser_t *parser,
+    const char *head, uintmax_t *length);
+
+/*
+ * Parses the Transfer-Encoding header. Returns 0 if there is none, 1 if it is
+ * chunked and -1 if it uses any other coding or there is more than one.
+ */
+extern int of_http_parser_chunked(const of_http_parser_t *parser,
+    const char *head);
+
+/*
+ * Returns a dictionary for the headers of the complete head, which only
+ * creates strings for the headers that are requested. Lookups ignore the case
+ * of the key and headers that occur multiple times are joined with a comma.
+ */
+extern OFDictionary OF_GENERIC(OFString*, OFString*) *of_http_parser_headers(
+    const of_http_parser_t *parser, const char *head);
+#ifdef __cplusplus
+}
+#endif
+
+OF_ASSUME_NONNULL_END
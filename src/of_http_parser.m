@@ -0,0 +1,681 @@
+/*
+ * Copyright (c) 2008, 2009, 2010, 2011, 2012, 2013, 2014, 2015, 2016
+ *   Jonathan Schleifer <js@heap.zone>
+ *
+ * All rights reserved.
+ *
+ * This file is part of ObjFW. It may be distributed under the terms of the
+ * Q Public License 1.0, which can be found in the file LICENSE.QPL included in
+ * the packaging of this file.
+ *
+ * Alternatively, it may be distributed under the terms of the GNU General
+ * Public License, either version 2 or 3, which can be found in the file
+ * LICENSE.GPLv2 or LICENSE.GPLv3 respectively included in the packaging of this
+ * file.
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#import "OFDictionary.h"
+#import "OFArray.h"
+#import "OFEnumerator.h"
+#import "OFString.h"
+#import "OFString_UTF8.h"
+
+#import "OFOutOfMemoryException.h"
+
+#import "of_http_parser.h"
+#import "of_ascii.h"
+
+enum {
+	STATE_METHOD,
+	STATE_TARGET,
+	STATE_REQUEST_VERSION,
+	STATE_RESPONSE_VERSION,
+	STATE_STATUS,
+	STATE_REASON,
+	STATE_LINE_LF,
+	STATE_HEADER_START,
+	STATE_HEADER_NAME,
+	STATE_VALUE_START,
+	STATE_VALUE,
+	STATE_END_LF
+};
+
+static const struct {
+	const char *name;
+	size_t length;
+	of_http_request_method_t method;
+} methods[] = {
+	{ "GET", 3, OF_HTTP_REQUEST_METHOD_GET },
+	{ "HEAD", 4, OF_HTTP_REQUEST_METHOD_HEAD },
+	{ "POST", 4, OF_HTTP_REQUEST_METHOD_POST },
+	{ "PUT", 3, OF_HTTP_REQUEST_METHOD_PUT },
+	{ "DELETE", 6, OF_HTTP_REQUEST_METHOD_DELETE },
+	{ "OPTIONS", 7, OF_HTTP_REQUEST_METHOD_OPTIONS },
+	{ "TRACE", 5, OF_HTTP_REQUEST_METHOD_TRACE },
+	{ "CONNECT", 7, OF_HTTP_REQUEST_METHOD_CONNECT }
+};
+
+/* Indexed by of_http_header_t, the keys are what normalizing would return. */
+static struct {
+	const char *name;
+	size_t length;
+	OFString *key;
+} knownHeaders[] = {
+	{ NULL, 0, nil },
+	{ "Accept", 6, @"Accept" },
+	{ "Accept-Encoding", 15, @"Accept-Encoding" },
+	{ "Authorization", 13, @"Authorization" },
+	{ "Connection", 10, @"Connection" },
+	{ "Content-Encoding", 16, @"Content-Encoding" },
+	{ "Content-Length", 14, @"Content-Length" },
+	{ "Content-Type", 12, @"Content-Type" },
+	{ "Cookie", 6, @"Cookie" },
+	{ "Date", 4, @"Date" },
+	{ "Host", 4, @"Host" },
+	{ "Location", 8, @"Location" },
+	{ "Server", 6, @"Server" },
+	{ "Set-Cookie", 10, @"Set-Cookie" },
+	{ "Transfer-Encoding", 17, @"Transfer-Encoding" },
+	{ "User-Agent", 10, @"User-Agent" }
+};
+
+static OF_INLINE bool
+isAlphanumeric(unsigned char c)
+{
+	return ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+	    (c >= '0' && c <= '9'));
+}
+
+static OF_INLINE bool
+isTokenCharacter(unsigned char c)
+{
+	if (isAlphanumeric(c))
+		return true;
+
+	switch (c) {
+	case '!': case '#': case '$': case '%': case '&': case '\'':
+	case '*': case '+': case '-': case '.': case '^': case '_':
+	case '`': case '|': case '~':
+		return true;
+	default:
+		return false;
+	}
+}
+
+static of_http_header_t
+classifyHeader(const char *name, size_t length)
+{
+	for (size_t i = 1; i < sizeof(knownHeaders) / sizeof(*knownHeaders);
+	    i++)
+		if (knownHeaders[i].length == length &&
+		    of_ascii_casematch(knownHeaders[i].name, name, length) ==
+		    length)
+			return (of_http_header_t)i;
+
+	return OF_HTTP_HEADER_OTHER;
+}
+
+static bool
+parseVersion(const char *version, size_t length, uint8_t *major,
+    uint8_t *minor)
+{
+	if (length != 8 || memcmp(version, "HTTP/", 5) != 0 ||
+	    version[6] != '.' || version[5] < '0' || version[5] > '9' ||
+	    version[7] < '0' || version[7] > '9')
+		return false;
+
+	*major = version[5] - '0';
+	*minor = version[7] - '0';
+
+	return true;
+}
+
+void
+of_http_parser_init(of_http_parser_t *parser, bool response)
+{
+	/* The header records are only written when used */
+	memset(parser, 0, offsetof(of_http_parser_t, headers));
+
+	parser->response = response;
+	parser->state = (response ? STATE_RESPONSE_VERSION : STATE_METHOD);
+	parser->numHeaders = 0;
+}
+
+static of_http_parser_status_t
+finish(of_http_parser_t *parser, const char *buffer, size_t length)
+{
+	parser->length = parser->position = length;
+
+	/* Header values are turned into strings later, which must not fail */
+	if (of_string_utf8_check(buffer, length, NULL) == -1)
+		return OF_HTTP_PARSER_INVALID;
+
+	return OF_HTTP_PARSER_DONE;
+}
+
+of_http_parser_status_t
+of_http_parser_parse(of_http_parser_t *parser, const char *buffer,
+    size_t length)
+{
+	const unsigned char *bytes = (const unsigned char*)buffer;
+	size_t i;
+
+	if (length > OF_HTTP_PARSER_MAX_LENGTH)
+		length = OF_HTTP_PARSER_MAX_LENGTH;
+
+	for (i = parser->position; i < length; i++) {
+		unsigned char c = bytes[i];
+		of_http_parser_header_t *header;
+
+		switch (parser->state) {
+		case STATE_METHOD:
+			if (c == ' ') {
+				size_t methodLength = i - parser->tokenStart;
+				size_t j;
+
+				if (methodLength == 0)
+					return OF_HTTP_PARSER_INVALID;
+
+				for (j = 0; j < sizeof(methods) /
+				    sizeof(*methods); j++)
+					if (methods[j].length == methodLength &&
+					    memcmp(methods[j].name, buffer +
+					    parser->tokenStart,
+					    methodLength) == 0)
+						break;
+
+				if (j == sizeof(methods) / sizeof(*methods))
+					return OF_HTTP_PARSER_UNKNOWN_METHOD;
+
+				parser->method = methods[j].method;
+				parser->tokenStart = i + 1;
+				parser->state = STATE_TARGET;
+			} else if ((c == '\r' || c == '\n') &&
+			    i == parser->tokenStart)
+				/* Empty lines before the request are ignored */
+				parser->tokenStart = i + 1;
+			else if (!isTokenCharacter(c))
+				return OF_HTTP_PARSER_INVALID;
+
+			break;
+		case STATE_TARGET:
+			if (c == ' ') {
+				if (i == parser->tokenStart)
+					return OF_HTTP_PARSER_INVALID;
+
+				parser->targetStart = parser->tokenStart;
+				parser->targetLength = i - parser->tokenStart;
+				parser->tokenStart = i + 1;
+				parser->state = STATE_REQUEST_VERSION;
+			} else if (c <= ' ' || c == 0x7F)
+				return OF_HTTP_PARSER_INVALID;
+
+			break;
+		case STATE_REQUEST_VERSION:
+			if (c == '\r' || c == '\n') {
+				if (!parseVersion(buffer + parser->tokenStart,
+				    i - parser->tokenStart, &parser->major,
+				    &parser->minor))
+					return OF_HTTP_PARSER_INVALID;
+
+				parser->state = (c == '\r'
+				    ? STATE_LINE_LF : STATE_HEADER_START);
+			} else if (i - parser->tokenStart >= 8)
+				return OF_HTTP_PARSER_INVALID;
+
+			break;
+		case STATE_RESPONSE_VERSION:
+			if (c == ' ') {
+				if (!parseVersion(buffer, i, &parser->major,
+				    &parser->minor))
+					return OF_HTTP_PARSER_INVALID;
+
+				parser->tokenStart = i + 1;
+				parser->state = STATE_STATUS;
+			} else if (i >= 8)
+				return OF_HTTP_PARSER_INVALID;
+
+			break;
+		case STATE_STATUS:
+			if (c >= '0' && c <= '9' &&
+			    i - parser->tokenStart < 3)
+				parser->statusCode =
+				    parser->statusCode * 10 + (c - '0');
+			else if (i - parser->tokenStart == 3 &&
+			    (c == ' ' || c == '\r' || c == '\n'))
+				parser->state = (c == ' ' ? STATE_REASON :
+				    c == '\r' ? STATE_LINE_LF :
+				    STATE_HEADER_START);
+			else
+				return OF_HTTP_PARSER_INVALID;
+
+			break;
+		case STATE_REASON:
+			if (c == '\r')
+				parser->state = STATE_LINE_LF;
+			else if (c == '\n')
+				parser->state = STATE_HEADER_START;
+			else if ((c < ' ' && c != '\t') || c == 0x7F)
+				return OF_HTTP_PARSER_INVALID;
+
+			break;
+		case STATE_LINE_LF:
+			if (c != '\n')
+				return OF_HTTP_PARSER_INVALID;
+
+			parser->state = STATE_HEADER_START;
+			break;
+		case STATE_HEADER_START:
+			if (c == '\r')
+				parser->state = STATE_END_LF;
+			else if (c == '\n')
+				return finish(parser, buffer, i + 1);
+			else if (isTokenCharacter(c)) {
+				if (parser->numHeaders ==
+				    OF_HTTP_PARSER_MAX_HEADERS)
+					return OF_HTTP_PARSER_TOO_LARGE;
+
+				parser->tokenStart = i;
+				parser->state = STATE_HEADER_NAME;
+			} else
+				/* Includes obsolete line folding */
+				return OF_HTTP_PARSER_INVALID;
+
+			break;
+		case STATE_HEADER_NAME:
+			if (c == ':') {
+				header = &parser->headers[parser->numHeaders];
+				header->nameStart = parser->tokenStart;
+				header->nameLength = i - parser->tokenStart;
+				header->header = classifyHeader(
+				    buffer + header->nameStart,
+				    header->nameLength);
+
+				parser->state = STATE_VALUE_START;
+			} else if (!isTokenCharacter(c))
+				return OF_HTTP_PARSER_INVALID;
+
+			break;
+		case STATE_VALUE_START:
+			if (c == ' ' || c == '\t')
+				break;
+
+			parser->tokenStart = parser->valueEnd = i;
+			parser->state = STATE_VALUE;
+			/* Fall through */
+		case STATE_VALUE:
+			if (c == '\r' || c == '\n') {
+				header = &parser->headers[parser->numHeaders++];
+				header->valueStart = parser->tokenStart;
+				header->valueLength =
+				    parser->valueEnd - parser->tokenStart;
+
+				parser->state = (c == '\r'
+				    ? STATE_LINE_LF : STATE_HEADER_START);
+			} else if (c != ' ' && c != '\t') {
+				if (c < ' ' || c == 0x7F)
+					return OF_HTTP_PARSER_INVALID;
+
+				parser->valueEnd = i + 1;
+			}
+
+			break;
+		case STATE_END_LF:
+			if (c != '\n')
+				return OF_HTTP_PARSER_INVALID;
+
+			return finish(parser, buffer, i + 1);
+		}
+	}
+
+	parser->position = i;
+
+	if (i == OF_HTTP_PARSER_MAX_LENGTH)
+		return OF_HTTP_PARSER_TOO_LARGE;
+
+	return OF_HTTP_PARSER_INCOMPLETE;
+}
+
+ssize_t
+of_http_parser_find_header(const of_http_parser_t *parser,
+    of_http_header_t header, size_t start)
+{
+	for (size_t i = start; i < parser->numHeaders; i++)
+		if (parser->headers[i].header == header)
+			return i;
+
+	return -1;
+}
+
+bool
+of_http_parser_has_token(const of_http_parser_t *parser, const char *head,
+    of_http_header_t header, const char *token)
+{
+	size_t tokenLength = strlen(token);
+	ssize_t i = -1;
+
+	while ((i = of_http_parser_find_header(parser, header, i + 1)) != -1) {
+		const char *value = head + parser->headers[i].valueStart;
+		size_t valueLength = parser->headers[i].valueLength;
+		size_t start = 0;
+
+		for (size_t j = 0; j <= valueLength; j++) {
+			size_t end = j;
+
+			if (j < valueLength && value[j] != ',')
+				continue;
+
+			while (start < end &&
+			    (value[start] == ' ' || value[start] == '\t'))
+				start++;
+			while (end > start &&
+			    (value[end - 1] == ' ' || value[end - 1] == '\t'))
+				end--;
+
+			if (end - start == tokenLength &&
+			    of_ascii_casematch(value + start, token,
+			    tokenLength) == tokenLength)
+				return true;
+
+			start = j + 1;
+		}
+	}
+
+	return false;
+}
+
+int
+of_http_parser_content_length(const of_http_parser_t *parser,
+    const char *head, uintmax_t *length)
+{
+	ssize_t i = of_http_parser_find_header(parser,
+	    OF_HTTP_HEADER_CONTENT_LENGTH, 0);
+	const char *value;
+	size_t valueLength;
+	uintmax_t ret = 0;
+
+	if (i == -1)
+		return 0;
+
+	if (of_http_parser_find_header(parser, OF_HTTP_HEADER_CONTENT_LENGTH,
+	    i + 1) != -1)
+		return -1;
+
+	value = head + parser->headers[i].valueStart;
+	valueLength = parser->headers[i].valueLength;
+
+	if (valueLength == 0)
+		return -1;
+
+	for (size_t j = 0; j < valueLength; j++) {
+		if (value[j] < '0' || value[j] > '9')
+			return -1;
+
+		if (ret > (UINTMAX_MAX - (value[j] - '0')) / 10)
+			return -1;
+
+		ret = ret * 10 + (value[j] - '0');
+	}
+
+	*length = ret;
+
+	return 1;
+}
+
+int
+of_http_parser_chunked(const of_http_parser_t *parser, const char *head)
+{
+	ssize_t i = of_http_parser_find_header(parser,
+	    OF_HTTP_HEADER_TRANSFER_ENCODING, 0);
+	const char *value;
+	size_t valueLength;
+
+	if (i == -1)
+		return 0;
+
+	if (of_http_parser_find_header(parser,
+	    OF_HTTP_HEADER_TRANSFER_ENCODING, i + 1) != -1)
+		return -1;
+
+	value = head + parser->headers[i].valueStart;
+	valueLength = parser->headers[i].valueLength;
+
+	/* No other codings are supported, so it has to be just chunked. */
+	if (valueLength != 7 || of_ascii_casematch(value, "chunked", 7) != 7)
+		return -1;
+
+	return 1;
+}
+
+@interface OFDictionary_HTTPHeaders: OFDictionary
+{
+	of_http_parser_header_t *_headers;
+	size_t _numHeaders;
+	char *_head;
+	OFArray OF_GENERIC(OFString*) *_keys;
+}
+
+- initWithParser: (const of_http_parser_t*)parser
+	    head: (const char*)head;
+- (bool)OF_header: (size_t)index
+	 matchesName: (const char*)name
+	      length: (size_t)length
+	      header: (of_http_header_t)header;
+- (OFArray OF_GENERIC(OFString*)*)OF_keys;
+@end
+
+static OFString*
+normalizedKey(const char *name, size_t length)
+{
+	char *copy;
+	bool firstLetter = true;
+
+	if ((copy = malloc(length + 1)) == NULL)
+		@throw [OFOutOfMemoryException
+		    exceptionWithRequestedSize: length + 1];
+
+	memcpy(copy, name, length);
+	copy[length] = '\0';
+
+	of_ascii_tolower(copy, length);
+
+	for (size_t i = 0; i < length; i++) {
+		if (!isAlphanumeric(copy[i])) {
+			firstLetter = true;
+			continue;
+		}
+
+		if (firstLetter && copy[i] >= 'a' && copy[i] <= 'z')
+			copy[i] -= 'a' - 'A';
+
+		firstLetter = false;
+	}
+
+	@try {
+		return [OFString stringWithUTF8StringNoCopy: copy
+					       freeWhenDone: true];
+	} @catch (id e) {
+		free(copy);
+		@throw e;
+	}
+}
+
+@implementation OFDictionary_HTTPHeaders
+- initWithParser: (const of_http_parser_t*)parser
+	    head: (const char*)head
+{
+	self = [super init];
+
+	@try {
+		_numHeaders = parser->numHeaders;
+
+		if (_numHeaders > 0) {
+			_headers = [self allocMemoryWithSize: sizeof(*_headers)
+						       count: _numHeaders];
+			memcpy(_headers, parser->headers,
+			    _numHeaders * sizeof(*_headers));
+		}
+
+		_head = [self allocMemoryWithSize: parser->length];
+		memcpy(_head, head, parser->length);
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	[_keys release];
+
+	[super dealloc];
+}
+
+- (bool)OF_header: (size_t)index
+	 matchesName: (const char*)name
+	      length: (size_t)length
+	      header: (of_http_header_t)header
+{
+	if (header != OF_HTTP_HEADER_OTHER)
+		return (_headers[index].header == header);
+
+	return (_headers[index].header == OF_HTTP_HEADER_OTHER &&
+	    _headers[index].nameLength == length &&
+	    of_ascii_casematch(_head + _headers[index].nameStart, name,
+	    length) == length);
+}
+
+- (id)objectForKey: (id)key
+{
+	const char *name;
+	size_t length;
+	of_http_header_t header;
+	OFString *ret = nil;
+	OFMutableString *joined = nil;
+
+	if (![key isKindOfClass: [OFString class]])
+		return nil;
+
+	name = [key UTF8String];
+	length = [key UTF8StringLength];
+	header = classifyHeader(name, length);
+
+	for (size_t i = 0; i < _numHeaders; i++) {
+		OFString *value;
+
+		if (![self OF_header: i
+			 matchesName: name
+			      length: length
+			      header: header])
+			continue;
+
+		value = [OFString
+		    stringWithUTF8String: _head + _headers[i].valueStart
+				  length: _headers[i].valueLength];
+
+		if (ret == nil) {
+			ret = value;
+			continue;
+		}
+
+		if (joined == nil) {
+			joined = [[ret mutableCopy] autorelease];
+			ret = joined;
+		}
+
+		[joined appendString: @","];
+		[joined appendString: value];
+	}
+
+	[joined makeImmutable];
+
+	return ret;
+}
+
+- (OFArray*)OF_keys
+{
+	OFMutableArray *keys;
+	void *pool;
+
+	if (_keys != nil)
+		return _keys;
+
+	keys = [OFMutableArray arrayWithCapacity: _numHeaders];
+	pool = objc_autoreleasePoolPush();
+
+	for (size_t i = 0; i < _numHeaders; i++) {
+		const char *name = _head + _headers[i].nameStart;
+		size_t length = _headers[i].nameLength;
+		bool seen = false;
+
+		for (size_t j = 0; j < i && !seen; j++)
+			if ([self OF_header: j
+				matchesName: name
+				     length: length
+				     header: _headers[i].header])
+				seen = true;
+
+		if (seen)
+			continue;
+
+		if (_headers[i].header != OF_HTTP_HEADER_OTHER)
+			[keys addObject: knownHeaders[_headers[i].header].key];
+		else
+			[keys addObject: normalizedKey(name, length)];
+	}
+
+	[keys makeImmutable];
+	_keys = [keys retain];
+
+	objc_autoreleasePoolPop(pool);
+
+	return _keys;
+}
+
+- (size_t)count
+{
+	return [[self OF_keys] count];
+}
+
+- (OFEnumerator*)keyEnumerator
+{
+	return [[self OF_keys] objectEnumerator];
+}
+
+- (OFEnumerator*)objectEnumerator
+{
+	OFArray *keys = [self OF_keys];
+	OFMutableArray *objects =
+	    [OFMutableArray arrayWithCapacity: [keys count]];
+
+	for (OFString *key in keys)
+		[objects addObject: [self objectForKey: key]];
+
+	return [objects objectEnumerator];
+}
+
+- (int)countByEnumeratingWithState: (of_fast_enumeration_state_t*)state
+			   objects: (id*)objects
+			     count: (int)count
+{
+	return [[self OF_keys] countByEnumeratingWithState: state
+						   objects: objects
+						     count: count];
+}
+@end
+
+OFDictionary*
+of_http_parser_headers(const of_http_parser_t *parser, const char *head)
+{
+	return [[[OFDictionary_HTTPHeaders alloc]
+	    initWithParser: parser
+		      head: head] autorelease];
+}
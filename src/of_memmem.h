@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2008, 2009, 2010, 2011, 2012, 2013, 2014, 2015, 2016
+ *   Jonathan Schleifer <js@heap.zone>
+ *
+ * All rights reserved.
+ *
+ * This file is part of ObjFW. It may be distributed under the terms of the
+ * Q Public License 1.0, which can be found in the file LICENSE.QPL included in
+ * the packaging of this file.
+ *
+ * Alternatively, it may be distributed under the terms of the GNU General
+ * Public License, either version 2 or 3, which can be found in the file
+ * LICENSE.GPLv2 or LICENSE.GPLv3 respectively included in the packaging of this
+ * file.
+ */
+
+#ifndef __STDC_LIMIT_MACROS
+# define __STDC_LIMIT_MACROS
+#endif
+#ifndef __STDC_CONSTANT_MACROS
+# define __STDC_CONSTANT_MACROS
+#endif
+
+#include <stddef.h>
+
+#import "macros.h"
+
+OF_ASSUME_NONNULL_BEGIN
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*
+ * Returns a pointer to the first occurrence of needle in haystack or NULL if
+ * it does not occur. Short needles are found using a first and last byte
+ * filter (vectorized where possible), long needles using the Two-Way
+ * algorithm, so the worst case is linear in the haystack length.
+ */
+extern const char *_Nullable of_memmem(const char *haystack,
+    size_t haystackLength, const char *needle, size_t needleLength);
+
+/*
+ * Returns a pointer to the last occurrence of needle in haystack or NULL if it
+ * does not occur.
+ */
+extern const char *_Nullable of_memrmem(const char *haystack,
+    size_t haystackLength, const char *needle, size_t needleLength);
+#ifdef __cplusplus
+}
+#endif
+
+OF_ASSUME_NONNULL_END
@@ -0,0 +1,306 @@
+/*
+ * Copyright (c) 2008, 2009, 2010, 2011, 2012, 2013, 2014, 2015, 2016
+ *   Jonathan Schleifer <js@heap.zone>
+ *
+ * All rights reserved.
+ *
+ * This file is part of ObjFW. It may be distributed under the terms of the
+ * Q Public License 1.0, which can be found in the file LICENSE.QPL included in
+ * the packaging of this file.
+ *
+ * Alternatively, it may be distributed under the terms of the GNU General
+ * Public License, either version 2 or 3, which can be found in the file
+ * LICENSE.GPLv2 or LICENSE.GPLv3 respectively included in the packaging of this
+ * file.
+ */
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+# include <emmintrin.h>
+# define HAVE_SSE2_SEARCH
+#endif
+
+#import "of_memmem.h"
+
+/*
+ * Needles up to this length are searched for using the first and last byte
+ * filter, longer ones use Two-Way (forwards) or Horspool (backwards).
+ */
+#define SHORT_NEEDLE_LENGTH 32
+
+static size_t
+maximalSuffix(const unsigned char *needle, size_t needleLength, size_t *period,
+    bool reversed)
+{
+	size_t suffix = SIZE_MAX, j = 0, k = 1, p = 1;
+
+	while (j + k < needleLength) {
+		unsigned char a = needle[j + k];
+		unsigned char b = needle[suffix + k];
+
+		if (reversed ? b < a : a < b) {
+			j += k;
+			k = 1;
+			p = j - suffix;
+		} else if (a == b) {
+			if (k != p)
+				k++;
+			else {
+				j += p;
+				k = 1;
+			}
+		} else {
+			suffix = j++;
+			k = p = 1;
+		}
+	}
+
+	*period = p;
+	return suffix;
+}
+
+static const char *
+twoWaySearch(const char *haystack_, size_t haystackLength,
+    const char *needle_, size_t needleLength)
+{
+	const unsigned char *haystack = (const unsigned char*)haystack_;
+	const unsigned char *needle = (const unsigned char*)needle_;
+	size_t suffix, period, reversedSuffix, reversedPeriod, i, j;
+
+	/* Critical factorization of the needle */
+	suffix = maximalSuffix(needle, needleLength, &period, false);
+	reversedSuffix = maximalSuffix(needle, needleLength, &reversedPeriod,
+	    true);
+	if (reversedSuffix + 1 < suffix + 1)
+		suffix++;
+	else {
+		suffix = reversedSuffix + 1;
+		period = reversedPeriod;
+	}
+
+	j = 0;
+
+	if (memcmp(needle, needle + period, suffix) == 0) {
+		/* Periodic needle: remember how much of it already matched */
+		size_t memory = 0;
+
+		while (j <= haystackLength - needleLength) {
+			i = (suffix > memory ? suffix : memory);
+			while (i < needleLength && needle[i] == haystack[i + j])
+				i++;
+
+			if (i < needleLength) {
+				j += i - suffix + 1;
+				memory = 0;
+				continue;
+			}
+
+			i = suffix - 1;
+			while (memory < i + 1 && needle[i] == haystack[i + j])
+				i--;
+			if (i + 1 < memory + 1)
+				return haystack_ + j;
+
+			j += period;
+			memory = needleLength - period;
+		}
+	} else {
+		period = (suffix > needleLength - suffix
+		    ? suffix : needleLength - suffix) + 1;
+
+		while (j <= haystackLength - needleLength) {
+			i = suffix;
+			while (i < needleLength && needle[i] == haystack[i + j])
+				i++;
+
+			if (i < needleLength) {
+				j += i - suffix + 1;
+				continue;
+			}
+
+			i = suffix - 1;
+			while (i != SIZE_MAX && needle[i] == haystack[i + j])
+				i--;
+			if (i == SIZE_MAX)
+				return haystack_ + j;
+
+			j += period;
+		}
+	}
+
+	return NULL;
+}
+
+static const char *
+reverseHorspoolSearch(const char *haystack_, size_t haystackLength,
+    const char *needle_, size_t needleLength)
+{
+	const unsigned char *haystack = (const unsigned char*)haystack_;
+	const unsigned char *needle = (const unsigned char*)needle_;
+	size_t shift[256];
+	size_t j;
+
+	for (size_t i = 0; i < 256; i++)
+		shift[i] = needleLength;
+	for (size_t i = needleLength - 1; i >= 1; i--)
+		shift[needle[i]] = i;
+
+	j = haystackLength - needleLength;
+
+	for (;;) {
+		size_t s;
+
+		if (haystack[j] == needle[0] &&
+		    haystack[j + needleLength - 1] == needle[needleLength - 1] &&
+		    memcmp(haystack + j + 1, needle + 1, needleLength - 2) == 0)
+			return haystack_ + j;
+
+		s = shift[haystack[j]];
+		if (s > j)
+			return NULL;
+
+		j -= s;
+	}
+}
+
+static const char *
+shortNeedleSearch(const char *haystack, size_t haystackLength,
+    const char *needle, size_t needleLength)
+{
+	const char *last = haystack + haystackLength - needleLength;
+	const char *iter = haystack;
+	char first = needle[0], lastByte = needle[needleLength - 1];
+	size_t middleLength = needleLength - 2;
+
+#ifdef HAVE_SSE2_SEARCH
+	const __m128i firstMask = _mm_set1_epi8(first);
+	const __m128i lastMask = _mm_set1_epi8(lastByte);
+
+	/* Compare 16 candidate positions at once */
+	while (last - iter >= 16) {
+		__m128i blockFirst = _mm_loadu_si128((const __m128i*)iter);
+		__m128i blockLast = _mm_loadu_si128(
+		    (const __m128i*)(iter + needleLength - 1));
+		unsigned int mask = _mm_movemask_epi8(_mm_and_si128(
+		    _mm_cmpeq_epi8(blockFirst, firstMask),
+		    _mm_cmpeq_epi8(blockLast, lastMask)));
+
+		while (mask != 0) {
+			unsigned int bit = __builtin_ctz(mask);
+
+			if (memcmp(iter + bit + 1, needle + 1,
+			    middleLength) == 0)
+				return iter + bit;
+
+			mask &= mask - 1;
+		}
+
+		iter += 16;
+	}
+#endif
+
+	while (iter <= last) {
+		iter = memchr(iter, first, last - iter + 1);
+		if (iter == NULL)
+			return NULL;
+
+		if (iter[needleLength - 1] == lastByte &&
+		    memcmp(iter + 1, needle + 1, middleLength) == 0)
+			return iter;
+
+		iter++;
+	}
+
+	return NULL;
+}
+
+static const char *
+reverseShortNeedleSearch(const char *haystack, size_t haystackLength,
+    const char *needle, size_t needleLength)
+{
+	/* One past the last possible match position */
+	size_t end = haystackLength - needleLength + 1;
+	char first = needle[0], lastByte = needle[needleLength - 1];
+	size_t middleLength = (needleLength > 2 ? needleLength - 2 : 0);
+
+#ifdef HAVE_SSE2_SEARCH
+	const __m128i firstMask = _mm_set1_epi8(first);
+	const __m128i lastMask = _mm_set1_epi8(lastByte);
+
+	/* Compare 16 candidate positions at once, starting at the end */
+	while (end >= 16) {
+		const char *block = haystack + end - 16;
+		__m128i blockFirst = _mm_loadu_si128((const __m128i*)block);
+		__m128i blockLast = _mm_loadu_si128(
+		    (const __m128i*)(block + needleLength - 1));
+		unsigned int mask = _mm_movemask_epi8(_mm_and_si128(
+		    _mm_cmpeq_epi8(blockFirst, firstMask),
+		    _mm_cmpeq_epi8(blockLast, lastMask)));
+
+		while (mask != 0) {
+			unsigned int bit = 31 - __builtin_clz(mask);
+
+			if (memcmp(block + bit + 1, needle + 1,
+			    middleLength) == 0)
+				return block + bit;
+
+			mask &= ~(1u << bit);
+		}
+
+		end -= 16;
+	}
+#endif
+
+	while (end > 0) {
+		const char *candidate = haystack + --end;
+
+		if (*candidate == first &&
+		    candidate[needleLength - 1] == lastByte &&
+		    memcmp(candidate + 1, needle + 1, middleLength) == 0)
+			return candidate;
+	}
+
+	return NULL;
+}
+
+const char *
+of_memmem(const char *haystack, size_t haystackLength,
+    const char *needle, size_t needleLength)
+{
+	if (needleLength == 0)
+		return haystack;
+
+	if (needleLength > haystackLength)
+		return NULL;
+
+	if (needleLength == 1)
+		return memchr(haystack, needle[0], haystackLength);
+
+	if (needleLength <= SHORT_NEEDLE_LENGTH)
+		return shortNeedleSearch(haystack, haystackLength,
+		    needle, needleLength);
+
+	return twoWaySearch(haystack, haystackLength, needle, needleLength);
+}
+
+const char *
+of_memrmem(const char *haystack, size_t haystackLength,
+    const char *needle, size_t needleLength)
+{
+	if (needleLength == 0)
+		return haystack + haystackLength;
+
+	if (needleLength > haystackLength)
+		return NULL;
+
+	if (needleLength <= SHORT_NEEDLE_LENGTH)
+		return reverseShortNeedleSearch(haystack, haystackLength,
+		    needle, needleLength);
+
+	return reverseHorspoolSearch(haystack, haystackLength,
+	    needle, needleLength);
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2008, 2009, 2010, 2011, 2012, 2013, 2014, 2015, 2016
+ *   Jonathan Schleifer <js@heap.zone>
+ *
+ * All rights reserved.
+ *
+ * This file is part of ObjFW. It may be distributed under the terms of the
+ * Q Public License 1.0, which can be found in the file LICENSE.QPL included in
+ * the packaging of this file.
+ *
+ * Alternatively, it may be distributed under the terms of the GNU General
+ * Public License, either version 2 or 3, which can be found in the file
+ * LICENSE.GPLv2 or LICENSE.GPLv3 respectively included in the packaging of this
+ * file.
+ */
+
+#ifndef __STDC_LIMIT_MACROS
+# define __STDC_LIMIT_MACROS
+#endif
+#ifndef __STDC_CONSTANT_MACROS
+# define __STDC_CONSTANT_MACROS
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#import "macros.h"
+
+/*
+ * The maximum number of bytes written by of_intmax_to_string() and
+ * of_uintmax_to_string().
+ */
+#define OF_INTMAX_STRING_SIZE (sizeof(uintmax_t) * 3 + 2)
+/*
+ * The maximum number of bytes written by of_double_to_string() and
+ * of_float_to_string().
+ */
+#define OF_DOUBLE_STRING_SIZE 32
+
+OF_ASSUME_NONNULL_BEGIN
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*
+ * Writes the decimal representation of the value to the buffer without a
+ * terminating zero and returns the number of bytes written.
+ */
+extern size_t of_uintmax_to_string(uintmax_t value, char *buffer);
+extern size_t of_intmax_to_string(intmax_t value, char *buffer);
+
+/*
+ * Writes the shortest representation that reads back as the same value to the
+ * buffer without a terminating zero and returns the number of bytes written.
+ *
+ * The notation follows the rules of ECMAScript's Number.prototype.toString(),
+ * e.g. 100, 0.001, 1e+21 and 1.5e-7. NaN and infinity are written as nan, inf
+ * and -inf.
+ */
+extern size_t of_double_to_string(double value, char *buffer);
+extern size_t of_float_to_string(float value, char *buffer);
+
+/*
+ * Parse the string with the semantics of -[OFString decimalValue],
+ * -[OFString hexadecimalValue], -[OFString octalValue],
+ * -[OFString doubleValue] and -[OFString floatValue].
+ *
+ * They return 0 on success, EINVAL if the string is not a valid number,
+ * ERANGE if the value does not fit and ENOMEM if memory could not be
+ * allocated.
+ *
+ * of_parse_double() and of_parse_float() only avoid strtod() and strtof() if
+ * the decimal mantissa is at most 2^53 (2^24 for float) and the power of ten
+ * is at most 10^22 (10^10 for float), as only then a single multiplication or
+ * division rounds correctly. Longer mantissas, which includes every number
+ * with 17 or more significant digits, still take the slow path.
+ */
+extern int of_parse_decimal(const char *string, size_t length,
+    intmax_t *value);
+extern int of_parse_hexadecimal(const char *string, size_t length,
+    uintmax_t *value);
+extern int of_parse_octal(const char *string, size_t length, uintmax_t *value);
+extern int of_parse_double(const char *string, size_t length, double *value);
+extern int of_parse_float(const char *string, size_t length, float *value);
+#ifdef __cplusplus
+}
+#endif
+
+OF_ASSUME_NONNULL_END
@@ -0,0 +1,918 @@
+/*
+ * Copyright (c) 2008, 2009, 2010, 2011, 2012, 2013, 2014, 2015, 2016
+ *   Jonathan Schleifer <js@heap.zone>
+ *
+ * All rights reserved.
+ *
+ * This file is part of ObjFW. It may be distributed under the terms of the
+ * Q Public License 1.0, which can be found in the file LICENSE.QPL included in
+ * the packaging of this file.
+ *
+ * Alternatively, it may be distributed under the terms of the GNU General
+ * Public License, either version 2 or 3, which can be found in the file
+ * LICENSE.GPLv2 or LICENSE.GPLv3 respectively included in the packaging of this
+ * file.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#import "of_numconv.h"
+
+/*
+ * It seems strtod is buggy on Win32.
+ * However, the MinGW version __strtod seems to be ok.
+ */
+#ifdef __MINGW32__
+# define strtod __strtod
+#endif
+
+/*
+ * Decimals that fit into the stack buffer are not copied to the heap when
+ * falling back to strtod().
+ */
+#define FALLBACK_BUFFER_SIZE 128
+
+/*
+ * Floating point operations are only correctly rounded if they are evaluated
+ * in the precision of their type, which is not the case on x87.
+ */
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+# define HAVE_EXACT_FLOAT_OPERATIONS
+#endif
+
+struct diy_fp {
+	uint64_t f;
+	int e;
+};
+
+/* Cached powers of ten 10^k as 64 bit significand and binary exponent. */
+static const struct {
+	uint64_t significand;
+	int16_t binaryExponent, decimalExponent;
+} cachedPowers[] = {
+	{ UINT64_C(0xFA8FD5A0081C0288), -1220, -348 },
+	{ UINT64_C(0xBAAEE17FA23EBF76), -1193, -340 },
+	{ UINT64_C(0x8B16FB203055AC76), -1166, -332 },
+	{ UINT64_C(0xCF42894A5DCE35EA), -1140, -324 },
+	{ UINT64_C(0x9A6BB0AA55653B2D), -1113, -316 },
+	{ UINT64_C(0xE61ACF033D1A45DF), -1087, -308 },
+	{ UINT64_C(0xAB70FE17C79AC6CA), -1060, -300 },
+	{ UINT64_C(0xFF77B1FCBEBCDC4F), -1034, -292 },
+	{ UINT64_C(0xBE5691EF416BD60C), -1007, -284 },
+	{ UINT64_C(0x8DD01FAD907FFC3C), -980, -276 },
+	{ UINT64_C(0xD3515C2831559A83), -954, -268 },
+	{ UINT64_C(0x9D71AC8FADA6C9B5), -927, -260 },
+	{ UINT64_C(0xEA9C227723EE8BCB), -901, -252 },
+	{ UINT64_C(0xAECC49914078536D), -874, -244 },
+	{ UINT64_C(0x823C12795DB6CE57), -847, -236 },
+	{ UINT64_C(0xC21094364DFB5637), -821, -228 },
+	{ UINT64_C(0x9096EA6F3848984F), -794, -220 },
+	{ UINT64_C(0xD77485CB25823AC7), -768, -212 },
+	{ UINT64_C(0xA086CFCD97BF97F4), -741, -204 },
+	{ UINT64_C(0xEF340A98172AACE5), -715, -196 },
+	{ UINT64_C(0xB23867FB2A35B28E), -688, -188 },
+	{ UINT64_C(0x84C8D4DFD2C63F3B), -661, -180 },
+	{ UINT64_C(0xC5DD44271AD3CDBA), -635, -172 },
+	{ UINT64_C(0x936B9FCEBB25C996), -608, -164 },
+	{ UINT64_C(0xDBAC6C247D62A584), -582, -156 },
+	{ UINT64_C(0xA3AB66580D5FDAF6), -555, -148 },
+	{ UINT64_C(0xF3E2F893DEC3F126), -529, -140 },
+	{ UINT64_C(0xB5B5ADA8AAFF80B8), -502, -132 },
+	{ UINT64_C(0x87625F056C7C4A8B), -475, -124 },
+	{ UINT64_C(0xC9BCFF6034C13053), -449, -116 },
+	{ UINT64_C(0x964E858C91BA2655), -422, -108 },
+	{ UINT64_C(0xDFF9772470297EBD), -396, -100 },
+	{ UINT64_C(0xA6DFBD9FB8E5B88F), -369, -92 },
+	{ UINT64_C(0xF8A95FCF88747D94), -343, -84 },
+	{ UINT64_C(0xB94470938FA89BCF), -316, -76 },
+	{ UINT64_C(0x8A08F0F8BF0F156B), -289, -68 },
+	{ UINT64_C(0xCDB02555653131B6), -263, -60 },
+	{ UINT64_C(0x993FE2C6D07B7FAC), -236, -52 },
+	{ UINT64_C(0xE45C10C42A2B3B06), -210, -44 },
+	{ UINT64_C(0xAA242499697392D3), -183, -36 },
+	{ UINT64_C(0xFD87B5F28300CA0E), -157, -28 },
+	{ UINT64_C(0xBCE5086492111AEB), -130, -20 },
+	{ UINT64_C(0x8CBCCC096F5088CC), -103, -12 },
+	{ UINT64_C(0xD1B71758E219652C), -77, -4 },
+	{ UINT64_C(0x9C40000000000000), -50, 4 },
+	{ UINT64_C(0xE8D4A51000000000), -24, 12 },
+	{ UINT64_C(0xAD78EBC5AC620000), 3, 20 },
+	{ UINT64_C(0x813F3978F8940984), 30, 28 },
+	{ UINT64_C(0xC097CE7BC90715B3), 56, 36 },
+	{ UINT64_C(0x8F7E32CE7BEA5C70), 83, 44 },
+	{ UINT64_C(0xD5D238A4ABE98068), 109, 52 },
+	{ UINT64_C(0x9F4F2726179A2245), 136, 60 },
+	{ UINT64_C(0xED63A231D4C4FB27), 162, 68 },
+	{ UINT64_C(0xB0DE65388CC8ADA8), 189, 76 },
+	{ UINT64_C(0x83C7088E1AAB65DB), 216, 84 },
+	{ UINT64_C(0xC45D1DF942711D9A), 242, 92 },
+	{ UINT64_C(0x924D692CA61BE758), 269, 100 },
+	{ UINT64_C(0xDA01EE641A708DEA), 295, 108 },
+	{ UINT64_C(0xA26DA3999AEF774A), 322, 116 },
+	{ UINT64_C(0xF209787BB47D6B85), 348, 124 },
+	{ UINT64_C(0xB454E4A179DD1877), 375, 132 },
+	{ UINT64_C(0x865B86925B9BC5C2), 402, 140 },
+	{ UINT64_C(0xC83553C5C8965D3D), 428, 148 },
+	{ UINT64_C(0x952AB45CFA97A0B3), 455, 156 },
+	{ UINT64_C(0xDE469FBD99A05FE3), 481, 164 },
+	{ UINT64_C(0xA59BC234DB398C25), 508, 172 },
+	{ UINT64_C(0xF6C69A72A3989F5C), 534, 180 },
+	{ UINT64_C(0xB7DCBF5354E9BECE), 561, 188 },
+	{ UINT64_C(0x88FCF317F22241E2), 588, 196 },
+	{ UINT64_C(0xCC20CE9BD35C78A5), 614, 204 },
+	{ UINT64_C(0x98165AF37B2153DF), 641, 212 },
+	{ UINT64_C(0xE2A0B5DC971F303A), 667, 220 },
+	{ UINT64_C(0xA8D9D1535CE3B396), 694, 228 },
+	{ UINT64_C(0xFB9B7CD9A4A7443C), 720, 236 },
+	{ UINT64_C(0xBB764C4CA7A44410), 747, 244 },
+	{ UINT64_C(0x8BAB8EEFB6409C1A), 774, 252 },
+	{ UINT64_C(0xD01FEF10A657842C), 800, 260 },
+	{ UINT64_C(0x9B10A4E5E9913129), 827, 268 },
+	{ UINT64_C(0xE7109BFBA19C0C9D), 853, 276 },
+	{ UINT64_C(0xAC2820D9623BF429), 880, 284 },
+	{ UINT64_C(0x80444B5E7AA7CF85), 907, 292 },
+	{ UINT64_C(0xBF21E44003ACDD2D), 933, 300 },
+	{ UINT64_C(0x8E679C2F5E44FF8F), 960, 308 },
+	{ UINT64_C(0xD433179D9C8CB841), 986, 316 },
+	{ UINT64_C(0x9E19DB92B4E31BA9), 1013, 324 },
+	{ UINT64_C(0xEB96BF6EBADF77D9), 1039, 332 },
+	{ UINT64_C(0xAF87023B9BF0EE6B), 1066, 340 },
+};
+#define CACHED_POWERS_OFFSET 348
+#define CACHED_POWERS_DISTANCE 8
+/* The exponent range of the scaled values during the digit generation. */
+#define MINIMAL_TARGET_EXPONENT -60
+#define MAXIMAL_TARGET_EXPONENT -32
+
+static const char digitPairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536"
+    "37383940414243444546474849505152535455565758596061626364656667686970717273"
+    "7475767778798081828384858687888990919293949596979899";
+
+#ifdef HAVE_EXACT_FLOAT_OPERATIONS
+static const double exactPowersOfTen[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+	1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+#endif
+
+static OF_INLINE bool
+isSpace(char c)
+{
+	return (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f');
+}
+
+size_t
+of_uintmax_to_string(uintmax_t value, char *buffer)
+{
+	char tmp[OF_INTMAX_STRING_SIZE];
+	char *end = tmp + sizeof(tmp), *pointer = end;
+	size_t length;
+
+	while (value >= 100) {
+		unsigned int index = (unsigned int)(value % 100) * 2;
+
+		value /= 100;
+		*--pointer = digitPairs[index + 1];
+		*--pointer = digitPairs[index];
+	}
+
+	if (value >= 10) {
+		unsigned int index = (unsigned int)value * 2;
+
+		*--pointer = digitPairs[index + 1];
+		*--pointer = digitPairs[index];
+	} else
+		*--pointer = '0' + (char)value;
+
+	length = end - pointer;
+	memcpy(buffer, pointer, length);
+
+	return length;
+}
+
+size_t
+of_intmax_to_string(intmax_t value, char *buffer)
+{
+	if (value < 0) {
+		*buffer = '-';
+		return of_uintmax_to_string(-(uintmax_t)value, buffer + 1) + 1;
+	}
+
+	return of_uintmax_to_string(value, buffer);
+}
+
+static OF_INLINE struct diy_fp
+multiply(struct diy_fp a, struct diy_fp b)
+{
+	uint64_t aHigh = a.f >> 32, aLow = a.f & 0xFFFFFFFF;
+	uint64_t bHigh = b.f >> 32, bLow = b.f & 0xFFFFFFFF;
+	uint64_t highHigh = aHigh * bHigh, lowHigh = aLow * bHigh;
+	uint64_t highLow = aHigh * bLow, lowLow = aLow * bLow;
+	/* Add 2^31 to round the result */
+	uint64_t middle = (lowLow >> 32) + (highLow & 0xFFFFFFFF) +
+	    (lowHigh & 0xFFFFFFFF) + (UINT64_C(1) << 31);
+	struct diy_fp ret;
+
+	ret.f = highHigh + (highLow >> 32) + (lowHigh >> 32) + (middle >> 32);
+	ret.e = a.e + b.e + 64;
+
+	return ret;
+}
+
+static OF_INLINE struct diy_fp
+normalize(struct diy_fp value)
+{
+	while (!(value.f & (UINT64_C(0xFFC0000000000000)))) {
+		value.f <<= 10;
+		value.e -= 10;
+	}
+
+	while (!(value.f & (UINT64_C(1) << 63))) {
+		value.f <<= 1;
+		value.e--;
+	}
+
+	return value;
+}
+
+/*
+ * Moves the last generated digit towards w as long as the result stays inside
+ * the unsafe interval. Returns false if the result can not be guaranteed to be
+ * the shortest and closest representation.
+ */
+static bool
+roundWeed(char *digits, int length, uint64_t distanceTooHighW,
+    uint64_t unsafeInterval, uint64_t rest, uint64_t tenKappa, uint64_t unit)
+{
+	uint64_t smallDistance = distanceTooHighW - unit;
+	uint64_t bigDistance = distanceTooHighW + unit;
+
+	while (rest < smallDistance && unsafeInterval - rest >= tenKappa &&
+	    (rest + tenKappa < smallDistance ||
+	    smallDistance - rest >= rest + tenKappa - smallDistance)) {
+		digits[length - 1]--;
+		rest += tenKappa;
+	}
+
+	if (rest < bigDistance && unsafeInterval - rest >= tenKappa &&
+	    (rest + tenKappa < bigDistance ||
+	    bigDistance - rest > rest + tenKappa - bigDistance))
+		return false;
+
+	return (2 * unit <= rest && rest <= unsafeInterval - 4 * unit);
+}
+
+static bool
+generateDigits(struct diy_fp low, struct diy_fp w, struct diy_fp high,
+    char *digits, int *length, int *kappa)
+{
+	static const uint32_t powersOfTen[] = {
+		1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+		1000000000
+	};
+	uint64_t unit = 1;
+	uint64_t tooLow = low.f - unit, tooHigh = high.f + unit;
+	uint64_t unsafeInterval = tooHigh - tooLow;
+	int shift = -w.e;
+	uint64_t one = UINT64_C(1) << shift;
+	uint32_t integrals = (uint32_t)(tooHigh >> shift);
+	uint64_t fractionals = tooHigh & (one - 1);
+	uint32_t divisor;
+
+	*kappa = 10;
+	while (integrals < powersOfTen[*kappa - 1])
+		(*kappa)--;
+	divisor = powersOfTen[*kappa - 1];
+
+	*length = 0;
+	while (*kappa > 0) {
+		uint64_t rest;
+
+		digits[(*length)++] = '0' + integrals / divisor;
+		integrals %= divisor;
+		(*kappa)--;
+
+		rest = ((uint64_t)integrals << shift) + fractionals;
+		if (rest < unsafeInterval)
+			return roundWeed(digits, *length, tooHigh - w.f,
+			    unsafeInterval, rest, (uint64_t)divisor << shift,
+			    unit);
+
+		divisor /= 10;
+	}
+
+	for (;;) {
+		fractionals *= 10;
+		unit *= 10;
+		unsafeInterval *= 10;
+
+		digits[(*length)++] = '0' + (char)(fractionals >> shift);
+		fractionals &= one - 1;
+		(*kappa)--;
+
+		if (fractionals < unsafeInterval)
+			return roundWeed(digits, *length,
+			    (tooHigh - w.f) * unit, unsafeInterval, fractionals,
+			    one, unit);
+	}
+}
+
+/*
+ * Grisu3 by Florian Loitsch. Generates the shortest digits of significand *
+ * 2^exponent so that digits * 10^decimalExponent reads back as the same value
+ * or returns false for the rare cases where this can not be guaranteed.
+ */
+static bool
+grisu3(uint64_t significand, int exponent, bool lowerBoundaryIsCloser,
+    char *digits, int *length, int *decimalExponent)
+{
+	struct diy_fp w, plus, minus, power;
+	int minimalExponent, k, index, kappa;
+
+	w.f = significand;
+	w.e = exponent;
+	w = normalize(w);
+
+	plus.f = (significand << 1) + 1;
+	plus.e = exponent - 1;
+	plus = normalize(plus);
+
+	if (lowerBoundaryIsCloser) {
+		minus.f = (significand << 2) - 1;
+		minus.e = exponent - 2;
+	} else {
+		minus.f = (significand << 1) - 1;
+		minus.e = exponent - 1;
+	}
+	minus.f <<= minus.e - plus.e;
+	minus.e = plus.e;
+
+	/* ceil((minimalExponent + 63) * log10(2)) */
+	minimalExponent = MINIMAL_TARGET_EXPONENT - (w.e + 64);
+	k = (int)((minimalExponent + 63) * 0.30102999566398114);
+	if ((minimalExponent + 63) * 0.30102999566398114 > k)
+		k++;
+	index = (CACHED_POWERS_OFFSET + k - 1) / CACHED_POWERS_DISTANCE + 1;
+
+	power.f = cachedPowers[index].significand;
+	power.e = cachedPowers[index].binaryExponent;
+
+	if (!generateDigits(multiply(minus, power), multiply(w, power),
+	    multiply(plus, power), digits, length, &kappa))
+		return false;
+
+	*decimalExponent = -cachedPowers[index].decimalExponent + kappa;
+
+	return true;
+}
+
+/*
+ * Finds the shortest digits with printf() and strtod() for the cases Grisu3
+ * rejects.
+ */
+static void
+fallbackDigits(double value, bool isFloat, char *digits, int *length,
+    int *decimalExponent)
+{
+	char buffer[40];
+	const char *pointer;
+	int precision;
+
+	for (precision = 1; precision < (isFloat ? 9 : 17); precision++) {
+		snprintf(buffer, sizeof(buffer), "%.*e", precision - 1, value);
+
+		if (isFloat ? strtof(buffer, NULL) == (float)value
+		    : strtod(buffer, NULL) == value)
+			break;
+	}
+
+	snprintf(buffer, sizeof(buffer), "%.*e", precision - 1, value);
+
+	*length = 0;
+	for (pointer = buffer; *pointer != 'e'; pointer++)
+		if (*pointer >= '0' && *pointer <= '9')
+			digits[(*length)++] = *pointer;
+
+	*decimalExponent = (int)strtol(pointer + 1, NULL, 10) - (*length - 1);
+}
+
+static size_t
+formatDigits(char *digits, int length, int decimalExponent, bool negative,
+    char *buffer)
+{
+	char *pointer = buffer;
+	int point, exponent;
+
+	while (length > 1 && digits[length - 1] == '0') {
+		length--;
+		decimalExponent++;
+	}
+
+	if (negative)
+		*pointer++ = '-';
+
+	/* The value is 0.digits * 10^point */
+	point = length + decimalExponent;
+
+	if (length <= point && point <= 21) {
+		memcpy(pointer, digits, length);
+		memset(pointer + length, '0', point - length);
+		pointer += point;
+	} else if (0 < point && point <= 21) {
+		memcpy(pointer, digits, point);
+		pointer[point] = '.';
+		memcpy(pointer + point + 1, digits + point, length - point);
+		pointer += length + 1;
+	} else if (-6 < point && point <= 0) {
+		*pointer++ = '0';
+		*pointer++ = '.';
+		memset(pointer, '0', -point);
+		pointer += -point;
+		memcpy(pointer, digits, length);
+		pointer += length;
+	} else {
+		*pointer++ = digits[0];
+
+		if (length > 1) {
+			*pointer++ = '.';
+			memcpy(pointer, digits + 1, length - 1);
+			pointer += length - 1;
+		}
+
+		exponent = point - 1;
+		*pointer++ = 'e';
+		*pointer++ = (exponent < 0 ? '-' : '+');
+		pointer += of_uintmax_to_string(
+		    (exponent < 0 ? -exponent : exponent), pointer);
+	}
+
+	return pointer - buffer;
+}
+
+static size_t
+formatNonFinite(bool negative, bool isNaN, char *buffer)
+{
+	if (isNaN) {
+		memcpy(buffer, "nan", 3);
+		return 3;
+	}
+
+	if (negative) {
+		memcpy(buffer, "-inf", 4);
+		return 4;
+	}
+
+	memcpy(buffer, "inf", 3);
+	return 3;
+}
+
+static size_t
+formatZero(bool negative, char *buffer)
+{
+	if (negative) {
+		memcpy(buffer, "-0", 2);
+		return 2;
+	}
+
+	*buffer = '0';
+	return 1;
+}
+
+size_t
+of_double_to_string(double value, char *buffer)
+{
+	char digits[20];
+	uint64_t bits, significand;
+	int biasedExponent, length, decimalExponent;
+	bool negative;
+
+	memcpy(&bits, &value, sizeof(bits));
+	negative = (bits >> 63);
+	biasedExponent = (bits >> 52) & 0x7FF;
+	significand = bits & UINT64_C(0xFFFFFFFFFFFFF);
+
+	if (biasedExponent == 0x7FF)
+		return formatNonFinite(negative, (significand != 0), buffer);
+	if (biasedExponent == 0 && significand == 0)
+		return formatZero(negative, buffer);
+
+	if (biasedExponent == 0) {
+		if (!grisu3(significand, -1074, false, digits, &length,
+		    &decimalExponent))
+			fallbackDigits(fabs(value), false, digits, &length,
+			    &decimalExponent);
+	} else {
+		if (!grisu3(significand | (UINT64_C(1) << 52),
+		    biasedExponent - 1075, (significand == 0 &&
+		    biasedExponent > 1), digits, &length, &decimalExponent))
+			fallbackDigits(fabs(value), false, digits, &length,
+			    &decimalExponent);
+	}
+
+	return formatDigits(digits, length, decimalExponent, negative, buffer);
+}
+
+size_t
+of_float_to_string(float value, char *buffer)
+{
+	char digits[20];
+	uint32_t bits, significand;
+	int biasedExponent, length, decimalExponent;
+	bool negative;
+
+	memcpy(&bits, &value, sizeof(bits));
+	negative = (bits >> 31);
+	biasedExponent = (bits >> 23) & 0xFF;
+	significand = bits & 0x7FFFFF;
+
+	if (biasedExponent == 0xFF)
+		return formatNonFinite(negative, (significand != 0), buffer);
+	if (biasedExponent == 0 && significand == 0)
+		return formatZero(negative, buffer);
+
+	if (biasedExponent == 0) {
+		if (!grisu3(significand, -149, false, digits, &length,
+		    &decimalExponent))
+			fallbackDigits(fabsf(value), true, digits, &length,
+			    &decimalExponent);
+	} else {
+		if (!grisu3(significand | (UINT32_C(1) << 23),
+		    biasedExponent - 150, (significand == 0 &&
+		    biasedExponent > 1), digits, &length, &decimalExponent))
+			fallbackDigits(fabsf(value), true, digits, &length,
+			    &decimalExponent);
+	}
+
+	return formatDigits(digits, length, decimalExponent, negative, buffer);
+}
+
+static void
+trimSpaces(const char **string, size_t *length)
+{
+	while (*length > 0 && isSpace(**string)) {
+		(*string)++;
+		(*length)--;
+	}
+
+	while (*length > 0 && isSpace((*string)[*length - 1]))
+		(*length)--;
+}
+
+/* Checks that only whitespace follows a number that ended before the end. */
+static OF_INLINE int
+checkTrailing(const char *string, size_t i, size_t length, bool allowSuffix)
+{
+	if (i == length)
+		return 0;
+
+	if (!isSpace(string[i]) && !(allowSuffix && string[i] == 'h'))
+		return EINVAL;
+
+	for (i++; i < length; i++)
+		if (!isSpace(string[i]))
+			return EINVAL;
+
+	return 0;
+}
+
+int
+of_parse_decimal(const char *string, size_t length, intmax_t *value)
+{
+	uintmax_t result = 0, limit;
+	size_t i = 0, fastEnd;
+	bool negative = false;
+	int error;
+
+	trimSpaces(&string, &length);
+
+	if (length > 0 && (string[0] == '-' || string[0] == '+')) {
+		negative = (string[0] == '-');
+		i++;
+	}
+
+	/* 18 decimal digits always fit into intmax_t, which has >= 64 bits */
+	fastEnd = (length - i > 18 ? i + 18 : length);
+	for (; i < fastEnd; i++) {
+		unsigned char digit = (unsigned char)string[i] - '0';
+
+		if (digit > 9)
+			break;
+
+		result = result * 10 + digit;
+	}
+
+	limit = (negative ? (uintmax_t)INTMAX_MAX + 1 : INTMAX_MAX);
+	for (; i < length; i++) {
+		unsigned char digit = (unsigned char)string[i] - '0';
+
+		if (digit > 9)
+			break;
+
+		if (result > (limit - digit) / 10)
+			return ERANGE;
+
+		result = result * 10 + digit;
+	}
+
+	if ((error = checkTrailing(string, i, length, false)) != 0)
+		return error;
+
+	if (negative && result > 0)
+		*value = -(intmax_t)(result - 1) - 1;
+	else
+		*value = (intmax_t)result;
+
+	return 0;
+}
+
+int
+of_parse_hexadecimal(const char *string, size_t length, uintmax_t *value)
+{
+	uintmax_t result = 0;
+	size_t i = 0, start;
+	int error;
+
+	trimSpaces(&string, &length);
+
+	if (length == 0) {
+		*value = 0;
+		return 0;
+	}
+
+	if (length >= 2 && string[0] == '0' && string[1] == 'x')
+		i = 2;
+	else if (string[0] == 'x' || string[0] == '$')
+		i = 1;
+
+	for (start = i; i < length; i++) {
+		unsigned char c = string[i], digit;
+
+		if (c >= '0' && c <= '9')
+			digit = c - '0';
+		else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+			digit = (c | 0x20) - 'a' + 10;
+		else
+			break;
+
+		if (result > UINTMAX_MAX >> 4)
+			return ERANGE;
+
+		result = (result << 4) | digit;
+	}
+
+	if (i == start)
+		return EINVAL;
+
+	if ((error = checkTrailing(string, i, length, true)) != 0)
+		return error;
+
+	*value = result;
+
+	return 0;
+}
+
+int
+of_parse_octal(const char *string, size_t length, uintmax_t *value)
+{
+	uintmax_t result = 0;
+	size_t i = 0;
+	int error;
+
+	trimSpaces(&string, &length);
+
+	for (; i < length; i++) {
+		unsigned char digit = (unsigned char)string[i] - '0';
+
+		if (digit > 7)
+			break;
+
+		if (result > UINTMAX_MAX >> 3)
+			return ERANGE;
+
+		result = (result << 3) | digit;
+	}
+
+	if ((error = checkTrailing(string, i, length, false)) != 0)
+		return error;
+
+	*value = result;
+
+	return 0;
+}
+
+/*
+ * Splits a plain decimal number into a mantissa of at most 19 digits and an
+ * exponent. Returns false for everything else, which is left to strtod().
+ */
+static bool
+decompose(const char *string, size_t length, uint64_t *mantissa,
+    int *exponent, bool *negative)
+{
+	size_t i = 0;
+	int digits = 0, explicitExponent = 0;
+	bool sawDigit = false;
+
+	*mantissa = 0;
+	*exponent = 0;
+	*negative = false;
+
+	if (i < length && (string[i] == '-' || string[i] == '+'))
+		*negative = (string[i++] == '-');
+
+	for (; i < length; i++) {
+		unsigned char digit = (unsigned char)string[i] - '0';
+
+		if (digit > 9)
+			break;
+
+		sawDigit = true;
+
+		if (*mantissa == 0 && digit == 0)
+			continue;
+		if (digits++ == 19)
+			return false;
+
+		*mantissa = *mantissa * 10 + digit;
+	}
+
+	if (i < length && string[i] == '.') {
+		for (i++; i < length; i++) {
+			unsigned char digit = (unsigned char)string[i] - '0';
+
+			if (digit > 9)
+				break;
+
+			sawDigit = true;
+			(*exponent)--;
+
+			if (*mantissa == 0 && digit == 0)
+				continue;
+			if (digits++ == 19)
+				return false;
+
+			*mantissa = *mantissa * 10 + digit;
+		}
+	}
+
+	if (!sawDigit)
+		return false;
+
+	if (i < length && (string[i] == 'e' || string[i] == 'E')) {
+		bool negativeExponent = false;
+		size_t start;
+
+		i++;
+		if (i < length && (string[i] == '-' || string[i] == '+'))
+			negativeExponent = (string[i++] == '-');
+
+		for (start = i; i < length; i++) {
+			unsigned char digit = (unsigned char)string[i] - '0';
+
+			if (digit > 9)
+				break;
+
+			if (explicitExponent < 100000)
+				explicitExponent = explicitExponent * 10 + digit;
+		}
+
+		if (i == start)
+			return false;
+
+		*exponent += (negativeExponent
+		    ? -explicitExponent : explicitExponent);
+	}
+
+	return (i == length);
+}
+
+/* Returns the number as a NUL-terminated copy for strtod() and strtof(). */
+static char *
+fallbackString(const char *string, size_t length, char *buffer)
+{
+	char *copy = buffer;
+
+	if (length >= FALLBACK_BUFFER_SIZE &&
+	    (copy = malloc(length + 1)) == NULL)
+		return NULL;
+
+	memcpy(copy, string, length);
+	copy[length] = '\0';
+
+	return copy;
+}
+
+int
+of_parse_double(const char *string, size_t length, double *value)
+{
+	char buffer[FALLBACK_BUFFER_SIZE], *copy, *endPointer;
+	uint64_t mantissa;
+	int exponent;
+	bool negative;
+
+	trimSpaces(&string, &length);
+
+	if (length == 0) {
+		*value = 0;
+		return 0;
+	}
+
+	if (decompose(string, length, &mantissa, &exponent, &negative)) {
+		if (mantissa == 0) {
+			*value = (negative ? -0.0 : 0.0);
+			return 0;
+		}
+
+#ifdef HAVE_EXACT_FLOAT_OPERATIONS
+		/*
+		 * Clinger's fast path: Both the mantissa and the power of ten
+		 * are exact doubles, so a single operation rounds correctly.
+		 */
+		while (exponent > 22 &&
+		    mantissa <= (UINT64_C(1) << 53) / 10) {
+			mantissa *= 10;
+			exponent--;
+		}
+
+		if (mantissa <= (UINT64_C(1) << 53) &&
+		    exponent >= -22 && exponent <= 22) {
+			double result = (double)mantissa;
+
+			if (exponent < 0)
+				result /= exactPowersOfTen[-exponent];
+			else
+				result *= exactPowersOfTen[exponent];
+
+			*value = (negative ? -result : result);
+			return 0;
+		}
+#endif
+	}
+
+	if ((copy = fallbackString(string, length, buffer)) == NULL)
+		return ENOMEM;
+
+	*value = strtod(copy, &endPointer);
+
+	if (copy != buffer)
+		free(copy);
+
+	return (endPointer == copy + length ? 0 : EINVAL);
+}
+
+int
+of_parse_float(const char *string, size_t length, float *value)
+{
+	char buffer[FALLBACK_BUFFER_SIZE], *copy, *endPointer;
+	uint64_t mantissa;
+	int exponent;
+	bool negative;
+
+	trimSpaces(&string, &length);
+
+	if (length == 0) {
+		*value = 0;
+		return 0;
+	}
+
+	if (decompose(string, length, &mantissa, &exponent, &negative)) {
+		if (mantissa == 0) {
+			*value = (negative ? -0.0f : 0.0f);
+			return 0;
+		}
+
+#ifdef HAVE_EXACT_FLOAT_OPERATIONS
+		/* 10^10 is the largest power of ten that is an exact float. */
+		if (mantissa <= (UINT64_C(1) << 24) &&
+		    exponent >= -10 && exponent <= 10) {
+			float result = (float)mantissa;
+
+			if (exponent < 0)
+				result /= (float)exactPowersOfTen[-exponent];
+			else
+				result *= (float)exactPowersOfTen[exponent];
+
+			*value = (negative ? -result : result);
+			return 0;
+		}
+#endif
+	}
+
+	if ((copy = fallbackString(string, length, buffer)) == NULL)
+		return ENOMEM;
+
+	*value = strtof(copy, &endPointer);
+
+	if (copy != buffer)
+		free(copy);
+
+	return (endPointer == copy + length ? 0 : EINVAL);
+}
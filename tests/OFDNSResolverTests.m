@@ -0,0 +1,441 @@
+/*
+ * Copyright (c) 2008, 2009, 2010, 2011, 2012, 2013, 2014, 2015, 2016
+ *   Jonathan Schleifer <js@heap.zone>
+ *
+ * All rights reserved.
+ *
+ * This file is part of ObjFW. It may be distributed under the terms of the
+ * Q Public License 1.0, which can be found in the file LICENSE.QPL included in
+ * the packaging of this file.
+ *
+ * Alternatively, it may be distributed under the terms of the GNU General
+ * Public License, either version 2 or 3, which can be found in the file
+ * LICENSE.GPLv2 or LICENSE.GPLv3 respectively included in the packaging of this
+ * file.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#import "OFDNSResolver.h"
+#import "OFUDPSocket.h"
+#import "OFArray.h"
+#import "OFDataArray.h"
+#import "OFDate.h"
+#import "OFRunLoop.h"
+#import "OFString.h"
+#import "OFTCPSocket.h"
+#import "OFAutoreleasePool.h"
+
+#import "OFAddressTranslationFailedException.h"
+#import "OFInvalidArgumentException.h"
+
+#import "TestsAppDelegate.h"
+
+static OFString *module = @"OFDNSResolver";
+
+/*
+ * A stand-in name server that answers every A query with 10.0.0.1, except for
+ * race.example.com, which has 127.0.0.1 and 127.0.0.2, dual.example.com, which
+ * has 127.0.0.1 and ::1, and all names with an "invalid" label, which do not
+ * exist.
+ */
+@interface DNSResolverTestsServer: OFObject
+{
+@public
+	OFUDPSocket *_socket;
+	uint16_t _port;
+	size_t _numQueries;
+	unsigned char _buffer[512];
+}
+@end
+
+@interface DNSResolverTestsClient: OFObject
+{
+@public
+	bool _done;
+	OFDataArray *_addresses;
+	OFException *_exception;
+}
+
+- (void)waitForResult;
+@end
+
+@implementation DNSResolverTestsServer
+- init
+{
+	self = [super init];
+
+	_socket = [[OFUDPSocket alloc] init];
+	_port = [_socket bindToHost: @"127.0.0.1"
+			       port: 0];
+	[_socket asyncReceiveIntoBuffer: _buffer
+				 length: 512
+				 target: self
+			       selector: @selector(socket:didReceiveIntoBuffer:
+					     length:sender:exception:)];
+
+	return self;
+}
+
+- (void)dealloc
+{
+	[_socket cancelAsyncRequests];
+	[_socket release];
+
+	[super dealloc];
+}
+
+-      (bool)socket: (OFUDPSocket*)sock
+  didReceiveIntoBuffer: (void*)buffer_
+		length: (size_t)length
+		sender: (of_udp_socket_address_t)sender
+	     exception: (OFException*)exception
+{
+	unsigned char *buffer = buffer_;
+	unsigned char response[512];
+	size_t questionLength = length - 12, i;
+	bool isA, isAAAA, isInvalid = false, isRace, isDual;
+
+	if (exception != nil || length < 17)
+		return false;
+
+	_numQueries++;
+
+	isA = (buffer[length - 4] == 0 && buffer[length - 3] == 1);
+	isAAAA = (buffer[length - 4] == 0 && buffer[length - 3] == 28);
+	for (i = 12; i < length - 5 && buffer[i] != 0; i += 1 + buffer[i])
+		if (buffer[i] == 7 && memcmp(buffer + i + 1, "invalid", 7) == 0)
+			isInvalid = true;
+	isRace = (buffer[12] == 4 && memcmp(buffer + 13, "race", 4) == 0);
+	isDual = (buffer[12] == 4 && memcmp(buffer + 13, "dual", 4) == 0);
+
+	/* Copy ID and question, set QR, RA and the response code */
+	memcpy(response, buffer, length);
+	response[2] = 0x81;
+	response[3] = (isInvalid ? 0x83 : 0x80);
+	response[6] = 0;
+	response[7] = 0;
+	i = 12 + questionLength;
+
+	if (isA && isDual) {
+		static const unsigned char answers[] = {
+			0xC0, 0x0C, 0x00, 0x01, 0x00, 0x01,
+			0x00, 0x00, 0x00, 0x3C, 0x00, 0x04, 127, 0, 0, 1
+		};
+
+		memcpy(response + i, answers, sizeof(answers));
+		i += sizeof(answers);
+		response[7] = 1;
+	} else if (isAAAA && isDual) {
+		static const unsigned char answers[] = {
+			0xC0, 0x0C, 0x00, 0x1C, 0x00, 0x01,
+			0x00, 0x00, 0x00, 0x3C, 0x00, 0x10,
+			0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1
+		};
+
+		memcpy(response + i, answers, sizeof(answers));
+		i += sizeof(answers);
+		response[7] = 1;
+	} else if (isA && isRace) {
+		static const unsigned char answers[] = {
+			0xC0, 0x0C, 0x00, 0x01, 0x00, 0x01,
+			0x00, 0x00, 0x00, 0x3C, 0x00, 0x04, 127, 0, 0, 1,
+			0xC0, 0x0C, 0x00, 0x01, 0x00, 0x01,
+			0x00, 0x00, 0x00, 0x3C, 0x00, 0x04, 127, 0, 0, 2
+		};
+
+		memcpy(response + i, answers, sizeof(answers));
+		i += sizeof(answers);
+		response[7] = 2;
+	} else if (isA && !isInvalid) {
+		static const unsigned char answers[] = {
+			/* CNAME pointing to itself, which must be skipped */
+			0xC0, 0x0C, 0x00, 0x05, 0x00, 0x01,
+			0x00, 0x00, 0x00, 0x3C, 0x00, 0x02, 0xC0, 0x0C,
+			/* A 10.0.0.1 with a TTL of 60 */
+			0xC0, 0x0C, 0x00, 0x01, 0x00, 0x01,
+			0x00, 0x00, 0x00, 0x3C, 0x00, 0x04, 10, 0, 0, 1
+		};
+
+		memcpy(response + i, answers, sizeof(answers));
+		i += sizeof(answers);
+		response[7] = 2;
+	}
+
+	[sock sendBuffer: response
+		  length: i
+		receiver: &sender];
+
+	return true;
+}
+@end
+
+@implementation DNSResolverTestsClient
+- (void)dealloc
+{
+	[_addresses release];
+	[_exception release];
+
+	[super dealloc];
+}
+
+- (void)resolvedHost: (OFString*)host
+	   addresses: (OFDataArray*)addresses
+	   exception: (OFException*)exception
+{
+	_done = true;
+	_addresses = [addresses retain];
+	_exception = [exception retain];
+}
+
+- (void)socket: (OFTCPSocket*)socket
+  didConnectWithException: (OFException*)exception
+{
+	_done = true;
+	_exception = [exception retain];
+}
+
+- (void)waitForResult
+{
+	OFDate *deadline = [OFDate dateWithTimeIntervalSinceNow: 5];
+
+	while (!_done && [deadline timeIntervalSinceNow] > 0)
+		[[OFRunLoop currentRunLoop] runUntilDate:
+		    [OFDate dateWithTimeIntervalSinceNow: 0.01]];
+}
+@end
+
+static bool
+isAddress(OFDataArray *addresses, size_t index, const char *expected)
+{
+	of_udp_socket_address_t *address;
+	struct sockaddr_in *sin;
+	unsigned char *bytes;
+	char string[16];
+
+	if (index >= [addresses count])
+		return false;
+
+	address = [addresses itemAtIndex: index];
+	sin = (struct sockaddr_in*)&address->address;
+	bytes = (unsigned char*)&sin->sin_addr.s_addr;
+
+	if (sin->sin_family != AF_INET)
+		return false;
+
+	snprintf(string, sizeof(string), "%u.%u.%u.%u",
+	    bytes[0], bytes[1], bytes[2], bytes[3]);
+
+	return (strcmp(string, expected) == 0);
+}
+
+@implementation TestsAppDelegate (OFDNSResolverTests)
+- (void)DNSResolverTests
+{
+	OFAutoreleasePool *pool = [[OFAutoreleasePool alloc] init];
+	DNSResolverTestsServer *server =
+	    [[[DNSResolverTestsServer alloc] init] autorelease];
+	OFDNSResolver *resolver;
+	DNSResolverTestsClient *client;
+#ifdef OF_HAVE_THREADS
+	OFTCPSocket *blackhole, *filler, *listener, *sock, *accepted;
+	uint16_t refusedPort, dualPort;
+	uint16_t port;
+	char buf[6];
+#endif
+
+	TEST(@"+[resolver]", (resolver = [OFDNSResolver resolver]))
+
+	TEST(@"-[setNameServers:]",
+	    R([resolver setNameServers: [OFArray arrayWithObject:
+	    @"127.0.0.1"]]) && R([resolver setNameServerPort: server->_port]) &&
+	    R([resolver setSearchDomains: [OFArray array]]))
+
+	EXPECT_EXCEPTION(@"-[setNameServers:] rejects host names",
+	    OFInvalidArgumentException,
+	    [resolver setNameServers: [OFArray arrayWithObject:
+	    @"localhost"]])
+
+	client = [[[DNSResolverTestsClient alloc] init] autorelease];
+	[resolver asyncResolveHost: @"127.0.0.2"
+			    target: client
+			  selector: @selector(resolvedHost:addresses:
+					exception:)];
+	[client waitForResult];
+	TEST(@"Resolving numeric addresses",
+	    client->_exception == nil && [client->_addresses count] == 1 &&
+	    isAddress(client->_addresses, 0, "127.0.0.2") &&
+	    server->_numQueries == 0)
+
+	client = [[[DNSResolverTestsClient alloc] init] autorelease];
+	[resolver asyncResolveHost: @"WWW.Example.COM."
+			    target: client
+			  selector: @selector(resolvedHost:addresses:
+					exception:)];
+	[client waitForResult];
+	TEST(@"-[asyncResolveHost:target:selector:]",
+	    client->_exception == nil && [client->_addresses count] == 1 &&
+	    isAddress(client->_addresses, 0, "10.0.0.1"))
+
+	client = [[[DNSResolverTestsClient alloc] init] autorelease];
+	server->_numQueries = 0;
+	[resolver asyncResolveHost: @"www.example.com"
+			    target: client
+			  selector: @selector(resolvedHost:addresses:
+					exception:)];
+	[client waitForResult];
+	TEST(@"Answers are cached",
+	    client->_exception == nil &&
+	    isAddress(client->_addresses, 0, "10.0.0.1") &&
+	    server->_numQueries == 0)
+
+	client = [[[DNSResolverTestsClient alloc] init] autorelease];
+	[resolver asyncResolveHost: @"invalid.example.com"
+			    target: client
+			  selector: @selector(resolvedHost:addresses:
+					exception:)];
+	[client waitForResult];
+	TEST(@"Non-existent hosts fail",
+	    client->_done && client->_addresses == nil &&
+	    [client->_exception isKindOfClass:
+	    [OFAddressTranslationFailedException class]])
+
+	[resolver setSearchDomains: [OFArray arrayWithObjects:
+	    @"invalid", @"example.com.", nil]];
+	[resolver setMinNumberOfDotsInAbsoluteName: 1];
+
+	client = [[[DNSResolverTestsClient alloc] init] autorelease];
+	[resolver asyncResolveHost: @"search"
+			    target: client
+			  selector: @selector(resolvedHost:addresses:
+					exception:)];
+	[client waitForResult];
+	TEST(@"Host names without a dot are tried in the search domains",
+	    client->_exception == nil && [client->_addresses count] == 1 &&
+	    isAddress(client->_addresses, 0, "10.0.0.1"))
+
+	client = [[[DNSResolverTestsClient alloc] init] autorelease];
+	[resolver asyncResolveHost: @"invalid"
+			    target: client
+			  selector: @selector(resolvedHost:addresses:
+					exception:)];
+	[client waitForResult];
+	TEST(@"Host names not in any search domain fail",
+	    client->_done && client->_addresses == nil &&
+	    [client->_exception isKindOfClass:
+	    [OFAddressTranslationFailedException class]])
+
+	[resolver setSearchDomains: [OFArray array]];
+
+	/*
+	 * Nothing answers on 127.0.0.2, so the query can only succeed before
+	 * the timeout if it is restarted with the new name server.
+	 */
+	[resolver setNameServers: [OFArray arrayWithObjects:
+	    @"127.0.0.2", @"127.0.0.3", nil]];
+	client = [[[DNSResolverTestsClient alloc] init] autorelease];
+	[resolver asyncResolveHost: @"moved.example.com"
+			    target: client
+			  selector: @selector(resolvedHost:addresses:
+					exception:)];
+	[[OFRunLoop currentRunLoop] runUntilDate:
+	    [OFDate dateWithTimeIntervalSinceNow: 0.01]];
+	[resolver setNameServers: [OFArray arrayWithObject: @"127.0.0.1"]];
+	[client waitForResult];
+	TEST(@"-[setNameServers:] restarts queries in flight",
+	    client->_exception == nil && [client->_addresses count] == 1 &&
+	    isAddress(client->_addresses, 0, "10.0.0.1"))
+
+#ifdef OF_HAVE_THREADS
+	/*
+	 * A listener with a backlog of 0 drops all SYNs once a connection is
+	 * waiting to be accepted. This blackholes 127.0.0.1, so that the
+	 * connect has to move on to 127.0.0.2 while the first attempt hangs.
+	 */
+	blackhole = [OFTCPSocket socket];
+	port = [blackhole bindToHost: @"127.0.0.1"
+				port: 0];
+	[blackhole listenWithBackLog: 0];
+	filler = [OFTCPSocket socket];
+	[filler connectToHost: @"127.0.0.1"
+			 port: port];
+
+	listener = [OFTCPSocket socket];
+	[listener bindToHost: @"127.0.0.2"
+			port: port];
+	[listener listen];
+
+	sock = [OFTCPSocket socket];
+	[sock setDNSResolver: resolver];
+	client = [[[DNSResolverTestsClient alloc] init] autorelease];
+	[sock asyncConnectToHost: @"race.example.com"
+			    port: port
+			  target: client
+			selector: @selector(socket:didConnectWithException:)];
+	[client waitForResult];
+	TEST(@"-[OFTCPSocket asyncConnectToHost:port:target:selector:] races "
+	    @"addresses",
+	    client->_done && client->_exception == nil &&
+	    (accepted = [listener accept]) &&
+	    [sock writeString: @"Hello!"] &&
+	    R([accepted readIntoBuffer: buf
+			   exactLength: 6]) && !memcmp(buf, "Hello!", 6))
+
+	/*
+	 * Nothing listens on 127.0.0.1 with this port, so the first attempt is
+	 * refused and closed, and the second one most likely gets the same
+	 * file descriptor number.
+	 */
+	listener = [OFTCPSocket socket];
+	refusedPort = [listener bindToHost: @"127.0.0.2"
+				      port: 0];
+	[listener listen];
+
+	sock = [OFTCPSocket socket];
+	[sock setDNSResolver: resolver];
+	client = [[[DNSResolverTestsClient alloc] init] autorelease];
+	[sock asyncConnectToHost: @"race.example.com"
+			    port: refusedPort
+			  target: client
+			selector: @selector(socket:didConnectWithException:)];
+	[client waitForResult];
+	TEST(@"-[OFTCPSocket asyncConnectToHost:port:target:selector:] skips "
+	    @"refused addresses",
+	    client->_done && client->_exception == nil &&
+	    (accepted = [listener accept]) &&
+	    [sock writeString: @"Hello!"] &&
+	    R([accepted readIntoBuffer: buf
+			   exactLength: 6]) && !memcmp(buf, "Hello!", 6))
+
+	/*
+	 * IPv6 is tried first, but nothing listens on ::1, or IPv6 is not
+	 * available at all. Either way, the connect has to fall back to IPv4.
+	 */
+	listener = [OFTCPSocket socket];
+	dualPort = [listener bindToHost: @"127.0.0.1"
+				   port: 0];
+	[listener listen];
+
+	sock = [OFTCPSocket socket];
+	[sock setDNSResolver: resolver];
+	client = [[[DNSResolverTestsClient alloc] init] autorelease];
+	[sock asyncConnectToHost: @"dual.example.com"
+			    port: dualPort
+			  target: client
+			selector: @selector(socket:didConnectWithException:)];
+	[client waitForResult];
+	TEST(@"-[OFTCPSocket asyncConnectToHost:port:target:selector:] falls "
+	    @"back to the other address family",
+	    client->_done && client->_exception == nil &&
+	    (accepted = [listener accept]) &&
+	    [sock writeString: @"Hello!"] &&
+	    R([accepted readIntoBuffer: buf
+			   exactLength: 6]) && !memcmp(buf, "Hello!", 6))
+#endif
+
+	[pool drain];
+}
+@end
@@ -20,21 +20,38 @@
 #include <string.h>
 
 #import "OFHTTPClient.h"
+#import "OFHTTPServer.h"
 #import "OFHTTPRequest.h"
 #import "OFHTTPResponse.h"
 #import "OFString.h"
 #import "OFTCPSocket.h"
 #import "OFThread.h"
 #import "OFCondition.h"
+#import "OFRunLoop.h"
 #import "OFURL.h"
+#import "OFDate.h"
 #import "OFDictionary.h"
 #import "OFDataArray.h"
 #import "OFAutoreleasePool.h"
 
+#import "OFChecksumFailedException.h"
+
 #import "TestsAppDelegate.h"
 
+#define ASYNC_REQUESTS 64
+
 static OFString *module = @"OFHTTPClient";
 static OFCondition *cond;
+/* "compressed ok" */
+static const uint8_t gzipBody[] = {
+	0x1F, 0x8B, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x4B, 0xCE,
+	0xCF, 0x2D, 0x28, 0x4A, 0x2D, 0x2E, 0x4E, 0x4D, 0x51, 0xC8, 0xCF, 0x06,
+	0x00, 0xA8, 0xBC, 0x34, 0x78, 0x0D, 0x00, 0x00, 0x00
+};
+static const uint8_t zlibBody[] = {
+	0x78, 0x9C, 0x4B, 0xCE, 0xCF, 0x2D, 0x28, 0x4A, 0x2D, 0x2E, 0x4E, 0x4D,
+	0x51, 0xC8, 0xCF, 0x06, 0x00, 0x25, 0x8A, 0x05, 0x30
+};
 
 @interface HTTPClientTestsServer: OFThread
 {
@@ -43,6 +60,30 @@ static OFCondition *cond;
 }
 @end
 
+@interface HTTPClientTestsPoolServer: OFThread <OFHTTPServerDelegate>
+{
+@public
+	uint16_t _port;
+}
+@end
+
+@interface HTTPClientTestsAsyncDelegate: OFObject <OFHTTPClientDelegate>
+{
+@public
+	const char *_expectedBody;
+	size_t _succeeded, _failed;
+}
+@end
+
+@interface HTTPClientTestsBodyReader: OFObject
+{
+@public
+	HTTPClientTestsAsyncDelegate *_delegate;
+	OFDataArray *_body;
+	char _buffer[16];
+}
+@end
+
 @implementation HTTPClientTestsServer
 - main
 {
@@ -84,7 +125,318 @@ static OFCondition *cond;
 }
 @end
 
+@implementation HTTPClientTestsPoolServer
+- main
+{
+	OFHTTPServer *server = [OFHTTPServer server];
+
+	[server setDelegate: self];
+	[server setHost: @"127.0.0.1"];
+
+	[cond lock];
+	[server start];
+	_port = [server port];
+	[cond signal];
+	[cond unlock];
+
+	[[OFRunLoop currentRunLoop] run];
+
+	[server stop];
+
+	return nil;
+}
+
+-      (void)server: (OFHTTPServer*)server
+  didReceiveRequest: (OFHTTPRequest*)request
+	   response: (OFHTTPResponse*)response
+{
+	OFString *path = [[request URL] path];
+
+	/* The server passes the path without the leading slash */
+	if ([path isEqual: @"gzip"] || [path isEqual: @"deflate"] ||
+	    [path isEqual: @"corrupt"]) {
+		bool gzip = [path isEqual: @"gzip"];
+		uint8_t body[sizeof(zlibBody)];
+
+		memcpy(body, zlibBody, sizeof(body));
+
+		/* Breaks the Adler-32 at the end */
+		if ([path isEqual: @"corrupt"])
+			body[sizeof(body) - 1] ^= 0xFF;
+
+		if ([[request headers] objectForKey: @"Accept-Encoding"] ==
+		    nil) {
+			[response setStatusCode: 406];
+			[response close];
+			return;
+		}
+
+		[response setStatusCode: 200];
+
+		/* Without a Content-Length, the body is sent chunked */
+		if (gzip)
+			[response setHeaders: [OFDictionary
+			    dictionaryWithObject: @"gzip"
+					  forKey: @"Content-Encoding"]];
+		else
+			[response setHeaders: [OFDictionary
+			    dictionaryWithKeysAndObjects:
+			    @"Content-Encoding", @"deflate",
+			    @"Content-Length", [OFString stringWithFormat:
+			    @"%zu", sizeof(zlibBody)], nil]];
+
+		[response writeBuffer: (gzip ? gzipBody : body)
+			       length: (gzip
+					   ? sizeof(gzipBody)
+					   : sizeof(zlibBody))];
+		[response close];
+		return;
+	}
+
+	[response setStatusCode: 200];
+	[response setHeaders: [OFDictionary
+	    dictionaryWithObject: @"2"
+			  forKey: @"Content-Length"]];
+	[response writeString: @"ok"];
+	[response close];
+}
+@end
+
+@implementation HTTPClientTestsBodyReader
+- init
+{
+	self = [super init];
+
+	_body = [[OFDataArray alloc] init];
+
+	return self;
+}
+
+- (void)dealloc
+{
+	[_body release];
+
+	[super dealloc];
+}
+
+- (bool)stream: (OFStream*)stream
+  didReadIntoBuffer: (void*)buffer
+	     length: (size_t)length
+	  exception: (OFException*)exception
+{
+	if (exception != nil) {
+		_delegate->_failed++;
+		return false;
+	}
+
+	[_body addItems: buffer
+		  count: length];
+
+	if (![stream isAtEndOfStream])
+		return true;
+
+	if ([_body count] == strlen(_delegate->_expectedBody) &&
+	    memcmp([_body items], _delegate->_expectedBody, [_body count]) == 0)
+		_delegate->_succeeded++;
+	else
+		_delegate->_failed++;
+
+	return false;
+}
+@end
+
+@implementation HTTPClientTestsAsyncDelegate
+- init
+{
+	self = [super init];
+
+	_expectedBody = "ok";
+
+	return self;
+}
+
+-      (void)client: (OFHTTPClient*)client
+  didPerformRequest: (OFHTTPRequest*)request
+	   response: (OFHTTPResponse*)response
+{
+	HTTPClientTestsBodyReader *reader =
+	    [[[HTTPClientTestsBodyReader alloc] init] autorelease];
+
+	/* The body is streamed from the run loop as well */
+	reader->_delegate = self;
+	[response asyncReadIntoBuffer: reader->_buffer
+			       length: sizeof(reader->_buffer)
+			       target: reader
+			     selector: @selector(stream:didReadIntoBuffer:
+					   length:exception:)];
+}
+
+-	  (void)client: (OFHTTPClient*)client
+  didFailWithException: (OFException*)exception
+	       request: (OFHTTPRequest*)request
+{
+	_failed++;
+}
+@end
+
+static HTTPClientTestsPoolServer*
+startPoolServer(void)
+{
+	HTTPClientTestsPoolServer *server =
+	    [[[HTTPClientTestsPoolServer alloc] init] autorelease];
+
+	[cond lock];
+	[server start];
+	[cond wait];
+	[cond unlock];
+
+	return server;
+}
+
+static bool
+requestOK(OFHTTPClient *client, HTTPClientTestsPoolServer *server)
+{
+	OFURL *URL = [OFURL URLWithString:
+	    [OFString stringWithFormat: @"http://127.0.0.1:%" @PRIu16 "/",
+					server->_port]];
+	OFHTTPResponse *response = [client performRequest:
+	    [OFHTTPRequest requestWithURL: URL]];
+	OFDataArray *data = [response readDataArrayTillEndOfStream];
+
+	return ([data count] == 2 && memcmp([data items], "ok", 2) == 0);
+}
+
+static bool
+requestCompressed(OFHTTPClient *client, HTTPClientTestsPoolServer *server,
+    OFString *path)
+{
+	OFURL *URL = [OFURL URLWithString:
+	    [OFString stringWithFormat: @"http://127.0.0.1:%" @PRIu16 "%@",
+					server->_port, path]];
+	OFHTTPResponse *response = [client performRequest:
+	    [OFHTTPRequest requestWithURL: URL]];
+	OFDataArray *data = [response readDataArrayTillEndOfStream];
+
+	return ([data count] == 13 &&
+	    memcmp([data items], "compressed ok", 13) == 0);
+}
+
 @implementation TestsAppDelegate (OFHTTPClientTests)
+- (void)HTTPClientPoolTests
+{
+	OFAutoreleasePool *pool = [[OFAutoreleasePool alloc] init];
+	HTTPClientTestsPoolServer *server1, *server2;
+	OFHTTPClient *client = [OFHTTPClient client];
+	of_http_client_statistics_t statistics;
+	HTTPClientTestsAsyncDelegate *delegate;
+	OFURL *URL;
+	OFHTTPRequest *request;
+	OFDate *deadline;
+	size_t i;
+
+	server1 = startPoolServer();
+	server2 = startPoolServer();
+
+	TEST(@"Reusing pooled connections",
+	    requestOK(client, server1) && requestOK(client, server1) &&
+	    requestOK(client, server1) &&
+	    (statistics = [client statistics]).connectionsCreated == 1 &&
+	    statistics.connectionsReused == 2 &&
+	    statistics.activeConnections == 0 &&
+	    statistics.idleConnections == 1)
+
+	TEST(@"Separate pools per host and port",
+	    requestOK(client, server2) &&
+	    (statistics = [client statistics]).connectionsCreated == 2 &&
+	    statistics.idleConnections == 2)
+
+	[client setIdleTimeout: 0];
+	TEST(@"Evicting idle connections",
+	    requestOK(client, server1) &&
+	    (statistics = [client statistics]).connectionsCreated == 3 &&
+	    statistics.connectionsEvicted == 1)
+
+	TEST(@"-[close]", R([client close]) &&
+	    [client statistics].idleConnections == 0)
+
+	client = [OFHTTPClient client];
+	[client setDecompressesResponses: true];
+	TEST(@"Decompressing gzip and Deflate responses",
+	    requestCompressed(client, server1, @"/gzip") &&
+	    requestCompressed(client, server1, @"/deflate") &&
+	    (statistics = [client statistics]).connectionsCreated == 1 &&
+	    statistics.connectionsReused == 1)
+
+	EXPECT_EXCEPTION(@"Detection of a wrong Adler-32 in Deflate responses",
+	    OFChecksumFailedException,
+	    requestCompressed(client, server1, @"/corrupt"))
+
+	URL = [OFURL URLWithString:
+	    [OFString stringWithFormat: @"http://127.0.0.1:%" @PRIu16 "/",
+					server1->_port]];
+	client = [OFHTTPClient client];
+	delegate = [[[HTTPClientTestsAsyncDelegate alloc] init] autorelease];
+	[client setDelegate: delegate];
+	[client setMaxConnectionsPerHost: 4];
+	[client setTimeout: 30];
+
+	for (i = 0; i < ASYNC_REQUESTS; i++)
+		[client asyncPerformRequest:
+		    [OFHTTPRequest requestWithURL: URL]];
+
+	deadline = [OFDate dateWithTimeIntervalSinceNow: 30];
+	while (delegate->_succeeded + delegate->_failed < ASYNC_REQUESTS &&
+	    [deadline timeIntervalSinceNow] > 0)
+		[[OFRunLoop currentRunLoop] runUntilDate:
+		    [OFDate dateWithTimeIntervalSinceNow: 0.01]];
+
+	TEST(@"-[asyncPerformRequest:] with concurrent requests",
+	    delegate->_succeeded == ASYNC_REQUESTS &&
+	    (statistics = [client statistics]).connectionsCreated <= 4 &&
+	    statistics.connectionsCreated + statistics.connectionsReused ==
+	    ASYNC_REQUESTS && statistics.activeConnections == 0)
+
+	request = [OFHTTPRequest requestWithURL: URL];
+	TEST(@"-[cancelAsyncRequest:]",
+	    R([client asyncPerformRequest: request]) &&
+	    R([client cancelAsyncRequest: request]) &&
+	    R([[OFRunLoop currentRunLoop] runUntilDate:
+	    [OFDate dateWithTimeIntervalSinceNow: 0.1]]) &&
+	    delegate->_succeeded == ASYNC_REQUESTS && delegate->_failed == 0 &&
+	    [client statistics].activeConnections == 0)
+
+	client = [OFHTTPClient client];
+	delegate = [[[HTTPClientTestsAsyncDelegate alloc] init] autorelease];
+	delegate->_expectedBody = "compressed ok";
+	[client setDelegate: delegate];
+	[client setDecompressesResponses: true];
+	[client setTimeout: 30];
+
+	[client asyncPerformRequest: [OFHTTPRequest requestWithURL:
+	    [OFURL URLWithString: [OFString stringWithFormat:
+	    @"http://127.0.0.1:%" @PRIu16 "/gzip", server1->_port]]]];
+	[client asyncPerformRequest: [OFHTTPRequest requestWithURL:
+	    [OFURL URLWithString: [OFString stringWithFormat:
+	    @"http://127.0.0.1:%" @PRIu16 "/deflate", server1->_port]]]];
+
+	deadline = [OFDate dateWithTimeIntervalSinceNow: 30];
+	while (delegate->_succeeded + delegate->_failed < 2 &&
+	    [deadline timeIntervalSinceNow] > 0)
+		[[OFRunLoop currentRunLoop] runUntilDate:
+		    [OFDate dateWithTimeIntervalSinceNow: 0.01]];
+
+	TEST(@"Decompressing responses read from the run loop",
+	    delegate->_succeeded == 2 &&
+	    [client statistics].activeConnections == 0)
+
+	[[server1 runLoop] stop];
+	[[server2 runLoop] stop];
+	[server1 join];
+	[server2 join];
+
+	[pool drain];
+}
+
 - (void)HTTPClientTests
 {
 	OFAutoreleasePool *pool = [[OFAutoreleasePool alloc] init];
@@ -122,6 +474,8 @@ static OFCondition *cond;
 
 	[server join];
 
+	[self HTTPClientPoolTests];
+
 	[pool drain];
 }
 @end
@@ -0,0 +1,872 @@
+/*
+ * Copyright (c) 2008, 2009, 2010, 2011, 2012, 2013, 2014, 2015, 2016
+ *   Jonathan Schleifer <js@heap.zone>
+ *
+ * All rights reserved.
+ *
+ * This file is part of ObjFW. It may be distributed under the terms of the
+ * Q Public License 1.0, which can be found in the file LICENSE.QPL included in
+ * the packaging of this file.
+ *
+ * Alternatively, it may be distributed under the terms of the GNU General
+ * Public License, either version 2 or 3, which can be found in the file
+ * LICENSE.GPLv2 or LICENSE.GPLv3 respectively included in the packaging of this
+ * file.
+ */
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#import "OFHTTPServer.h"
+#import "OFHTTPClient.h"
+#import "OFHTTPRequest.h"
+#import "OFHTTPResponse.h"
+#import "OFHTTPRouter.h"
+#import "OFString.h"
+#import "OFTCPSocket.h"
+#import "OFThread.h"
+#import "OFRunLoop.h"
+#import "OFURL.h"
+#import "OFDate.h"
+#import "OFArray.h"
+#import "OFDictionary.h"
+#import "OFDataArray.h"
+#import "OFDeflateStream.h"
+#import "OFAutoreleasePool.h"
+
+#import "OFInvalidArgumentException.h"
+
+#import "of_http_parser.h"
+
+#import "TestsAppDelegate.h"
+
+static OFString *module = @"OFHTTPServer";
+static const char *request = "POST /foo?bar HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8080\r\n"
+    "x-foo-bar:  a \r\n"
+    "Content-Length: 3\r\n"
+    "X-FOO-BAR: b\r\n"
+    "Connection: Upgrade, Keep-Alive\r\n"
+    "\r\n"
+    "foo";
+static const char *chunkedHead = "POST / HTTP/1.1\r\n"
+    "Transfer-Encoding: Chunked\r\n"
+    "\r\n";
+static const char *gzipHead = "POST / HTTP/1.1\r\n"
+    "Transfer-Encoding: gzip, chunked\r\n"
+    "\r\n";
+static const char *invalidHeads[] = {
+	"GET  / HTTP/1.1\r\n\r\n",
+	"GET / HTTP/1.1 \r\n\r\n",
+	"GET / HTTP/1.x\r\n\r\n",
+	"GET / HTTP/1.1\r\n folded\r\n\r\n",
+	"GET / HTTP/1.1\r\nNo Colon\r\n\r\n",
+	"GET / HTTP/1.1\r\nName : value\r\n\r\n",
+	"GET / HTTP/1.1\r\nX: a\001b\r\n\r\n",
+	"GET / HTTP/1.1\r\nX: \377\r\n\r\n",
+	"GET / HTTP/1.1\rX: y\r\n\r\n",
+	"GET /\177 HTTP/1.1\r\n\r\n",
+	NULL
+};
+
+@interface HTTPServerTestsDelegate: OFObject <OFHTTPServerDelegate>
+@end
+
+@interface HTTPServerTestsRouteHandler: OFObject <OFHTTPRouteHandler>
+@end
+
+@interface HTTPServerTestsCompressionClient: OFThread
+{
+@public
+	uint16_t _port;
+	OFString *_path;
+	OFDataArray *_body;
+	OFString *_contentEncoding, *_vary;
+	volatile bool _done;
+}
+@end
+
+static OFString*
+compressedLine(size_t i)
+{
+	return [OFString stringWithFormat:
+	    @"Line %zu of a response that is compressed by the server\n", i];
+}
+
+@interface HTTPServerTestsClient: OFThread
+{
+@public
+	uint16_t _port;
+	OFMutableArray *_bodies;
+	OFString *_lastConnection, *_lastDate;
+	bool _closed;
+	volatile bool _done;
+}
+@end
+
+/* Discards everything written to it */
+@interface HTTPServerTestsNullStream: OFStream
+@end
+
+/* Sends requests one after another and reads the responses */
+@interface HTTPServerTestsLoadClient: OFThread
+{
+@public
+	uint16_t _port;
+	size_t _requests;
+	bool _keepAlive;
+	volatile bool _done;
+}
+@end
+
+@implementation HTTPServerTestsDelegate
+-      (void)server: (OFHTTPServer*)server
+  didReceiveRequest: (OFHTTPRequest*)request
+	   response: (OFHTTPResponse*)response
+{
+	OFMutableString *reply;
+	OFDataArray *body = [request body];
+
+	/* Every line is a separate write and thus a separate chunk */
+	if ([[[request URL] path] isEqual: @"compressed"]) {
+		[response setStatusCode: 200];
+		[response setHeaders: [OFDictionary
+		    dictionaryWithObject: @"text/plain; charset=UTF-8"
+				  forKey: @"Content-Type"]];
+
+		for (size_t i = 0; i < 200; i++)
+			[response writeString: compressedLine(i)];
+
+		[response close];
+		return;
+	}
+
+#ifdef OF_HAVE_FILES
+	if ([[[request URL] path] isEqual: @"file"]) {
+		/* Closes the response once the file has been sent */
+		[server sendFileAtPath: @"testfile.bin"
+			    forRequest: request
+			      response: response];
+		return;
+	}
+#endif
+
+	reply = [OFMutableString stringWithString:
+	    [[request headers] objectForKey: @"X-Test"]];
+
+	if (body != nil)
+		[reply appendString: [OFString
+		    stringWithUTF8String: [body items]
+				  length: [body count]]];
+
+	[response setStatusCode: 200];
+	[response setHeaders: [OFDictionary dictionaryWithObject:
+	    [OFString stringWithFormat: @"%zu", [reply UTF8StringLength]]
+							  forKey:
+	    @"Content-Length"]];
+	[response writeString: reply];
+	[response close];
+}
+@end
+
+@implementation HTTPServerTestsClient
+- (void)dealloc
+{
+	[_bodies release];
+	[_lastConnection release];
+	[_lastDate release];
+
+	[super dealloc];
+}
+
+- main
+{
+	OFTCPSocket *socket = [OFTCPSocket socket];
+
+	_bodies = [[OFMutableArray alloc] init];
+
+	@try {
+		[socket connectToHost: @"127.0.0.1"
+				 port: _port];
+
+		/* All requests are sent before reading any response. */
+		[socket writeString: @"GET /a HTTP/1.1\r\n"
+				     @"Host: 127.0.0.1\r\n"
+				     @"X-Test: a\r\n"
+				     @"\r\n"
+				     @"POST /b HTTP/1.1\r\n"
+				     @"Host: 127.0.0.1\r\n"
+				     @"X-Test: b\r\n"
+				     @"Content-Length: 3\r\n"
+				     @"\r\n"
+				     @"foo"
+				     @"POST /d HTTP/1.1\r\n"
+				     @"Host: 127.0.0.1\r\n"
+				     @"X-Test: d\r\n"
+				     @"Transfer-Encoding: chunked\r\n"
+				     @"\r\n"
+				     @"3\r\nfoo\r\n"
+				     @"2;x=y\r\nba\r\n"
+				     @"0\r\n"
+				     @"X-Trailer: z\r\n"
+				     @"\r\n"
+				     @"GET /c HTTP/1.1\r\n"
+				     @"Host: 127.0.0.1\r\n"
+				     @"X-Test: c\r\n"
+				     @"Connection: close\r\n"
+				     @"\r\n"];
+
+		for (size_t i = 0; i < 4; i++) {
+			OFString *line;
+			size_t length = 0;
+			char buffer[16];
+
+			if (![[socket readLine] hasPrefix: @"HTTP/1.1 200 "])
+				break;
+
+			[_lastConnection release];
+			_lastConnection = nil;
+
+			while ((line = [socket readLine]) != nil &&
+			    [line length] > 0) {
+				if ([line hasPrefix: @"Content-Length: "])
+					length = (size_t)[[line
+					    substringWithRange: of_range(16,
+					    [line length] - 16)] decimalValue];
+				else if ([line hasPrefix: @"Connection: "])
+					_lastConnection = [[line
+					    substringWithRange: of_range(12,
+					    [line length] - 12)] retain];
+				else if ([line hasPrefix: @"Date: "]) {
+					[_lastDate release];
+					_lastDate = [[line
+					    substringWithRange: of_range(6,
+					    [line length] - 6)] retain];
+				}
+			}
+
+			if (line == nil || length > sizeof(buffer))
+				break;
+
+			[socket readIntoBuffer: buffer
+				   exactLength: length];
+			[_bodies addObject:
+			    [OFString stringWithUTF8String: buffer
+						    length: length]];
+		}
+
+		_closed = ([socket readLine] == nil);
+	} @finally {
+		_done = true;
+	}
+
+	return nil;
+}
+@end
+
+@implementation HTTPServerTestsNullStream
+- (void)lowlevelWriteBuffer: (const void*)buffer
+		     length: (size_t)length
+{
+}
+@end
+
+@implementation HTTPServerTestsLoadClient
+- main
+{
+	OFAutoreleasePool *pool = [[OFAutoreleasePool alloc] init];
+	OFString *request = (_keepAlive
+	    ? @"GET / HTTP/1.1\r\nHost: 127.0.0.1\r\nX-Test: x\r\n\r\n"
+	    : @"GET / HTTP/1.1\r\nHost: 127.0.0.1\r\nX-Test: x\r\n"
+	      @"Connection: close\r\n\r\n");
+	OFTCPSocket *socket = nil;
+
+	@try {
+		for (size_t i = 0; i < _requests; i++) {
+			OFString *line;
+			size_t length = 0;
+			bool reconnect = !_keepAlive;
+			char buffer[16];
+
+			if (socket == nil) {
+				socket = [[OFTCPSocket alloc] init];
+				[socket connectToHost: @"127.0.0.1"
+						 port: _port];
+			}
+
+			[socket writeString: request];
+
+			if (![[socket readLine] hasPrefix: @"HTTP/1.1 200 "])
+				break;
+
+			while ((line = [socket readLine]) != nil &&
+			    [line length] > 0) {
+				if ([line hasPrefix: @"Content-Length: "])
+					length = (size_t)[[line
+					    substringWithRange: of_range(16,
+					    [line length] - 16)] decimalValue];
+				else if ([line isEqual: @"Connection: close"])
+					reconnect = true;
+			}
+
+			if (line == nil || length > sizeof(buffer))
+				break;
+
+			[socket readIntoBuffer: buffer
+				   exactLength: length];
+
+			/* The server limits the requests per connection */
+			if (reconnect) {
+				[socket release];
+				socket = nil;
+			}
+
+			[pool releaseObjects];
+		}
+	} @finally {
+		[socket release];
+		[pool release];
+		_done = true;
+	}
+
+	return nil;
+}
+@end
+
+static void
+runLoadClients(size_t count, uint16_t port, size_t requests, bool keepAlive)
+{
+	OFMutableArray *clients = [OFMutableArray arrayWithCapacity: count];
+	OFDate *deadline;
+
+	for (size_t i = 0; i < count; i++) {
+		HTTPServerTestsLoadClient *client =
+		    [[[HTTPServerTestsLoadClient alloc] init] autorelease];
+
+		client->_port = port;
+		client->_requests = requests;
+		client->_keepAlive = keepAlive;
+		[clients addObject: client];
+	}
+
+	for (HTTPServerTestsLoadClient *client in clients)
+		[client start];
+
+	/* The server accepts in this thread, so its run loop has to run */
+	deadline = [OFDate dateWithTimeIntervalSinceNow: 60];
+	for (HTTPServerTestsLoadClient *client in clients) {
+		while (!client->_done && [deadline timeIntervalSinceNow] > 0)
+			[[OFRunLoop currentRunLoop] runUntilDate:
+			    [OFDate dateWithTimeIntervalSinceNow: 0.001]];
+
+		[client join];
+	}
+}
+
+@implementation HTTPServerTestsRouteHandler
+-      (void)server: (OFHTTPServer*)server
+  didReceiveRequest: (OFHTTPRequest*)request
+	requestBody: (OFStream*)requestBody
+	      match: (const of_http_router_match_t*)match
+	   response: (OFHTTPResponse*)response
+{
+	[response setStatusCode: 204];
+	[response close];
+}
+@end
+
+@implementation HTTPServerTestsCompressionClient
+- (void)dealloc
+{
+	[_path release];
+	[_body release];
+	[_contentEncoding release];
+	[_vary release];
+
+	[super dealloc];
+}
+
+- main
+{
+	OFHTTPClient *client = [OFHTTPClient client];
+	OFURL *URL = [OFURL URLWithString: [OFString stringWithFormat:
+	    @"http://127.0.0.1:%" @PRIu16 "/%@", _port, _path]];
+	OFHTTPResponse *response;
+
+	@try {
+		[client setDecompressesResponses: true];
+
+		response = [client performRequest:
+		    [OFHTTPRequest requestWithURL: URL]];
+
+		_contentEncoding = [[[response headers]
+		    objectForKey: @"Content-Encoding"] copy];
+		_vary = [[[response headers] objectForKey: @"Vary"] copy];
+		_body = [[response readDataArrayTillEndOfStream] retain];
+	} @finally {
+		_done = true;
+	}
+
+	return nil;
+}
+@end
+
+static bool
+matchPath(OFHTTPRouter *router, const char *path, of_http_router_match_t *match)
+{
+	return [router matchPath: path
+			  length: strlen(path)
+			   match: match];
+}
+
+/* Feeds the head to the parser in steps of the specified size */
+static of_http_parser_status_t
+parse(of_http_parser_t *parser, const char *head, size_t step, bool response)
+{
+	size_t length = strlen(head);
+	of_http_parser_status_t status = OF_HTTP_PARSER_INCOMPLETE;
+
+	of_http_parser_init(parser, response);
+
+	for (size_t i = step; status == OF_HTTP_PARSER_INCOMPLETE; i += step) {
+		if (i > length)
+			i = length;
+
+		status = of_http_parser_parse(parser, head, i);
+
+		if (i == length)
+			break;
+	}
+
+	return status;
+}
+
+@implementation TestsAppDelegate (OFHTTPServerTests)
+- (void)HTTPParserTests
+{
+	OFAutoreleasePool *pool = [[OFAutoreleasePool alloc] init];
+	of_http_parser_t *parser, *parser2;
+	uintmax_t contentLength;
+	OFDictionary *headers;
+	bool ok;
+	char mutated[256];
+	size_t length;
+	uint32_t seed;
+
+	parser = [self allocMemoryWithSize: sizeof(*parser)];
+	parser2 = [self allocMemoryWithSize: sizeof(*parser2)];
+
+	TEST(@"of_http_parser_parse()",
+	    parse(parser, request, strlen(request), false) ==
+	    OF_HTTP_PARSER_DONE && parser->length == strlen(request) - 3 &&
+	    parser->method == OF_HTTP_REQUEST_METHOD_POST &&
+	    parser->targetLength == 8 &&
+	    !memcmp(request + parser->targetStart, "/foo?bar", 8) &&
+	    parser->major == 1 && parser->minor == 1 &&
+	    parser->numHeaders == 5 &&
+	    parser->headers[1].header == OF_HTTP_HEADER_OTHER &&
+	    parser->headers[1].valueLength == 1 &&
+	    request[parser->headers[1].valueStart] == 'a')
+
+	ok = true;
+	for (size_t step = 1; step < 16; step++)
+		if (parse(parser2, request, step, false) !=
+		    OF_HTTP_PARSER_DONE || parser2->length != parser->length ||
+		    parser2->numHeaders != parser->numHeaders ||
+		    memcmp(parser2->headers, parser->headers,
+		    parser->numHeaders * sizeof(*parser->headers)) != 0)
+			ok = false;
+	TEST(@"of_http_parser_parse() with incremental input", ok)
+
+	TEST(@"of_http_parser_content_length()",
+	    of_http_parser_content_length(parser, request,
+	    &contentLength) == 1 && contentLength == 3)
+
+	TEST(@"of_http_parser_chunked()",
+	    of_http_parser_chunked(parser, request) == 0 &&
+	    parse(parser2, chunkedHead, 7, false) == OF_HTTP_PARSER_DONE &&
+	    of_http_parser_chunked(parser2, chunkedHead) == 1 &&
+	    parse(parser2, gzipHead, 7, false) == OF_HTTP_PARSER_DONE &&
+	    of_http_parser_chunked(parser2, gzipHead) == -1)
+
+	TEST(@"of_http_parser_has_token()",
+	    of_http_parser_has_token(parser, request,
+	    OF_HTTP_HEADER_CONNECTION, "keep-alive") &&
+	    !of_http_parser_has_token(parser, request,
+	    OF_HTTP_HEADER_CONNECTION, "close"))
+
+	TEST(@"of_http_parser_headers()",
+	    (headers = of_http_parser_headers(parser, request)) &&
+	    [headers count] == 4 &&
+	    [[headers objectForKey: @"Host"] isEqual: @"127.0.0.1:8080"] &&
+	    [[headers objectForKey: @"X-Foo-Bar"] isEqual: @"a,b"] &&
+	    [[headers objectForKey: @"content-length"] isEqual: @"3"] &&
+	    [headers objectForKey: @"Content-Type"] == nil &&
+	    [[headers allKeys] containsObject: @"X-Foo-Bar"] &&
+	    [[headers allKeys] containsObject: @"Content-Length"])
+
+	TEST(@"Parsing responses",
+	    parse(parser, "HTTP/1.0 404 Not Found\nServer: x\n\n", 3,
+	    true) == OF_HTTP_PARSER_DONE && parser->statusCode == 404 &&
+	    parser->minor == 0 && parser->numHeaders == 1 &&
+	    parser->headers[0].header == OF_HTTP_HEADER_SERVER &&
+	    parse(parser, "HTTP/1.1 204\r\n\r\n", 1, true) ==
+	    OF_HTTP_PARSER_DONE && parser->statusCode == 204)
+
+	ok = true;
+	for (size_t i = 0; invalidHeads[i] != NULL; i++)
+		if (parse(parser, invalidHeads[i], 1, false) !=
+		    OF_HTTP_PARSER_INVALID)
+			ok = false;
+	TEST(@"Rejecting malformed heads", ok &&
+	    parse(parser, "FOO / HTTP/1.1\r\n\r\n", 1, false) ==
+	    OF_HTTP_PARSER_UNKNOWN_METHOD &&
+	    parse(parser, "HTTP/1.1 20 OK\r\n\r\n", 1, true) ==
+	    OF_HTTP_PARSER_INVALID)
+
+	/*
+	 * Whatever the input, parsing it at once and incrementally must agree
+	 * and everything the parser reports must be inside the head.
+	 */
+	ok = true;
+	seed = 1;
+	length = strlen(request);
+	for (size_t i = 0; i < 10000; i++) {
+		of_http_parser_status_t status;
+
+		memcpy(mutated, request, length + 1);
+
+		for (size_t j = 0; j < 3; j++) {
+			seed = seed * 1103515245 + 12345;
+			/* Never insert a '\0', parse() uses strlen() */
+			mutated[(seed >> 8) % length] = (seed >> 20) % 255 + 1;
+		}
+
+		status = parse(parser, mutated, length, false);
+
+		if (parse(parser2, mutated, i % 7 + 1, false) != status)
+			ok = false;
+
+		if (status != OF_HTTP_PARSER_DONE)
+			continue;
+
+		if (parser->length > length || parser->targetStart +
+		    parser->targetLength > parser->length)
+			ok = false;
+
+		for (size_t j = 0; j < parser->numHeaders; j++)
+			if (parser->headers[j].nameStart +
+			    parser->headers[j].nameLength > parser->length ||
+			    parser->headers[j].valueStart +
+			    parser->headers[j].valueLength > parser->length)
+				ok = false;
+	}
+	TEST(@"Parsing 10000 randomly mutated heads", ok)
+
+	BENCHMARK(@"of_http_parser_parse() of a request head", 1000000,
+	    of_http_parser_init(parser, false);
+	    of_http_parser_parse(parser, request, length))
+
+	[self freeMemory: parser];
+	[self freeMemory: parser2];
+
+	[pool drain];
+}
+
+- (void)HTTPRouterTests
+{
+	OFAutoreleasePool *pool = [[OFAutoreleasePool alloc] init];
+	HTTPServerTestsRouteHandler *users, *user, *me, *files;
+	OFHTTPRouter *router;
+	of_http_router_match_t match;
+	char path[64];
+	bool ok;
+	OFMutableArray *paths;
+
+	users = [[[HTTPServerTestsRouteHandler alloc] init] autorelease];
+	user = [[[HTTPServerTestsRouteHandler alloc] init] autorelease];
+	me = [[[HTTPServerTestsRouteHandler alloc] init] autorelease];
+	files = [[[HTTPServerTestsRouteHandler alloc] init] autorelease];
+
+	TEST(@"+[router]", (router = [OFHTTPRouter router]))
+
+	TEST(@"-[addRoute:handler:]",
+	    R([router addRoute: @"/users"
+		       handler: users]) &&
+	    R([router addRoute: @"/users/:user"
+		       handler: user]) &&
+	    R([router addRoute: @"/users/me"
+		       handler: me]) &&
+	    R([router addRoute: @"/users/:user/files/*file"
+		       handler: files]))
+
+	EXPECT_EXCEPTION(@"Rejecting duplicate routes",
+	    OFInvalidArgumentException, [router addRoute: @"users"
+						 handler: me])
+
+	EXPECT_EXCEPTION(@"Rejecting wildcards before the end",
+	    OFInvalidArgumentException, [router addRoute: @"/a/*b/c"
+						 handler: me])
+
+	TEST(@"-[matchPath:length:match:]",
+	    matchPath(router, "users", &match) && match.handler == users &&
+	    match.parametersCount == 0 &&
+	    matchPath(router, "users/me", &match) && match.handler == me &&
+	    matchPath(router, "users/j%C3%B6rg", &match) &&
+	    match.handler == user && match.parametersCount == 1 &&
+	    [of_http_router_match_parameter(&match, @"user")
+	    isEqual: @"jörg"])
+
+	TEST(@"Matching wildcards",
+	    matchPath(router, "users/me/files/a/b.txt", &match) &&
+	    match.handler == files && match.parametersCount == 2 &&
+	    [of_http_router_match_parameter(&match, @"user")
+	    isEqual: @"me"] &&
+	    [of_http_router_match_parameter(&match, @"file")
+	    isEqual: @"a/b.txt"])
+
+	TEST(@"Not matching other paths",
+	    !matchPath(router, "user", &match) &&
+	    !matchPath(router, "users/", &match) &&
+	    !matchPath(router, "users/me/files", &match))
+
+	for (size_t i = 0; i < 1000; i++)
+		[router addRoute: [OFString stringWithFormat:
+				      @"/api/v%zu/resource%zu/:id", i % 7, i]
+			 handler: user];
+
+	ok = true;
+	for (size_t i = 0; i < 1000; i++) {
+		snprintf(path, sizeof(path), "api/v%zu/resource%zu/%zu",
+		    i % 7, i, i);
+
+		if (!matchPath(router, path, &match) || match.handler != user ||
+		    match.parametersCount != 1)
+			ok = false;
+	}
+	TEST(@"Matching with 1000 routes", ok &&
+	    matchPath(router, "users/me", &match) && match.handler == me)
+
+	paths = [OFMutableArray array];
+	for (size_t i = 0; i < 1000; i++)
+		[paths addObject: [OFString stringWithFormat:
+		    @"api/v%zu/resource%zu/%zu", i % 7, i, i]];
+
+	BENCHMARK(@"Matching 1000 paths with 1000 routes", 1000,
+	    for (OFString *string in paths)
+		matchPath(router, [string UTF8String], &match))
+
+	[pool drain];
+}
+
+- (void)HTTPServerTests
+{
+	OFAutoreleasePool *pool = [[OFAutoreleasePool alloc] init];
+	HTTPServerTestsDelegate *delegate =
+	    [[[HTTPServerTestsDelegate alloc] init] autorelease];
+	HTTPServerTestsClient *client;
+	HTTPServerTestsCompressionClient *compressionClient;
+	OFHTTPServer *server;
+	OFDate *deadline;
+	OFMutableString *expected;
+#ifdef OF_HAVE_THREADS
+	OFMutableArray *clients;
+	bool ok;
+#endif
+
+	[self HTTPParserTests];
+	[self HTTPRouterTests];
+
+	TEST(@"+[server]", (server = [OFHTTPServer server]))
+
+	TEST(@"Default keep-alive settings",
+	    [server keepAliveTimeout] == 10 &&
+	    [server maxRequestsPerConnection] == 100 &&
+	    [server maxRequestBodySize] == SIZE_MAX)
+
+	[server setDelegate: delegate];
+	[server setHost: @"127.0.0.1"];
+
+	TEST(@"-[start]", R([server start]))
+
+	client = [[[HTTPServerTestsClient alloc] init] autorelease];
+	client->_port = [server port];
+	[client start];
+
+	deadline = [OFDate dateWithTimeIntervalSinceNow: 5];
+	while (!client->_done && [deadline timeIntervalSinceNow] > 0)
+		[[OFRunLoop currentRunLoop] runUntilDate:
+		    [OFDate dateWithTimeIntervalSinceNow: 0.01]];
+
+	[client join];
+
+	TEST(@"Pipelined requests on a persistent connection",
+	    [client->_bodies isEqual: [OFArray arrayWithObjects:
+	    @"a", @"bfoo", @"dfooba", @"c", nil]])
+
+	TEST(@"Date header",
+	    [[OFDate dateWithDateString: client->_lastDate
+				 format: @"%a, %d %b %Y %H:%M:%S GMT"]
+	    timeIntervalSinceNow] > -60)
+
+	TEST(@"Closing the connection on Connection: close",
+	    [client->_lastConnection isEqual: @"close"] && client->_closed)
+
+	TEST(@"-[setCompressesResponses:]",
+	    R([server setCompressesResponses: true]))
+
+	compressionClient =
+	    [[[HTTPServerTestsCompressionClient alloc] init] autorelease];
+	compressionClient->_port = [server port];
+	compressionClient->_path = @"compressed";
+	[compressionClient start];
+
+	deadline = [OFDate dateWithTimeIntervalSinceNow: 5];
+	while (!compressionClient->_done &&
+	    [deadline timeIntervalSinceNow] > 0)
+		[[OFRunLoop currentRunLoop] runUntilDate:
+		    [OFDate dateWithTimeIntervalSinceNow: 0.01]];
+
+	[compressionClient join];
+
+	expected = [OFMutableString string];
+	for (size_t i = 0; i < 200; i++)
+		[expected appendString: compressedLine(i)];
+
+	TEST(@"Compressing responses",
+	    [compressionClient->_contentEncoding isEqual: @"gzip"] &&
+	    [compressionClient->_vary isEqual: @"Accept-Encoding"] &&
+	    [compressionClient->_body count] == [expected UTF8StringLength] &&
+	    memcmp([compressionClient->_body items], [expected UTF8String],
+	    [expected UTF8StringLength]) == 0)
+
+	if (_benchmarks) {
+		const char *text;
+
+		expected = [OFMutableString string];
+		for (size_t i = 0; [expected UTF8StringLength] < 1048576; i++)
+			[expected appendString: compressedLine(i)];
+		text = [expected UTF8String];
+
+		for (int level = 1; level <= 9; level += 4) {
+			OFString *benchmark = [OFString stringWithFormat:
+			    @"Compressing 1 MiB of text at level %d in 64 KiB "
+			    @"writes", level];
+
+			BENCHMARK(benchmark, 10,
+			    OFDeflateStream *deflate = [OFDeflateStream
+				streamWithStream: [[[HTTPServerTestsNullStream
+				alloc] init] autorelease]];
+
+			    [deflate setCompressionLevel: level];
+			    for (size_t i = 0; i < 1048576; i += 65536)
+				[deflate writeBuffer: text + i
+					      length: 65536];
+			    [deflate close])
+		}
+	}
+
+#ifdef OF_HAVE_FILES
+	compressionClient =
+	    [[[HTTPServerTestsCompressionClient alloc] init] autorelease];
+	compressionClient->_port = [server port];
+	compressionClient->_path = @"file";
+	[compressionClient start];
+
+	deadline = [OFDate dateWithTimeIntervalSinceNow: 5];
+	while (!compressionClient->_done &&
+	    [deadline timeIntervalSinceNow] > 0)
+		[[OFRunLoop currentRunLoop] runUntilDate:
+		    [OFDate dateWithTimeIntervalSinceNow: 0.01]];
+
+	[compressionClient join];
+
+	TEST(@"-[sendFileAtPath:forRequest:response:]",
+	    compressionClient->_contentEncoding == nil &&
+	    [compressionClient->_body isEqual:
+	    [OFDataArray dataArrayWithContentsOfFile: @"testfile.bin"]])
+#endif
+
+	BENCHMARK(@"1000 requests with keep-alive", 10,
+	    runLoadClients(1, [server port], 1000, true))
+
+	BENCHMARK(@"1000 requests without keep-alive", 10,
+	    runLoadClients(1, [server port], 1000, false))
+
+	[server stop];
+
+#ifdef OF_HAVE_THREADS
+	server = [[OFHTTPServer alloc] init];
+	[server setHost: @"127.0.0.1"];
+	[server setNumberOfThreads: 4];
+	[server start];
+	[server stop];
+
+	TEST(@"-[dealloc] before the worker threads ran", R([server release]))
+
+	server = [[OFHTTPServer alloc] init];
+	[server setDelegate: delegate];
+	[server setHost: @"127.0.0.1"];
+
+	TEST(@"-[setNumberOfThreads:]", R([server setNumberOfThreads: 4]) &&
+	    R([server start]))
+
+	clients = [OFMutableArray array];
+	for (size_t i = 0; i < 8; i++) {
+		client = [[[HTTPServerTestsClient alloc] init] autorelease];
+		client->_port = [server port];
+		[clients addObject: client];
+	}
+
+	for (client in clients)
+		[client start];
+
+	ok = true;
+	deadline = [OFDate dateWithTimeIntervalSinceNow: 5];
+	for (client in clients) {
+		while (!client->_done && [deadline timeIntervalSinceNow] > 0)
+			[[OFRunLoop currentRunLoop] runUntilDate:
+			    [OFDate dateWithTimeIntervalSinceNow: 0.01]];
+
+		[client join];
+
+		if (![client->_bodies isEqual: [OFArray arrayWithObjects:
+		    @"a", @"bfoo", @"dfooba", @"c", nil]] || !client->_closed)
+			ok = false;
+	}
+
+	TEST(@"Concurrent connections on worker threads", ok)
+
+	[server stop];
+
+	/* The last reference might be released by a worker thread */
+	TEST(@"-[dealloc] with worker threads", R([server release]))
+
+	if (_benchmarks) {
+		for (size_t threads = 1; threads <= 8; threads *= 2) {
+			OFString *benchmark;
+
+			server = [[OFHTTPServer alloc] init];
+			[server setDelegate: delegate];
+			[server setHost: @"127.0.0.1"];
+			[server setNumberOfThreads: threads];
+			[server start];
+
+			benchmark = [OFString stringWithFormat:
+			    @"8 clients sending 1000 requests each to %zu "
+			    @"worker threads", threads];
+			BENCHMARK(benchmark, 5,
+			    runLoadClients(8, [server port], 1000, true))
+
+			[server stop];
+			[server release];
+		}
+	}
+#endif
+
+	[pool drain];
+}
+@end
@@ -45,6 +45,7 @@ static OFString *module = @"OFJSON";
 		[OFNumber numberWithBool: false],
 		nil],
 	    nil];
+	OFMutableArray *numbers;
 
 	TEST(@"-[JSONValue #1]", [[s JSONValue] isEqual: d])
 
@@ -60,6 +61,11 @@ static OFString *module = @"OFJSON";
 	    [[d JSONRepresentationWithOptions: OF_JSON_REPRESENTATION_JSON5]
 	    isEqual: @"{x:[0.5,15,null,\"foo\",false],foo:\"b\\\na\\r\"}"])
 
+	TEST(@"-[JSONValue] with exponents", [[@"[1e3,-2.5E-1]" JSONValue]
+	    isEqual: [OFArray arrayWithObjects:
+	    [OFNumber numberWithDouble: 1000],
+	    [OFNumber numberWithDouble: -0.25], nil]])
+
 	EXPECT_EXCEPTION(@"-[JSONValue #2]", OFInvalidJSONException,
 	    [@"{" JSONValue])
 	EXPECT_EXCEPTION(@"-[JSONValue #3]", OFInvalidJSONException,
@@ -69,6 +75,19 @@ static OFString *module = @"OFJSON";
 	EXPECT_EXCEPTION(@"-[JSONValue #5]", OFInvalidJSONException,
 	    [@"[\"a\" \"b\"]" JSONValue])
 
+	numbers = [OFMutableArray array];
+	for (size_t i = 0; i < 10000; i++) {
+		[numbers addObject: [OFNumber numberWithIntMax:
+		    (intmax_t)(i * 2654435761u) - 1000000000]];
+		[numbers addObject:
+		    [OFNumber numberWithDouble: (double)i / 7 + 0.1]];
+	}
+	s = [numbers JSONRepresentation];
+
+	BENCHMARK(@"-[JSONValue] of 20000 numbers", 100, [s JSONValue])
+	BENCHMARK(@"-[JSONRepresentation] of 20000 numbers", 100,
+	    [numbers JSONRepresentation])
+
 	[pool drain];
 }
 @end
@@ -16,11 +16,19 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #import "OFKernelEventObserver.h"
 #import "OFString.h"
+#import "OFArray.h"
 #import "OFDate.h"
 #import "OFTCPSocket.h"
+#import "OFRunLoop.h"
 #import "OFAutoreleasePool.h"
+#ifdef OF_HAVE_FILES
+# import "OFFile.h"
+# import "OFFileManager.h"
+#endif
 
 #if defined(HAVE_SYS_SELECT_H) || defined(OF_WINDOWS)
 # import "OFKernelEventObserver_select.h"
@@ -34,10 +42,17 @@
 #ifdef HAVE_KQUEUE
 # import "OFKernelEventObserver_kqueue.h"
 #endif
+#ifdef HAVE_IO_URING
+# import "OFKernelEventObserver_io_uring.h"
+#endif
 
 #import "TestsAppDelegate.h"
 
 #define EXPECTED_EVENTS 3
+/* More than fit into the initial event list of the epoll observer */
+#define MANY_OBJECTS 100
+/* More than fits into the buffer used for a single file operation */
+#define FILE_LENGTH (200 * 1024)
 
 static OFString *module;
 
@@ -54,6 +69,35 @@ static OFString *module;
 - (void)run;
 @end
 
+@interface ManyObjectsTest: OFObject <OFKernelEventObserverDelegate>
+{
+@public
+	OFMutableArray *_sockets;
+	bool _seen[MANY_OBJECTS];
+	size_t _seenCount;
+}
+@end
+
+@interface EchoBenchmark: OFObject <OFKernelEventObserverDelegate>
+{
+@public
+	OFTCPSocket *_client, *_accepted;
+	size_t _roundTrips;
+}
+@end
+
+#ifdef OF_HAVE_FILES
+@interface AsyncFileTest: OFObject
+{
+@public
+	char *_data, *_readBuffer;
+	size_t _writtenLength, _readLength;
+	OFException *_exception;
+	bool _writeDone, _readDone;
+}
+@end
+#endif
+
 @implementation ObserverTest
 - initWithTestsAppDelegate: (TestsAppDelegate*)testsAppDelegate
 {
@@ -200,6 +244,115 @@ static OFString *module;
 }
 @end
 
+@implementation ManyObjectsTest
+- init
+{
+	self = [super init];
+
+	@try {
+		_sockets = [[OFMutableArray alloc] init];
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	[_sockets release];
+
+	[super dealloc];
+}
+
+- (void)objectIsReadyForReading: (id)object
+{
+	size_t i = [_sockets indexOfObjectIdenticalTo: object];
+	char buffer;
+
+	if (i == OF_NOT_FOUND || _seen[i])
+		return;
+
+	if ([object readIntoBuffer: &buffer
+			    length: 1] == 1 && buffer == 'x') {
+		_seen[i] = true;
+		_seenCount++;
+	}
+}
+@end
+
+@implementation EchoBenchmark
+- (void)objectIsReadyForReading: (id)object
+{
+	char buffer[64];
+	size_t length = [object readIntoBuffer: buffer
+					length: sizeof(buffer)];
+
+	if (length == 0)
+		return;
+
+	if (object == _accepted)
+		[_accepted writeBuffer: buffer
+				length: length];
+	else if (object == _client)
+		_roundTrips++;
+}
+@end
+
+#ifdef OF_HAVE_FILES
+@implementation AsyncFileTest
+- init
+{
+	self = [super init];
+
+	@try {
+		_data = [self allocMemoryWithSize: FILE_LENGTH];
+		_readBuffer = [self allocMemoryWithSize: FILE_LENGTH];
+
+		for (size_t i = 0; i < FILE_LENGTH; i++)
+			_data[i] = (char)(i ^ (i >> 8));
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	[_exception release];
+
+	[super dealloc];
+}
+
+- (size_t)stream: (OFStream*)stream
+  didWriteBuffer: (const void**)buffer
+	  length: (size_t)length
+       exception: (OFException*)exception
+{
+	_writtenLength = length;
+	_exception = [exception retain];
+	_writeDone = true;
+
+	return 0;
+}
+
+- (bool)stream: (OFStream*)stream
+  didReadIntoBuffer: (void*)buffer
+	     length: (size_t)length
+	  exception: (OFException*)exception
+{
+	_readLength = length;
+	_exception = [exception retain];
+	_readDone = true;
+
+	return false;
+}
+@end
+#endif
+
 @implementation TestsAppDelegate (OFKernelEventObserverTests)
 - (void)kernelEventObserverTestsWithClass: (Class)class
 {
@@ -209,8 +362,7 @@ static OFString *module;
 	test = [[[ObserverTest alloc]
 	    initWithTestsAppDelegate: self] autorelease];
 
-	TEST(@"+[observer]",
-	    (test->_observer = [OFKernelEventObserver observer]))
+	TEST(@"+[observer]", (test->_observer = [class observer]))
 	[test->_observer setDelegate: test];
 
 	TEST(@"-[addObjectForReading:]",
@@ -218,8 +370,151 @@ static OFString *module;
 
 	[test run];
 	_fails += test->_fails;
+
+	[self manyObjectsTestsWithClass: class];
+
+	if (_benchmarks)
+		[self echoBenchmarkWithClass: class];
 }
 
+- (void)manyObjectsTestsWithClass: (Class)class
+{
+	OFAutoreleasePool *pool = [[OFAutoreleasePool alloc] init];
+	ManyObjectsTest *test = [[[ManyObjectsTest alloc] init] autorelease];
+	OFKernelEventObserver *observer = [class observer];
+	OFTCPSocket *server = [OFTCPSocket socket];
+	OFMutableArray *clients = [OFMutableArray array];
+	uint16_t port;
+	OFDate *deadline;
+
+	port = [server bindToHost: @"127.0.0.1"
+			     port: 0];
+	[server listen];
+
+	/* Every connection has one byte waiting to be read */
+	for (size_t i = 0; i < MANY_OBJECTS; i++) {
+		OFTCPSocket *client = [OFTCPSocket socket];
+
+		[client connectToHost: @"127.0.0.1"
+				 port: port];
+		[client writeBuffer: "x"
+			     length: 1];
+
+		[clients addObject: client];
+		[test->_sockets addObject: [server accept]];
+	}
+
+	[observer setDelegate: test];
+
+	for (OFTCPSocket *socket in test->_sockets)
+		[observer addObjectForReading: socket];
+
+	deadline = [OFDate dateWithTimeIntervalSinceNow: 5];
+	while (test->_seenCount < MANY_OBJECTS &&
+	    [deadline timeIntervalSinceNow] > 0)
+		[observer observeForTimeInterval: 0.01];
+
+	TEST(@"-[observe] with more objects than fit into one event list",
+	    test->_seenCount == MANY_OBJECTS)
+
+	/* Every socket is writable, so each observe reports all of them */
+	BENCHMARK(@"Adding and removing 100 objects for writing", 1000,
+	    for (OFTCPSocket *socket in test->_sockets)
+		[observer addObjectForWriting: socket];
+	    [observer observeForTimeInterval: 0];
+
+	    for (OFTCPSocket *socket in test->_sockets)
+		[observer removeObjectForWriting: socket];
+	    [observer observeForTimeInterval: 0])
+
+	[pool drain];
+}
+
+- (void)echoBenchmarkWithClass: (Class)class
+{
+	OFAutoreleasePool *pool = [[OFAutoreleasePool alloc] init];
+	EchoBenchmark *benchmark = [[[EchoBenchmark alloc] init] autorelease];
+	OFKernelEventObserver *observer = [class observer];
+	OFTCPSocket *server = [OFTCPSocket socket];
+	OFTCPSocket *client = [OFTCPSocket socket];
+	OFTCPSocket *accepted;
+	uint16_t port;
+
+	port = [server bindToHost: @"127.0.0.1"
+			     port: 0];
+	[server listen];
+
+	[client connectToHost: @"127.0.0.1"
+			 port: port];
+	accepted = [server accept];
+
+	benchmark->_client = client;
+	benchmark->_accepted = accepted;
+
+	[observer setDelegate: benchmark];
+	[observer addObjectForReading: client];
+	[observer addObjectForReading: accepted];
+
+	/* Both ends are driven by the observer, as in a run loop */
+	BENCHMARK(@"Loopback echo round trips", 10000,
+	    size_t roundTrips = benchmark->_roundTrips;
+
+	    [client writeBuffer: "ping"
+			 length: 4];
+
+	    while (benchmark->_roundTrips == roundTrips)
+		[observer observeForTimeInterval: 1])
+
+	[pool drain];
+}
+
+#ifdef OF_HAVE_FILES
+- (void)asyncFileTests
+{
+	AsyncFileTest *test = [[[AsyncFileTest alloc] init] autorelease];
+	OFFile *file;
+	OFDate *deadline;
+
+	file = [OFFile fileWithPath: @"asyncfiletest.bin"
+			       mode: @"w"];
+	[file asyncWriteBuffer: test->_data
+			length: FILE_LENGTH
+			target: test
+		      selector: @selector(stream:didWriteBuffer:length:
+				    exception:)];
+
+	deadline = [OFDate dateWithTimeIntervalSinceNow: 5];
+	while (!test->_writeDone && [deadline timeIntervalSinceNow] > 0)
+		[[OFRunLoop currentRunLoop] runUntilDate:
+		    [OFDate dateWithTimeIntervalSinceNow: 0.01]];
+
+	TEST(@"-[asyncWriteBuffer:length:target:selector:] on OFFile",
+	    test->_writeDone && test->_exception == nil &&
+	    test->_writtenLength == FILE_LENGTH && R([file close]))
+
+	file = [OFFile fileWithPath: @"asyncfiletest.bin"
+			       mode: @"r"];
+	[file asyncReadIntoBuffer: test->_readBuffer
+		      exactLength: FILE_LENGTH
+			   target: test
+			 selector: @selector(stream:didReadIntoBuffer:length:
+				       exception:)];
+
+	deadline = [OFDate dateWithTimeIntervalSinceNow: 5];
+	while (!test->_readDone && [deadline timeIntervalSinceNow] > 0)
+		[[OFRunLoop currentRunLoop] runUntilDate:
+		    [OFDate dateWithTimeIntervalSinceNow: 0.01]];
+
+	TEST(@"-[asyncReadIntoBuffer:exactLength:target:selector:] on OFFile",
+	    test->_readDone && test->_exception == nil &&
+	    test->_readLength == FILE_LENGTH &&
+	    memcmp(test->_readBuffer, test->_data, FILE_LENGTH) == 0)
+
+	[file close];
+	[[OFFileManager defaultManager] removeItemAtPath: @"asyncfiletest.bin"];
+}
+#endif
+
 - (void)kernelEventObserverTests
 {
 	OFAutoreleasePool *pool = [[OFAutoreleasePool alloc] init];
@@ -244,6 +539,18 @@ static OFString *module;
 	    [OFKernelEventObserver_kqueue class]];
 #endif
 
+#ifdef HAVE_IO_URING
+	if ([OFKernelEventObserver_io_uring OF_isSupported]) {
+		[self kernelEventObserverTestsWithClass:
+		    [OFKernelEventObserver_io_uring class]];
+
+# ifdef OF_HAVE_FILES
+		/* The run loop uses io_uring, which can observe files */
+		[self asyncFileTests];
+# endif
+	}
+#endif
+
 	[pool drain];
 }
 @end
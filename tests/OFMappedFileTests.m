@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2008, 2009, 2010, 2011, 2012, 2013, 2014, 2015, 2016
+ *   Jonathan Schleifer <js@heap.zone>
+ *
+ * All rights reserved.
+ *
+ * This file is part of ObjFW. It may be distributed under the terms of the
+ * Q Public License 1.0, which can be found in the file LICENSE.QPL included in
+ * the packaging of this file.
+ *
+ * Alternatively, it may be distributed under the terms of the GNU General
+ * Public License, either version 2 or 3, which can be found in the file
+ * LICENSE.GPLv2 or LICENSE.GPLv3 respectively included in the packaging of this
+ * file.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#import "OFMappedFile.h"
+#import "OFDataArray.h"
+#import "OFString.h"
+#import "OFFile.h"
+#import "OFFileManager.h"
+#import "OFAutoreleasePool.h"
+
+#import "OFNotImplementedException.h"
+#import "OFOutOfRangeException.h"
+
+#import "TestsAppDelegate.h"
+
+static OFString *module = @"OFMappedFile";
+
+/* Best effort, the benchmark measures a warm cache if this does nothing */
+static void
+dropFromPageCache(const char *path)
+{
+#ifdef POSIX_FADV_DONTNEED
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return;
+
+	fsync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+#endif
+}
+
+/*
+ * Touches every page, like a parser reading all of the file would. The sum is
+ * stored so that the reads are not optimized away.
+ */
+static volatile unsigned char pageSum;
+
+static void
+touchPages(const unsigned char *items, size_t length)
+{
+	unsigned char sum = 0;
+
+	for (size_t i = 0; i < length; i += 4096)
+		sum += items[i];
+
+	pageSum = sum;
+}
+
+@implementation TestsAppDelegate (OFMappedFileTests)
+- (void)mappedFileTests
+{
+	OFAutoreleasePool *pool = [[OFAutoreleasePool alloc] init];
+	OFDataArray *data =
+	    [OFDataArray dataArrayWithContentsOfFile: @"testfile.bin"];
+	OFMappedFile *file, *copy;
+	char buffer[16];
+
+	TEST(@"+[mappedFileWithPath:]",
+	    (file = [OFMappedFile mappedFileWithPath: @"testfile.bin"]))
+
+	TEST(@"-[length]", [file length] == [data count])
+
+	TEST(@"-[items]", memcmp([file items], [data items], [data count]) == 0)
+
+	TEST(@"-[readIntoBuffer:exactLength:]",
+	    R([file readIntoBuffer: buffer
+		       exactLength: 16]) &&
+	    memcmp(buffer, [data items], 16) == 0)
+
+	TEST(@"-[seekToOffset:whence:]",
+	    [file seekToOffset: -16
+			whence: SEEK_END] == 1008 &&
+	    R([file readIntoBuffer: buffer
+		       exactLength: 16]) &&
+	    memcmp(buffer, (char*)[data items] + 1008, 16) == 0 &&
+	    [file isAtEndOfStream])
+
+	TEST(@"-[adviseAccessPattern:]",
+	    R([file adviseAccessPattern: OF_MAPPED_FILE_ADVICE_SEQUENTIAL]) &&
+	    R([file adviseAccessPattern: OF_MAPPED_FILE_ADVICE_WILL_NEED
+				inRange: of_range(100, 500)]))
+
+	EXPECT_EXCEPTION(@"Detect out of range in "
+	    @"-[adviseAccessPattern:inRange:]", OFOutOfRangeException,
+	    [file adviseAccessPattern: OF_MAPPED_FILE_ADVICE_RANDOM
+			      inRange: of_range(1000, 25)])
+
+	EXPECT_EXCEPTION(@"Detect -[mutableItems] on a read-only mapping",
+	    OFNotImplementedException, [file mutableItems])
+
+	TEST(@"+[mappedFileWithPath:mode:] copy-on-write",
+	    (copy = [OFMappedFile
+	    mappedFileWithPath: @"testfile.bin"
+			  mode: OF_MAPPED_FILE_MODE_COPY_ON_WRITE]) &&
+	    R(((char*)[copy mutableItems])[0] ^= 0xFF) &&
+	    ((char*)[copy items])[0] != ((char*)[data items])[0] &&
+	    memcmp([[OFMappedFile mappedFileWithPath: @"testfile.bin"] items],
+	    [data items], [data count]) == 0)
+
+	if (_benchmarks) {
+		OFFile *benchmarkFile = [OFFile fileWithPath: @"benchmark.bin"
+							mode: @"w"];
+		char *chunk = [self allocMemoryWithSize: 65536];
+
+		memset(chunk, 'X', 65536);
+		for (size_t i = 0; i < 1024; i++)
+			[benchmarkFile writeBuffer: chunk
+					    length: 65536];
+		[benchmarkFile close];
+		[self freeMemory: chunk];
+
+		BENCHMARK(@"Reading a 64 MiB file into an OFDataArray, cold",
+		    10,
+		    dropFromPageCache("benchmark.bin");
+		    data = [OFDataArray dataArrayWithContentsOfFile:
+			@"benchmark.bin"];
+		    touchPages([data items], [data count]))
+
+		BENCHMARK(@"Mapping a 64 MiB file, cold", 10,
+		    dropFromPageCache("benchmark.bin");
+		    file = [OFMappedFile mappedFileWithPath: @"benchmark.bin"];
+		    [file adviseAccessPattern:
+			OF_MAPPED_FILE_ADVICE_SEQUENTIAL];
+		    touchPages([file items], [file length]))
+
+		BENCHMARK(@"Reading a 64 MiB file into an OFDataArray, warm",
+		    10,
+		    data = [OFDataArray dataArrayWithContentsOfFile:
+			@"benchmark.bin"];
+		    touchPages([data items], [data count]))
+
+		BENCHMARK(@"Mapping a 64 MiB file, warm", 10,
+		    file = [OFMappedFile mappedFileWithPath: @"benchmark.bin"];
+		    touchPages([file items], [file length]))
+
+		[[OFFileManager defaultManager]
+		    removeItemAtPath: @"benchmark.bin"];
+	}
+
+	[pool drain];
+}
+@end
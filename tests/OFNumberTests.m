@@ -16,6 +16,9 @@
 
 #include "config.h"
 
+#include <math.h>
+#include <string.h>
+
 #import "OFString.h"
 #import "OFNumber.h"
 #import "OFAutoreleasePool.h"
@@ -24,6 +27,46 @@
 
 static OFString *module = @"OFNumber";
 
+/* Checks that random doubles and floats survive -[description] */
+static bool
+descriptionRoundTrips(void)
+{
+	OFAutoreleasePool *pool = [[OFAutoreleasePool alloc] init];
+	uint64_t state = 1;
+
+	for (size_t i = 0; i < 10000; i++) {
+		double doubleValue;
+		float floatValue;
+		uint32_t floatBits;
+
+		state = state * UINT64_C(6364136223846793005) +
+		    UINT64_C(1442695040888963407);
+		memcpy(&doubleValue, &state, sizeof(doubleValue));
+		floatBits = (uint32_t)(state >> 32);
+		memcpy(&floatValue, &floatBits, sizeof(floatValue));
+
+		if (!isnan(doubleValue) && !isinf(doubleValue) &&
+		    [[[OFNumber numberWithDouble: doubleValue] description]
+		    doubleValue] != doubleValue) {
+			[pool release];
+			return false;
+		}
+
+		if (!isnan(floatValue) && !isinf(floatValue) &&
+		    [[[OFNumber numberWithFloat: floatValue] description]
+		    floatValue] != floatValue) {
+			[pool release];
+			return false;
+		}
+
+		[pool releaseObjects];
+	}
+
+	[pool release];
+
+	return true;
+}
+
 @implementation TestsAppDelegate (OFNumberTests)
 - (void)numberTests
 {
@@ -42,6 +85,36 @@ static OFString *module = @"OFNumber";
 
 	TEST(@"-[doubleValue]", [num doubleValue] == 123456789.L)
 
+	TEST(@"-[description]",
+	    [[num description] isEqual: @"123456789"] &&
+	    [[[OFNumber numberWithIntMax: INTMAX_MIN] description] isEqual:
+	    [OFString stringWithFormat: @"%jd", INTMAX_MIN]] &&
+	    [[[OFNumber numberWithUIntMax: UINTMAX_MAX] description] isEqual:
+	    [OFString stringWithFormat: @"%ju", UINTMAX_MAX]])
+
+	TEST(@"-[description] of floating point numbers",
+	    [[[OFNumber numberWithDouble: 0.1] description] isEqual: @"0.1"] &&
+	    [[[OFNumber numberWithDouble: 1.0 / 3] description]
+	    isEqual: @"0.3333333333333333"] &&
+	    [[[OFNumber numberWithFloat: 1.0f / 3] description]
+	    isEqual: @"0.33333334"] &&
+	    [[[OFNumber numberWithDouble: -100] description]
+	    isEqual: @"-100.0"] &&
+	    [[[OFNumber numberWithDouble: 123456789.5] description]
+	    isEqual: @"123456789.5"] &&
+	    [[[OFNumber numberWithDouble: 0.000001] description]
+	    isEqual: @"0.000001"] &&
+	    [[[OFNumber numberWithDouble: 1.5e-7] description]
+	    isEqual: @"1.5e-7"] &&
+	    [[[OFNumber numberWithDouble: 1e21] description]
+	    isEqual: @"1e+21"] &&
+	    [[[OFNumber numberWithDouble: 1.7976931348623157e308] description]
+	    isEqual: @"1.7976931348623157e+308"] &&
+	    [[[OFNumber numberWithDouble: -INFINITY] description]
+	    isEqual: @"-inf"])
+
+	TEST(@"-[description] round trips", descriptionRoundTrips())
+
 	[pool drain];
 }
 @end
@@ -16,13 +16,22 @@
 
 #include "config.h"
 
+#include <errno.h>
+#include <stdio.h>
 #include <string.h>
 
 #import "OFStream.h"
 #import "OFString.h"
+#import "OFDataArray.h"
+#ifdef OF_HAVE_FILES
+# import "OFFile.h"
+# import "OFFileManager.h"
+#endif
 #import "OFSystemInfo.h"
 #import "OFAutoreleasePool.h"
 
+#import "OFWriteFailedException.h"
+
 #import "TestsAppDelegate.h"
 
 static OFString *module = @"OFStream";
@@ -68,14 +77,103 @@ static OFString *module = @"OFStream";
 }
 @end
 
+@interface ChunkedStreamTester: OFStream
+{
+	const char *_data;
+	size_t _length, _position;
+}
+
+- initWithCString: (const char*)cString;
+@end
+
+@implementation ChunkedStreamTester
+- initWithCString: (const char*)cString
+{
+	self = [super init];
+
+	_data = cString;
+	_length = strlen(cString);
+
+	return self;
+}
+
+- (bool)lowlevelIsAtEndOfStream
+{
+	return (_position == _length);
+}
+
+- (size_t)lowlevelReadIntoBuffer: (void*)buffer
+			  length: (size_t)length
+{
+	/* Never return more than 3 bytes to split lines and delimiters */
+	if (length > 3)
+		length = 3;
+	if (length > _length - _position)
+		length = _length - _position;
+
+	memcpy(buffer, _data + _position, length);
+	_position += length;
+
+	return length;
+}
+@end
+
+@interface WriteTester: OFStream
+{
+@public
+	OFDataArray *_written;
+	size_t _writes, _capacity;
+}
+@end
+
+@implementation WriteTester
+- init
+{
+	self = [super init];
+
+	_written = [[OFDataArray alloc] init];
+	_capacity = SIZE_MAX;
+
+	return self;
+}
+
+- (void)dealloc
+{
+	[_written release];
+
+	[super dealloc];
+}
+
+- (void)lowlevelWriteBuffer: (const void*)buffer
+		     length: (size_t)length
+{
+	/* Behaves like a non-blocking stream that only takes _capacity bytes */
+	size_t accepted = (length < _capacity ? length : _capacity);
+
+	[_written addItems: buffer
+		     count: accepted];
+	_capacity -= accepted;
+	_writes++;
+
+	if (accepted < length)
+		@throw [OFWriteFailedException exceptionWithObject: self
+						   requestedLength: length
+						      bytesWritten: accepted
+							     errNo: EAGAIN];
+}
+@end
+
 @implementation TestsAppDelegate (OFStreamTests)
 - (void)streamTests
 {
 	OFAutoreleasePool *pool = [[OFAutoreleasePool alloc] init];
 	size_t pageSize = [OFSystemInfo pageSize];
-	StreamTester *t = [[[StreamTester alloc] init] autorelease];
+	OFStream *t = [[[StreamTester alloc] init] autorelease];
 	OFString *str;
 	char *cstr;
+	WriteTester *w;
+	of_stream_buffer_t buffers[3];
+	OFWriteFailedException *writeException;
 
 	cstr = [t allocMemoryWithSize: pageSize - 2];
 	memset(cstr, 'X', pageSize - 3);
@@ -85,6 +183,183 @@ static OFString *module = @"OFStream";
 	    [(str = [t readLine]) length] == pageSize - 3 &&
 	    !strcmp([str UTF8String], cstr))
 
+	t = [[[ChunkedStreamTester alloc]
+	    initWithCString: "Hello World\r\nfoo\nab--cd-\x01\x02\x03\x04X"]
+	    autorelease];
+
+	TEST(@"-[setReadBufferSize:]", R([t setReadBufferSize: 4]) &&
+	    [t readBufferSize] == 4)
+
+	TEST(@"-[readLine] with lines longer than the read buffer",
+	    [[t readLine] isEqual: @"Hello World"] &&
+	    [[t readLine] isEqual: @"foo"])
+
+	TEST(@"-[readTillDelimiter:] with a split delimiter",
+	    [[t readTillDelimiter: @"--"] isEqual: @"ab"] &&
+	    [[t readTillDelimiter: @"-"] isEqual: @"cd"])
+
+	TEST(@"-[readBigEndianInt32] from the read buffer",
+	    [t readBigEndianInt32] == 0x01020304 && [t readInt8] == 'X' &&
+	    [t isAtEndOfStream])
+
+	w = [[[WriteTester alloc] init] autorelease];
+	[w setWriteBuffered: true];
+
+	TEST(@"-[setWriteBufferSize:]", R([w setWriteBufferSize: 8]) &&
+	    [w writeBufferSize] == 8)
+
+	TEST(@"-[writeBuffer:length:] with a bounded write buffer",
+	    R([w writeString: @"abc"]) && R([w writeString: @"def"]) &&
+	    R([w writeString: @"gh"]) && w->_writes == 0 &&
+	    R([w writeString: @"0123456789"]) && w->_writes == 2 &&
+	    [w->_written count] == 18 &&
+	    !memcmp([w->_written items], "abcdefgh0123456789", 18))
+
+	buffers[0].buffer = "foo";
+	buffers[0].length = 3;
+	buffers[1].buffer = "";
+	buffers[1].length = 0;
+	buffers[2].buffer = "bar";
+	buffers[2].length = 3;
+
+	TEST(@"-[writeBuffers:count:]", R([w writeBuffers: buffers
+						     count: 3]) &&
+	    R([w flushWriteBuffer]) && [w->_written count] == 24 &&
+	    !memcmp((char*)[w->_written items] + 18, "foobar", 6))
+
+	w = [[[WriteTester alloc] init] autorelease];
+	[w setWriteBuffered: true];
+	[w setWriteBufferSize: 8];
+	[w writeString: @"abc"];
+	w->_capacity = 5;
+	writeException = nil;
+	@try {
+		[w writeBuffer: "0123456789"
+			length: 10];
+	} @catch (OFWriteFailedException *e) {
+		writeException = e;
+	}
+
+	TEST(@"-[writeBuffer:length:] does not count buffered data as written",
+	    writeException != nil && [writeException requestedLength] == 10 &&
+	    [writeException bytesWritten] == 2 && [w->_written count] == 5 &&
+	    !memcmp([w->_written items], "abc01", 5))
+
+	w = [[[WriteTester alloc] init] autorelease];
+	[w setWriteBuffered: true];
+	[w setWriteBufferSize: 8];
+	[w writeString: @"abc"];
+	w->_capacity = 1;
+	writeException = nil;
+	@try {
+		[w writeBuffer: "defghi"
+			length: 6];
+	} @catch (OFWriteFailedException *e) {
+		writeException = e;
+	}
+
+	TEST(@"-[writeBuffer:length:] when flushing the buffer fails",
+	    writeException != nil && [writeException requestedLength] == 6 &&
+	    [writeException bytesWritten] == 0 && R(w->_capacity = SIZE_MAX) &&
+	    R([w writeBuffer: "defghi"
+		      length: 6]) && R([w flushWriteBuffer]) &&
+	    [w->_written count] == 9 &&
+	    !memcmp([w->_written items], "abcdefghi", 9))
+
+	t = [[[ChunkedStreamTester alloc] initWithCString: "0123456789abcdef"]
+	    autorelease];
+	w = [[[WriteTester alloc] init] autorelease];
+
+	TEST(@"-[transferToStream:length:]", [t readInt8] == '0' &&
+	    [t transferToStream: w
+			 length: 5] == 5 && [w->_written count] == 5 &&
+	    !memcmp([w->_written items], "12345", 5))
+
+	TEST(@"-[transferToStream:]", [t transferToStream: w] == 10 &&
+	    [t isAtEndOfStream] && [w->_written count] == 15 &&
+	    !memcmp([w->_written items], "123456789abcdef", 15))
+
+#ifdef OF_HAVE_FILES
+	if (_benchmarks) {
+		OFFile *file = [OFFile fileWithPath: @"benchmark.txt"
+					       mode: @"w"];
+		char line[16];
+		size_t size = 0;
+
+		[file setWriteBuffered: true];
+		for (size_t i = 0; i < 1000000; i++) {
+			int length = snprintf(line, sizeof(line), "%zu\n",
+			    (i * 7919) % 100000);
+
+			[file writeBuffer: line
+				   length: length];
+			size += length;
+		}
+		[file flushWriteBuffer];
+		[file close];
+
+		BENCHMARK(@"-[readLine] and -[decimalValue] of 1000000 lines",
+		    10,
+		    file = [OFFile fileWithPath: @"benchmark.txt"
+					   mode: @"r"];
+		    while ((str = [file readLine]) != nil)
+			[str decimalValue];
+		    [file close])
+
+		BENCHMARK(@"-[readLittleEndianInt32] of a 6 MB file", 10,
+		    file = [OFFile fileWithPath: @"benchmark.txt"
+					   mode: @"r"];
+		    for (size_t i = 0; i < size / 4; i++)
+			[file readLittleEndianInt32];
+		    [file close])
+
+		[[OFFileManager defaultManager]
+		    removeItemAtPath: @"benchmark.txt"];
+	}
+
+	if (_benchmarks) {
+		OFFile *file = [OFFile fileWithPath: @"benchmark.bin"
+					       mode: @"w"];
+		OFFile *destination;
+		char *buffer = [self allocMemoryWithSize: 65536];
+
+		memset(buffer, 'X', 65536);
+		for (size_t i = 0; i < 1024; i++)
+			[file writeBuffer: buffer
+				   length: 65536];
+		[file close];
+
+		BENCHMARK(@"Copying a 64 MiB file with a read and write loop",
+		    10,
+		    file = [OFFile fileWithPath: @"benchmark.bin"
+					   mode: @"r"];
+		    destination = [OFFile fileWithPath: @"benchmark.copy"
+						  mode: @"w"];
+		    while (![file isAtEndOfStream])
+			[destination writeBuffer: buffer
+					  length: [file readIntoBuffer: buffer
+								length: 65536]];
+		    [file close];
+		    [destination close])
+
+		BENCHMARK(@"Copying a 64 MiB file with -[transferToStream:]",
+		    10,
+		    file = [OFFile fileWithPath: @"benchmark.bin"
+					   mode: @"r"];
+		    destination = [OFFile fileWithPath: @"benchmark.copy"
+						  mode: @"w"];
+		    [file transferToStream: destination];
+		    [file close];
+		    [destination close])
+
+		[self freeMemory: buffer];
+		[[OFFileManager defaultManager]
+		    removeItemAtPath: @"benchmark.bin"];
+		[[OFFileManager defaultManager]
+		    removeItemAtPath: @"benchmark.copy"];
+	}
+#endif
+
 	[pool drain];
 }
 @end
@@ -163,6 +163,22 @@ static uint16_t sutf16str[] = {
 
 	TEST(@"-[capitalizedString]", [[@"ǆbla tǆst TǄST" capitalizedString]
 	    isEqual: @"ǅbla Tǆst Tǆst"])
+
+	TEST(@"-[lowercaseString] with changing UTF-8 length",
+	    [[@"ABCDEFGHIJKLMNOPQRSTUVWXYZ ÖȺÄ ABC" lowercaseString]
+	    isEqual: @"abcdefghijklmnopqrstuvwxyz öⱥä abc"] &&
+	    [[@"abcdefghijklmnopqrstuvwxyz öⱥä abc" uppercaseString]
+	    isEqual: @"ABCDEFGHIJKLMNOPQRSTUVWXYZ ÖȺÄ ABC"])
+
+	TEST(@"-[caseInsensitiveCompare:] with long strings",
+	    [@"The Quick Brown Fox Jumps Over Äöü The Lazy Dog"
+	    caseInsensitiveCompare:
+	    @"the quick brown fox jumps over äÖÜ the lazy dog"] ==
+	    OF_ORDERED_SAME &&
+	    [@"The Quick Brown Fox Jumps Over Äöü The Lazy Dog"
+	    caseInsensitiveCompare:
+	    @"the quick brown fox jumps over äÖÜ the lazy cat"] ==
+	    OF_ORDERED_DESCENDING)
 #else
 	TEST(@"-[uppercase]", R([s[0] uppercase]) &&
 	    [s[0] isEqual: @"3𝄞1€SäT"] &&
@@ -319,6 +335,17 @@ static uint16_t sutf16str[] = {
 	    R(([s[0] appendFormat: @"%02X", 15])) &&
 	    [s[0] isEqual: @"test:1230F"])
 
+	TEST(@"+[stringWithFormat:] with options and length modifiers",
+	    [[OFString stringWithFormat: @"%5d|%-3u|%hhd|%jd|%zu|%5@|%C|%%",
+	    42, 7u, 300, (intmax_t)-5, (size_t)8, @"ab", (of_unichar_t)0x20AC]
+	    isEqual: @"   42|7  |44|-5|8|   ab|€|%"] &&
+	    [[OFString stringWithFormat: [OFString stringWithUTF8String:
+	    "%s-%lu"], "x", 9ul] isEqual: @"x-9"])
+
+	TEST(@"+[stringWithFormat:] with long results",
+	    [[OFString stringWithFormat: @"%300d", 1] length] == 300 &&
+	    [[OFString stringWithFormat: @"%-300d|", 1] hasSuffix: @"  |"])
+
 	TEST(@"-[rangeOfString:]",
 	    [@"𝄞öö" rangeOfString: @"öö"].location == 1 &&
 	    [@"𝄞öö" rangeOfString: @"ö"].location == 1 &&
@@ -334,10 +361,40 @@ static uint16_t sutf16str[] = {
 			  options: OF_STRING_SEARCH_BACKWARDS].location ==
 	     OF_NOT_FOUND)
 
+	is = @"xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx"
+	    @"abcabcabcabcabcabcabcabcabcabcabcabcabcabcabcabcabcabd"
+	    @"xxabcabcabcabcabcabcabcabcabcabcabcabcabcabcabcabcabcabd"
+	    @"xxxxxxxx";
+	TEST(@"-[rangeOfString:] with long needles",
+	    [is rangeOfString: @"abcabcabcabcabcabcabcabcabcabcabcabcabcabd"]
+	    .location == 68 &&
+	    [is rangeOfString: @"abcabcabcabcabcabcabcabcabcabcabcabcabcabd"
+		      options: OF_STRING_SEARCH_BACKWARDS].location == 124 &&
+	    [is rangeOfString: @"abcabcabcabcabcabcabcabcabcabcabcabcabcabe"]
+	    .location == OF_NOT_FOUND &&
+	    [is rangeOfString: @"abcabcabcabcabcabcabcabcabcabcabcabcabcabd"
+		      options: 0
+			range: of_range(69, 99)].location == 124 &&
+	    [is containsString: @"dxxabcabcabcabcabcabcabcabcabcabcabcabcabca"] &&
+	    ![is containsString: @"dxxabcabcabcabcabcabcabcabcabcabcabcabcabcb"])
+
 	TEST(@"-[substringWithRange:]",
 	    [[@"𝄞öö" substringWithRange: of_range(1, 1)] isEqual: @"ö"] &&
 	    [[@"𝄞öö" substringWithRange: of_range(3, 0)] isEqual: @""])
 
+	is = [OFString stringWithUTF8String:
+	    "ö123456789012345678901234567890123456789x"
+	    "/a123456789012345678901234567890123456789y"];
+	TEST(@"-[substringWithRange:] of large parts",
+	    (is = [is substringWithRange: of_range(1, 40)]) &&
+	    [is isEqual: @"123456789012345678901234567890123456789x"] &&
+	    !strcmp([is UTF8String],
+	    "123456789012345678901234567890123456789x") &&
+	    [[is substringWithRange: of_range(0, 39)] isEqual:
+	    @"123456789012345678901234567890123456789"] &&
+	    [[[is mutableCopy] autorelease] isEqual:
+	    @"123456789012345678901234567890123456789x"])
+
 	EXPECT_EXCEPTION(@"Detect out of range in -[substringWithRange:] #1",
 	    OFOutOfRangeException, [@"𝄞öö" substringWithRange: of_range(2, 2)])
 	EXPECT_EXCEPTION(@"Detect out of range in -[substringWithRange:] #2",
@@ -366,6 +423,21 @@ static uint16_t sutf16str[] = {
 	    [[a objectAtIndex: i++] isEqual: @""] &&
 	    [[a objectAtIndex: i++] isEqual: @""])
 
+	i = 0;
+	TEST(@"-[componentsSeparatedByString:] with long components",
+	    (a = [[OFString stringWithUTF8String:
+	    "a123456789012345678901234567890123456789, "
+	    "b123456789012345678901234567890123456789ä, "]
+	    componentsSeparatedByString: @", "]) && [a count] == 3 &&
+	    [[a objectAtIndex: i++] isEqual:
+	    @"a123456789012345678901234567890123456789"] &&
+	    [[a objectAtIndex: i] isEqual:
+	    @"b123456789012345678901234567890123456789ä"] &&
+	    [[a objectAtIndex: i++] length] == 41 &&
+	    !strcmp([[a objectAtIndex: i - 1] UTF8String],
+	    "b123456789012345678901234567890123456789ä") &&
+	    [[a objectAtIndex: i++] isEqual: @""])
+
 	i = 0;
 	TEST(@"-[componentsSeparatedByString:options:]",
 	    (a = [@"fooXXbarXXXXbazXXXX"
@@ -463,6 +535,12 @@ static uint16_t sutf16str[] = {
 	    [@"-500\t" decimalValue] == -500 &&
 	    [@"\t\t\r\n" decimalValue] == 0)
 
+	TEST(@"-[decimalValue] with the limits of intmax_t",
+	    [[OFString stringWithFormat: @"%jd", INTMAX_MAX] decimalValue] ==
+	    INTMAX_MAX &&
+	    [[OFString stringWithFormat: @"%jd", INTMAX_MIN] decimalValue] ==
+	    INTMAX_MIN)
+
 	TEST(@"-[hexadecimalValue]",
 	    [@"123f" hexadecimalValue] == 0x123f &&
 	    [@"\t\n0xABcd\r" hexadecimalValue] == 0xABCD &&
@@ -514,6 +592,13 @@ static uint16_t sutf16str[] = {
 	EXPECT_EXCEPTION(@"Detect invalid characters in -[decimalValue] #3",
 	    OFInvalidFormatException, [@"0 1" decimalValue])
 
+	EXPECT_EXCEPTION(@"Detect out of range in -[decimalValue] #1",
+	    OFOutOfRangeException,
+	    [[OFString stringWithFormat: @"%jd0", INTMAX_MAX] decimalValue])
+	EXPECT_EXCEPTION(@"Detect out of range in -[decimalValue] #2",
+	    OFOutOfRangeException,
+	    [[OFString stringWithFormat: @"%jd0", INTMAX_MIN] decimalValue])
+
 	EXPECT_EXCEPTION(@"Detect invalid chars in -[hexadecimalValue] #1",
 	    OFInvalidFormatException, [@"0xABCDEFG" hexadecimalValue])
 	EXPECT_EXCEPTION(@"Detect invalid chars in -[hexadecimalValue] #2",
@@ -523,6 +608,11 @@ static uint16_t sutf16str[] = {
 	EXPECT_EXCEPTION(@"Detect invalid chars in -[hexadecimalValue] #4",
 	    OFInvalidFormatException, [@"$ " hexadecimalValue])
 
+	EXPECT_EXCEPTION(@"Detect out of range in -[hexadecimalValue]",
+	    OFOutOfRangeException,
+	    [[OFString stringWithFormat: @"%jX0", UINTMAX_MAX]
+	    hexadecimalValue])
+
 	EXPECT_EXCEPTION(@"Detect invalid chars in -[floatValue] #1",
 	    OFInvalidFormatException, [@"0,0" floatValue])
 	EXPECT_EXCEPTION(@"Detect invalid chars in -[floatValue] #2",
@@ -777,6 +867,37 @@ static uint16_t sutf16str[] = {
 	TEST(@"-[enumerateLinesUsingBlock:]", ok)
 #endif
 
+	s[0] = [OFMutableString string];
+	for (i = 0; i < 24000; i++)
+		[s[0] appendString:
+		    @"the quick brown fox jumps over the lazy dog, "];
+	[s[0] makeImmutable];
+
+	BENCHMARK(@"-[rangeOfString:] of a short needle in 1 MiB", 100,
+	    [s[0] rangeOfString: @"lazy cat"])
+
+	BENCHMARK(@"-[rangeOfString:] of a long needle in 1 MiB", 100,
+	    [s[0] rangeOfString:
+	    @"the quick brown fox jumps over the lazy dog, the lazy cat"])
+
+	BENCHMARK(@"-[rangeOfString:options:] backwards in 1 MiB", 100,
+	    [s[0] rangeOfString: @"the lazy cat"
+			options: OF_STRING_SEARCH_BACKWARDS])
+
+	BENCHMARK(@"-[componentsSeparatedByString:] of 1 MiB", 100,
+	    [s[0] componentsSeparatedByString: @", "])
+
+	BENCHMARK(@"+[stringWithFormat:] of a log line", 100000,
+	    [OFString stringWithFormat: @"%@ [%d] %s: request %u took %zu us",
+	    @"2016-09-18 12:34:56", 1234, "worker", 42u, (size_t)1337])
+
+	/* Formats that are not constant strings are not cached */
+	is = [[@"%@ [%d] %s: request %u took %zu us" mutableCopy] autorelease];
+	BENCHMARK(@"+[stringWithFormat:] of a log line without caching",
+	    100000,
+	    [OFString stringWithFormat: is,
+	    @"2016-09-18 12:34:56", 1234, "worker", 42u, (size_t)1337])
+
 	[pool drain];
 }
 @end
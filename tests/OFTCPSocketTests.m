@@ -20,12 +20,231 @@
 
 #import "OFTCPSocket.h"
 #import "OFString.h"
+#import "OFFile.h"
+#import "OFFileManager.h"
+#import "OFThread.h"
+#import "OFDate.h"
+#import "OFRunLoop.h"
 #import "OFAutoreleasePool.h"
 
 #import "TestsAppDelegate.h"
 
+#define ASYNC_WRITE_LENGTH (4 * 1024 * 1024)
+#define NONBLOCKING_READ_LENGTH (64 * 1024)
+
 static OFString *module = @"OFTCPSocket";
 
+@interface AsyncWriteTest: OFObject
+{
+@public
+	char *_data, _readBuffer[1024];
+	size_t _readLength, _writtenLength;
+	OFException *_exception;
+	bool _matches, _readDone, _writeDone;
+}
+@end
+
+@implementation AsyncWriteTest
+- init
+{
+	self = [super init];
+
+	@try {
+		size_t i;
+
+		_data = [self allocMemoryWithSize: ASYNC_WRITE_LENGTH];
+		for (i = 0; i < ASYNC_WRITE_LENGTH; i++)
+			_data[i] = (char)(i ^ (i >> 8));
+
+		_matches = true;
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	[_exception release];
+
+	[super dealloc];
+}
+
+- (size_t)stream: (OFStream*)stream
+  didWriteBuffer: (const void**)buffer
+	  length: (size_t)length
+       exception: (OFException*)exception
+{
+	_writtenLength = length;
+	_exception = [exception retain];
+	_writeDone = true;
+
+	return 0;
+}
+
+- (bool)stream: (OFStream*)stream
+  didReadIntoBuffer: (void*)buffer
+	     length: (size_t)length
+	  exception: (OFException*)exception
+{
+	if (exception != nil || _readLength + length > ASYNC_WRITE_LENGTH ||
+	    memcmp(buffer, _data + _readLength, length) != 0) {
+		_matches = false;
+		_readDone = true;
+		return false;
+	}
+
+	_readLength += length;
+	_readDone = (_readLength == ASYNC_WRITE_LENGTH);
+
+	return !_readDone;
+}
+@end
+
+@interface NonBlockingReadTest: OFObject
+{
+@public
+	const char *_expected;
+	char _buffer[16 * 1024];
+	size_t _readLength;
+	bool _done, _failed;
+}
+@end
+
+@implementation NonBlockingReadTest
+- (bool)stream: (OFStream*)stream
+  didReadIntoBuffer: (void*)buffer
+	     length: (size_t)length
+	  exception: (OFException*)exception
+{
+	if (exception != nil ||
+	    _readLength + length > NONBLOCKING_READ_LENGTH ||
+	    memcmp(buffer, _expected + _readLength, length) != 0) {
+		_failed = _done = true;
+		return false;
+	}
+
+	_readLength += length;
+	_done = (_readLength == NONBLOCKING_READ_LENGTH);
+
+	return !_done;
+}
+@end
+
+@interface MemoryStream: OFStream
+{
+@public
+	const char *_data;
+	size_t _length, _position;
+}
+@end
+
+@implementation MemoryStream
+- (bool)lowlevelIsAtEndOfStream
+{
+	return (_position == _length);
+}
+
+- (size_t)lowlevelReadIntoBuffer: (void*)buffer
+			  length: (size_t)length
+{
+	if (length > _length - _position)
+		length = _length - _position;
+
+	memcpy(buffer, _data + _position, length);
+	_position += length;
+
+	return length;
+}
+@end
+
+#ifdef OF_HAVE_THREADS
+@interface TransferReader: OFThread
+{
+@public
+	OFTCPSocket *_socket;
+	const char *_expected;
+	bool _matches;
+}
+@end
+
+@implementation TransferReader
+- main
+{
+	char buffer[1024];
+	size_t readLength = 0;
+
+	_matches = true;
+
+	while (readLength < ASYNC_WRITE_LENGTH) {
+		size_t length = ASYNC_WRITE_LENGTH - readLength;
+
+		if (length > sizeof(buffer))
+			length = sizeof(buffer);
+
+		length = [_socket readIntoBuffer: buffer
+					  length: length];
+
+		if (length == 0 ||
+		    memcmp(buffer, _expected + readLength, length) != 0) {
+			_matches = false;
+			break;
+		}
+
+		readLength += length;
+	}
+
+	return nil;
+}
+@end
+#endif
+
+#ifdef OF_HAVE_THREADS
+@interface AsyncConnectTest: OFObject
+{
+@public
+	OFException *_exception;
+	bool _done, _writeOnConnect, _writeDone;
+}
+@end
+
+@implementation AsyncConnectTest
+- (void)dealloc
+{
+	[_exception release];
+
+	[super dealloc];
+}
+
+- (void)socket: (OFTCPSocket*)socket
+  didConnectWithException: (OFException*)exception
+{
+	_exception = [exception retain];
+	_done = true;
+
+	/* The socket reuses the number of the attempt's file descriptor */
+	if (_writeOnConnect && exception == nil)
+		[socket asyncWriteBuffer: "Hello!"
+				  length: 6
+				  target: self
+				selector: @selector(stream:didWriteBuffer:
+					      length:exception:)];
+}
+
+- (size_t)stream: (OFStream*)stream
+  didWriteBuffer: (const void**)buffer
+	  length: (size_t)length
+       exception: (OFException*)exception
+{
+	_writeDone = (exception == nil && length == 6);
+
+	return 0;
+}
+@end
+#endif
+
 @implementation TestsAppDelegate (OFTCPSocketTests)
 - (void)TCPSocketTests
 {
@@ -33,6 +252,18 @@ static OFString *module = @"OFTCPSocket";
 	OFTCPSocket *server, *client = nil, *accepted;
 	uint16_t port;
 	char buf[6];
+	AsyncWriteTest *test;
+	NonBlockingReadTest *nonBlockingTest;
+#ifdef OF_HAVE_THREADS
+	AsyncConnectTest *connectTest;
+	OFTCPSocket *asyncClient;
+	TransferReader *reader;
+	MemoryStream *memoryStream;
+#endif
+#if defined(OF_HAVE_THREADS) && defined(OF_HAVE_FILES)
+	OFFile *file;
+#endif
+	OFDate *deadline;
 
 	TEST(@"+[socket]", (server = [OFTCPSocket socket]) &&
 	    (client = [OFTCPSocket socket]))
@@ -58,6 +289,157 @@ static OFString *module = @"OFTCPSocket";
 							     length: 6] &&
 	    !memcmp(buf, "Hello!", 6))
 
+	/*
+	 * Write more than fits into the socket buffers while the peer only
+	 * reads in small chunks, so that the write has to wait for the socket
+	 * to become writable again several times.
+	 */
+	[client setBlocking: false];
+	test = [[[AsyncWriteTest alloc] init] autorelease];
+	[client asyncWriteBuffer: test->_data
+			  length: ASYNC_WRITE_LENGTH
+			  target: test
+			selector: @selector(stream:didWriteBuffer:length:
+				      exception:)];
+	[accepted asyncReadIntoBuffer: test->_readBuffer
+			       length: sizeof(test->_readBuffer)
+			       target: test
+			     selector: @selector(stream:didReadIntoBuffer:
+					   length:exception:)];
+
+	deadline = [OFDate dateWithTimeIntervalSinceNow: 30];
+	while ((!test->_readDone || !test->_writeDone) &&
+	    [deadline timeIntervalSinceNow] > 0)
+		[[OFRunLoop currentRunLoop] runUntilDate:
+		    [OFDate dateWithTimeIntervalSinceNow: 0.1]];
+
+	TEST(@"-[asyncWriteBuffer:length:target:selector:]",
+	    test->_writeDone && test->_exception == nil &&
+	    test->_writtenLength == ASYNC_WRITE_LENGTH &&
+	    test->_readDone && test->_matches &&
+	    test->_readLength == ASYNC_WRITE_LENGTH)
+
+	TEST(@"-[asyncWriteString:]", R([client asyncWriteString: @"Hello!"]) &&
+	    R([[OFRunLoop currentRunLoop] runUntilDate:
+	    [OFDate dateWithTimeIntervalSinceNow: 0.1]]) &&
+	    R([accepted readIntoBuffer: buf
+			   exactLength: 6]) && !memcmp(buf, "Hello!", 6))
+
+#if defined(OF_HAVE_THREADS) && defined(OF_HAVE_FILES)
+	/* The client is still in non-blocking mode */
+	file = [OFFile fileWithPath: @"transfertest.bin"
+			       mode: @"w"];
+	[file writeBuffer: test->_data
+		   length: ASYNC_WRITE_LENGTH];
+	[file close];
+
+	reader = [[[TransferReader alloc] init] autorelease];
+	reader->_socket = accepted;
+	reader->_expected = test->_data;
+	[reader start];
+
+	file = [OFFile fileWithPath: @"transfertest.bin"
+			       mode: @"r"];
+
+	TEST(@"-[transferToStream:] into a non-blocking socket",
+	    [file transferToStream: client] == ASYNC_WRITE_LENGTH &&
+	    R([reader join]) && reader->_matches)
+
+	[file close];
+	[[OFFileManager defaultManager] removeItemAtPath: @"transfertest.bin"];
+#endif
+
+#ifdef OF_HAVE_THREADS
+	/* Cannot be transferred by the kernel, so it is copied */
+	memoryStream = [[[MemoryStream alloc] init] autorelease];
+	memoryStream->_data = test->_data;
+	memoryStream->_length = ASYNC_WRITE_LENGTH;
+
+	reader = [[[TransferReader alloc] init] autorelease];
+	reader->_socket = accepted;
+	reader->_expected = test->_data;
+	[reader start];
+
+	TEST(@"-[transferToStream:] copying into a non-blocking socket",
+	    [memoryStream transferToStream: client] == ASYNC_WRITE_LENGTH &&
+	    R([reader join]) && reader->_matches)
+#endif
+
+#ifdef OF_HAVE_THREADS
+	asyncClient = [OFTCPSocket socket];
+	connectTest = [[[AsyncConnectTest alloc] init] autorelease];
+	[asyncClient asyncConnectToHost: @"127.0.0.1"
+				   port: port
+				 target: connectTest
+			       selector: @selector(socket:
+					     didConnectWithException:)];
+
+	deadline = [OFDate dateWithTimeIntervalSinceNow: 5];
+	while (!connectTest->_done && [deadline timeIntervalSinceNow] > 0)
+		[[OFRunLoop currentRunLoop] runUntilDate:
+		    [OFDate dateWithTimeIntervalSinceNow: 0.01]];
+
+	TEST(@"-[asyncConnectToHost:port:target:selector:]",
+	    connectTest->_done && connectTest->_exception == nil &&
+	    [asyncClient isBlocking] && (accepted = [server accept]) &&
+	    [asyncClient writeString: @"Hello!"] &&
+	    R([accepted readIntoBuffer: buf
+			   exactLength: 6]) && !memcmp(buf, "Hello!", 6))
+
+	asyncClient = [OFTCPSocket socket];
+	connectTest = [[[AsyncConnectTest alloc] init] autorelease];
+	connectTest->_writeOnConnect = true;
+	[asyncClient asyncConnectToHost: @"127.0.0.1"
+				   port: port
+				 target: connectTest
+			       selector: @selector(socket:
+					     didConnectWithException:)];
+
+	deadline = [OFDate dateWithTimeIntervalSinceNow: 5];
+	while (!connectTest->_writeDone && [deadline timeIntervalSinceNow] > 0)
+		[[OFRunLoop currentRunLoop] runUntilDate:
+		    [OFDate dateWithTimeIntervalSinceNow: 0.01]];
+
+	TEST(@"-[asyncWriteBuffer:length:target:selector:] from the connect "
+	    @"handler",
+	    connectTest->_done && connectTest->_exception == nil &&
+	    connectTest->_writeDone && (accepted = [server accept]) &&
+	    R([accepted readIntoBuffer: buf
+			   exactLength: 6]) && !memcmp(buf, "Hello!", 6))
+#endif
+
+	/*
+	 * The reads are at least as big as the read buffer and thus bypass it,
+	 * so nothing but the socket has the data. As an edge-triggered
+	 * observer reports it only once, it has to be read until it would
+	 * block.
+	 */
+	client = [OFTCPSocket socket];
+	[client connectToHost: @"127.0.0.1"
+			 port: port];
+	accepted = [server accept];
+	[accepted setBlocking: false];
+	[client writeBuffer: test->_data
+		     length: NONBLOCKING_READ_LENGTH];
+
+	nonBlockingTest = [[[NonBlockingReadTest alloc] init] autorelease];
+	nonBlockingTest->_expected = test->_data;
+	[accepted asyncReadIntoBuffer: nonBlockingTest->_buffer
+			       length: sizeof(nonBlockingTest->_buffer)
+			       target: nonBlockingTest
+			     selector: @selector(stream:didReadIntoBuffer:
+					   length:exception:)];
+
+	deadline = [OFDate dateWithTimeIntervalSinceNow: 5];
+	while (!nonBlockingTest->_done && [deadline timeIntervalSinceNow] > 0)
+		[[OFRunLoop currentRunLoop] runUntilDate:
+		    [OFDate dateWithTimeIntervalSinceNow: 0.01]];
+
+	TEST(@"-[asyncReadIntoBuffer:length:target:selector:] on a "
+	    @"non-blocking socket",
+	    nonBlockingTest->_done && !nonBlockingTest->_failed &&
+	    nonBlockingTest->_readLength == NONBLOCKING_READ_LENGTH)
+
 	[pool drain];
 }
 @end
@@ -18,6 +18,8 @@
 
 #import "OFURL.h"
 #import "OFString.h"
+#import "OFArray.h"
+#import "OFDictionary.h"
 #import "OFAutoreleasePool.h"
 
 #import "OFInvalidFormatException.h"
@@ -32,7 +34,9 @@ static OFString *url_str = @"ht%3atp://us%3Aer:p%40w@ho%3Ast:1234/"
 - (void)URLTests
 {
 	OFAutoreleasePool *pool = [[OFAutoreleasePool alloc] init];
-	OFURL *u1, *u2, *u3, *u4;
+	OFURL *u1, *u2, *u3, *u4, *u5;
+	OFDictionary *query;
+	OFMutableArray *corpus;
 
 	TEST(@"+[URLWithString:]",
 	    R(u1 = [OFURL URLWithString: url_str]) &&
@@ -84,9 +88,65 @@ static OFString *url_str = @"ht%3atp://us%3Aer:p%40w@ho%3Ast:1234/"
 
 	TEST(@"-[hash:]", [u1 hash] == [u4 hash] && [u2 hash] != [u3 hash])
 
+	TEST(@"-[copy] of parts not accessed yet",
+	    (u5 = [OFURL URLWithString: @"http://h:8080/p;x?q#f"]) &&
+	    R(u4 = [[u5 copy] autorelease]) &&
+	    [[u4 host] isEqual: @"h"] && [u4 port] == 8080 &&
+	    [[u4 path] isEqual: @"/p"] && [[u4 parameters] isEqual: @"x"] &&
+	    [[u4 query] isEqual: @"q"] && [[u4 fragment] isEqual: @"f"] &&
+	    [u4 isEqual: u5])
+
+	TEST(@"-[setPath:] before accessing other parts",
+	    (u5 = [OFURL URLWithString: @"http://h/a?q"]) &&
+	    R([u5 setPath: @"/b"]) && [[u5 path] isEqual: @"/b"] &&
+	    [[u5 string] isEqual: @"http://h/b?q"])
+
+	TEST(@"-[queryDictionary]",
+	    (query = [[OFURL URLWithString: @"http://h/p?a=1&b=x%20y+z&c&&d="]
+	    queryDictionary]) && [query count] == 4 &&
+	    [[query objectForKey: @"a"] isEqual: @"1"] &&
+	    [[query objectForKey: @"b"] isEqual: @"x y z"] &&
+	    [[query objectForKey: @"c"] isEqual: @""] &&
+	    [[query objectForKey: @"d"] isEqual: @""] &&
+	    [u3 queryDictionary] == nil)
+
+	EXPECT_EXCEPTION(@"Detection of invalid query encoding",
+	    OFInvalidFormatException,
+	    [[OFURL URLWithString: @"http://h/?a=%2"] queryDictionary])
+
 	EXPECT_EXCEPTION(@"Detection of invalid format",
 	    OFInvalidFormatException, [OFURL URLWithString: @"http"])
 
+	corpus = [OFMutableArray array];
+	for (size_t i = 0; i < 10000; i++)
+		[corpus addObject: [OFString stringWithFormat:
+		    @"http://user%zu:pw@host%zu.example.com:%zu/a/b%zu/c.html;p"
+		    @"?id=%zu&name=x%%20y+z&flag#section%zu",
+		    i, i % 100, 8000 + i % 1000, i, i, i % 10]];
+
+	BENCHMARK(@"Parsing 10000 URLs", 100,
+	    for (OFString *string in corpus)
+		[OFURL URLWithString: string])
+
+	BENCHMARK(@"Parsing 10000 URLs and accessing every part", 100,
+	    for (OFString *string in corpus) {
+		OFURL *URL = [OFURL URLWithString: string];
+
+		[URL scheme];
+		[URL user];
+		[URL password];
+		[URL host];
+		[URL port];
+		[URL path];
+		[URL parameters];
+		[URL query];
+		[URL fragment];
+	    })
+
+	BENCHMARK(@"-[queryDictionary] of 10000 URLs", 100,
+	    for (OFString *string in corpus)
+		[[OFURL URLWithString: string] queryDictionary])
+
 	[pool drain];
 }
 @end
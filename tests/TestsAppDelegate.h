@@ -16,6 +16,8 @@
 
 #import "OFApplication.h"
 #import "OFXMLElementBuilder.h"
+#import "OFAutoreleasePool.h"
+#import "OFDate.h"
 
 #define TEST(test, ...)					\
 	{						\
@@ -54,12 +56,40 @@
 		}					\
 	}
 #define R(...) (__VA_ARGS__, 1)
+/*
+ * Benchmarks are only run if the environment variable OBJFW_TESTS_BENCHMARK
+ * is set, e.g. by "make bench". Autoreleased objects are released after each
+ * iteration.
+ */
+#define BENCHMARK(benchmark, iterations, ...)				\
+	if (_benchmarks) {						\
+		OFAutoreleasePool *benchmarkPool =			\
+		    [[OFAutoreleasePool alloc] init];			\
+		OFDate *benchmarkStart = [[OFDate alloc] init];		\
+									\
+		for (size_t benchmarkIteration = 0;			\
+		    benchmarkIteration < (iterations);			\
+		    benchmarkIteration++) {				\
+			__VA_ARGS__;					\
+			[benchmarkPool releaseObjects];			\
+		}							\
+									\
+		[self outputBenchmark: benchmark			\
+			     inModule: module				\
+			   iterations: (iterations)			\
+			     duration: -[benchmarkStart			\
+					   timeIntervalSinceNow]];	\
+									\
+		[benchmarkStart release];				\
+		[benchmarkPool release];				\
+	}
 
 @class OFString;
 
 @interface TestsAppDelegate: OFObject <OFApplicationDelegate>
 {
 	int _fails;
+	bool _benchmarks;
 }
 
 - (void)outputString: (OFString*)str
@@ -70,6 +100,10 @@
 	     inModule: (OFString*)module;
 - (void)outputFailure: (OFString*)test
 	     inModule: (OFString*)module;
+- (void)outputBenchmark: (OFString*)benchmark
+	       inModule: (OFString*)module
+	     iterations: (size_t)iterations
+	       duration: (of_time_interval_t)duration;
 @end
 
 @interface TestsAppDelegate (OFArrayTests)
@@ -88,6 +122,10 @@
 - (void)dateTests;
 @end
 
+@interface TestsAppDelegate (OFDNSResolverTests)
+- (void)DNSResolverTests;
+@end
+
 @interface TestsAppDelegate (OFDictionaryTests)
 - (void)dictionaryTests;
 @end
@@ -98,12 +136,19 @@
 
 @interface TestsAppDelegate (OFHTTPClientTests)
 - (void)HTTPClientTests;
+- (void)HTTPClientPoolTests;
 @end
 
 @interface TestsAppDelegate (OFHTTPCookieTests)
 - (void)HTTPCookieTests;
 @end
 
+@interface TestsAppDelegate (OFHTTPServerTests)
+- (void)HTTPParserTests;
+- (void)HTTPRouterTests;
+- (void)HTTPServerTests;
+@end
+
 @interface TestsAppDelegate (OFINIFileTests)
 - (void)INIFileTests;
 @end
@@ -120,6 +165,10 @@
 - (void)listTests;
 @end
 
+@interface TestsAppDelegate (OFMappedFileTests)
+- (void)mappedFileTests;
+@end
+
 @interface TestsAppDelegate (OFMD5HashTests)
 - (void)MD5HashTests;
 @end
@@ -358,6 +358,20 @@ main(int argc, char *argv[])
 #endif
 }
 
+- (void)outputBenchmark: (OFString*)benchmark
+	       inModule: (OFString*)module
+	     iterations: (size_t)iterations
+	       duration: (of_time_interval_t)duration
+{
+	OFAutoreleasePool *pool = [[OFAutoreleasePool alloc] init];
+	[self outputString: [OFString stringWithFormat:
+	    @"[%@] %@: %zu iterations in %.3f s (%.3f us each)\n",
+	    module, benchmark, iterations, duration,
+	    duration * 1000000 / iterations]
+		   inColor: NO_COLOR];
+	[pool release];
+}
+
 - (void)applicationDidFinishLaunching
 {
 #if defined(OF_IOS) && defined(OF_HAVE_FILES)
@@ -379,6 +393,9 @@ main(int argc, char *argv[])
 	    changeCurrentDirectoryPath: @"/apps/objfw-tests"];
 #endif
 
+	_benchmarks = ([[OFApplication environment]
+	    objectForKey: @"OBJFW_TESTS_BENCHMARK"] != nil);
+
 	[self runtimeTests];
 	[self forwardingTests];
 	[self objectTests];
@@ -406,10 +423,12 @@ main(int argc, char *argv[])
 	[self PBKDF2Tests];
 	[self scryptTests];
 	[self INIFileTests];
+	[self mappedFileTests];
 #endif
 #ifdef OF_HAVE_SOCKETS
 	[self TCPSocketTests];
 	[self UDPSocketTests];
+	[self DNSResolverTests];
 	[self kernelEventObserverTests];
 #endif
 #ifdef OF_HAVE_THREADS
@@ -418,6 +437,7 @@ main(int argc, char *argv[])
 	[self URLTests];
 #if defined(OF_HAVE_SOCKETS) && defined(OF_HAVE_THREADS)
 	[self HTTPClientTests];
+	[self HTTPServerTests];
 #endif
 #ifdef OF_HAVE_SOCKETS
 	[self HTTPCookieTests];